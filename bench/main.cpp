@@ -0,0 +1,1095 @@
+#include <avltree.hpp>
+#include <avltree/blocked.hpp>
+#include <avltree/buffered.hpp>
+#include <avltree/concurrent.hpp>
+#include <avltree/frozen.hpp>
+#include <avltree/mapped.hpp>
+#include <avltree/persistent.hpp>
+#include <avltree/sharded.hpp>
+#include <avltree/strings.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using namespace avltree;
+
+/// Counters of the global operator new, which the comparison suite reads to report allocations and memory.
+struct AllocationCounters {
+   std::atomic<std::size_t> allocations{0};
+   std::atomic<std::size_t> live_bytes{0};
+   std::atomic<std::size_t> peak_bytes{0};
+};
+
+AllocationCounters allocation_counters;
+
+// every block starts with a header holding its size, so freeing it can be counted too
+constexpr std::size_t allocation_header = alignof(std::max_align_t);
+
+void *operator new(std::size_t size) {
+   auto block = static_cast<unsigned char *>(std::malloc(size + allocation_header));
+
+   if (block == nullptr) { throw std::bad_alloc(); }
+
+   *reinterpret_cast<std::size_t *>(block) = size;
+
+   auto live = allocation_counters.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+   auto peak = allocation_counters.peak_bytes.load(std::memory_order_relaxed);
+
+   while (live > peak && !allocation_counters.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+
+   allocation_counters.allocations.fetch_add(1, std::memory_order_relaxed);
+
+   return block + allocation_header;
+}
+
+void operator delete(void *pointer) noexcept {
+   if (pointer == nullptr) { return; }
+
+   auto block = static_cast<unsigned char *>(pointer) - allocation_header;
+
+   allocation_counters.live_bytes.fetch_sub(*reinterpret_cast<std::size_t *>(block), std::memory_order_relaxed);
+   std::free(block);
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void *pointer, std::size_t) noexcept { operator delete(pointer); }
+void operator delete[](void *pointer) noexcept { operator delete(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { operator delete(pointer); }
+
+/// Get the peak resident set size of the process in kilobytes, or 0 where it can't be read.
+std::size_t max_rss_kb() {
+#if defined(__APPLE__)
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+
+   // macOS reports bytes where Linux reports kilobytes
+   return static_cast<std::size_t>(usage.ru_maxrss) / 1024;
+#elif defined(__unix__)
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+
+   return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+   return 0;
+#endif
+}
+
+/// A tree whose hooks are dispatched through a vtable, the way AVLTreeBase dispatched them before its hooks
+/// were resolved at compile time. Every hook forwards to the base version, so the only difference is the dispatch.
+class VirtualHookTree : public AVLTreeBase<std::uint32_t, std::uint32_t, KeyIsValue<std::uint32_t>, std::less<std::uint32_t>,
+                                           RawNodeStorage, std::allocator<std::uint32_t>, NoAugment, VirtualHookTree>
+{
+public:
+   using TreeBase = AVLTreeBase<std::uint32_t, std::uint32_t, KeyIsValue<std::uint32_t>, std::less<std::uint32_t>,
+                                RawNodeStorage, std::allocator<std::uint32_t>, NoAugment, VirtualHookTree>;
+
+   virtual void rotate_left(NodePointer node) { TreeBase::rotate_left(node); }
+   virtual void rotate_right(NodePointer node) { TreeBase::rotate_right(node); }
+   virtual void rebalance_node(NodePointer node) { TreeBase::rebalance_node(node); }
+   virtual void update_node(NodePointer node) { TreeBase::update_node(node); }
+   virtual NodePointer allocate_node(const std::uint32_t &value) { return TreeBase::allocate_node(value); }
+   virtual NodePointer allocate_node(std::uint32_t &&value) { return TreeBase::allocate_node(std::move(value)); }
+   virtual NodePointer add_node(const std::uint32_t &value) { return TreeBase::add_node(value); }
+   virtual NodePointer add_node(std::uint32_t &&value) { return TreeBase::add_node(std::move(value)); }
+   virtual NodePointer remove_node(const std::uint32_t &value) { return TreeBase::remove_node(value); }
+};
+
+/// Generate a reproducible sequence of distinct pseudo-random keys.
+std::vector<std::uint32_t> make_keys(std::size_t count) {
+   std::vector<std::uint32_t> keys;
+   std::uint32_t state = 0x9e3779b9;
+
+   keys.reserve(count);
+
+   // every odd multiplier of a power of two modulus is a bijection, so the keys never repeat
+   for (std::size_t i=0; i<count; ++i)
+      keys.push_back(static_cast<std::uint32_t>(i) * 2654435761u + state);
+
+   return keys;
+}
+
+/// Run the given function and return how many nanoseconds it took per operation.
+template <typename Function>
+double time_per_op(std::size_t operations, Function &&function) {
+   auto start = std::chrono::steady_clock::now();
+   function();
+   auto end = std::chrono::steady_clock::now();
+
+   return std::chrono::duration<double, std::nano>(end - start).count() / operations;
+}
+
+void report(const std::string &name, double nanoseconds) {
+   std::cout << std::left << std::setw(40) << name << std::right << std::setw(10) << std::fixed << std::setprecision(1)
+             << nanoseconds << " ns/op" << std::endl;
+}
+
+/// Insert and then remove every key, which exercises every hook on the update path. The best of a few rounds
+/// is reported, so the first round warming up the allocator doesn't skew the results.
+template <typename Tree>
+void bench_insert_remove(const std::string &name, const std::vector<std::uint32_t> &keys, std::size_t rounds=3) {
+   double best_insert = std::numeric_limits<double>::max(), best_remove = std::numeric_limits<double>::max();
+
+   for (std::size_t round=0; round<rounds; ++round)
+   {
+      Tree tree;
+
+      best_insert = std::min(best_insert, time_per_op(keys.size(), [&]() {
+         for (auto key : keys)
+            tree.insert(key);
+      }));
+
+      best_remove = std::min(best_remove, time_per_op(keys.size(), [&]() {
+         for (auto key : keys)
+            tree.remove(key);
+      }));
+   }
+
+   report(name + " insert", best_insert);
+   report(name + " remove", best_remove);
+}
+
+/// Compare static and virtual hook dispatch, on a tree small enough to stay in cache, where the dispatch
+/// matters most, and on a large one, where cache misses dominate.
+void bench_dispatch() {
+   for (std::size_t count : { std::size_t(1) << 10, std::size_t(1) << 20 })
+   {
+      auto keys = make_keys(count);
+      auto rounds = std::max<std::size_t>(3, (std::size_t(1) << 22) / count);
+
+      std::cout << "Hook dispatch, " << keys.size() << " keys:" << std::endl;
+      bench_insert_remove<AVLTree<std::uint32_t>>("static dispatch", keys, rounds);
+      bench_insert_remove<VirtualHookTree>("virtual dispatch", keys, rounds);
+   }
+}
+
+/// Report how many bytes each storage policy spends per node of a 4-byte key, not counting allocator overhead.
+void bench_node_layout() {
+   std::cout << "Node layout, std::uint32_t keys:" << std::endl;
+   std::cout << std::left << std::setw(40) << "RawNodeStorage" << std::right << std::setw(10)
+             << sizeof(AVLTree<std::uint32_t>::Node) << " bytes" << std::endl;
+   std::cout << std::left << std::setw(40) << "CompactNodeStorage" << std::right << std::setw(10)
+             << sizeof(AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage>::Node) << " bytes" << std::endl;
+   std::cout << std::left << std::setw(40) << "SharedNodeStorage" << std::right << std::setw(10)
+             << sizeof(AVLTree<std::uint32_t, std::less<std::uint32_t>, SharedNodeStorage>::Node) << " bytes" << std::endl;
+}
+
+/// Compare point lookups on a tree against lookups on its frozen snapshot.
+void bench_frozen() {
+   auto keys = make_keys(1 << 20);
+   AVLTree<std::uint32_t> tree;
+
+   for (auto key : keys)
+      tree.insert(key);
+
+   auto frozen = freeze(tree);
+   auto queries = keys;
+   std::size_t found = 0;
+
+   // query in a different order than the nodes were allocated in, so the lookups don't get locality for free
+   std::shuffle(queries.begin(), queries.end(), std::mt19937(0xdeadbeef));
+
+   std::cout << "Lookups, " << keys.size() << " keys:" << std::endl;
+   report("AVLTree::contains", time_per_op(queries.size(), [&]() {
+      for (auto key : queries)
+         found += tree.contains(key);
+   }));
+   report("FrozenTree::contains", time_per_op(queries.size(), [&]() {
+      for (auto key : queries)
+         found += frozen.contains(key);
+   }));
+   report("FrozenTree::contains_many", time_per_op(queries.size(), [&]() {
+      auto bitmap = frozen.contains_many(queries.begin(), queries.end());
+      found += std::count(bitmap.begin(), bitmap.end(), true);
+   }));
+
+   if (found != keys.size() * 3) { std::cout << "lookups missed keys" << std::endl; }
+}
+
+/// Run the given lookup on several reader threads while a writer keeps inserting and removing keys, and
+/// return how many nanoseconds each lookup took on average, across all readers.
+template <typename Lookup, typename Write>
+double time_contended_lookups(std::size_t readers, std::size_t lookups, Lookup &&lookup, Write &&write) {
+   std::atomic<bool> done(false);
+   std::vector<std::thread> threads;
+   std::thread writer([&]() {
+      for (std::uint32_t key=0; !done.load(); ++key)
+         write(key);
+   });
+
+   auto result = time_per_op(readers * lookups, [&]() {
+      for (std::size_t reader=0; reader<readers; ++reader)
+         threads.emplace_back([&, reader]() { lookup(reader, lookups); });
+
+      for (auto &thread : threads)
+         thread.join();
+   });
+
+   done.store(true);
+   writer.join();
+
+   return result;
+}
+
+/// Compare lookups on an AVLMap behind a std::shared_mutex against lookups on a ConcurrentAVLMap, with a
+/// writer running alongside the readers.
+void bench_concurrent() {
+   // readers look up the first half of the keys, the writer inserts and removes the other half
+   auto keys = make_keys(1 << 17);
+   std::vector<std::uint32_t> churn(keys.begin() + keys.size() / 2, keys.end());
+   keys.resize(keys.size() / 2);
+
+   auto readers = std::max<std::size_t>(2, std::thread::hardware_concurrency());
+   std::size_t lookups = 1 << 20;
+
+   AVLMap<std::uint32_t, std::uint32_t> locked;
+   std::shared_mutex lock;
+   ConcurrentAVLMap<std::uint32_t, std::uint32_t> concurrent;
+
+   for (auto key : keys)
+   {
+      locked.insert(key, key);
+      concurrent.insert(key, key);
+   }
+
+   std::cout << "Contended lookups, " << keys.size() << " keys, " << readers << " readers:" << std::endl;
+   report("AVLMap + std::shared_mutex", time_contended_lookups(readers, lookups, [&](std::size_t reader, std::size_t count) {
+      std::size_t found = 0;
+
+      for (std::size_t i=0; i<count; ++i)
+      {
+         std::shared_lock<std::shared_mutex> guard(lock);
+         found += locked.contains(keys[(i * 31 + reader) % keys.size()]);
+      }
+
+      if (found != count) { std::cout << "lookups missed keys" << std::endl; }
+   }, [&](std::uint32_t key) {
+      std::unique_lock<std::shared_mutex> guard(lock);
+      locked.insert(churn[key % churn.size()], key);
+      locked.remove(churn[key % churn.size()]);
+   }));
+   report("ConcurrentAVLMap", time_contended_lookups(readers, lookups, [&](std::size_t reader, std::size_t count) {
+      std::size_t found = 0;
+
+      for (std::size_t i=0; i<count; ++i)
+         found += concurrent.contains(keys[(i * 31 + reader) % keys.size()]);
+
+      if (found != count) { std::cout << "lookups missed keys" << std::endl; }
+   }, [&](std::uint32_t key) {
+      concurrent.insert(churn[key % churn.size()], key);
+      concurrent.remove(churn[key % churn.size()]);
+   }));
+}
+
+/// Compare taking a consistent copy of a tree with AVLTreeBase::copy against taking a persistent snapshot, and
+/// the cost of the path copying the snapshots make writes pay for.
+void bench_snapshot() {
+   auto keys = make_keys(1 << 20);
+   AVLTree<std::uint32_t> tree;
+   PersistentAVLTree<std::uint32_t> persistent;
+
+   for (auto key : keys)
+   {
+      tree.insert(key);
+      persistent.insert(key);
+   }
+
+   std::cout << "Snapshots, " << keys.size() << " keys:" << std::endl;
+   report("AVLTree::copy", time_per_op(1, [&]() {
+      AVLTree<std::uint32_t> copy;
+      copy.copy(tree);
+   }));
+   report("PersistentAVLTree::snapshot", time_per_op(1, [&]() {
+      auto snapshot = persistent.snapshot();
+   }));
+
+   auto updates = make_keys(1 << 21);
+   updates.erase(updates.begin(), updates.begin() + keys.size());
+
+   report("PersistentAVLTree insert, unshared", time_per_op(updates.size() / 2, [&]() {
+      for (std::size_t i=0; i<updates.size() / 2; ++i)
+         persistent.insert(updates[i]);
+   }));
+   report("PersistentAVLTree insert, snapshot each", time_per_op(updates.size() / 2, [&]() {
+      for (std::size_t i=updates.size() / 2; i<updates.size(); ++i)
+      {
+         auto snapshot = persistent.snapshot();
+         persistent.insert(updates[i]);
+      }
+   }));
+}
+
+/// Compare inserts from several threads into an AVLMap behind a std::mutex against inserts into a ShardedAVLMap.
+void bench_sharded() {
+   auto keys = make_keys(1 << 20);
+   auto writers = std::max<std::size_t>(2, std::thread::hardware_concurrency());
+   auto per_writer = keys.size() / writers;
+
+   auto time_writers = [&](auto &&insert) {
+      return time_per_op(per_writer * writers, [&]() {
+         std::vector<std::thread> threads;
+
+         for (std::size_t writer=0; writer<writers; ++writer)
+            threads.emplace_back([&, writer]() {
+               for (std::size_t i=writer * per_writer; i<(writer + 1) * per_writer; ++i)
+                  insert(keys[i]);
+            });
+
+         for (auto &thread : threads)
+            thread.join();
+      });
+   };
+
+   AVLMap<std::uint32_t, std::uint32_t> locked;
+   std::mutex lock;
+   ShardedAVLMap<std::uint32_t, std::uint32_t> sharded;
+
+   std::cout << "Contended inserts, " << keys.size() << " keys, " << writers << " writers:" << std::endl;
+   report("AVLMap + std::mutex", time_writers([&](std::uint32_t key) {
+      std::lock_guard<std::mutex> guard(lock);
+      locked.insert(key, key);
+   }));
+   report("ShardedAVLMap", time_writers([&](std::uint32_t key) { sharded.insert(key, key); }));
+}
+
+/// Compare merging a tree of m keys into a tree of n keys with set_union against inserting the keys one by one.
+void bench_set_operations() {
+   auto keys = make_keys(1 << 21);
+   std::vector<std::uint32_t> base(keys.begin(), keys.begin() + (1 << 20));
+   std::sort(base.begin(), base.end());
+
+   for (std::size_t count : { std::size_t(1) << 10, std::size_t(1) << 20 })
+   {
+      std::vector<std::uint32_t> other(keys.begin() + (1 << 20), keys.begin() + (1 << 20) + count);
+      std::sort(other.begin(), other.end());
+
+      AVLTree<std::uint32_t> inserted, merged, parallel, source, parallel_source;
+      inserted.assign_sorted(base.begin(), base.end());
+      merged.copy(inserted);
+      parallel.copy(inserted);
+      source.assign_sorted(other.begin(), other.end());
+      parallel_source.copy(source);
+
+      std::cout << "Union of " << base.size() << " and " << count << " keys:" << std::endl;
+      report("insert loop", time_per_op(count, [&]() {
+         for (auto key : other)
+            inserted.insert(key);
+      }));
+      report("set_union", time_per_op(count, [&]() { merged.set_union(source); }));
+      report("set_union, parallel", time_per_op(count, [&]() {
+         parallel.set_union(parallel_source, std::thread::hardware_concurrency());
+      }));
+   }
+}
+
+/// Compare scanning a narrow key range through range against filtering a full in-order traversal.
+void bench_range() {
+   auto keys = make_keys(1 << 20);
+   AVLTree<std::uint32_t> tree;
+   tree.assign(keys.begin(), keys.end());
+
+   std::uint32_t low = 1u << 31, high = low + (1u << 22);
+   std::size_t in_range = 0, scanned = 0;
+
+   std::cout << "Range scan of 1/1024 of the key space, " << keys.size() << " keys:" << std::endl;
+   report("full traversal", time_per_op(1, [&]() {
+      for (auto iter = tree.cbegin_inorder(); iter != tree.cend_inorder(); ++iter)
+         if ((*iter)->key() >= low && (*iter)->key() < high)
+            ++scanned;
+   }));
+   report("range", time_per_op(1, [&]() {
+      for (auto node : tree.range(low, high))
+      {
+         (void)node;
+         ++in_range;
+      }
+   }));
+
+   if (in_range != scanned) { std::cout << "range mismatch: " << in_range << " != " << scanned << std::endl; }
+}
+
+/// Time a full in-order traversal of the given tree.
+template <typename Tree>
+void bench_traversal(const std::string &name, Tree &tree) {
+   std::uint64_t sum = 0;
+
+   report(name, time_per_op(tree.size(), [&]() {
+      for (auto iter = tree.cbegin_inorder(); iter != tree.cend_inorder(); ++iter)
+         sum += (*iter)->key();
+   }));
+
+   if (sum == 0) { std::cout << "empty traversal" << std::endl; }
+}
+
+/// Compare in-order traversals across node storage policies.
+void bench_iteration() {
+   auto keys = make_keys(1 << 20);
+   AVLTree<std::uint32_t> raw;
+   AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage> compact;
+   AVLTree<std::uint32_t, std::less<std::uint32_t>, SharedNodeStorage> shared;
+
+   for (auto key : keys)
+   {
+      raw.insert(key);
+      compact.insert(key);
+      shared.insert(key);
+   }
+
+   std::cout << "In-order traversal, " << keys.size() << " keys:" << std::endl;
+   bench_traversal("RawNodeStorage", raw);
+   bench_traversal("CompactNodeStorage", compact);
+   bench_traversal("SharedNodeStorage", shared);
+}
+
+/// Compare appending increasing keys, with and without an end hint, against inserting the same keys shuffled.
+void bench_append() {
+   constexpr std::size_t count = 1 << 20;
+   auto shuffled = make_keys(count);
+   std::vector<std::uint32_t> increasing(count);
+
+   for (std::size_t i=0; i<count; ++i)
+      increasing[i] = static_cast<std::uint32_t>(i);
+
+   std::cout << "Insertion of " << count << " keys:" << std::endl;
+
+   for (int round=0; round<2; ++round)
+   {
+      AVLTree<std::uint32_t> appended, hinted, random;
+      AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage> compact;
+
+      auto append = time_per_op(count, [&]() {
+         for (auto key : increasing)
+            appended.insert(key);
+      });
+      auto hint = time_per_op(count, [&]() {
+         for (auto key : increasing)
+            hinted.insert(hinted.end(), key);
+      });
+      auto unlinked = time_per_op(count, [&]() {
+         for (auto key : increasing)
+            compact.insert(key);
+      });
+      auto shuffle = time_per_op(count, [&]() {
+         for (auto key : shuffled)
+            random.insert(key);
+      });
+
+      if (round == 0) { continue; }
+
+      report("increasing keys", append);
+      report("increasing keys, end hint", hint);
+      report("increasing keys, CompactNodeStorage", unlinked);
+      report("random keys", shuffle);
+   }
+}
+
+/// Measure what counting stats costs on the update path, against the default policy which counts nothing.
+void bench_stats() {
+   using CountedTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, std::allocator<std::uint32_t>, NoAugment,
+                               CountingStats>;
+
+   auto keys = make_keys(1 << 20);
+
+   std::cout << "Stats policies, " << keys.size() << " keys:" << std::endl;
+   bench_insert_remove<AVLTree<std::uint32_t>>("NoStats", keys);
+   bench_insert_remove<CountedTree>("CountingStats", keys);
+
+   CountedTree tree;
+
+   for (auto key : keys)
+      tree.insert(key);
+
+   auto stats = tree.stats();
+   std::cout << "height " << stats.height << " of at most " << stats.height_bound << ", average depth "
+             << stats.average_depth() << ", " << static_cast<double>(stats.counters.single_rotations + stats.counters.double_rotations) / keys.size()
+             << " rotations and " << static_cast<double>(stats.counters.comparisons) / keys.size() << " comparisons per insert" << std::endl;
+}
+
+/// Compare applying batches of keys to a large tree key by key against insert_batch and erase_batch, for a
+/// sparse batch spread over the whole tree and a dense batch within one range of it.
+void bench_batch() {
+   constexpr std::size_t count = 1 << 20, batch_size = 1 << 14;
+   auto keys = make_keys(count + 2 * batch_size);
+   std::vector<std::uint32_t> base(keys.begin(), keys.begin() + count);
+   std::vector<std::uint32_t> sparse(keys.begin() + count, keys.begin() + count + batch_size);
+   std::vector<std::uint32_t> dense(keys.begin() + count + batch_size, keys.end());
+
+   std::sort(dense.begin(), dense.end());
+   std::transform(dense.begin(), dense.end(), dense.begin(), [](std::uint32_t key) { return key / 256; });
+   dense.erase(std::unique(dense.begin(), dense.end()), dense.end());
+
+   AVLTree<std::uint32_t> original;
+   original.assign(base.begin(), base.end());
+
+   std::cout << "Batches of " << batch_size << " keys applied to " << count << " keys:" << std::endl;
+
+   for (auto batch : { &sparse, &dense })
+   {
+      auto name = std::string(batch == &sparse ? "sparse" : "dense");
+      auto single = original, batched = original;
+
+      report("insert, key by key, " + name, time_per_op(batch->size(), [&]() {
+         for (auto key : *batch)
+            if (!single.contains(key)) { single.insert(key); }
+      }));
+      report("insert_batch, " + name, time_per_op(batch->size(), [&]() {
+         batched.insert_batch(batch->begin(), batch->end());
+      }));
+      report("remove, key by key, " + name, time_per_op(batch->size(), [&]() {
+         for (auto key : *batch)
+            if (single.contains(key)) { single.remove(key); }
+      }));
+      report("erase_batch, " + name, time_per_op(batch->size(), [&]() {
+         batched.erase_batch(batch->begin(), batch->end());
+      }));
+
+      if (single.size() != batched.size()) { std::cout << "batches disagree" << std::endl; }
+   }
+}
+
+/// Compare expiring the oldest half of a tree key by key against erase_below, which cuts it off in one split.
+void bench_range_erase() {
+   constexpr std::uint32_t count = 1 << 20;
+   AVLTree<std::uint32_t> single, ranged;
+
+   for (std::uint32_t i=0; i<count; ++i)
+   {
+      single.insert(i);
+      ranged.insert(i);
+   }
+
+   std::cout << "Expiring " << count / 2 << " of " << count << " keys:" << std::endl;
+   report("remove, key by key", time_per_op(count / 2, [&]() {
+      for (std::uint32_t i=0; i<count/2; ++i)
+         single.remove(i);
+   }));
+   report("erase_below", time_per_op(count / 2, [&]() { ranged.erase_below(count / 2); }));
+
+   if (single.size() != ranged.size()) { std::cout << "expiries disagree" << std::endl; }
+}
+
+/// Compare inserting, searching and scanning small keys in a tree of one key per node against a tree of
+/// key blocks, and the memory each takes.
+void bench_blocked() {
+   auto keys = make_keys(1 << 20);
+   AVLTree<std::uint32_t> tree;
+   BlockedAVLTree<std::uint32_t> blocked;
+   auto queries = keys;
+   std::uint64_t sum = 0, blocked_sum = 0;
+   std::size_t found = 0, blocked_found = 0;
+
+   std::cout << "Storing " << keys.size() << " small keys one per node and in blocks:" << std::endl;
+   report("insert, one key per node", time_per_op(keys.size(), [&]() {
+      for (auto key : keys)
+         tree.insert(key);
+   }));
+   report("insert, blocks", time_per_op(keys.size(), [&]() {
+      for (auto key : keys)
+         blocked.insert(key);
+   }));
+   // searching in insertion order would favour the nodes, which the allocator hands out in that order
+   std::shuffle(queries.begin(), queries.end(), std::mt19937(0xdeadbeef));
+
+   report("contains, one key per node", time_per_op(keys.size(), [&]() {
+      for (auto key : queries)
+         found += tree.contains(key + 1);
+   }));
+   report("contains, blocks", time_per_op(keys.size(), [&]() {
+      for (auto key : queries)
+         blocked_found += blocked.contains(key + 1);
+   }));
+   report("scan, one key per node", time_per_op(keys.size(), [&]() {
+      for (auto iter = tree.cbegin_inorder(); iter != tree.cend_inorder(); ++iter)
+         sum += (*iter)->key();
+   }));
+   report("scan, blocks", time_per_op(keys.size(), [&]() {
+      for (auto key : blocked)
+         blocked_sum += key;
+   }));
+
+   std::cout << "  nodes: " << tree.size() * sizeof(AVLTree<std::uint32_t>::Node) / 1024 << " KiB, blocks: "
+             << blocked.memory_bytes() / 1024 << " KiB" << std::endl;
+
+   if (found != blocked_found || sum != blocked_sum) { std::cout << "blocked tree disagrees" << std::endl; }
+}
+
+/// Compare searching a map keyed by std::string against a map keyed by PrefixedString, with keys too long for
+/// the small-string buffer which mostly differ within their first eight bytes.
+void bench_string_keys() {
+   auto numbers = make_keys(1 << 19);
+   std::vector<std::string> keys;
+   AVLMap<std::string, std::uint32_t> map;
+   StringMap<std::uint32_t> prefixed;
+   std::size_t found = 0, prefixed_found = 0;
+
+   for (auto number : numbers)
+      keys.push_back(std::to_string(number) + "/session/00000000");
+
+   for (std::uint32_t i=0; i<keys.size(); ++i)
+   {
+      map.insert(keys[i], i);
+      prefixed.insert(keys[i], i);
+   }
+
+   std::shuffle(keys.begin(), keys.end(), std::mt19937(0xdeadbeef));
+
+   std::cout << "Searching " << keys.size() << " string keys:" << std::endl;
+   report("std::string keys", time_per_op(keys.size(), [&]() {
+      for (auto &key : keys)
+         found += map.has_key(key);
+   }));
+   report("PrefixedString keys", time_per_op(keys.size(), [&]() {
+      for (auto &key : keys)
+         prefixed_found += prefixed.has_key(key);
+   }));
+
+   if (found != prefixed_found) { std::cout << "string maps disagree" << std::endl; }
+}
+
+/// Compare bursts of insertions and removals under strict and relaxed balance, and the cost of restoring strict
+/// balance afterwards. Both trees draw their nodes from a fresh pool, so neither inherits a fragmented heap.
+void bench_relaxed() {
+   using Tree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, PoolAllocator<std::uint32_t>, NoAugment,
+                        CountingStats>;
+
+   auto keys = make_keys(1 << 20);
+
+   std::cout << "Writing " << keys.size() << " keys under strict and relaxed balance:" << std::endl;
+
+   for (auto relaxed : { false, true })
+   {
+      std::string name = relaxed ? "relaxed" : "strict";
+      Tree tree;
+      tree.set_relaxed_balance(relaxed);
+
+      report("insert, " + name, time_per_op(keys.size(), [&]() {
+         for (auto key : keys)
+            tree.insert(key);
+      }));
+      report("remove half, " + name, time_per_op(keys.size() / 2, [&]() {
+         for (std::size_t i=0; i<keys.size(); i+=2)
+            tree.remove(keys[i]);
+      }));
+
+      auto counters = tree.stats().counters;
+      auto height = tree.root()->height();
+
+      report("rebalance_pending, " + name, time_per_op(tree.size(), [&]() { tree.rebalance_pending(); }));
+      std::cout << "  rotations: " << counters.single_rotations + counters.double_rotations << ", height "
+                << static_cast<int>(height) << " -> " << static_cast<int>(tree.root()->height()) << std::endl;
+   }
+}
+
+/// Compare upserting random keys into a map key by key against buffering the writes and merging them in batches,
+/// and lookups on both afterwards.
+void bench_buffered() {
+   auto keys = make_keys(1 << 20);
+   AVLMap<std::uint32_t, std::uint32_t> map;
+   BufferedAVLMap<std::uint32_t, std::uint32_t> buffered;
+   std::size_t found = 0, buffered_found = 0;
+
+   // the map starts out full, so the writes land among settled keys
+   for (std::size_t i=0; i<keys.size(); i+=2)
+   {
+      map.insert(keys[i], 0);
+      buffered.insert_or_assign(keys[i], 0);
+   }
+
+   buffered.flush();
+
+   std::cout << "Upserting " << keys.size() << " keys into a map of " << map.size() << ":" << std::endl;
+   report("insert_or_assign, AVLMap", time_per_op(keys.size(), [&]() {
+      for (auto key : keys)
+         map.insert_or_assign(key, key);
+   }));
+   report("insert_or_assign, buffered", time_per_op(keys.size(), [&]() {
+      for (auto key : keys)
+         buffered.insert_or_assign(key, key);
+
+      buffered.flush();
+   }));
+   report("get, AVLMap", time_per_op(keys.size(), [&]() {
+      for (auto key : keys)
+         found += map.get(key) == key;
+   }));
+   report("get, buffered", time_per_op(keys.size(), [&]() {
+      for (auto key : keys)
+         buffered_found += buffered.get(key) == key;
+   }));
+
+   if (found != buffered_found) { std::cout << "buffered map disagrees" << std::endl; }
+}
+
+/// Compare restoring a map by reinserting its values against loading it from a mapped file, and lookups on
+/// the map against lookups served straight from the mapping.
+void bench_mapped() {
+   using Map = AVLMap<std::uint32_t, std::uint64_t>;
+
+   auto keys = make_keys(1 << 20);
+   const std::string path = "benchavltree_mapped.bin";
+   Map map;
+   std::size_t found = 0;
+
+   for (auto key : keys)
+      map.insert(key, key);
+
+   auto values = map.to_vec();
+   serialize(map, path);
+
+   std::cout << "Restoring and searching a map of " << keys.size() << " keys:" << std::endl;
+   report("reinsert to_vec", time_per_op(keys.size(), [&]() {
+      Map restored;
+
+      for (auto &value : values)
+         restored.insert(value.first, value.second);
+
+      found += restored.size();
+   }));
+   report("MappedTree::open + thaw", time_per_op(keys.size(), [&]() {
+      found += MappedTree<Map>::open(path).thaw().size();
+   }));
+
+   auto view = MappedTree<Map>::open(path);
+   auto queries = keys;
+   std::shuffle(queries.begin(), queries.end(), std::mt19937(0xdeadbeef));
+
+   report("AVLMap::contains", time_per_op(queries.size(), [&]() {
+      for (auto key : queries)
+         found += map.contains(key);
+   }));
+   report("MappedTree::contains", time_per_op(queries.size(), [&]() {
+      for (auto key : queries)
+         found += view.contains(key);
+   }));
+
+   std::remove(path.c_str());
+
+   if (found != keys.size() * 4) { std::cout << "restore lost keys" << std::endl; }
+}
+
+/// How a container of the comparison suite is driven. Sets hold the keys themselves, maps hold the keys with a
+/// 64-bit value.
+template <typename Container>
+struct SuiteAdapter;
+
+template <typename Key>
+struct SuiteAdapter<AVLTree<Key>> {
+   using Element = Key;
+
+   static constexpr const char *name = "AVLTree";
+
+   static Element element(const Key &key) { return key; }
+   static const Key &key_of(const Element &element) { return element; }
+   static void insert(AVLTree<Key> &tree, const Key &key) { tree.insert(key); }
+   static bool contains(const AVLTree<Key> &tree, const Key &key) { return tree.contains(key); }
+   static void erase(AVLTree<Key> &tree, const Key &key) { tree.remove(key); }
+   static void build(AVLTree<Key> &tree, const std::vector<Element> &sorted) { tree.assign_sorted(sorted.begin(), sorted.end()); }
+};
+
+template <typename Key>
+struct SuiteAdapter<std::set<Key>> {
+   using Element = Key;
+
+   static constexpr const char *name = "std::set";
+
+   static Element element(const Key &key) { return key; }
+   static const Key &key_of(const Element &element) { return element; }
+   static void insert(std::set<Key> &set, const Key &key) { set.insert(key); }
+   static bool contains(const std::set<Key> &set, const Key &key) { return set.find(key) != set.end(); }
+   static void erase(std::set<Key> &set, const Key &key) { set.erase(key); }
+   static void build(std::set<Key> &set, const std::vector<Element> &sorted) { set = std::set<Key>(sorted.begin(), sorted.end()); }
+};
+
+template <typename Key>
+struct SuiteAdapter<AVLMap<Key, std::uint64_t>> {
+   using Element = std::pair<Key, std::uint64_t>;
+
+   static constexpr const char *name = "AVLMap";
+
+   static Element element(const Key &key) { return Element(key, 0); }
+   template <typename Pair>
+   static const Key &key_of(const Pair &element) { return element.first; }
+   static void insert(AVLMap<Key, std::uint64_t> &map, const Key &key) { map.insert(key, 0); }
+   static bool contains(const AVLMap<Key, std::uint64_t> &map, const Key &key) { return map.contains(key); }
+   static void erase(AVLMap<Key, std::uint64_t> &map, const Key &key) { map.remove(key); }
+   static void build(AVLMap<Key, std::uint64_t> &map, const std::vector<Element> &sorted) {
+      map.assign_sorted(sorted.begin(), sorted.end());
+   }
+};
+
+template <typename Key>
+struct SuiteAdapter<std::map<Key, std::uint64_t>> {
+   using Element = std::pair<Key, std::uint64_t>;
+
+   static constexpr const char *name = "std::map";
+
+   static Element element(const Key &key) { return Element(key, 0); }
+   template <typename Pair>
+   static const Key &key_of(const Pair &element) { return element.first; }
+   static void insert(std::map<Key, std::uint64_t> &map, const Key &key) { map.emplace(key, 0); }
+   static bool contains(const std::map<Key, std::uint64_t> &map, const Key &key) { return map.find(key) != map.end(); }
+   static void erase(std::map<Key, std::uint64_t> &map, const Key &key) { map.erase(key); }
+   static void build(std::map<Key, std::uint64_t> &map, const std::vector<Element> &sorted) {
+      map = std::map<Key, std::uint64_t>(sorted.begin(), sorted.end());
+   }
+};
+
+/// Turn a distinct 32-bit key into a distinct key of the given type. Strings are long enough to be allocated,
+/// the way most string keys are.
+template <typename Key>
+Key suite_key(std::uint32_t key) {
+   // multiplying by an odd constant is a bijection modulo 2^64, so the wider keys stay distinct
+   auto wide = static_cast<std::uint64_t>(key) * 0x9e3779b97f4a7c15ull;
+
+   if constexpr (std::is_same<Key, std::string>::value)
+   {
+      static const char digits[] = "0123456789abcdef";
+      std::string result = "key:";
+
+      for (int shift=60; shift>=0; shift-=4)
+         result.push_back(digits[(wide >> shift) & 0xf]);
+
+      return result;
+   }
+   else if constexpr (std::is_same<Key, std::uint64_t>::value) { return wide; }
+   else { return key; }
+}
+
+std::string suite_key_name(std::uint32_t) { return "uint32_t"; }
+std::string suite_key_name(std::uint64_t) { return "uint64_t"; }
+std::string suite_key_name(const std::string &) { return "std::string"; }
+
+/// Fold a key into a checksum, so the compiler can't drop a loop whose results are never used.
+std::uint64_t suite_digest(std::uint64_t key) { return key; }
+std::uint64_t suite_digest(const std::string &key) { return key.size() + static_cast<unsigned char>(key.back()); }
+
+/// The result of one case of the comparison suite, per operation.
+struct SuiteResult {
+   double nanoseconds;
+   double allocations;
+   double peak_bytes;
+};
+
+/// The state a case of the comparison suite runs on. The copy lives here, so destroying it isn't timed.
+template <typename Container>
+struct SuiteState {
+   std::unique_ptr<Container> container;
+   std::unique_ptr<Container> copy;
+};
+
+/// Time an operation over the given number of elements, best of the given rounds. The setup runs untimed
+/// before every round. Allocations and the peak of the bytes allocated on top of the setup are counted too.
+template <typename Container, typename Setup, typename Operation>
+SuiteResult measure_case(std::size_t operations, std::size_t rounds, Setup &&setup, Operation &&operation) {
+   SuiteResult result{std::numeric_limits<double>::max(), 0, 0};
+
+   for (std::size_t round=0; round<rounds; ++round)
+   {
+      SuiteState<Container> state;
+      setup(state);
+
+      auto allocations = allocation_counters.allocations.load();
+      auto live = allocation_counters.live_bytes.load();
+      allocation_counters.peak_bytes.store(live);
+
+      result.nanoseconds = std::min(result.nanoseconds, time_per_op(operations, [&]() { operation(state); }));
+      result.allocations = static_cast<double>(allocation_counters.allocations.load() - allocations) / operations;
+      result.peak_bytes = static_cast<double>(allocation_counters.peak_bytes.load() - live) / operations;
+   }
+
+   return result;
+}
+
+/// Print a result of the comparison suite, as an aligned table row or as a CSV record.
+void report_case(bool csv, const std::string &operation, const std::string &container, const std::string &key,
+                 std::size_t size, const SuiteResult &result) {
+   if (csv)
+   {
+      std::cout << operation << ',' << container << ',' << key << ',' << size << ',' << std::fixed << std::setprecision(2)
+                << result.nanoseconds << ',' << result.allocations << ',' << result.peak_bytes << ',' << max_rss_kb() << std::endl;
+      return;
+   }
+
+   std::cout << std::left << std::setw(20) << operation << std::setw(12) << container << std::setw(14) << key
+             << std::right << std::setw(10) << size << std::setw(12) << std::fixed << std::setprecision(1) << result.nanoseconds
+             << " ns/op" << std::setw(8) << std::setprecision(2) << result.allocations << " allocs/op"
+             << std::setw(10) << std::setprecision(1) << result.peak_bytes << " bytes/op" << std::endl;
+}
+
+/// Run every case of the comparison suite on one container with keys of its type, at the given size.
+template <typename Container, typename Key>
+void run_suite_cases(bool csv, std::size_t size, std::uint64_t &checksum) {
+   using Adapter = SuiteAdapter<Container>;
+   using Element = typename Adapter::Element;
+
+   // the first half of the keys goes into the container, the second half is looked up and missed
+   auto raw = make_keys(size * 2);
+   std::vector<Key> keys, misses;
+
+   keys.reserve(size);
+   misses.reserve(size);
+
+   for (std::size_t i=0; i<size; ++i)
+   {
+      keys.push_back(suite_key<Key>(raw[i]));
+      misses.push_back(suite_key<Key>(raw[size + i]));
+   }
+
+   raw = std::vector<std::uint32_t>();
+
+   std::vector<Key> ascending = keys;
+   std::sort(ascending.begin(), ascending.end());
+   std::vector<Key> descending(ascending.rbegin(), ascending.rend());
+   std::vector<Element> sorted;
+
+   sorted.reserve(size);
+
+   for (auto &key : ascending)
+      sorted.push_back(Adapter::element(key));
+
+   // small sizes repeat, so a case takes long enough to time
+   auto rounds = std::min<std::size_t>(100, std::max<std::size_t>(1, 1000000 / size));
+   auto name = suite_key_name(Key());
+   auto empty = [](SuiteState<Container> &state) { state.container = std::make_unique<Container>(); };
+   auto built = [&sorted](SuiteState<Container> &state) {
+      state.container = std::make_unique<Container>();
+      Adapter::build(*state.container, sorted);
+   };
+   auto insert_all = [](const std::vector<Key> &order) {
+      return [&order](SuiteState<Container> &state) {
+         for (auto &key : order)
+            Adapter::insert(*state.container, key);
+      };
+   };
+   auto report_result = [&](const std::string &operation, const SuiteResult &result) {
+      report_case(csv, operation, Adapter::name, name, size, result);
+   };
+
+   report_result("insert_random", measure_case<Container>(size, rounds, empty, insert_all(keys)));
+   report_result("insert_ascending", measure_case<Container>(size, rounds, empty, insert_all(ascending)));
+   report_result("insert_descending", measure_case<Container>(size, rounds, empty, insert_all(descending)));
+   report_result("lookup_hit", measure_case<Container>(size, rounds, built, [&](SuiteState<Container> &state) {
+      for (auto &key : keys)
+         checksum += Adapter::contains(*state.container, key);
+   }));
+   report_result("lookup_miss", measure_case<Container>(size, rounds, built, [&](SuiteState<Container> &state) {
+      for (auto &key : misses)
+         checksum += Adapter::contains(*state.container, key);
+   }));
+   report_result("erase_random", measure_case<Container>(size, rounds, built, [&](SuiteState<Container> &state) {
+      for (auto &key : keys)
+         Adapter::erase(*state.container, key);
+   }));
+   report_result("scan_inorder", measure_case<Container>(size, rounds, built, [&](SuiteState<Container> &state) {
+      for (auto iter = state.container->cbegin(); iter != state.container->cend(); ++iter)
+         checksum += suite_digest(Adapter::key_of(*iter));
+   }));
+   report_result("copy", measure_case<Container>(size, rounds, built, [](SuiteState<Container> &state) {
+      state.copy = std::make_unique<Container>(*state.container);
+   }));
+   report_result("destroy", measure_case<Container>(size, rounds, built, [](SuiteState<Container> &state) {
+      state.container.reset();
+   }));
+   report_result("bulk_build", measure_case<Container>(size, rounds, empty, [&sorted](SuiteState<Container> &state) {
+      Adapter::build(*state.container, sorted);
+   }));
+}
+
+/// Run every case of the comparison suite with keys of the given type, against every container.
+template <typename Key>
+void run_suite_keys(bool csv, std::size_t size, std::uint64_t &checksum) {
+   run_suite_cases<AVLTree<Key>, Key>(csv, size, checksum);
+   run_suite_cases<std::set<Key>, Key>(csv, size, checksum);
+   run_suite_cases<AVLMap<Key, std::uint64_t>, Key>(csv, size, checksum);
+   run_suite_cases<std::map<Key, std::uint64_t>, Key>(csv, size, checksum);
+}
+
+/// Compare AVLTree and AVLMap against std::set and std::map on the common operations, at every power of ten
+/// from 10^3 up to the given size, with 32-bit, 64-bit and string keys.
+///
+/// Each case reports the best time per operation, the allocations per operation and the peak of the bytes
+/// allocated per operation on top of its setup. The CSV records also carry the peak resident set size of the
+/// process so far, which only ever grows as the sizes do.
+void run_suite(bool csv, std::size_t max_size) {
+   std::uint64_t checksum = 0;
+
+   if (csv) { std::cout << "operation,container,key,size,ns_per_op,allocs_per_op,peak_bytes_per_op,max_rss_kb" << std::endl; }
+
+   for (std::size_t size=1000; size<=max_size; size*=10)
+   {
+      run_suite_keys<std::uint32_t>(csv, size, checksum);
+      run_suite_keys<std::uint64_t>(csv, size, checksum);
+      run_suite_keys<std::string>(csv, size, checksum);
+   }
+
+   if (checksum == 0) { std::cout << "empty suite" << std::endl; }
+   if (!csv) { std::cout << "Peak resident set size: " << max_rss_kb() << " KiB" << std::endl; }
+}
+
+int
+main
+(int argc, char *argv[])
+{
+   bool suite = false, csv = false;
+   std::size_t max_size = 100000;
+
+   for (int i=1; i<argc; ++i)
+   {
+      std::string arg = argv[i];
+
+      if (arg == "--suite") { suite = true; }
+      else if (arg == "--csv") { suite = csv = true; }
+      else if (arg == "--max-size" && i + 1 < argc) { suite = true; max_size = std::stoull(argv[++i]); }
+      else
+      {
+         std::cerr << "usage: " << argv[0] << " [--suite] [--csv] [--max-size N]" << std::endl;
+         return 1;
+      }
+   }
+
+   if (suite)
+   {
+      run_suite(csv, max_size);
+      return 0;
+   }
+
+   bench_dispatch();
+   bench_node_layout();
+   bench_frozen();
+   bench_concurrent();
+   bench_snapshot();
+   bench_sharded();
+   bench_set_operations();
+   bench_range();
+   bench_iteration();
+   bench_append();
+   bench_stats();
+   bench_mapped();
+   bench_batch();
+   bench_range_erase();
+   bench_blocked();
+   bench_string_keys();
+   bench_relaxed();
+   bench_buffered();
+
+   return 0;
+}
@@ -13,16 +13,34 @@
 //! [interval tree](https://en.wikipedia.org/wiki/Interval_tree).
 //!
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <exception>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <new>
 #include <optional>
 #include <string>
+#include <system_error>
+#include <tuple>
 #include <type_traits>
 #include <vector>
 #include <utility>
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <xmmintrin.h>
+#endif
+
+#if __cplusplus > 201703L && __has_include(<compare>)
+#include <compare>
+#endif
+
 namespace avltree
 {
 namespace exception {
@@ -88,1350 +106,4995 @@ namespace exception {
    public:
       KeyNotFound() : Exception("The key was not found in the tree.") {}
    };
-}
 
-   /// @brief The base implementation of an AVL tree.
-   ///
-   /// **NOTE**: For a basic AVL tree implementation, this interface is too complex. See the AVLTree class
-   /// for a more basic interface to an AVL tree. Additionally, because of how verbose the template arguments
-   /// are, it is recommended you employ a typedef to save yourself the typing.
+   /// @brief Exception thrown when a range expected to be sorted by key is not.
    ///
-   /// This is the base AVL tree implementation. Its template interface is designed in this way to handle
-   /// mapping objects, and takes inspiration from libstdc++'s red-black tree interface for its implementation
-   /// of a map. For implementing some tree-based objects that have a map-like design, this is the interface
-   /// to use. Otherwise, the simplified versions of this interface, separated into AVLTree and AVLMap, should
-   /// suffice.
+   class NotSorted : public Exception {
+   public:
+      NotSorted() : Exception("The values are not sorted by strictly increasing keys.") {}
+   };
+
+   /// @brief Exception thrown when a position is past the end of the tree.
    ///
-   /// @tparam Key The type class of the object that acts as the node's key, also known as its label. This value
-   /// is the value responsible for indexing the nodes in the tree. This is expected to be a constant value-- undefined
-   /// behavior is likely to happen if you modify a tree node's key.
+   class IndexOutOfRange : public Exception {
+   public:
+      IndexOutOfRange() : Exception("The index is out of range of the tree.") {}
+   };
+
+   /// @brief Exception thrown when data read back is not a tree serialized in a format this library reads.
    ///
-   /// @tparam Value The value type class of the object, which is expected to host the key value in some way, whose
-   /// extraction of said key is determined by the functor KeyOfValue. This type can be the same as the key type with
-   /// use of the KeyIsValue functor.
+   class InvalidFormat : public Exception {
+   public:
+      InvalidFormat() : Exception("The data is not a serialized tree of this type.") {}
+   };
+
+   /// @brief Exception thrown when a file can't be opened, read, written or mapped.
    ///
-   /// @tparam KeyOfValue The functor which extracts the node's Key type value from the node's Value object. See
-   /// KeyIsValue and KeyOfPair for examples of how to use this value.
+   class FileError : public Exception {
+   public:
+      FileError(const std::string &path) : Exception("Could not access the file " + path + ".") {}
+   };
+}
+
+   /// @brief A node storage policy which links nodes with raw pointers owned by the tree.
    ///
-   /// @tparam KeyCompare The key comparison functor, usually std::less<Key>. This functor must conform to C++'s
-   /// [Compare requirements](https://en.cppreference.com/w/cpp/named_req/Compare).
+   /// This is the default storage policy of the tree objects. Every node is owned exclusively by the tree
+   /// which allocated it and is released when it is removed from the tree or when the tree is destroyed,
+   /// so node handles returned by the tree are plain pointers which become invalid once their node leaves
+   /// the tree. Walking and relinking nodes costs no reference counting.
    ///
-   template <typename Key, typename Value, typename KeyOfValue, typename KeyCompare>
-   class AVLTreeBase
-   {
-   public:
-      class Node;
-      
-      using KeyType = Key;
-      using ValueType = Value;
-      using SharedNode = std::shared_ptr<Node>;
-      using ConstSharedNode = std::shared_ptr<const Node>;
+   struct RawNodeStorage {
+      /// @brief Whether nodes link back to their parent.
+      ///
+      static constexpr bool parent_links = true;
 
-      /// @brief A node object for an AVL tree.
+      /// @brief The pointer type used to link and hand out nodes.
       ///
-      /// This object contains data about a given node's key object, value, tree height and node relationships.
+      template <typename Node> using pointer = Node *;
+      /// @brief The pointer type used to hand out const nodes.
       ///
-      class Node
-      {
-      protected:
-         /// @brief The value data of the node.
-         ///
-         /// This contains the node's key.
-         ///
-         Value _value;
-         
-         /// @brief The height of the node in the tree.
-         ///
-         int _height;
+      template <typename Node> using const_pointer = const Node *;
 
-         /// @brief The parent node of this node.
-         ///
-         SharedNode _parent;
+      /// @brief Allocate a new node with the given allocator, forwarding the given arguments to its constructor.
+      ///
+      /// The allocator is expected to hand out plain pointers.
+      ///
+      template <typename Node, typename Allocator, typename... Args>
+      static pointer<Node> allocate(Allocator &allocator, Args&&... args) {
+         using Traits = std::allocator_traits<Allocator>;
+         pointer<Node> node = Traits::allocate(allocator, 1);
 
-         /// @brief The left child of this node.
-         ///
-         SharedNode _left;
+         try {
+            Traits::construct(allocator, node, std::forward<Args>(args)...);
+         }
+         catch (...) {
+            Traits::deallocate(allocator, node, 1);
+            throw;
+         }
 
-         /// @brief The right child of this node.
-         ///
-         SharedNode _right;
+         return node;
+      }
+
+      /// @brief Release a node which has been removed from its tree.
+      ///
+      template <typename Node, typename Allocator>
+      static void deallocate(Allocator &allocator, pointer<Node> node) {
+         using Traits = std::allocator_traits<Allocator>;
          
-      public:
-         friend class AVLTreeBase;
+         Traits::destroy(allocator, node);
+         Traits::deallocate(allocator, node, 1);
+      }
+   };
 
-         Node () : _value(Value()), _parent(nullptr), _left(nullptr), _right(nullptr), _height(0) {}
-         Node(const Value &value) : _value(value), _parent(nullptr), _left(nullptr), _right(nullptr), _height(0) {}
-         Node(const Node &other) : _value(other._value), _parent(other._parent), _left(other._left), _right(other._right), _height(other._height) {}
+   /// @brief A node storage policy which links nodes with std::shared_ptr.
+   ///
+   /// Node handles returned by a tree using this policy are reference-counted and remain valid after their
+   /// node has been removed from the tree or the tree itself has been destroyed. This comes at the cost of a
+   /// control block per node and reference count traffic on every link that is followed, so only use this
+   /// policy when you need handles which outlive the tree.
+   ///
+   struct SharedNodeStorage {
+      /// @brief Whether nodes link back to their parent.
+      ///
+      static constexpr bool parent_links = true;
 
-         /// @brief Copy everything except the value from the given node.
-         ///
-         /// This is useful for certain cases when deleting nodes from the tree.
-         ///
-         virtual void copy_node_data(const Node &other) {
-            this->_height = other._height;
-            this->_parent = other._parent;
-            this->_left = other._left;
-            this->_right = other._right;
-         }
+      /// @brief The pointer type used to link and hand out nodes.
+      ///
+      template <typename Node> using pointer = std::shared_ptr<Node>;
+      /// @brief The pointer type used to hand out const nodes.
+      ///
+      template <typename Node> using const_pointer = std::shared_ptr<const Node>;
 
-         /// @brief Get the key value of this node.
-         ///
-         /// This calls the KeyOfValue functor against the value object within the node and returns it.
-         ///
-         inline const Key &key() const { return KeyOfValue()(this->value()); }
-         /// @brief Get the value object of this node.
-         ///
-         inline Value &value() { return this->_value; }
-         /// @brief Get the const value object of this node.
-         ///
-         inline const Value &value() const { return this->_value; }
-         /// @brief Get the height of this node.
-         ///
-         inline int height() const { return this->_height; }
-         /// @brief Get the parent node of this node.
-         ///
-         inline SharedNode parent() { return this->_parent; }
-         /// @brief Get the const parent node of this node.
-         ///
-         inline ConstSharedNode parent() const { return this->_parent; }
-         /// @brief Get the left child of this node.
-         ///
-         inline SharedNode left() { return this->_left; }
-         /// @brief Get the const left child of this node.
-         ///
-         inline ConstSharedNode left() const { return this->_left; }
-         /// @brief Get the right child of this node.
-         ///
-         inline SharedNode right() { return this->_right; }
-         /// @brief Get the const right child of this node.
-         ///
-         inline ConstSharedNode right() const { return this->_right; }
+      /// @brief Allocate a new node with the given allocator, forwarding the given arguments to its constructor.
+      ///
+      /// The node and its control block share a single allocation, see std::allocate_shared.
+      ///
+      template <typename Node, typename Allocator, typename... Args>
+      static pointer<Node> allocate(Allocator &allocator, Args&&... args) {
+         return std::allocate_shared<Node>(allocator, std::forward<Args>(args)...);
+      }
 
-         /// @brief Determine if this node is a leaf node.
-         ///
-         inline bool is_leaf() const { return this->_left == nullptr && this->_right == nullptr; }
+      /// @brief Release a node which has been removed from its tree.
+      ///
+      /// This does nothing: the node is freed when its last handle goes away.
+      ///
+      template <typename Node, typename Allocator>
+      static void deallocate(Allocator &, pointer<Node>) {}
+   };
 
-         /// @brief Do a binary comparison of the given key against the node's key.
-         ///
-         /// @returns 0 if the key is equal to the key in the node, -1 if the key is less than the node's key,
-         /// and 1 if the key is greater than the node's key.
-         ///
-         int compare(const Key &key) const {
-            auto ab = KeyCompare()(key, this->key());
-            auto ba = KeyCompare()(this->key(), key);
+   /// @brief A node storage policy like RawNodeStorage whose nodes do not link back to their parent.
+   ///
+   /// Dropping the parent link saves a pointer per node. In exchange, the tree records the path it descends
+   /// in a fixed-size buffer on the stack to rebalance after an update, and iterators keep a stack of the
+   /// ancestors of their node. Iterators must therefore start at the root of the tree, as they do when they
+   /// come from the begin functions, and node handles cannot be used to walk up the tree. Hints are ignored,
+   /// and the rotation and update hooks of the Derived class are not called.
+   ///
+   struct CompactNodeStorage : public RawNodeStorage {
+      /// @brief Whether nodes link back to their parent.
+      ///
+      static constexpr bool parent_links = false;
+   };
 
-            if (!ab && !ba) { return 0; }
-            if (ab && !ba) { return -1; }
-            else { return 1; }
-         }
+   /// @brief A node storage policy like SharedNodeStorage whose nodes do not link back to their parent.
+   ///
+   /// A node without a parent link can be the child of several nodes at once, so whole subtrees can be shared
+   /// between trees. Destroying a tree only lets go of its root, and the nodes no other tree shares are freed
+   /// as their last owner goes away. This is the storage persistent trees are built on, see PersistentTreeBase.
+   /// The same restrictions as CompactNodeStorage apply.
+   ///
+   struct PersistentNodeStorage : public SharedNodeStorage {
+      /// @brief Whether nodes link back to their parent.
+      ///
+      static constexpr bool parent_links = false;
+   };
 
-         /// @brief Compare this node's key against the current node's key.
-         ///
-         /// See compare(const Key &key).
-         ///
-         int compare(ConstSharedNode &node) const {
-            if (node == nullptr) { throw exception::NullPointer(); }
+   /// @brief A slab allocator which hands out fixed-size blocks from contiguous chunks.
+   ///
+   /// Blocks are carved out of large chunks in the order they're requested, so nodes allocated one after
+   /// another end up next to each other in memory. Freed blocks are kept on a free list per block size and
+   /// handed out again before any new chunk is allocated. Chunks are only returned to the system when the
+   /// pool is released or destroyed, which frees everything the pool ever handed out at once.
+   ///
+   /// This object is not thread-safe. See PoolAllocator for using it with the tree objects.
+   ///
+   class NodePool
+   {
+   public:
+      /// @brief Create a pool whose chunks are at least the given number of bytes.
+      ///
+      explicit NodePool(std::size_t chunk_size=65536) : _chunk_size(chunk_size) {}
+      NodePool(const NodePool &other) = delete;
+      ~NodePool() {
+         this->release();
+      }
 
-            return this->compare(node->key());
-         }
+      NodePool &operator=(const NodePool &other) = delete;
 
-         /// @brief Determine the balance of this given node.
-         ///
-         /// In other words, subtract the height of the right child against the height of the left child
-         /// and return the value.
-         ///
-         int balance() const {
-            auto left_height = (this->_left != nullptr) ? this->_left->height() : 0;
-            auto right_height = (this->_right != nullptr) ? this->_right->height() : 0;
-            
-            return right_height - left_height;
+      /// @brief Allocate a block of at least the given size.
+      ///
+      /// The block is aligned to alignof(std::max_align_t).
+      ///
+      void *allocate(std::size_t size) {
+         auto &slab = this->slab(size);
+
+         if (slab.free_list != nullptr)
+         {
+            auto block = slab.free_list;
+            slab.free_list = block->next;
+            return block;
          }
 
-         /// @brief Determine the new height value of this node.
-         ///
-         int new_height() const {
-            auto left_height = (this->_left != nullptr) ? this->_left->height() : 0;
-            auto right_height = (this->_right != nullptr) ? this->_right->height() : 0;
+         if (slab.cursor == slab.end)
+         {
+            auto blocks = std::max<std::size_t>(this->_chunk_size / slab.block_size, 1);
+            auto chunk = static_cast<char *>(::operator new(blocks * slab.block_size));
 
-            return std::max(left_height,right_height)+1;
+            this->_chunks.push_back(chunk);
+            slab.cursor = chunk;
+            slab.end = chunk + blocks * slab.block_size;
          }
-      };
 
-   protected:
-      /// @brief The base iterator for performing an in-order traversal.
+         auto block = slab.cursor;
+         slab.cursor += slab.block_size;
+
+         return block;
+      }
+
+      /// @brief Return a block of the given size to the pool.
       ///
-      /// This class is the base class for iterating over the nodes in the tree in an
-      /// [in-order traversal](https://en.wikipedia.org/wiki/Tree_traversal#In-order,_LNR).
+      /// The size must be the size the block was allocated with.
       ///
-      /// @tparam NodeType The node class for the base iterator. Can be either SharedNode or ConstSharedNode.
+      void deallocate(void *block, std::size_t size) {
+         auto &slab = this->slab(size);
+         auto free_block = static_cast<FreeBlock *>(block);
+
+         free_block->next = slab.free_list;
+         slab.free_list = free_block;
+      }
+
+      /// @brief Return every chunk to the system at once.
       ///
-      template <typename NodeType>
-      class inorder_iterator_base
-      {
-         static_assert(std::is_same<NodeType, SharedNode>::value || std::is_same<NodeType, ConstSharedNode>::value,
-                       "Iterator template type must be a SharedNode or a ConstSharedNode.");
-         
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = SharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
+      /// This invalidates every block handed out by the pool, so only do this once nothing lives in it anymore.
+      ///
+      void release() {
+         for (auto chunk : this->_chunks)
+            ::operator delete(chunk);
 
-         inorder_iterator_base(NodeType node) : node(node) {
-            if (this->node == nullptr) return;
-            
-            while (this->node->_left != nullptr)
-            {
-               this->node = this->node->_left;
-            }
-         }
-         inorder_iterator_base(const inorder_iterator_base &other) : node(other.node) {}
-         ~inorder_iterator_base() {}
+         this->_chunks.clear();
+         this->_slabs.clear();
+      }
 
-         inorder_iterator_base& operator=(const inorder_iterator_base& other) { this->node = other.node; }
+      /// @brief Return the number of chunks currently held by the pool.
+      ///
+      inline std::size_t chunks() const { return this->_chunks.size(); }
 
-         inorder_iterator_base& operator++() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+   private:
+      struct FreeBlock {
+         FreeBlock *next;
+      };
 
-            if (this->node->_right != nullptr)
-            {
-               this->node = this->node->_right;
+      struct Slab {
+         std::size_t block_size;
+         FreeBlock *free_list;
+         char *cursor;
+         char *end;
+      };
 
-               while (this->node->_left != nullptr)
-                  this->node = this->node->_left;
-            }
-            else
-            {
-               auto parent = this->node->_parent;
+      Slab &slab(std::size_t size) {
+         const std::size_t alignment = alignof(std::max_align_t);
+         auto block_size = (std::max(size, sizeof(FreeBlock)) + alignment - 1) & ~(alignment - 1);
 
-               while (parent != nullptr && this->node == parent->_right)
-               {
-                  this->node = parent;
-                  parent = parent->_parent;
-               }
+         for (auto &slab : this->_slabs)
+            if (slab.block_size == block_size)
+               return slab;
 
-               this->node = parent;
-            }
-            
-            return *this;
-         }
-         inorder_iterator_base& operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+         this->_slabs.push_back(Slab{block_size, nullptr, nullptr, nullptr});
+         return this->_slabs.back();
+      }
 
-         friend bool operator== (const inorder_iterator_base &a, const inorder_iterator_base &b) { return a.node == b.node; }
-         friend bool operator!= (const inorder_iterator_base &a, const inorder_iterator_base &b) { return a.node != b.node; }
+      std::size_t _chunk_size;
+      std::vector<Slab> _slabs;
+      std::vector<char *> _chunks;
+   };
 
-      protected:
-         NodeType node;
-      };
+   /// @brief A standard allocator which allocates single objects out of a NodePool.
+   ///
+   /// Copies of this allocator, including copies rebound to other types, share the same pool. Copying a tree
+   /// object gives the copy a fresh pool of its own (see select_on_container_copy_construction), so by default
+   /// every tree owns its pool exclusively and can release all of its nodes at once when it is destroyed.
+   /// Requests for more than one object or for over-aligned types are passed to the global operator new.
+   ///
+   /// @tparam T The type of the object to allocate.
+   ///
+   template <typename T>
+   class PoolAllocator
+   {
+   public:
+      using value_type = T;
+      using propagate_on_container_copy_assignment = std::false_type;
+      using propagate_on_container_move_assignment = std::true_type;
+      using propagate_on_container_swap = std::true_type;
+      using is_always_equal = std::false_type;
 
-      /// @brief The base iterator for performing a pre-order traversal.
+      PoolAllocator() : _pool(std::make_shared<NodePool>()) {}
+      explicit PoolAllocator(std::shared_ptr<NodePool> pool) : _pool(pool) {}
+      template <typename U>
+      PoolAllocator(const PoolAllocator<U> &other) : _pool(other.pool()) {}
+
+      /// @brief Allocate storage for the given number of objects.
       ///
-      /// This class is the base class for iterating over the nodes in the tree in a
-      /// [pre-order traversal](https://en.wikipedia.org/wiki/Tree_traversal#Pre-order,_NLR).
+      T *allocate(std::size_t count) {
+         if (count != 1 || alignof(T) > alignof(std::max_align_t))
+            return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(alignof(T))));
+
+         return static_cast<T *>(this->_pool->allocate(sizeof(T)));
+      }
+
+      /// @brief Deallocate storage for the given number of objects.
       ///
-      /// @tparam NodeType The node class for the base iterator. Can be either SharedNode or ConstSharedNode.
+      void deallocate(T *pointer, std::size_t count) {
+         if (count != 1 || alignof(T) > alignof(std::max_align_t))
+            ::operator delete(pointer, std::align_val_t(alignof(T)));
+         else
+            this->_pool->deallocate(pointer, sizeof(T));
+      }
+
+      /// @brief Return the allocator used by copies of a tree: one with a fresh pool.
       ///
-      template <typename NodeType>
-      class preorder_iterator_base
-      {
-         static_assert(std::is_same<NodeType, SharedNode>::value || std::is_same<NodeType, ConstSharedNode>::value,
-                       "Iterator template type must be a SharedNode or a ConstSharedNode.");
-         
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = SharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
+      PoolAllocator select_on_container_copy_construction() const { return PoolAllocator(); }
 
-         preorder_iterator_base(NodeType node) : node(node) {}
+      /// @brief Get the pool this allocator allocates from.
+      ///
+      inline const std::shared_ptr<NodePool> &pool() const { return this->_pool; }
 
-         preorder_iterator_base& operator++() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+      template <typename U>
+      friend bool operator== (const PoolAllocator &a, const PoolAllocator<U> &b) { return a.pool() == b.pool(); }
+      template <typename U>
+      friend bool operator!= (const PoolAllocator &a, const PoolAllocator<U> &b) { return a.pool() != b.pool(); }
 
-            if (this->node->_left != nullptr)
-               this->node = this->node->_left;
-            else if (this->node->_right != nullptr)
-               this->node = this->node->_right;
-            else {
-               auto parent = this->node->_parent;
+   private:
+      std::shared_ptr<NodePool> _pool;
+   };
 
-               while (parent != nullptr && (this->node == parent->_right || parent->_right == nullptr))
-               {
-                  this->node = parent;
-                  parent = parent->_parent;
-               }
+   /// @brief Hint the processor to start loading the cache line holding the given address.
+   ///
+   /// This never faults, so the address does not need to be valid.
+   ///
+   inline void prefetch(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+      __builtin_prefetch(address);
+#elif defined(_MSC_VER)
+      _mm_prefetch(static_cast<const char *>(address), _MM_HINT_T0);
+#else
+      (void)address;
+#endif
+   }
 
-               if (parent != nullptr)
-                  this->node = parent->_right;
-               else
-                  this->node = parent;
-            }
-                   
-            return *this;
-         }
-         preorder_iterator_base& operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+   /// @brief Determine whether the given allocator is a PoolAllocator.
+   ///
+   template <typename Allocator>
+   struct is_pool_allocator : std::false_type {};
+   template <typename T>
+   struct is_pool_allocator<PoolAllocator<T>> : std::true_type {};
 
-         friend bool operator== (const preorder_iterator_base &a, const preorder_iterator_base &b) { return a.node == b.node; }
-         friend bool operator!= (const preorder_iterator_base &a, const preorder_iterator_base &b) { return a.node != b.node; }
+   /// @brief The default augmentation policy of AVLTreeBase, which keeps no data about subtrees.
+   ///
+   /// An augmentation policy describes an aggregate kept in every node and computed from the node's subtree:
+   /// lift turns the value of a node into an aggregate, and combine merges the aggregates of the left subtree,
+   /// the node itself and the right subtree, in that order. Missing subtrees contribute identity(). The tree
+   /// recomputes the aggregate wherever it recomputes heights-- along the update path and during rotations.
+   ///
+   struct NoAugment {
+      /// @brief The aggregate kept by this policy, which is empty.
+      ///
+      struct type {};
 
-      protected:
-         NodeType node;
-      };
+      static type identity() { return type(); }
+      template <typename Value>
+      static type lift(const Value &) { return type(); }
+      static type combine(const type &, const type &, const type &) { return type(); }
+   };
 
-      /// @brief The base iterator for performing a post-order traversal.
-      ///
-      /// This class is the base class for iterating over the nodes in the tree in a
-      /// [post-order traversal](https://en.wikipedia.org/wiki/Tree_traversal#Post-order,_LRN).
-      ///
-      /// @tparam NodeType The node class for the base iterator. Can be either SharedNode or ConstSharedNode.
+   /// @brief An augmentation policy which counts the nodes in every subtree.
+   ///
+   /// This makes the order-statistic operations of AVLTreeBase, such as rank, select and count_range,
+   /// run in logarithmic time. See NoAugment for how augmentation policies work.
+   ///
+   struct SubtreeSize {
+      using type = std::size_t;
+
+      static type identity() { return 0; }
+      template <typename Value>
+      static type lift(const Value &) { return 1; }
+      static type combine(const type &left, const type &self, const type &right) { return left + self + right; }
+
+      /// @brief Get the number of nodes counted by the given aggregate.
       ///
-      template <typename NodeType>
-      class postorder_iterator_base
-      {
-         static_assert(std::is_same<NodeType, SharedNode>::value || std::is_same<NodeType, ConstSharedNode>::value,
-                       "Iterator template type must be a SharedNode or a ConstSharedNode.");
-         
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = SharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
+      static std::size_t size(const type &aggregate) { return aggregate; }
+   };
 
-         postorder_iterator_base(NodeType node) : node(node) {
-            if (node == nullptr) return;
-            
-            while (this->node->_left != nullptr)
-               this->node = this->node->_left;
+   /// @brief Determine whether the given augmentation policy counts the nodes of subtrees, like SubtreeSize.
+   ///
+   template <typename Augment, typename = void>
+   struct augment_counts_nodes : std::false_type {};
+   template <typename Augment>
+   struct augment_counts_nodes<Augment, std::void_t<decltype(Augment::size(std::declval<const typename Augment::type &>()))>>
+      : std::true_type {};
 
-            while (this->node->_right != nullptr)
-               this->node = this->node->_right;
-         }
+   /// @brief An augmentation policy which sums a quantity over every subtree.
+   ///
+   /// Paired with AVLTreeBase::aggregate_range, this answers range-sum queries in logarithmic time.
+   ///
+   /// @tparam T The type of the sum. A value-initialized T must be zero, and T must support operator+.
+   /// @tparam Projection The functor which extracts the quantity to sum from the value of a node.
+   ///
+   template <typename T, typename Projection>
+   struct SubtreeSum {
+      using type = T;
+
+      static type identity() { return T(); }
+      template <typename Value>
+      static type lift(const Value &value) { return Projection()(value); }
+      static type combine(const type &left, const type &self, const type &right) { return left + self + right; }
+   };
 
-         postorder_iterator_base& operator++() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+   /// @brief An augmentation policy which keeps the greatest interval end found in every subtree.
+   ///
+   /// This is the augmentation behind IntervalTree: a subtree whose greatest end lies before a query
+   /// cannot hold an interval overlapping it, so it can be skipped entirely.
+   ///
+   /// @tparam Bound The type of the ends of the intervals.
+   /// @tparam HighOf The functor which extracts the end of the interval from the value of a node.
+   /// @tparam Compare The comparison functor of the bounds, usually std::less<Bound>.
+   ///
+   template <typename Bound, typename HighOf, typename Compare=std::less<Bound>>
+   struct IntervalMax {
+      using type = std::optional<Bound>;
 
-            auto parent = this->node->_parent;
+      static type identity() { return std::nullopt; }
+      template <typename Value>
+      static type lift(const Value &value) { return HighOf()(value); }
+      static type combine(const type &left, const type &self, const type &right) {
+         type result = self;
 
-            if (parent != nullptr && this->node == parent->_left)
-            {
-               if (parent->_right == nullptr)
-                  this->node = parent;
-               else {
-                  this->node = parent->_right;
-
-                  while (this->node->_left != nullptr)
-                     this->node = this->node->_left;
-                  
-                  while (this->node->_right != nullptr)
-                     this->node = this->node->_right;
-               }
-            }
-            else
-               this->node = parent;
-                   
-            return *this;
-         }
-         postorder_iterator_base& operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+         if (left.has_value() && (!result.has_value() || Compare()(*result, *left))) { result = left; }
+         if (right.has_value() && (!result.has_value() || Compare()(*result, *right))) { result = right; }
 
-         friend bool operator== (const postorder_iterator_base &a, const postorder_iterator_base &b) { return a.node == b.node; }
-         friend bool operator!= (const postorder_iterator_base &a, const postorder_iterator_base &b) { return a.node != b.node; }
+         return result;
+      }
+   };
 
-      protected:
-         NodeType node;
-      };
+   /// @brief An augmentation policy which keeps the aggregates of several policies side by side.
+   ///
+   /// The aggregate is a std::tuple of the aggregates of each policy, in order. Use get to read the aggregate of
+   /// one of them. If SubtreeSize is among them, the order-statistic operations of AVLTreeBase are available.
+   ///
+   /// @tparam Policies The augmentation policies to combine.
+   ///
+   template <typename... Policies>
+   struct Augments {
+      using type = std::tuple<typename Policies::type...>;
+
+      static type identity() { return type(Policies::identity()...); }
+      template <typename Value>
+      static type lift(const Value &value) { return type(Policies::lift(value)...); }
+      static type combine(const type &left, const type &self, const type &right) {
+         return combine_each(left, self, right, std::index_sequence_for<Policies...>());
+      }
 
-      /// @brief The root of the tree.
+      /// @brief Get the aggregate kept by the given policy out of the combined aggregate.
       ///
-      SharedNode _root;
-      /// @brief The number of nodes in the tree.
-      ///
-      std::size_t _size;
+      template <typename Policy>
+      static const typename Policy::type &get(const type &aggregate) {
+         return std::get<index_of<Policy>()>(aggregate);
+      }
 
-      /// @brief Set the right child of the given node.
-      ///
-      /// This sets the *target* as the parent of *child* and the *child* as the right-child of *target*.
-      ///
-      /// @param target The node to set the right child of.
-      /// @param child The child node to set in the target.
-      ///
-      /// @throws exception::NullPointer Thrown when the target argument is null.
+      /// @brief Get the number of nodes counted by the SubtreeSize policy of the given aggregate.
       ///
-      void set_right_child(SharedNode target, SharedNode child) {
-         if (target == nullptr) { throw exception::NullPointer(); }
-         
-         target->_right = child;
+      static std::size_t size(const type &aggregate) { return SubtreeSize::size(get<SubtreeSize>(aggregate)); }
 
-         if (child != nullptr)
-            child->_parent = target;
+   private:
+      template <std::size_t... Indexes>
+      static type combine_each(const type &left, const type &self, const type &right, std::index_sequence<Indexes...>) {
+         return type(Policies::combine(std::get<Indexes>(left), std::get<Indexes>(self), std::get<Indexes>(right))...);
       }
 
-      /// @brief Set the left child of the given node.
-      ///
-      /// This sets the *target* as the parent of *child* and the *child* as the left-child of *target*.
-      ///
-      /// @param target The node to set the left child of.
-      /// @param child The child node to set in the target.
-      ///
-      /// @throws exception::NullPointer Thrown when the target argument is null.
-      ///
-      void set_left_child(SharedNode target, SharedNode child) {
-         if (target == nullptr) { throw exception::NullPointer(); }
+      template <typename Policy>
+      static constexpr std::size_t index_of() {
+         constexpr bool matches[] = { std::is_same<Policy, Policies>::value... };
 
-         target->_left = child;
+         for (std::size_t i=0; i<sizeof...(Policies); ++i)
+            if (matches[i]) { return i; }
 
-         if (child != nullptr)
-            child->_parent = target;
+         return sizeof...(Policies);
       }
+   };
 
-      /// @brief Set the parent of the given node.
-      ///
-      /// This sets the *parent* of the *target* node and sets the *target* as the left or right child
-      /// of the *parent*, depending on how it compares with the node.
+   /// @brief The counters kept by a stats policy of AVLTreeBase. See CountingStats.
+   ///
+   struct StatsCounters {
+      /// @brief The key comparisons made by searches through locate, which every lookup, insertion and removal
+      /// starts with.
       ///
-      /// @param target The target node whose parent you wish to alter.
-      /// @param parent The parent node to change to.
+      std::size_t comparisons = 0;
+      /// @brief The rebalances done with a single rotation.
       ///
-      /// @throws exception::NullPointer Thrown when the target argument is null.
-      /// @throws exception::NodeKeysMatch Thrown when the target key is equal to the parent key.
+      std::size_t single_rotations = 0;
+      /// @brief The rebalances done with a double rotation.
       ///
-      void set_parent(SharedNode target, SharedNode parent) {
-         if (target == nullptr) { throw exception::NullPointer(); }
-
-         if (parent == nullptr) { 
-            target->_parent = parent;
-            return;
-         }
-
-         auto branch = parent->compare(target);
-
-         if (branch == 0) { throw exception::NodeKeysMatch(); }
-         else if (branch < 0) { parent->_left = target; }
-         else { parent->_right = target; }
-      }
-
-      /// @brief Do a left rotation on the given node.
+      std::size_t double_rotations = 0;
+      /// @brief The nodes allocated, including copies.
       ///
-      /// See [the rebalancing section](https://en.wikipedia.org/wiki/AVL_tree#Rebalancing) for an AVL tree.
+      std::size_t allocations = 0;
+      /// @brief The nodes freed by the tree. Reference-counted nodes freed by their last owner are not counted.
       ///
-      /// @param rotation_root The node to rotate.
+      std::size_t deallocations = 0;
+      /// @brief The walks back up the tree after an insertion or removal, by update_node or retrace.
       ///
-      /// @throws exception::NullPointer Thrown when the rotation root is null.
+      std::size_t updates = 0;
+      /// @brief The nodes visited by those walks, so updates divides this into the average path length.
       ///
-      virtual void rotate_left(SharedNode rotation_root) {
-         if (rotation_root == nullptr) { throw exception::NullPointer(); }
-         
-         auto pivot_root = rotation_root->_right;
-         auto left_child = pivot_root->_left;
-         auto rotation_parent = rotation_root->_parent;
+      std::size_t update_path_nodes = 0;
+   };
 
-         if (rotation_parent == nullptr)
-            this->_root = pivot_root;
-         else if (rotation_parent->_left == rotation_root)
-            rotation_parent->_left = pivot_root;
-         else if (rotation_parent->_right == rotation_root)
-            rotation_parent->_right = pivot_root;
+   /// @brief The default stats policy of AVLTreeBase, which counts nothing.
+   ///
+   /// A stats policy is told about the work the tree does on its hot paths. Every call to this one is empty and
+   /// inlined away, so a tree which doesn't ask for stats pays nothing for them. See CountingStats.
+   ///
+   struct NoStats {
+      static constexpr bool enabled = false;
 
-         pivot_root->_parent = rotation_parent;
+      void count_comparisons(std::size_t) {}
+      void count_rotation(bool) {}
+      void count_allocation() {}
+      void count_deallocations(std::size_t) {}
+      void count_update(std::size_t) {}
 
-         if (left_child != nullptr)
-            left_child->_parent = rotation_root;
+      StatsCounters counters() const { return StatsCounters(); }
+      void reset() {}
+   };
 
-         rotation_root->_right = left_child;
-         pivot_root->_left = rotation_root;
-         rotation_root->_parent = pivot_root;
+   /// @brief A stats policy which counts comparisons, rotations, allocations and update paths.
+   ///
+   /// The counters are plain integers: counting costs an increment per event, and counting lookups made from
+   /// several threads at once, even through a const tree, is a data race. See NoStats.
+   ///
+   struct CountingStats {
+      static constexpr bool enabled = true;
 
-         rotation_root->_height = rotation_root->new_height();
-         pivot_root->_height = pivot_root->new_height();
+      void count_comparisons(std::size_t count) { this->_counters.comparisons += count; }
+      void count_rotation(bool double_rotation) {
+         if (double_rotation) { ++this->_counters.double_rotations; }
+         else { ++this->_counters.single_rotations; }
+      }
+      void count_allocation() { ++this->_counters.allocations; }
+      void count_deallocations(std::size_t count) { this->_counters.deallocations += count; }
+      void count_update(std::size_t path_nodes) {
+         ++this->_counters.updates;
+         this->_counters.update_path_nodes += path_nodes;
       }
 
-      /// @brief Do a right rotation on the given node.
-      ///
-      /// See [the rebalancing section](https://en.wikipedia.org/wiki/AVL_tree#Rebalancing) for an AVL tree.
-      ///
-      /// @param rotation_root The node to rotate.
-      ///
-      /// @throws exception::NullPointer Thrown when the rotation root is null.
-      ///
-      virtual void rotate_right(SharedNode rotation_root) {
-         if (rotation_root == nullptr) { throw exception::NullPointer(); }
-         
-         auto pivot_root = rotation_root->_left;
-         auto right_child = pivot_root->_right;
-         auto rotation_parent = rotation_root->_parent;
-
-         if (rotation_parent == nullptr)
-            this->_root = pivot_root;
-         else if (rotation_parent->_left == rotation_root)
-            rotation_parent->_left = pivot_root;
-         else if (rotation_parent->_right == rotation_root)
-            rotation_parent->_right = pivot_root;
-
-         pivot_root->_parent = rotation_parent;
-
-         if (right_child != nullptr)
-            right_child->_parent = rotation_root;
-
-         rotation_root->_left = right_child;
-         pivot_root->_right = rotation_root;
-         rotation_root->_parent = pivot_root;
+      const StatsCounters &counters() const { return this->_counters; }
+      void reset() { this->_counters = StatsCounters(); }
 
-         rotation_root->_height = rotation_root->new_height();
-         pivot_root->_height = pivot_root->new_height();
-      }
+   private:
+      StatsCounters _counters;
+   };
 
-      /// @brief Rebalance the given node if its balance is greater than 1 or less than -1.
+   /// @brief A snapshot of the shape, footprint and counters of a tree. See AVLTreeBase::stats.
+   ///
+   struct TreeStats {
+      /// @brief The counters of the tree's stats policy, which are all zero under NoStats.
       ///
-      /// When a node needs to be rebalanced, certain rotation operations need to happen.
-      /// See [the rebalancing section](https://en.wikipedia.org/wiki/AVL_tree#Rebalancing) on AVL trees.
+      StatsCounters counters;
+      /// @brief The number of nodes in the tree.
       ///
-      /// @param node The node to rebalance.
+      std::size_t size = 0;
+      /// @brief The number of levels of the tree, 0 when it is empty.
       ///
-      /// @throws exception::NullPointer Thrown when the node argument is null.
+      std::size_t height = 0;
+      /// @brief The greatest height an AVL tree of this size can have.
       ///
-      virtual void rebalance_node(SharedNode node) {
-         if (node == nullptr) { throw exception::NullPointer(); }
-         
-         auto balance = node->balance();
-         if (balance == 0) { return; }
-
-         if (balance < 0)
-         {
-            auto child = node->_left;
-            auto balance = (child != nullptr) ? child->balance() : 0;
-
-            if (balance > 0)
-            {
-               this->rotate_left(child);
-               this->rotate_right(node);
-            }
-            else {
-               this->rotate_right(node);
-            }
-         }
-         else
-         {
-            auto child = node->_right;
-            auto balance = (child != nullptr) ? child->balance() : 0;
-
-            if (balance < 0) {
-               this->rotate_right(child);
-               this->rotate_left(node);
-            }
-            else {
-               this->rotate_left(node);
-            }
-         }
-      }
-
-      /// @brief Update the given node after an insertion or deletion operation.
+      std::size_t height_bound = 0;
+      /// @brief The number of nodes at every depth, the root being at depth 0.
       ///
-      /// This function simply updates the height and verifies the tree is balanced, but is virtual
-      /// for tree objects which need to update more information or perform other actions.
+      std::vector<std::size_t> depth_histogram;
+      /// @brief The bytes of a node, not counting allocator overhead or memory the value owns.
       ///
-      /// @param node The node to update.
+      std::size_t node_bytes = 0;
+      /// @brief The bytes of every node of the tree, by the same measure.
       ///
-      /// @throws exception::NullPointer Thrown when the node argument is null.
+      std::size_t memory_bytes = 0;
+
+      /// @brief Get the average depth of the nodes, 0 when the tree is empty.
       ///
-      virtual void update_node(SharedNode node) {
-         if (node == nullptr) { throw exception::NullPointer(); }
-         
-         SharedNode update = node;
+      double average_depth() const {
+         std::size_t total = 0;
 
-         while (update != nullptr)
-         {
-            auto old_height = update->_height;
-            auto new_height = update->new_height();
-            auto balance = update->balance();
-            
-            update->_height = new_height;
+         for (std::size_t depth=0; depth<this->depth_histogram.size(); ++depth)
+            total += depth * this->depth_histogram[depth];
 
-            if (balance > 1 || balance < -1)
-            {
-               this->rebalance_node(update);
-               return;
-            }
+         return (this->size == 0) ? 0.0 : static_cast<double>(total) / this->size;
+      }
+   };
+
+   /// @brief A comparator which orders keys with a single three-way comparison.
+   ///
+   /// It returns a negative number if the first key is less than the second, 0 if they are equivalent and a
+   /// positive number otherwise. Keys with a compare method, such as strings, are compared with it; other keys
+   /// with operator<=> when the language has it, and with operator< both ways when it doesn't. It is
+   /// transparent, so a tree ordered by it can be searched with any type its keys compare against.
+   ///
+   struct ThreeWayCompare {
+      using is_transparent = void;
 
-            if (old_height == new_height) { return; }
+      template <typename A, typename B>
+      int operator() (const A &a, const B &b) const {
+         if constexpr (has_compare_method<A, B>::value) { return a.compare(b); }
+#if defined(__cpp_lib_three_way_comparison) && __cpp_lib_three_way_comparison >= 201907L
+         else if constexpr (std::three_way_comparable_with<A, B>) {
+            auto order = a <=> b;
 
-            if (update->_parent != nullptr)
-               update = update->_parent;
+            return (order < 0) ? -1 : (order > 0) ? 1 : 0;
          }
+#endif
+         else { return (a < b) ? -1 : (b < a) ? 1 : 0; }
       }
 
-      /// @brief Allocate a new node object with the given value.
-      ///
-      /// @param value The value the node should have.
+   protected:
+      template <typename A, typename B, typename = void>
+      struct has_compare_method : std::false_type {};
+      template <typename A, typename B>
+      struct has_compare_method<A, B, std::enable_if_t<std::is_convertible<
+         decltype(std::declval<const A &>().compare(std::declval<const B &>())), int>::value>> : std::true_type {};
+   };
+
+   /// @brief How AVLTreeBase orders keys with its comparator, which is either a less-than predicate or a
+   /// three-way comparator.
+   ///
+   /// A comparator whose result is not a bool, but compares against 0, is taken to be three-way: ordering two
+   /// keys takes one call to it. A predicate takes two calls to tell the keys apart, except when it is
+   /// std::less of strings: their compare method gives the same order in a single pass over the characters.
+   ///
+   /// @tparam KeyCompare The comparator of the tree.
+   ///
+   template <typename KeyCompare>
+   struct KeyOrder {
+      /// @brief Whether the comparator is transparent, letting the tree be searched with types other than its key.
       ///
-      virtual SharedNode allocate_node(const Value &value) {
-         auto node = std::make_shared<Node>(value);
+      template <typename Compare, typename = void>
+      struct transparent : std::false_type {};
+      template <typename Compare>
+      struct transparent<Compare, std::void_t<typename Compare::is_transparent>> : std::true_type {};
 
-         return node;
-      }
+      static constexpr bool is_transparent = transparent<KeyCompare>::value;
 
-      /// @brief Create a copy of the given node.
-      ///
-      /// @param The node to copy.
+      /// @brief Whether the comparator is three-way when comparing the given types.
       ///
-      virtual SharedNode copy_node(ConstSharedNode node) {
-         auto new_node = std::make_shared<Node>(*node);
+      template <typename A, typename B>
+      static constexpr bool is_three_way() {
+         using Result = std::decay_t<std::invoke_result_t<const KeyCompare &, const A &, const B &>>;
 
-         return new_node;
+         if constexpr (std::is_same<Result, bool>::value) { return false; }
+         else { return std::is_convertible<decltype(std::declval<Result>() < 0), bool>::value; }
       }
 
-      /// @brief Add a new node to the tree.
-      ///
-      /// @param value The value the new node should have.
+      /// @brief Determine whether the first key is ordered before the second.
       ///
-      /// @throws exception::KeyExists Thrown when the key of the given value already exists within the tree.
-      ///
-      virtual SharedNode add_node(const Value &value) {
-         if (this->_root == nullptr)
-         {
-            this->_root = this->allocate_node(value);
-            ++this->_size;
-            return this->_root;
-         }
-
-         auto key = KeyOfValue()(value);
-         auto traversal = this->search(key);
-         auto last_result = *traversal.rbegin();
-         auto parent = last_result.first;
-         auto branch = last_result.second;
-         
-         if (branch == 0) { throw exception::KeyExists(); }
-
-         auto new_node = this->allocate_node(value);
-
-         if (branch < 0) { this->set_left_child(parent, new_node); }
-         else { this->set_right_child(parent, new_node); }
-
-         this->update_node(new_node);
-
-         ++this->_size;
-
-         return new_node;
+      template <typename A, typename B>
+      static bool less(const KeyCompare &compare, const A &a, const B &b) {
+         if constexpr (is_three_way<A, B>()) { return compare(a, b) < 0; }
+         else { return compare(a, b); }
       }
 
-      /// @brief Remove a given node from the tree with the given value.
-      ///
-      /// Note that only the key of the value is used to verify the node to delete, not the whole value itself.
+      /// @brief Do a three-way comparison of the given keys.
       ///
-      /// @param value The value object to remove from the tree.
-      ///
-      /// @throw exception::EmptyTree Thrown when the tree is empty.
-      /// @throw exception::NodeNotFound Thrown when the key of the value is not found within the tree.
+      /// @returns A negative number if the first key is ordered before the second, 0 if they are equivalent
+      /// and a positive number otherwise.
       ///
-      virtual SharedNode remove_node(const Value &value) {
-         if (this->is_empty()) { throw exception::EmptyTree(); }
+      template <typename A, typename B>
+      static int compare(const KeyCompare &compare, const A &a, const B &b) {
+         if constexpr (is_three_way<A, B>())
+         {
+            auto order = compare(a, b);
 
-         auto key = KeyOfValue()(value);
-         auto traversal = this->search(key);
-         auto last_node = *traversal.rbegin();
-         SharedNode update_node = nullptr;
+            return (order < 0) ? -1 : (order > 0) ? 1 : 0;
+         }
+         else if constexpr (is_string_less<A, B>::value)
+         {
+            auto order = a.compare(b);
 
-         if (last_node.second != 0) { throw exception::NodeNotFound(); }
+            return (order < 0) ? -1 : (order > 0) ? 1 : 0;
+         }
+         else
+         {
+            if (compare(a, b)) { return -1; }
+            return compare(b, a) ? 1 : 0;
+         }
+      }
 
-         auto node = last_node.first;
+   protected:
+      template <typename T>
+      struct is_string : std::false_type {};
+      template <typename Char, typename Traits, typename Alloc>
+      struct is_string<std::basic_string<Char, Traits, Alloc>> : std::true_type {};
+
+      template <typename A, typename B>
+      struct is_string_less : std::integral_constant<bool, is_string<A>::value && std::is_same<A, B>::value &&
+                                                           (std::is_same<KeyCompare, std::less<A>>::value ||
+                                                            std::is_same<KeyCompare, std::less<>>::value)> {};
+   };
 
-         if (node->is_leaf())
+   /// @brief The base implementation of an AVL tree.
+   ///
+   /// **NOTE**: For a basic AVL tree implementation, this interface is too complex. See the AVLTree class
+   /// for a more basic interface to an AVL tree. Additionally, because of how verbose the template arguments
+   /// are, it is recommended you employ a typedef to save yourself the typing.
+   ///
+   /// This is the base AVL tree implementation. Its template interface is designed in this way to handle
+   /// mapping objects, and takes inspiration from libstdc++'s red-black tree interface for its implementation
+   /// of a map. For implementing some tree-based objects that have a map-like design, this is the interface
+   /// to use. Otherwise, the simplified versions of this interface, separated into AVLTree and AVLMap, should
+   /// suffice.
+   ///
+   /// @tparam Key The type class of the object that acts as the node's key, also known as its label. This value
+   /// is the value responsible for indexing the nodes in the tree. This is expected to be a constant value-- undefined
+   /// behavior is likely to happen if you modify a tree node's key.
+   ///
+   /// @tparam Value The value type class of the object, which is expected to host the key value in some way, whose
+   /// extraction of said key is determined by the functor KeyOfValue. This type can be the same as the key type with
+   /// use of the KeyIsValue functor.
+   ///
+   /// @tparam KeyOfValue The functor which extracts the node's Key type value from the node's Value object. See
+   /// KeyIsValue and KeyOfPair for examples of how to use this value.
+   ///
+   /// @tparam KeyCompare The key comparison functor, usually std::less<Key>. This functor must conform to C++'s
+   /// [Compare requirements](https://en.cppreference.com/w/cpp/named_req/Compare), or be a three-way comparator
+   /// such as ThreeWayCompare, which orders two keys in one call. The tree keeps the comparator it is constructed
+   /// with, so it may hold state. If it is transparent, lookups take any type it compares keys against. See
+   /// KeyOrder.
+   ///
+   /// @tparam NodeStorage The policy which determines how nodes are linked, owned and handed out. See
+   /// RawNodeStorage, the default, and SharedNodeStorage.
+   ///
+   /// @tparam Allocator The allocator used to allocate nodes, rebound to the node type. See PoolAllocator for
+   /// an allocator which hands out nodes from contiguous chunks.
+   ///
+   /// @tparam Augment The policy which determines the aggregate each node keeps about its subtree. See NoAugment,
+   /// the default, and SubtreeSize.
+   ///
+   /// @tparam Derived The tree class which customizes the tree's hooks, or void if nothing does. The hooks--
+   /// rotate_left, rotate_right, rebalance_node, update_node, allocate_node, copy_node, add_node and remove_node--
+   /// are not virtual. The tree calls them on the Derived class instead, so a class which hides one of them with
+   /// its own version has it called without any indirection. This makes it the
+   /// [curiously recurring template pattern](https://en.wikipedia.org/wiki/Curiously_recurring_template_pattern):
+   /// `class MyTree : public AVLTreeBase<..., MyTree>`. A Derived class which makes its hooks protected must
+   /// befriend AVLTreeBase. Note the constructors of AVLTreeBase which fill the tree already call the hooks of
+   /// Derived, before the members of Derived are constructed.
+   ///
+   /// @tparam Stats The policy which counts the work done on the tree's hot paths. See NoStats, the default, and
+   /// CountingStats.
+   ///
+   template <typename Key, typename Value, typename KeyOfValue, typename KeyCompare, typename NodeStorage=RawNodeStorage,
+             typename Allocator=std::allocator<Value>, typename Augment=NoAugment, typename Derived=void,
+             typename Stats=NoStats>
+   class AVLTreeBase
+   {
+   public:
+      class Node;
+      
+      using KeyType = Key;
+      using ValueType = Value;
+      using KeyOfValueType = KeyOfValue;
+      using KeyCompareType = KeyCompare;
+      using NodePointer = typename NodeStorage::template pointer<Node>;
+      using ConstNodePointer = typename NodeStorage::template const_pointer<Node>;
+      using SharedNode = std::shared_ptr<Node>;
+      using ConstSharedNode = std::shared_ptr<const Node>;
+      using AllocatorType = Allocator;
+      using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+      using AugmentType = Augment;
+      using AggregateType = typename Augment::type;
+      using DerivedType = std::conditional_t<std::is_void<Derived>::value, AVLTreeBase, Derived>;
+      using StatsType = Stats;
+
+      /// @brief Whether nodes link back to their parent. See CompactNodeStorage.
+      ///
+      static constexpr bool has_parent_links = NodeStorage::parent_links;
+
+      /// @brief Whether nodes keep an aggregate of their subtree. See NoAugment.
+      ///
+      static constexpr bool is_augmented = !std::is_same<Augment, NoAugment>::value;
+
+      /// @brief Whether the aggregates of nodes count the nodes of their subtree. See SubtreeSize.
+      ///
+      static constexpr bool counts_nodes = augment_counts_nodes<Augment>::value;
+
+      /// @brief The maximum height a tree can reach.
+      ///
+      /// An AVL tree of height h holds at least F(h+2)-1 nodes, F being the Fibonacci sequence, which bounds
+      /// its height by roughly 1.44 times the number of bits it takes to count its nodes. Under relaxed balance
+      /// the heights of two children may differ by two, which loosens the bound to roughly 1.81 times, so this
+      /// allows two levels for every bit.
+      ///
+      static constexpr std::size_t max_height = std::numeric_limits<std::size_t>::digits * 2;
+
+      /// @brief The path taken by a search through the tree.
+      ///
+      /// This is a fixed-capacity sequence of pairs: the node that was traversed, and the number representing the
+      /// path which was taken. 1 means right, -1 means left, 0 means it matched the key. Its capacity is bounded by
+      /// max_height, so recording a path never allocates.
+      ///
+      /// @tparam NodeType The node class of the path. Can be either NodePointer or ConstNodePointer.
+      ///
+      template <typename NodeType>
+      class SearchPath
+      {
+      public:
+         using value_type = std::pair<NodeType, int>;
+         using size_type = std::size_t;
+         using reference = value_type &;
+         using const_reference = const value_type &;
+         using iterator = value_type *;
+         using const_iterator = const value_type *;
+         using reverse_iterator = std::reverse_iterator<iterator>;
+         using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+         SearchPath() : _length(0) {}
+
+         /// @brief Append a traversed node and the branch taken from it to the path.
+         ///
+         void push_back(NodeType node, int branch) { this->_steps[this->_length++] = std::make_pair(node, branch); }
+         /// @brief Remove the last step of the path.
+         ///
+         void pop_back() { this->_steps[--this->_length] = value_type(); }
+         
+         inline bool empty() const { return this->_length == 0; }
+         inline size_type size() const { return this->_length; }
+
+         inline reference operator[](size_type index) { return this->_steps[index]; }
+         inline const_reference operator[](size_type index) const { return this->_steps[index]; }
+         inline reference front() { return this->_steps[0]; }
+         inline const_reference front() const { return this->_steps[0]; }
+         inline reference back() { return this->_steps[this->_length-1]; }
+         inline const_reference back() const { return this->_steps[this->_length-1]; }
+
+         iterator begin() { return this->_steps.data(); }
+         iterator end() { return this->_steps.data() + this->_length; }
+         const_iterator begin() const { return this->_steps.data(); }
+         const_iterator end() const { return this->_steps.data() + this->_length; }
+         reverse_iterator rbegin() { return reverse_iterator(this->end()); }
+         reverse_iterator rend() { return reverse_iterator(this->begin()); }
+         const_reverse_iterator rbegin() const { return const_reverse_iterator(this->end()); }
+         const_reverse_iterator rend() const { return const_reverse_iterator(this->begin()); }
+
+      private:
+         std::array<value_type, max_height> _steps;
+         std::size_t _length;
+      };
+
+      /// @brief A fixed-capacity stack of the ancestors of a node, most recent last.
+      ///
+      /// This stands in for parent links when the node storage policy has none. See CompactNodeStorage.
+      ///
+      /// @tparam NodeType The type of the entries, either nodes or links to nodes.
+      ///
+      template <typename NodeType>
+      class AncestorStack
+      {
+      public:
+         AncestorStack() : _length(0) {}
+         /// @brief Copy a stack of another entry type, such as the stack of a mutable iterator into a const one.
+         ///
+         template <typename OtherType>
+         AncestorStack(const AncestorStack<OtherType> &other) : _length(0) {
+            for (std::size_t index=0; index<other.size(); ++index)
+               this->push(other[index]);
+         }
+
+         inline void push(const NodeType &node) { this->_nodes[this->_length++] = node; }
+         inline void push(NodeType &&node) { this->_nodes[this->_length++] = std::move(node); }
+         /// @brief Remove the top of the stack and return it, or null if the stack is empty.
+         ///
+         inline NodeType pop() { return (this->_length > 0) ? std::move(this->_nodes[--this->_length]) : nullptr; }
+         /// @brief Get the top of the stack, or null if the stack is empty.
+         ///
+         inline NodeType top() const { return (this->_length > 0) ? this->_nodes[this->_length-1] : nullptr; }
+         /// @brief Get a reference to the top of the stack, which must not be empty.
+         ///
+         inline const NodeType &back() const { return this->_nodes[this->_length-1]; }
+
+         inline bool empty() const { return this->_length == 0; }
+         inline std::size_t size() const { return this->_length; }
+         inline NodeType &operator[](std::size_t index) { return this->_nodes[index]; }
+         inline const NodeType &operator[](std::size_t index) const { return this->_nodes[index]; }
+
+      private:
+         std::array<NodeType, max_height> _nodes;
+         std::uint8_t _length;
+      };
+
+   protected:
+      /// @brief The parent link of a node, for storage policies with parent links.
+      ///
+      struct ParentLink {
+         NodePointer _parent = nullptr;
+      };
+
+      /// @brief The missing parent link of a node, for storage policies without parent links.
+      ///
+      struct NoParentLink {};
+
+   public:
+
+      /// @brief A node object for an AVL tree.
+      ///
+      /// This object contains data about a given node's key object, value, tree height and node relationships.
+      ///
+      /// The parent of the node, if the storage policy keeps one, lives in its base class.
+      ///
+      class Node : protected std::conditional_t<has_parent_links, ParentLink, NoParentLink>
+      {
+      protected:
+         using LinkBase = std::conditional_t<has_parent_links, ParentLink, NoParentLink>;
+
+         /// @brief The value data of the node.
+         ///
+         /// This contains the node's key.
+         ///
+         Value _value;
+         
+         /// @brief The height of the node in the tree.
+         ///
+         /// A byte is plenty, since the height of a tree never exceeds max_height, relaxed balance included.
+         ///
+         std::uint8_t _height;
+
+         /// @brief The aggregate of the subtree rooted at this node. See NoAugment.
+         ///
+         AggregateType _aggregate;
+
+         /// @brief The left child of this node.
+         ///
+         NodePointer _left;
+
+         /// @brief The right child of this node.
+         ///
+         NodePointer _right;
+         
+      public:
+         friend class AVLTreeBase;
+
+         Node () : _value(Value()), _left(nullptr), _right(nullptr), _height(0), _aggregate() {}
+         Node(const Value &value) : _value(value), _left(nullptr), _right(nullptr), _height(0), _aggregate() {}
+         Node(Value &&value) : _value(std::move(value)), _left(nullptr), _right(nullptr), _height(0), _aggregate() {}
+         /// @brief Construct the value of the node in place from the given arguments.
+         ///
+         template <typename... Args>
+         explicit Node(std::in_place_t, Args&&... args)
+            : _value(std::forward<Args>(args)...), _left(nullptr), _right(nullptr), _height(0), _aggregate() {}
+         Node(const Node &other)
+            : LinkBase(other), _value(other._value), _left(other._left), _right(other._right), _height(other._height),
+              _aggregate(other._aggregate) {}
+         /// @brief Copy everything except the value from the given node.
+         ///
+         /// This is useful for certain cases when deleting nodes from the tree.
+         ///
+         void copy_node_data(const Node &other) {
+            this->_height = other._height;
+            this->_aggregate = other._aggregate;
+            if constexpr (has_parent_links) { this->_parent = other._parent; }
+            this->_left = other._left;
+            this->_right = other._right;
+         }
+
+         /// @brief Get the key value of this node.
+         ///
+         /// This calls the KeyOfValue functor against the value object within the node and returns it.
+         ///
+         inline const Key &key() const { return KeyOfValue()(this->value()); }
+         /// @brief Get the value object of this node.
+         ///
+         inline Value &value() { return this->_value; }
+         /// @brief Get the const value object of this node.
+         ///
+         inline const Value &value() const { return this->_value; }
+         /// @brief Get the height of this node.
+         ///
+         inline int height() const { return this->_height; }
+         /// @brief Get the aggregate of the subtree rooted at this node. See NoAugment.
+         ///
+         inline const AggregateType &aggregate() const { return this->_aggregate; }
+         /// @brief Get the parent node of this node.
+         ///
+         /// This is only available when the storage policy keeps parent links.
+         ///
+         inline NodePointer parent() { return this->_parent; }
+         /// @brief Get the const parent node of this node.
+         ///
+         /// This is only available when the storage policy keeps parent links.
+         ///
+         inline ConstNodePointer parent() const { return this->_parent; }
+         /// @brief Get the left child of this node.
+         ///
+         inline NodePointer left() { return this->_left; }
+         /// @brief Get the const left child of this node.
+         ///
+         inline ConstNodePointer left() const { return this->_left; }
+         /// @brief Get the right child of this node.
+         ///
+         inline NodePointer right() { return this->_right; }
+         /// @brief Get the const right child of this node.
+         ///
+         inline ConstNodePointer right() const { return this->_right; }
+
+         /// @brief Determine if this node is a leaf node.
+         ///
+         inline bool is_leaf() const { return this->_left == nullptr && this->_right == nullptr; }
+
+         /// @brief Do a binary comparison of the given key against the node's key.
+         ///
+         /// The node doesn't know its tree, so this orders keys with a default-constructed KeyCompare. The tree
+         /// itself orders keys with the comparator it holds, see AVLTreeBase::key_comp.
+         ///
+         /// @returns 0 if the key is equal to the key in the node, -1 if the key is less than the node's key,
+         /// and 1 if the key is greater than the node's key.
+         ///
+         int compare(const Key &key) const { return KeyOrder<KeyCompare>::compare(KeyCompare(), key, this->key()); }
+
+         /// @brief Compare this node's key against the current node's key.
+         ///
+         /// See compare(const Key &key).
+         ///
+         int compare(ConstNodePointer node) const {
+            if (node == nullptr) { throw exception::NullPointer(); }
+
+            return this->compare(node->key());
+         }
+
+         /// @brief Determine the balance of this given node.
+         ///
+         /// In other words, subtract the height of the right child against the height of the left child
+         /// and return the value.
+         ///
+         int balance() const {
+            auto left_height = (this->_left != nullptr) ? this->_left->height() : 0;
+            auto right_height = (this->_right != nullptr) ? this->_right->height() : 0;
+            
+            return right_height - left_height;
+         }
+
+         /// @brief Determine the new height value of this node.
+         ///
+         int new_height() const {
+            auto left_height = (this->_left != nullptr) ? this->_left->height() : 0;
+            auto right_height = (this->_right != nullptr) ? this->_right->height() : 0;
+
+            return std::max(left_height,right_height)+1;
+         }
+
+         /// @brief Determine the new aggregate value of this node from its value and its children.
+         ///
+         AggregateType new_aggregate() const {
+            return Augment::combine(AVLTreeBase::aggregate_of(this->_left), Augment::lift(this->_value),
+                                    AVLTreeBase::aggregate_of(this->_right));
+         }
+      };
+
+   protected:
+      /// @brief An empty stand-in for the ancestor stack of an iterator, when nodes link to their parents.
+      ///
+      struct NoAncestors {};
+
+      /// @brief Get the address of the node the given pointer points at, without touching its reference count.
+      ///
+      template <typename Pointer>
+      static const Node *address_of(const Pointer &pointer) {
+         if constexpr (std::is_pointer<Pointer>::value) { return pointer; }
+         else { return pointer.get(); }
+      }
+
+      /// @brief The node an iterator is on, and the means to move it around the tree.
+      ///
+      /// When nodes link to their parents, moving up follows the parent link. Otherwise, the cursor keeps a stack
+      /// of the ancestors of its node as it moves down, and pops it to move up. Nodes are moved onto and off the
+      /// stack and compared by address, so with reference-counted nodes a step only copies the pointer to the node
+      /// it lands on.
+      ///
+      /// @tparam NodeType The node class of the cursor. Can be either NodePointer or ConstNodePointer.
+      ///
+      template <typename NodeType>
+      class node_cursor : protected std::conditional_t<has_parent_links, NoAncestors, AncestorStack<NodeType>>
+      {
+         static_assert(std::is_same<NodeType, NodePointer>::value || std::is_same<NodeType, ConstNodePointer>::value,
+                       "Iterator template type must be a NodePointer or a ConstNodePointer.");
+
+      protected:
+         using Ancestors = std::conditional_t<has_parent_links, NoAncestors, AncestorStack<NodeType>>;
+
+         template <typename> friend class node_cursor;
+
+         node_cursor(NodeType node) : node(node) {}
+         /// @brief Copy a cursor over mutable nodes into a cursor over const nodes, ancestors included.
+         ///
+         template <typename OtherType>
+         node_cursor(const node_cursor<OtherType> &other)
+            : Ancestors(static_cast<const typename node_cursor<OtherType>::Ancestors &>(other)), node(other.node) {}
+
+         /// @brief Get the address of the parent of the current node, or null if it is the root.
+         ///
+         inline const Node *parent_address() const {
+            if constexpr (has_parent_links) { return address_of(this->node->_parent); }
+            else { return this->empty() ? nullptr : address_of(this->back()); }
+         }
+         /// @brief Move to the left child of the current node.
+         ///
+         inline void descend_left() {
+            if constexpr (has_parent_links) { this->node = this->node->_left; }
+            else
+            {
+               this->push(std::move(this->node));
+               this->node = this->back()->_left;
+            }
+         }
+         /// @brief Move to the right child of the current node.
+         ///
+         inline void descend_right() {
+            if constexpr (has_parent_links) { this->node = this->node->_right; }
+            else
+            {
+               this->push(std::move(this->node));
+               this->node = this->back()->_right;
+            }
+         }
+         /// @brief Move to the parent of the current node, which is null past the root.
+         ///
+         inline void ascend() {
+            if constexpr (has_parent_links) { this->node = this->node->_parent; }
+            else { this->node = this->pop(); }
+         }
+         /// @brief Climb for as long as the given predicate holds, then move to one more parent.
+         ///
+         /// The predicate is called with the addresses of each parent and its child on the way up. With parent
+         /// links, the climb follows addresses and the cursor lands with a single assignment.
+         ///
+         template <typename Predicate>
+         inline void ascend_while(Predicate &&climb) {
+            if constexpr (has_parent_links)
+            {
+               const Node *child = address_of(this->node);
+               const Node *parent = address_of(child->_parent);
+
+               while (parent != nullptr && climb(parent, child))
+               {
+                  child = parent;
+                  parent = address_of(parent->_parent);
+               }
+
+               this->node = child->_parent;
+            }
+            else
+            {
+               while (!this->empty() && climb(address_of(this->back()), address_of(this->node)))
+                  this->node = this->pop();
+
+               this->node = this->pop();
+            }
+         }
+         /// @brief Hint the processor to load the given child of the current node, which is visited soon.
+         ///
+         inline void prefetch_child(bool right) const {
+            if (this->node != nullptr) { prefetch(address_of(right ? this->node->_right : this->node->_left)); }
+         }
+
+         NodeType node;
+      };
+
+      /// @brief The base iterator for performing an in-order traversal.
+      ///
+      /// This class is the base class for iterating over the nodes in the tree in an
+      /// [in-order traversal](https://en.wikipedia.org/wiki/Tree_traversal#In-order,_LNR).
+      ///
+      /// @tparam NodeType The node class for the base iterator. Can be either NodePointer or ConstNodePointer.
+      ///
+      template <typename NodeType>
+      class inorder_iterator_base : public node_cursor<NodeType>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = NodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         inorder_iterator_base(NodeType node) : node_cursor<NodeType>(node) {
+            if (this->node == nullptr) return;
+            
+            while (this->node->_left != nullptr)
+               this->descend_left();
+
+            this->prefetch_child(true);
+         }
+         /// @brief Copy an iterator over mutable nodes into one over const nodes.
+         ///
+         template <typename OtherType, typename = std::enable_if_t<!std::is_same<OtherType, NodeType>::value &&
+                                                                      std::is_same<NodeType, ConstNodePointer>::value>>
+         inorder_iterator_base(const inorder_iterator_base<OtherType> &other) : node_cursor<NodeType>(other) {}
+
+         /// @brief Move the iterator to the next node in order.
+         ///
+         /// Every edge is crossed twice over a whole traversal, so a step takes amortized constant time. The
+         /// right subtree of the node landed on is visited next, and is prefetched.
+         ///
+         inorder_iterator_base& operator++() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            if (this->node->_right != nullptr)
+            {
+               this->descend_right();
+
+               while (this->node->_left != nullptr)
+                  this->descend_left();
+            }
+            else
+            {
+               this->ascend_while([](const Node *parent, const Node *child) { return address_of(parent->_right) == child; });
+            }
+
+            this->prefetch_child(true);
+            
+            return *this;
+         }
+         /// @brief Move the iterator to the previous node in order.
+         ///
+         /// Moving back from the first node yields the end iterator, which can't be moved back in turn, so reverse
+         /// scans start from the last node instead. See last_inorder.
+         ///
+         inorder_iterator_base& operator--() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            if (this->node->_left != nullptr)
+            {
+               this->descend_left();
+
+               while (this->node->_right != nullptr)
+                  this->descend_right();
+            }
+            else
+            {
+               this->ascend_while([](const Node *parent, const Node *child) { return address_of(parent->_left) == child; });
+            }
+
+            this->prefetch_child(false);
+
+            return *this;
+         }
+         /// @brief Move the iterator the given number of nodes forward, or backward if negative.
+         ///
+         /// This climbs only as far as the smallest subtree containing both nodes, then descends to the target,
+         /// so it takes logarithmic time no matter the distance. It requires an augmentation policy which counts
+         /// nodes, such as SubtreeSize. Moving past either end of the tree yields the end iterator.
+         ///
+         inorder_iterator_base& operator+=(difference_type offset) {
+            if (this->node == nullptr || offset == 0) { return *this; }
+
+            auto index = static_cast<std::ptrdiff_t>(subtree_size(this->node->_left));
+
+            while (true)
+            {
+               auto target = index + offset;
+
+               if (target >= 0 && target < static_cast<std::ptrdiff_t>(subtree_size(this->node)))
+               {
+                  auto remaining = static_cast<std::size_t>(target);
+
+                  while (true)
+                  {
+                     auto left_size = subtree_size(this->node->_left);
+
+                     if (remaining < left_size) { this->descend_left(); }
+                     else if (remaining == left_size) { return *this; }
+                     else
+                     {
+                        remaining -= left_size + 1;
+                        this->descend_right();
+                     }
+                  }
+               }
+
+               const Node *parent = this->parent_address();
+
+               if (parent == nullptr)
+               {
+                  this->ascend();
+                  return *this;
+               }
+
+               if (address_of(parent->_right) == address_of(this->node)) { index += subtree_size(parent->_left) + 1; }
+
+               this->ascend();
+            }
+         }
+
+         friend bool operator== (const inorder_iterator_base &a, const inorder_iterator_base &b) { return a.node == b.node; }
+         friend bool operator!= (const inorder_iterator_base &a, const inorder_iterator_base &b) { return a.node != b.node; }
+
+      protected:
+         friend class AVLTreeBase;
+
+         /// @brief Move an end iterator to the first node of the given subtree whose key is not less than the given
+         /// key, or with upper, the first node whose key is greater than it.
+         ///
+         /// The search descends once from the root, so without parent links the ancestors of the node found are
+         /// already on the stack and iterating onwards from it costs nothing more.
+         ///
+         template <typename K>
+         void seek(NodeType root, const K &key, bool upper, const KeyCompare &compare) {
+            using Order = KeyOrder<KeyCompare>;
+            NodeType bound = nullptr;
+
+            this->node = root;
+
+            while (this->node != nullptr)
+            {
+               auto go_left = upper ? Order::less(compare, key, this->node->key()) : !Order::less(compare, this->node->key(), key);
+
+               if (go_left)
+               {
+                  bound = this->node;
+                  this->descend_left();
+               }
+               else { this->descend_right(); }
+            }
+
+            if constexpr (has_parent_links) { this->node = bound; }
+            else
+            {
+               // pop the nodes below the bound off the stack, leaving its ancestors, or everything past the end
+               do { this->node = this->pop(); } while (this->node != bound && this->node != nullptr);
+            }
+         }
+         /// @brief Move an end iterator to the last node of the given subtree.
+         ///
+         void seek_last(NodeType root) {
+            this->node = root;
+
+            if (this->node == nullptr) { return; }
+
+            while (this->node->_right != nullptr)
+               this->descend_right();
+         }
+      };
+
+      /// @brief The base iterator for performing a pre-order traversal.
+      ///
+      /// This class is the base class for iterating over the nodes in the tree in a
+      /// [pre-order traversal](https://en.wikipedia.org/wiki/Tree_traversal#Pre-order,_NLR).
+      ///
+      /// @tparam NodeType The node class for the base iterator. Can be either NodePointer or ConstNodePointer.
+      ///
+      template <typename NodeType>
+      class preorder_iterator_base : public node_cursor<NodeType>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = NodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         preorder_iterator_base(NodeType node) : node_cursor<NodeType>(node) {}
+
+         preorder_iterator_base& operator++() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            if (this->node->_left != nullptr)
+               this->descend_left();
+            else if (this->node->_right != nullptr)
+               this->descend_right();
+            else {
+               // climb to the nearest ancestor whose right subtree is left to visit
+               this->ascend_while([](const Node *parent, const Node *child) {
+                  return address_of(parent->_right) == child || parent->_right == nullptr;
+               });
+
+               if (this->node != nullptr)
+                  this->descend_right();
+            }
+
+            // the right subtree is visited once the left one is done
+            this->prefetch_child(true);
+                   
+            return *this;
+         }
+
+         friend bool operator== (const preorder_iterator_base &a, const preorder_iterator_base &b) { return a.node == b.node; }
+         friend bool operator!= (const preorder_iterator_base &a, const preorder_iterator_base &b) { return a.node != b.node; }
+      };
+
+      /// @brief The base iterator for performing a post-order traversal.
+      ///
+      /// This class is the base class for iterating over the nodes in the tree in a
+      /// [post-order traversal](https://en.wikipedia.org/wiki/Tree_traversal#Post-order,_LRN).
+      ///
+      /// @tparam NodeType The node class for the base iterator. Can be either NodePointer or ConstNodePointer.
+      ///
+      template <typename NodeType>
+      class postorder_iterator_base : public node_cursor<NodeType>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = NodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         postorder_iterator_base(NodeType node) : node_cursor<NodeType>(node) {
+            if (node == nullptr) return;
+
+            this->descend_to_first();
+         }
+
+         postorder_iterator_base& operator++() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            const Node *parent = this->parent_address();
+
+            if (parent != nullptr && address_of(this->node) == address_of(parent->_left) && parent->_right != nullptr)
+            {
+               this->ascend();
+               this->descend_right();
+               this->descend_to_first();
+            }
+            else
+               this->ascend();
+                   
+            return *this;
+         }
+
+         friend bool operator== (const postorder_iterator_base &a, const postorder_iterator_base &b) { return a.node == b.node; }
+         friend bool operator!= (const postorder_iterator_base &a, const postorder_iterator_base &b) { return a.node != b.node; }
+
+      protected:
+         /// @brief Move to the first node of the current subtree to visit, preferring left children over right ones.
+         ///
+         void descend_to_first() {
+            while (!this->node->is_leaf())
+            {
+               if (this->node->_left != nullptr) { this->descend_left(); }
+               else { this->descend_right(); }
+            }
+         }
+      };
+
+      /// @brief The root of the tree.
+      ///
+      NodePointer _root;
+      /// @brief The number of nodes in the tree.
+      ///
+      std::size_t _size;
+      /// @brief The allocator used for the nodes of the tree.
+      ///
+      NodeAllocator _allocator;
+      /// @brief The counters of the stats policy, which lookups through a const tree update too.
+      ///
+      /// Declared next to the allocator, so that an empty policy shares its padding and costs no space.
+      ///
+      mutable Stats _stats;
+      /// @brief The greatest node of the tree, cached for appending past it, or null if it isn't known.
+      ///
+      /// This is only kept when nodes link to their parents, since without parents an append descends the tree
+      /// anyway to record the path it rebalances along. See locate_insert.
+      ///
+      NodePointer _rightmost;
+      /// @brief How far apart the heights of the children of a node may drift before it is rotated: 1 keeps
+      /// strict AVL balance, 2 is relaxed balance. See set_relaxed_balance.
+      ///
+      int _balance_limit;
+      /// @brief The number of insertions and removals which left a node out of strict balance since it was last
+      /// restored. See rebalance_pending.
+      ///
+      std::size_t _deferred_rotations;
+      /// @brief The comparator which orders the keys of the tree.
+      ///
+      KeyCompare _compare;
+
+      /// @brief Whether lookups can take the given type as their key, which any type can if the comparator is
+      /// transparent.
+      ///
+      template <typename K>
+      using enable_if_lookup = std::enable_if_t<KeyOrder<KeyCompare>::is_transparent || std::is_same<K, Key>::value>;
+
+      /// @brief Do a three-way comparison of the given keys with the comparator of the tree.
+      ///
+      /// @returns -1 if the first key is ordered before the second, 0 if they are equivalent and 1 otherwise, as
+      /// Node::compare does.
+      ///
+      template <typename A, typename B>
+      inline int compare_keys(const A &a, const B &b) const { return KeyOrder<KeyCompare>::compare(this->_compare, a, b); }
+      /// @brief Determine whether the first key is ordered before the second by the comparator of the tree.
+      ///
+      template <typename A, typename B>
+      inline bool key_less(const A &a, const B &b) const { return KeyOrder<KeyCompare>::less(this->_compare, a, b); }
+
+      /// @brief Descend to the given key, returning the link which holds the last node visited.
+      ///
+      /// The descent follows references to the links themselves, so no node handles are copied on the way down.
+      ///
+      /// @param key The key value to search for.
+      /// @param branch Receives the branch taken from the returned node. See locate.
+      ///
+      template <typename K>
+      const NodePointer &locate_link(const K &key, int &branch) const {
+         auto node = &this->_root;
+         std::size_t comparisons = 0;
+         branch = 0;
+
+         if (*node == nullptr) { return *node; }
+
+         while (true)
+         {
+            branch = this->compare_keys(key, (*node)->key());
+            ++comparisons;
+            if (branch == 0) { break; }
+
+            auto next = (branch < 0) ? &(*node)->_left : &(*node)->_right;
+            if (*next == nullptr) { break; }
+
+            node = next;
+         }
+
+         this->_stats.count_comparisons(comparisons);
+
+         return *node;
+      }
+
+      /// @brief Set the right child of the given node.
+      ///
+      /// This sets the *target* as the parent of *child* and the *child* as the right-child of *target*.
+      ///
+      /// @param target The node to set the right child of.
+      /// @param child The child node to set in the target.
+      ///
+      /// @throws exception::NullPointer Thrown when the target argument is null.
+      ///
+      void set_right_child(NodePointer target, NodePointer child) {
+         if (target == nullptr) { throw exception::NullPointer(); }
+         
+         target->_right = child;
+
+         if constexpr (has_parent_links)
+            if (child != nullptr)
+               child->_parent = target;
+      }
+
+      /// @brief Set the left child of the given node.
+      ///
+      /// This sets the *target* as the parent of *child* and the *child* as the left-child of *target*.
+      ///
+      /// @param target The node to set the left child of.
+      /// @param child The child node to set in the target.
+      ///
+      /// @throws exception::NullPointer Thrown when the target argument is null.
+      ///
+      void set_left_child(NodePointer target, NodePointer child) {
+         if (target == nullptr) { throw exception::NullPointer(); }
+
+         target->_left = child;
+
+         if constexpr (has_parent_links)
+            if (child != nullptr)
+               child->_parent = target;
+      }
+
+      /// @brief Set the parent of the given node.
+      ///
+      /// This sets the *parent* of the *target* node and sets the *target* as the left or right child
+      /// of the *parent*, depending on how it compares with the node.
+      ///
+      /// @param target The target node whose parent you wish to alter.
+      /// @param parent The parent node to change to.
+      ///
+      /// @throws exception::NullPointer Thrown when the target argument is null.
+      /// @throws exception::NodeKeysMatch Thrown when the target key is equal to the parent key.
+      ///
+      void set_parent(NodePointer target, NodePointer parent) {
+         if (target == nullptr) { throw exception::NullPointer(); }
+
+         if (parent == nullptr) { 
+            if constexpr (has_parent_links) { target->_parent = parent; }
+            return;
+         }
+
+         auto branch = this->compare_keys(target->key(), parent->key());
+
+         if (branch == 0) { throw exception::NodeKeysMatch(); }
+         else if (branch < 0) { parent->_left = target; }
+         else { parent->_right = target; }
+      }
+
+      /// @brief Do a left rotation on the given node.
+      ///
+      /// See [the rebalancing section](https://en.wikipedia.org/wiki/AVL_tree#Rebalancing) for an AVL tree.
+      ///
+      /// @param rotation_root The node to rotate.
+      ///
+      /// @throws exception::NullPointer Thrown when the rotation root is null.
+      ///
+      void rotate_left(NodePointer rotation_root) {
+         if (rotation_root == nullptr) { throw exception::NullPointer(); }
+
+         this->rotate_left_at(this->link_of(rotation_root));
+      }
+
+      /// @brief Do a right rotation on the given node.
+      ///
+      /// See [the rebalancing section](https://en.wikipedia.org/wiki/AVL_tree#Rebalancing) for an AVL tree.
+      ///
+      /// @param rotation_root The node to rotate.
+      ///
+      /// @throws exception::NullPointer Thrown when the rotation root is null.
+      ///
+      void rotate_right(NodePointer rotation_root) {
+         if (rotation_root == nullptr) { throw exception::NullPointer(); }
+
+         this->rotate_right_at(this->link_of(rotation_root));
+      }
+
+      /// @brief Get the link which points at the given node: the root of the tree, or a child of its parent.
+      ///
+      /// This is only available when the storage policy keeps parent links.
+      ///
+      NodePointer &link_of(const NodePointer &node) {
+         auto &parent = node->_parent;
+
+         if (parent == nullptr) { return this->_root; }
+         else if (parent->_left == node) { return parent->_left; }
+         else { return parent->_right; }
+      }
+
+      /// @brief Do a left rotation on the node the given link points at, pointing the link at the new root.
+      ///
+      void rotate_left_at(NodePointer &link) {
+         NodePointer rotation_root = link;
+         NodePointer pivot_root = rotation_root->_right;
+         NodePointer left_child = pivot_root->_left;
+
+         rotation_root->_right = left_child;
+         pivot_root->_left = rotation_root;
+
+         if constexpr (has_parent_links)
+         {
+            pivot_root->_parent = rotation_root->_parent;
+            rotation_root->_parent = pivot_root;
+
+            if (left_child != nullptr)
+               left_child->_parent = rotation_root;
+         }
+
+         link = pivot_root;
+
+         refresh_node(rotation_root);
+         refresh_node(pivot_root);
+      }
+
+      /// @brief Do a right rotation on the node the given link points at, pointing the link at the new root.
+      ///
+      void rotate_right_at(NodePointer &link) {
+         NodePointer rotation_root = link;
+         NodePointer pivot_root = rotation_root->_left;
+         NodePointer right_child = pivot_root->_right;
+
+         rotation_root->_left = right_child;
+         pivot_root->_right = rotation_root;
+
+         if constexpr (has_parent_links)
+         {
+            pivot_root->_parent = rotation_root->_parent;
+            rotation_root->_parent = pivot_root;
+
+            if (right_child != nullptr)
+               right_child->_parent = rotation_root;
+         }
+
+         link = pivot_root;
+
+         refresh_node(rotation_root);
+         refresh_node(pivot_root);
+      }
+
+      /// @brief Rebalance the given node if its balance is greater than 1 or less than -1.
+      ///
+      /// When a node needs to be rebalanced, certain rotation operations need to happen.
+      /// See [the rebalancing section](https://en.wikipedia.org/wiki/AVL_tree#Rebalancing) on AVL trees.
+      ///
+      /// @param node The node to rebalance.
+      ///
+      /// @throws exception::NullPointer Thrown when the node argument is null.
+      ///
+      void rebalance_node(NodePointer node) {
+         if (node == nullptr) { throw exception::NullPointer(); }
+         
+         auto balance = node->balance();
+         if (balance == 0) { return; }
+
+         if (balance < 0)
+         {
+            auto child = node->_left;
+            auto balance = (child != nullptr) ? child->balance() : 0;
+
+            this->_stats.count_rotation(balance > 0);
+
+            if (balance > 0)
+            {
+               this->self().rotate_left(child);
+               this->self().rotate_right(node);
+            }
+            else {
+               this->self().rotate_right(node);
+            }
+         }
+         else
+         {
+            auto child = node->_right;
+            auto balance = (child != nullptr) ? child->balance() : 0;
+
+            this->_stats.count_rotation(balance < 0);
+
+            if (balance < 0) {
+               this->self().rotate_right(child);
+               this->self().rotate_left(node);
+            }
+            else {
+               this->self().rotate_left(node);
+            }
+         }
+      }
+
+      /// @brief Recompute the height and aggregate of the given node from its children.
+      ///
+      static void refresh_node(const NodePointer &node) {
+         node->_height = static_cast<std::uint8_t>(node->new_height());
+         node->_aggregate = node->new_aggregate();
+      }
+
+      /// @brief Get this tree as its Derived class, through which every hook is called.
+      ///
+      inline DerivedType &self() { return static_cast<DerivedType &>(*this); }
+      /// @brief Get this tree as its const Derived class.
+      ///
+      inline const DerivedType &self() const { return static_cast<const DerivedType &>(*this); }
+
+      /// @brief Determine whether the given node, whose height is up to date, is out of balance far enough to
+      /// be rotated.
+      ///
+      /// Under relaxed balance, a node whose children differ in height by two is left alone, and the given flag
+      /// is set instead. See set_relaxed_balance.
+      ///
+      inline bool needs_rotation(NodePointer node, bool &deferred) const {
+         auto balance = node->balance();
+
+         if (balance > this->_balance_limit || balance < -this->_balance_limit) { return true; }
+         if (balance > 1 || balance < -1) { deferred = true; }
+
+         return false;
+      }
+
+      /// @brief Update the given node after an insertion or deletion operation.
+      ///
+      /// This function updates the heights on the way to the root and rebalances the nodes which need it. Tree
+      /// objects which need to update more information or perform other actions can hide it, see Derived. Without an
+      /// augmentation policy it stops as soon as a height stays the same; otherwise it walks all the way up, since
+      /// every aggregate above the node may have changed.
+      ///
+      /// @param node The node to update.
+      ///
+      /// @throws exception::NullPointer Thrown when the node argument is null.
+      ///
+      void update_node(NodePointer node) {
+         if (node == nullptr) { throw exception::NullPointer(); }
+         
+         NodePointer update = node;
+         std::size_t path_nodes = 0;
+         bool deferred = false;
+
+         while (update != nullptr)
+         {
+            auto old_height = update->_height;
+            refresh_node(update);
+            ++path_nodes;
+
+            if (this->needs_rotation(update, deferred))
+            {
+               this->self().rebalance_node(update);
+
+               // the rotation moved the node under the new root of its subtree
+               update = update->_parent;
+            }
+
+            if (!is_augmented && update->_height == old_height) { break; }
+
+            update = update->_parent;
+         }
+
+         this->_deferred_rotations += deferred;
+         this->_stats.count_update(path_nodes);
+      }
+
+      /// @brief Rebalance the node the given link points at, like rebalance_node, using the rotations on links.
+      ///
+      void rebalance_at(NodePointer &link) {
+         auto balance = link->balance();
+
+         if (balance < 0)
+         {
+            auto double_rotation = link->_left->balance() > 0;
+            this->_stats.count_rotation(double_rotation);
+
+            if (double_rotation) { this->rotate_left_at(link->_left); }
+
+            this->rotate_right_at(link);
+         }
+         else if (balance > 0)
+         {
+            auto double_rotation = link->_right->balance() < 0;
+            this->_stats.count_rotation(double_rotation);
+
+            if (double_rotation) { this->rotate_right_at(link->_right); }
+
+            this->rotate_left_at(link);
+         }
+      }
+
+      /// @brief Update the nodes the given links point at after an insertion or deletion, deepest first.
+      ///
+      /// This is update_node for trees without parent links, which walk the recorded path of links back up
+      /// instead of following parents. The stack is emptied as the nodes are updated.
+      ///
+      /// @param links The links from the root down to the deepest node which changed.
+      ///
+      void retrace(AncestorStack<NodePointer *> &links) {
+         std::size_t path_nodes = 0;
+         bool deferred = false;
+
+         while (!links.empty())
+         {
+            NodePointer &link = *links.pop();
+            auto old_height = link->_height;
+            refresh_node(link);
+            ++path_nodes;
+
+            if (this->needs_rotation(link, deferred)) { this->rebalance_at(link); }
+            if (!is_augmented && link->_height == old_height) { break; }
+         }
+
+         this->_deferred_rotations += deferred;
+         this->_stats.count_update(path_nodes);
+      }
+
+      /// @brief Point the given link at a copy of the node it points at, handing the original to the retire functor.
+      ///
+      /// This is the building block of path copying: the copy shares the children of the original, so only the
+      /// nodes which are about to change are duplicated, and the original is left untouched for whoever may still
+      /// be reading it. Shared children can't point back at two parents, so this needs a storage policy without
+      /// parent links. See CompactNodeStorage.
+      ///
+      /// Reference-counted nodes which nothing but the link owns are left as they are, since nobody else can see
+      /// them change. See PersistentNodeStorage.
+      ///
+      /// @param link The link to the node to copy.
+      /// @param retire The functor called with the original node once nothing in this tree refers to it.
+      ///
+      template <typename Retire>
+      void copy_at(NodePointer &link, Retire &retire) {
+         static_assert(!has_parent_links, "path copying needs a node storage policy without parent links");
+
+         if constexpr (!std::is_pointer<NodePointer>::value)
+         {
+            if (link.use_count() == 1)
+            {
+               // pairs with the release of whichever owner let go last, so none of its reads race the changes
+               std::atomic_thread_fence(std::memory_order_acquire);
+               return;
+            }
+         }
+
+         NodePointer original = link;
+         NodePointer copy = this->self().copy_node(*original);
+
+         copy->_left = original->_left;
+         copy->_right = original->_right;
+         link = copy;
+
+         retire(original);
+      }
+
+      /// @brief Copy the nodes on the path to the given key, recording the links to them. See copy_at.
+      ///
+      /// The node with the key is copied too, but its link is not recorded.
+      ///
+      /// @param key The key to descend to.
+      /// @param links Receives the links from the root down to the parent of the returned link.
+      /// @param retire The functor called with each original node. See copy_at.
+      ///
+      /// @returns The link which holds the node with the key, or the null link where it belongs.
+      ///
+      template <typename Retire>
+      NodePointer *copy_path(const Key &key, AncestorStack<NodePointer *> &links, Retire &retire) {
+         auto link = &this->_root;
+
+         while (*link != nullptr)
+         {
+            this->copy_at(*link, retire);
+
+            auto branch = this->compare_keys(key, (*link)->key());
+            if (branch == 0) { break; }
+
+            links.push(link);
+            link = (branch < 0) ? &(*link)->_left : &(*link)->_right;
+         }
+
+         return link;
+      }
+
+      /// @brief Retrace the copied path of an insertion or removal, copying whatever else the rotations touch.
+      ///
+      /// This is retrace for path copying. An insertion only rotates nodes on its own path, which are already
+      /// copies. A removal rotates the heavy side of a node, which is never on its path, so those nodes are
+      /// copied before they are rotated.
+      ///
+      /// @param links The links from the root down to the deepest node which changed, all pointing at copies.
+      /// @param copy_heavy_side Whether the path is the one of a removal.
+      /// @param retire The functor called with each original node. See copy_at.
+      ///
+      template <typename Retire>
+      void retrace_copied(AncestorStack<NodePointer *> &links, bool copy_heavy_side, Retire &retire) {
+         bool deferred = false;
+
+         while (!links.empty())
+         {
+            NodePointer &link = *links.pop();
+            auto old_height = link->_height;
+            refresh_node(link);
+
+            auto balance = link->balance();
+
+            if (this->needs_rotation(link, deferred))
+            {
+               if (copy_heavy_side)
+               {
+                  auto &heavy = (balance < 0) ? link->_left : link->_right;
+                  this->copy_at(heavy, retire);
+
+                  // a double rotation also moves the inner grandchild
+                  if (balance < 0 && heavy->balance() > 0) { this->copy_at(heavy->_right, retire); }
+                  else if (balance > 0 && heavy->balance() < 0) { this->copy_at(heavy->_left, retire); }
+               }
+
+               this->rebalance_at(link);
+            }
+
+            if (!is_augmented && link->_height == old_height) { break; }
+         }
+
+         this->_deferred_rotations += deferred;
+      }
+
+      /// @brief Link the given node into the tree by path copying, leaving every node which was reachable before intact.
+      ///
+      /// The key of the node must not be in the tree already. See copy_at.
+      ///
+      /// @param node The node to link into the tree.
+      /// @param retire The functor called with each node the new version of the tree no longer refers to.
+      ///
+      template <typename Retire>
+      void attach_copied(NodePointer node, Retire &retire) {
+         AncestorStack<NodePointer *> links;
+         auto link = this->copy_path(node->key(), links, retire);
+
+         *link = node;
+         links.push(link);
+         this->retrace_copied(links, false, retire);
+
+         ++this->_size;
+      }
+
+      /// @brief Remove the node with the given key by path copying, leaving every node which was reachable before intact.
+      ///
+      /// The key must be in the tree. This is remove_unlinked_node for path copying: the successor of a node with
+      /// two children is copied too, and the copy takes the place of the node. See copy_at.
+      ///
+      /// @param key The key to remove.
+      /// @param retire The functor called with each node the new version of the tree no longer refers to.
+      ///
+      template <typename Retire>
+      void remove_copied(const Key &key, Retire &retire) {
+         AncestorStack<NodePointer *> links;
+         auto link = this->copy_path(key, links, retire);
+         NodePointer node = *link;
+
+         if (node->_left == nullptr || node->_right == nullptr)
+         {
+            *link = (node->_left != nullptr) ? node->_left : node->_right;
+         }
+         else
+         {
+            links.push(link);
+
+            auto right_index = links.size();
+            auto successor_link = &node->_right;
+            this->copy_at(*successor_link, retire);
+
+            while ((*successor_link)->_left != nullptr)
+            {
+               links.push(successor_link);
+               successor_link = &(*successor_link)->_left;
+               this->copy_at(*successor_link, retire);
+            }
+
+            NodePointer successor = *successor_link;
+            *successor_link = successor->_right;
+
+            successor->_left = node->_left;
+            successor->_right = node->_right;
+            successor->_height = node->_height;
+            *link = successor;
+
+            if (links.size() > right_index) { links[right_index] = &successor->_right; }
+         }
+
+         // the node is a copy nothing else has seen, so it goes right away
+         node->_left = nullptr;
+         node->_right = nullptr;
+         this->deallocate_node(node);
+
+         --this->_size;
+         this->retrace_copied(links, true, retire);
+      }
+
+      /// @brief Allocate a new node object with the given value.
+      ///
+      /// @param value The value the node should have.
+      ///
+      NodePointer allocate_node(const Value &value) {
+         return this->construct_node(value);
+      }
+
+      /// @brief Allocate a new node object, moving the given value into it.
+      ///
+      /// @param value The value the node should have.
+      ///
+      NodePointer allocate_node(Value &&value) {
+         return this->construct_node(std::move(value));
+      }
+
+      /// @brief Allocate a new node object whose value is constructed in place from the given arguments.
+      ///
+      /// @param args The arguments to pass to the constructor of the value.
+      ///
+      template <typename... Args>
+      NodePointer construct_node(Args&&... args) {
+         auto node = NodeStorage::template allocate<Node>(this->_allocator, std::in_place, std::forward<Args>(args)...);
+         this->_stats.count_allocation();
+
+         return node;
+      }
+
+      /// @brief Create an unlinked copy of the given node.
+      ///
+      /// The value, height and aggregate of the node are copied, but not its links to other nodes.
+      ///
+      /// @param node The node to copy.
+      ///
+      NodePointer copy_node(const Node &node) {
+         auto new_node = this->construct_node(node._value);
+         new_node->_height = node._height;
+         new_node->_aggregate = node._aggregate;
+
+         return new_node;
+      }
+
+      /// @brief Release a node which is no longer linked into the tree.
+      ///
+      /// See NodeStorage::deallocate.
+      ///
+      /// @param node The node to release.
+      ///
+      void deallocate_node(NodePointer node) {
+         NodeStorage::template deallocate<Node>(this->_allocator, node);
+         this->_stats.count_deallocations(1);
+      }
+
+      /// @brief Add a new node to the tree.
+      ///
+      /// @param value The value the new node should have.
+      ///
+      /// @throws exception::KeyExists Thrown when the key of the given value already exists within the tree.
+      ///
+      NodePointer add_node(const Value &value) {
+         const auto &key = KeyOfValue()(value);
+         auto result = this->locate_insert(key);
+
+         if (result.first != nullptr && result.second == 0) { throw exception::KeyExists(); }
+
+         return this->attach_node(result.first, result.second, this->self().allocate_node(value));
+      }
+
+      /// @brief Add a new node to the tree, moving the given value into it.
+      ///
+      /// @param value The value the new node should have.
+      ///
+      /// @throws exception::KeyExists Thrown when the key of the given value already exists within the tree.
+      ///
+      NodePointer add_node(Value &&value) {
+         auto result = this->locate_insert(KeyOfValue()(value));
+
+         if (result.first != nullptr && result.second == 0) { throw exception::KeyExists(); }
+
+         return this->attach_node(result.first, result.second, this->self().allocate_node(std::move(value)));
+      }
+
+      /// @brief Link an already constructed node into the tree, unless its key is already present.
+      ///
+      /// If the key exists, the node is released and the existing node is returned instead.
+      ///
+      /// @param node The node to link into the tree.
+      ///
+      /// @returns A pair of the node with the key of the given node and whether the given node was linked.
+      ///
+      std::pair<NodePointer, bool> attach_unique(NodePointer node) {
+         auto result = this->locate_insert(node->key());
+
+         if (result.first != nullptr && result.second == 0)
+         {
+            this->deallocate_node(node);
+            return std::make_pair(result.first, false);
+         }
+
+         return std::make_pair(this->attach_node(result.first, result.second, node), true);
+      }
+
+      /// @brief Link an already constructed node into the tree, using the given node as a hint.
+      ///
+      /// If the node belongs directly before or after the hint, it is linked next to the hint without
+      /// searching the tree. Otherwise this falls back to attach_unique.
+      ///
+      /// @param hint A node of this tree which is close to where the node belongs, or null.
+      /// @param node The node to link into the tree.
+      ///
+      /// @returns The node with the key of the given node.
+      ///
+      NodePointer attach_hinted(NodePointer hint, NodePointer node) {
+         if constexpr (has_parent_links)
+         {
+            if (hint != nullptr)
+            {
+               auto branch = this->compare_keys(node->key(), hint->key());
+
+               if (branch == 0)
+               {
+                  this->deallocate_node(node);
+                  return hint;
+               }
+               else if (branch > 0)
+               {
+                  auto next = successor(hint);
+
+                  if (next == nullptr || this->compare_keys(node->key(), next->key()) < 0)
+                  {
+                     if (hint->_right == nullptr) { return this->attach_node(hint, 1, node); }
+                     else { return this->attach_node(next, -1, node); }
+                  }
+               }
+               else
+               {
+                  auto prev = predecessor(hint);
+
+                  if (prev == nullptr || this->compare_keys(node->key(), prev->key()) > 0)
+                  {
+                     if (hint->_left == nullptr) { return this->attach_node(hint, -1, node); }
+                     else { return this->attach_node(prev, 1, node); }
+                  }
+               }
+            }
+         }
+
+         return this->attach_unique(node).first;
+      }
+
+      /// @brief Get a modifiable pointer to a node of this tree given by a const iterator.
+      ///
+      /// The tree owns the node, so modifying it through the tree is sound even though the iterator is const.
+      ///
+      static NodePointer mutable_node(const ConstNodePointer &node) {
+         if constexpr (std::is_pointer<NodePointer>::value) { return const_cast<NodePointer>(node); }
+         else { return std::const_pointer_cast<Node>(node); }
+      }
+
+      /// @brief Get the node which follows the given node in an in-order traversal.
+      ///
+      /// @returns The next node, or null if the given node is the last node in the tree.
+      ///
+      template <typename NodeType>
+      static NodeType successor(NodeType node) {
+         if (node->_right != nullptr)
+         {
+            node = node->_right;
+
+            while (node->_left != nullptr)
+               node = node->_left;
+
+            return node;
+         }
+
+         NodeType parent = node->_parent;
+
+         while (parent != nullptr && node == parent->_right)
+         {
+            node = parent;
+            parent = parent->_parent;
+         }
+
+         return parent;
+      }
+
+      /// @brief Get the node which precedes the given node in an in-order traversal.
+      ///
+      /// @returns The previous node, or null if the given node is the first node in the tree.
+      ///
+      template <typename NodeType>
+      static NodeType predecessor(NodeType node) {
+         if (node->_left != nullptr)
+         {
+            node = node->_left;
+
+            while (node->_right != nullptr)
+               node = node->_right;
+
+            return node;
+         }
+
+         NodeType parent = node->_parent;
+
+         while (parent != nullptr && node == parent->_left)
+         {
+            node = parent;
+            parent = parent->_parent;
+         }
+
+         return parent;
+      }
+
+      /// @brief Get the aggregate of the given subtree, which is the identity for an empty subtree.
+      ///
+      template <typename NodeType>
+      static AggregateType aggregate_of(const NodeType &node) {
+         return (node != nullptr) ? node->_aggregate : Augment::identity();
+      }
+
+      /// @brief Combine two adjacent aggregates, the first one coming before the second in key order.
+      ///
+      static AggregateType merge_aggregates(const AggregateType &first, const AggregateType &second) {
+         return Augment::combine(first, Augment::identity(), second);
+      }
+
+      /// @brief Get the number of nodes in the given subtree from its aggregate.
+      ///
+      /// This requires an augmentation policy which counts nodes, such as SubtreeSize.
+      ///
+      template <typename NodeType>
+      static std::size_t subtree_size(const NodeType &node) {
+         return (node != nullptr) ? Augment::size(node->_aggregate) : 0;
+      }
+
+      /// @brief Get the node at the given in-order position of the given subtree.
+      ///
+      /// @returns The node, or null if the index is not less than the size of the subtree.
+      ///
+      template <typename NodeType>
+      static NodeType select_node(NodeType node, std::size_t index) {
+         while (node != nullptr)
+         {
+            auto left_size = subtree_size(node->_left);
+
+            if (index < left_size) { node = node->_left; }
+            else if (index == left_size) { return node; }
+            else
+            {
+               index -= left_size + 1;
+               node = node->_right;
+            }
+         }
+
+         return node;
+      }
+
+      /// @brief The smallest number of nodes worth building on a thread of its own. See assign_sorted.
+      ///
+      static constexpr std::size_t parallel_grain = 1 << 14;
+
+      /// @brief Determine whether a range of values is sorted by strictly increasing keys.
+      ///
+      template <typename ForwardIt>
+      bool is_sorted_unique(ForwardIt first, ForwardIt last) const {
+         if (first == last) { return true; }
+
+         auto prev = first;
+
+         for (auto iter = std::next(first); iter != last; prev = iter++)
+         {
+            const Value &a = *prev, &b = *iter;
+
+            if (!this->key_less(KeyOfValue()(a), KeyOfValue()(b))) { return false; }
+         }
+
+         return true;
+      }
+
+      /// @brief Link the given children under the given node and compute its height.
+      ///
+      /// This is the building block of bottom-up construction, where the children are already complete subtrees.
+      ///
+      void link_subtrees(NodePointer node, NodePointer left, NodePointer right) {
+         node->_left = left;
+         node->_right = right;
+
+         if constexpr (has_parent_links)
+         {
+            if (left != nullptr) { left->_parent = node; }
+            if (right != nullptr) { right->_parent = node; }
+         }
+
+         refresh_node(node);
+      }
+
+      /// @brief Build a perfectly balanced subtree out of the next count values of a sorted range.
+      ///
+      /// The values are consumed in order, so the cursor may be a forward iterator. The left subtree gets the
+      /// smaller half of the values.
+      ///
+      /// @param cursor The iterator of the next value to consume. It is advanced past the consumed values.
+      /// @param count The number of values to build the subtree from.
+      ///
+      /// @returns The root of the subtree, or null if the count is 0.
+      ///
+      template <typename ForwardIt>
+      NodePointer build_sorted(ForwardIt &cursor, std::size_t count) {
+         if (count == 0) { return nullptr; }
+
+         auto left_count = count / 2;
+         auto left = this->build_sorted(cursor, left_count);
+         NodePointer node = nullptr, right = nullptr;
+
+         try {
+            node = this->construct_node(*cursor);
+            ++cursor;
+            right = this->build_sorted(cursor, count - left_count - 1);
+         }
+         catch (...) {
+            this->destroy_subtree(left);
+            if (node != nullptr) { this->deallocate_node(node); }
+            throw;
+         }
+
+         this->link_subtrees(node, left, right);
+
+         return node;
+      }
+
+      /// @brief Get the number of threads a bulk operation may use.
+      ///
+      /// The worker threads allocate and free nodes on their own, so the allocator and the stats policy must be
+      /// safe to use from several threads at once. Neither a PoolAllocator nor the plain counters of CountingStats
+      /// are, so trees using either always work on the calling thread.
+      ///
+      static std::size_t worker_threads(std::size_t threads) {
+         return (is_pool_allocator<NodeAllocator>::value || Stats::enabled) ? 1 : threads;
+      }
+
+      /// @brief Build a perfectly balanced subtree out of a sorted range, splitting the work across threads.
+      ///
+      /// This produces the same shape as build_sorted. The left half of the range is built on a new thread while
+      /// the right half is built on this one, until the thread budget runs out or the range gets small.
+      ///
+      template <typename RandomIt>
+      NodePointer build_sorted_parallel(RandomIt first, std::size_t count, std::size_t threads) {
+         if (threads <= 1 || count < parallel_grain)
+         {
+            auto cursor = first;
+            return this->build_sorted(cursor, count);
+         }
+
+         auto left_count = count / 2;
+         auto left_threads = threads / 2;
+         auto left_future = std::async(std::launch::async, [this, first, left_count, left_threads]() {
+            return this->build_sorted_parallel(first, left_count, left_threads);
+         });
+         NodePointer left = nullptr, node = nullptr, right = nullptr;
+
+         try {
+            node = this->construct_node(*(first + left_count));
+            right = this->build_sorted_parallel(first + left_count + 1, count - left_count - 1, threads - left_threads);
+            left = left_future.get();
+         }
+         catch (...) {
+            if (left_future.valid())
+            {
+               try { this->destroy_subtree(left_future.get()); }
+               catch (...) {}
+            }
+
+            this->destroy_subtree(right);
+            if (node != nullptr) { this->deallocate_node(node); }
+            throw;
+         }
+
+         this->link_subtrees(node, left, right);
+
+         return node;
+      }
+
+      /// @brief Clone the given subtree, returning the root of the copy.
+      ///
+      /// The links of the source are followed by reference, so cloning does not touch their reference counts.
+      ///
+      NodePointer clone_subtree(const NodePointer &source) {
+         if (source == nullptr) { return nullptr; }
+
+         auto node = this->self().copy_node(*source);
+         NodePointer left = nullptr, right = nullptr;
+
+         try {
+            left = this->clone_subtree(source->_left);
+            right = this->clone_subtree(source->_right);
+         }
+         catch (...) {
+            this->destroy_subtree(left);
+            this->deallocate_node(node);
+            throw;
+         }
+
+         node->_left = left;
+         node->_right = right;
+
+         if constexpr (has_parent_links)
+         {
+            if (left != nullptr) { left->_parent = node; }
+            if (right != nullptr) { right->_parent = node; }
+         }
+
+         return node;
+      }
+
+      /// @brief Clone the given subtree, splitting the work across threads.
+      ///
+      /// The left subtree is cloned on a new thread while the right subtree is cloned on this one, until the
+      /// thread budget runs out or the subtrees get small. See clone_subtree.
+      ///
+      NodePointer clone_subtree_parallel(const NodePointer &source, std::size_t threads) {
+         if (source == nullptr) { return nullptr; }
+         if (threads <= 1 || (std::size_t(1) << source->_height) < parallel_grain) { return this->clone_subtree(source); }
+
+         auto left_threads = threads / 2;
+         auto left_future = std::async(std::launch::async, [this, &source, left_threads]() {
+            return this->clone_subtree_parallel(source->_left, left_threads);
+         });
+         NodePointer node = nullptr, left = nullptr, right = nullptr;
+
+         try {
+            node = this->self().copy_node(*source);
+            right = this->clone_subtree_parallel(source->_right, threads - left_threads);
+            left = left_future.get();
+         }
+         catch (...) {
+            if (left_future.valid())
+            {
+               try { this->destroy_subtree(left_future.get()); }
+               catch (...) {}
+            }
+
+            this->destroy_subtree(right);
+            if (node != nullptr) { this->deallocate_node(node); }
+            throw;
+         }
+
+         node->_left = left;
+         node->_right = right;
+
+         if constexpr (has_parent_links)
+         {
+            if (left != nullptr) { left->_parent = node; }
+            if (right != nullptr) { right->_parent = node; }
+         }
+
+         return node;
+      }
+
+      /// @brief Release every node of the given subtree.
+      ///
+      /// The subtree must already be unlinked from the rest of the tree.
+      ///
+      void destroy_subtree(NodePointer node) {
+         if (node == nullptr) { return; }
+
+         // reference-counted nodes without parents hold no cycles to break, and may be shared with other trees
+         if constexpr (!has_parent_links && !std::is_pointer<NodePointer>::value) { return; }
+
+         this->destroy_subtree(node->_left);
+         this->destroy_subtree(node->_right);
+
+         if constexpr (has_parent_links) { node->_parent = nullptr; }
+         node->_left = nullptr;
+         node->_right = nullptr;
+         this->deallocate_node(node);
+      }
+
+      /// @brief Add the nodes of the given subtree to a histogram of nodes by depth, growing it as needed.
+      ///
+      static void count_depths(const NodePointer &node, std::size_t depth, std::vector<std::size_t> &histogram) {
+         if (node == nullptr) { return; }
+         if (histogram.size() <= depth) { histogram.resize(depth + 1, 0); }
+
+         ++histogram[depth];
+         count_depths(node->_left, depth + 1, histogram);
+         count_depths(node->_right, depth + 1, histogram);
+      }
+
+      /// @brief Get the height of the given subtree, which is 0 for an empty subtree.
+      ///
+      static int height_of(const NodePointer &node) { return (node != nullptr) ? node->_height : 0; }
+
+      /// @brief Count the nodes of the given subtree, from its aggregate if the augmentation policy counts nodes.
+      ///
+      static std::size_t count_nodes(const NodePointer &node) {
+         if constexpr (counts_nodes) { return subtree_size(node); }
+         else { return (node != nullptr) ? count_nodes(node->_left) + count_nodes(node->_right) + 1 : 0; }
+      }
+
+      /// @brief Get the smallest key of the tree, which must not be empty.
+      ///
+      const Key &first_key() const {
+         ConstNodePointer node = this->_root;
+
+         while (node->_left != nullptr)
+            node = node->_left;
+
+         return node->key();
+      }
+      /// @brief Get the greatest key of the tree, which must not be empty.
+      ///
+      const Key &last_key() const {
+         ConstNodePointer node = this->_root;
+
+         while (node->_right != nullptr)
+            node = node->_right;
+
+         return node->key();
+      }
+
+      /// @brief Make the given detached subtree the whole tree.
+      ///
+      void set_root(NodePointer root, std::size_t size) {
+         if constexpr (has_parent_links)
+         {
+            if (root != nullptr) { root->_parent = nullptr; }
+         }
+
+         this->_root = root;
+         this->_size = size;
+         this->_rightmost = nullptr;
+      }
+
+      /// @brief Release a single node which was cut out of a subtree, dropping the links it still holds.
+      ///
+      void discard_node(NodePointer node) {
+         if constexpr (has_parent_links) { node->_parent = nullptr; }
+         node->_left = nullptr;
+         node->_right = nullptr;
+         this->deallocate_node(node);
+      }
+
+      /// @brief Join two detached subtrees and a node whose key lies between them into a single subtree.
+      ///
+      /// Every key of the left subtree must be less than the key of the node, and every key of the right subtree
+      /// greater. The node is linked into the spine of the taller subtree where the heights meet, and only the
+      /// nodes above it are rebalanced, so this costs O(|h(left) - h(right)|) rather than a full rebuild. Joining
+      /// relinks nodes directly and calls none of the hooks of Derived, and neither does any operation built on
+      /// it: join, split and the set operations.
+      ///
+      /// @returns The root of the joined subtree.
+      ///
+      NodePointer join_subtrees(NodePointer left, NodePointer node, NodePointer right) {
+         auto left_height = height_of(left);
+         auto right_height = height_of(right);
+
+         if (left_height > right_height + 1)
+         {
+            this->join_right_spine(left, node, right, right_height);
+            return left;
+         }
+         if (right_height > left_height + 1)
+         {
+            this->join_left_spine(right, left, node, left_height);
+            return right;
+         }
+
+         this->link_subtrees(node, left, right);
+
+         return node;
+      }
+
+      /// @brief Rebuild the balance of the given detached subtree bottom-up, returning its new root.
+      ///
+      /// Both children are restored first, so join_subtrees always joins two strictly balanced subtrees. See
+      /// rebalance_pending.
+      ///
+      NodePointer restore_balance(NodePointer node) {
+         if (node == nullptr) { return nullptr; }
+
+         auto left = this->restore_balance(node->_left);
+         auto right = this->restore_balance(node->_right);
+
+         return this->join_subtrees(left, node, right);
+      }
+
+      /// @brief Join a node and a shorter subtree into the right spine of the subtree the given link points at.
+      ///
+      /// See join_subtrees. The link is pointed at the new root of the subtree.
+      ///
+      void join_right_spine(NodePointer &link, NodePointer node, NodePointer right, int right_height) {
+         if (height_of(link->_right) <= right_height + 1)
+         {
+            this->link_subtrees(node, link->_right, right);
+            this->link_subtrees(link, link->_left, node);
+         }
+         else
+         {
+            this->join_right_spine(link->_right, node, right, right_height);
+            this->link_subtrees(link, link->_left, link->_right);
+         }
+
+         if (link->balance() > 1) { this->rebalance_at(link); }
+      }
+
+      /// @brief Join a shorter subtree and a node into the left spine of the subtree the given link points at.
+      ///
+      /// The mirror of join_right_spine.
+      ///
+      void join_left_spine(NodePointer &link, NodePointer left, NodePointer node, int left_height) {
+         if (height_of(link->_left) <= left_height + 1)
+         {
+            this->link_subtrees(node, left, link->_left);
+            this->link_subtrees(link, node, link->_right);
+         }
+         else
+         {
+            this->join_left_spine(link->_left, left, node, left_height);
+            this->link_subtrees(link, link->_left, link->_right);
+         }
+
+         if (link->balance() < -1) { this->rebalance_at(link); }
+      }
+
+      /// @brief Join two detached subtrees, every key of the left one being less than every key of the right one.
+      ///
+      /// The last node of the left subtree is cut out and becomes the middle node of join_subtrees.
+      ///
+      NodePointer join_subtrees(NodePointer left, NodePointer right) {
+         if (left == nullptr) { return right; }
+         if (right == nullptr) { return left; }
+
+         NodePointer rest = nullptr;
+         auto last = this->split_last(left, rest);
+
+         return this->join_subtrees(rest, last, right);
+      }
+
+      /// @brief Cut the last node out of the given detached subtree.
+      ///
+      /// @param node The root of the subtree, which must not be empty.
+      /// @param rest Set to the root of what is left of the subtree.
+      ///
+      /// @returns The last node, unlinked from its children.
+      ///
+      NodePointer split_last(NodePointer node, NodePointer &rest) {
+         if (node->_right == nullptr)
+         {
+            rest = node->_left;
+            node->_left = nullptr;
+            return node;
+         }
+
+         NodePointer right_rest = nullptr;
+         auto last = this->split_last(node->_right, right_rest);
+
+         rest = this->join_subtrees(node->_left, node, right_rest);
+
+         return last;
+      }
+
+      /// @brief Split the given detached subtree into the keys less than and greater than the given key.
+      ///
+      /// The subtrees cut off the path to the key are joined back together on the way up, and since their
+      /// heights grow along the path the joins add up to O(log n).
+      ///
+      /// @param node The root of the subtree.
+      /// @param key The key to split at.
+      /// @param left Set to the root of the subtree of keys less than the key.
+      /// @param right Set to the root of the subtree of keys greater than the key.
+      ///
+      /// @returns The node with the key, unlinked from its children, or null if the key isn't in the subtree.
+      ///
+      NodePointer split_subtree(NodePointer node, const Key &key, NodePointer &left, NodePointer &right) {
+         if (node == nullptr)
+         {
+            left = nullptr;
+            right = nullptr;
+            return nullptr;
+         }
+
+         auto branch = this->compare_keys(key, node->key());
+         NodePointer node_left = node->_left, node_right = node->_right;
+
+         if (branch == 0)
+         {
+            left = node_left;
+            right = node_right;
+            node->_left = nullptr;
+            node->_right = nullptr;
+            return node;
+         }
+
+         NodePointer middle = nullptr;
+         NodePointer found = nullptr;
+
+         if (branch < 0)
+         {
+            found = this->split_subtree(node_left, key, left, middle);
+            right = this->join_subtrees(middle, node, node_right);
+         }
+         else
+         {
+            found = this->split_subtree(node_right, key, middle, right);
+            left = this->join_subtrees(node_left, node, middle);
+         }
+
+         return found;
+      }
+
+      /// @brief Split the given detached subtree into the keys less than the given key and the rest.
+      ///
+      /// See split_subtree. The node with the key, if there is one, goes with the rest, or with the keys less than
+      /// it when asked to.
+      ///
+      /// @param node The root of the subtree.
+      /// @param key The key to split at.
+      /// @param key_left Whether the node with the key goes to the left subtree.
+      /// @param left Set to the root of the subtree of keys less than the key.
+      /// @param right Set to the root of the subtree of keys greater than the key.
+      ///
+      void split_around(NodePointer node, const Key &key, bool key_left, NodePointer &left, NodePointer &right) {
+         auto found = this->split_subtree(node, key, left, right);
+
+         if (found == nullptr) { return; }
+
+         if (key_left) { left = this->join_subtrees(left, found, nullptr); }
+         else { right = this->join_subtrees(nullptr, found, right); }
+      }
+
+      /// @brief Make the given detached subtree the whole tree, releasing the other detached subtree in bulk.
+      ///
+      /// The released nodes are freed without any rebalancing.
+      ///
+      /// @param kept The subtree which becomes the tree.
+      /// @param removed The subtree to release, which holds every other node of the tree.
+      ///
+      /// @returns The number of nodes released.
+      ///
+      std::size_t keep_subtree(NodePointer kept, NodePointer removed) {
+         auto count = count_nodes(removed);
+
+         this->set_root(kept, this->_size - count);
+         this->destroy_subtree(removed);
+
+         return count;
+      }
+
+      /// @brief Link a sorted run of detached nodes into a perfectly balanced subtree.
+      ///
+      NodePointer link_sorted_nodes(NodePointer *nodes, std::size_t count) {
+         if (count == 0) { return nullptr; }
+
+         auto left_count = count / 2;
+         auto left = this->link_sorted_nodes(nodes, left_count);
+         auto right = this->link_sorted_nodes(nodes + left_count + 1, count - left_count - 1);
+
+         this->link_subtrees(nodes[left_count], left, right);
+
+         return nodes[left_count];
+      }
+
+      /// @brief Determine whether a set operation over the given subtrees is worth a thread of its own.
+      ///
+      static bool worth_forking(std::size_t threads, const NodePointer &a, const NodePointer &b) {
+         return threads > 1 && (std::size_t(1) << std::min(height_of(a), height_of(b))) >= parallel_grain;
+      }
+
+      /// @brief Run the two given functions, the left one on a new thread if asked to, and return both results.
+      ///
+      /// If no thread can be started, both functions run on this thread, the left one first.
+      ///
+      template <typename Left, typename Right>
+      static auto fork_join(bool parallel, Left &&left, Right &&right) {
+         if (parallel)
+         {
+            std::future<decltype(left())> left_future;
+
+            try { left_future = std::async(std::launch::async, std::ref(left)); }
+            catch (const std::system_error &) {}
+
+            if (left_future.valid())
+            {
+               auto right_result = right();
+               return std::make_pair(left_future.get(), std::move(right_result));
+            }
+         }
+
+         auto left_result = left();
+         return std::make_pair(std::move(left_result), right());
+      }
+
+      /// @brief Merge two detached subtrees into their union, keeping the nodes of the first on equal keys.
+      ///
+      /// The second subtree is split at the key of the root of the first, and the halves are merged with the
+      /// children of that root, which costs O(m log(n/m + 1)) for subtrees of m and n >= m nodes. The halves
+      /// are merged on separate threads while the thread budget and the subtrees are large enough.
+      ///
+      /// @param dropped Incremented by the number of nodes of the second subtree which were released.
+      /// @param duplicates If not null, the nodes of the second subtree whose key is in the first are moved here in
+      /// order instead of being released. This must then run on a single thread.
+      ///
+      /// @returns The root of the union.
+      ///
+      NodePointer union_subtrees(NodePointer a, NodePointer b, std::size_t threads, std::size_t &dropped,
+                                 std::vector<NodePointer> *duplicates)
+      {
+         if (a == nullptr) { return b; }
+         if (b == nullptr) { return a; }
+
+         NodePointer b_left = nullptr, b_right = nullptr;
+         auto duplicate = this->split_subtree(b, a->key(), b_left, b_right);
+         NodePointer a_left = a->_left, a_right = a->_right;
+
+         if (duplicate != nullptr && duplicates == nullptr)
+         {
+            this->discard_node(duplicate);
+            ++dropped;
+         }
+
+         auto parallel = worth_forking(threads, a, b_left) || worth_forking(threads, a, b_right);
+         auto left_threads = threads / 2;
+         std::size_t left_dropped = 0, right_dropped = 0;
+         auto halves = fork_join(parallel, [&]() {
+            auto left = this->union_subtrees(a_left, b_left, left_threads, left_dropped, duplicates);
+
+            if (duplicate != nullptr && duplicates != nullptr) { duplicates->push_back(duplicate); }
+
+            return left;
+         }, [&]() {
+            return this->union_subtrees(a_right, b_right, threads - left_threads, right_dropped, duplicates);
+         });
+
+         dropped += left_dropped + right_dropped;
+
+         return this->join_subtrees(halves.first, a, halves.second);
+      }
+
+      /// @brief Reduce two detached subtrees to their intersection, keeping the nodes of the first.
+      ///
+      /// See union_subtrees. Every node which is not kept is released.
+      ///
+      /// @param dropped Incremented by the number of nodes of the first subtree which were released.
+      ///
+      /// @returns The root of the intersection.
+      ///
+      NodePointer intersect_subtrees(NodePointer a, NodePointer b, std::size_t threads, std::size_t &dropped) {
+         if (a == nullptr || b == nullptr)
+         {
+            dropped += count_nodes(a);
+            this->destroy_subtree(a);
+            this->destroy_subtree(b);
+            return nullptr;
+         }
+
+         NodePointer b_left = nullptr, b_right = nullptr;
+         auto duplicate = this->split_subtree(b, a->key(), b_left, b_right);
+         NodePointer a_left = a->_left, a_right = a->_right;
+
+         auto parallel = worth_forking(threads, a, b_left) || worth_forking(threads, a, b_right);
+         auto left_threads = threads / 2;
+         std::size_t left_dropped = 0, right_dropped = 0;
+         auto halves = fork_join(parallel, [&]() {
+            return this->intersect_subtrees(a_left, b_left, left_threads, left_dropped);
+         }, [&]() {
+            return this->intersect_subtrees(a_right, b_right, threads - left_threads, right_dropped);
+         });
+
+         dropped += left_dropped + right_dropped;
+
+         if (duplicate != nullptr)
+         {
+            this->discard_node(duplicate);
+            return this->join_subtrees(halves.first, a, halves.second);
+         }
+
+         this->discard_node(a);
+         ++dropped;
+
+         return this->join_subtrees(halves.first, halves.second);
+      }
+
+      /// @brief Remove the keys of the second detached subtree from the first one.
+      ///
+      /// The first subtree is split at the key of the root of the second. See union_subtrees. The second subtree
+      /// is released entirely.
+      ///
+      /// @param dropped Incremented by the number of nodes of the first subtree which were released.
+      ///
+      /// @returns The root of the difference.
+      ///
+      NodePointer subtract_subtrees(NodePointer a, NodePointer b, std::size_t threads, std::size_t &dropped) {
+         if (a == nullptr)
+         {
+            this->destroy_subtree(b);
+            return nullptr;
+         }
+         if (b == nullptr) { return a; }
+
+         NodePointer a_left = nullptr, a_right = nullptr;
+         auto duplicate = this->split_subtree(a, b->key(), a_left, a_right);
+         NodePointer b_left = b->_left, b_right = b->_right;
+
+         if (duplicate != nullptr)
+         {
+            this->discard_node(duplicate);
+            ++dropped;
+         }
+
+         this->discard_node(b);
+
+         auto parallel = worth_forking(threads, a_left, b_left) || worth_forking(threads, a_right, b_right);
+         auto left_threads = threads / 2;
+         std::size_t left_dropped = 0, right_dropped = 0;
+         auto halves = fork_join(parallel, [&]() {
+            return this->subtract_subtrees(a_left, b_left, left_threads, left_dropped);
+         }, [&]() {
+            return this->subtract_subtrees(a_right, b_right, threads - left_threads, right_dropped);
+         });
+
+         dropped += left_dropped + right_dropped;
+
+         return this->join_subtrees(halves.first, halves.second);
+      }
+
+      /// @brief Remove a sorted run of keys from a detached subtree.
+      ///
+      /// The subtree is split at the middle key of the run, and each side loses the keys of its half of the run.
+      /// Like subtract_subtrees, this costs O(m log(n/m + 1)) for m keys rather than a descent per key.
+      ///
+      /// @param node The root of the subtree.
+      /// @param keys The keys to remove, sorted by strictly increasing keys.
+      /// @param count The number of keys to remove.
+      /// @param dropped Incremented by the number of nodes which were released.
+      ///
+      /// @returns The root of what is left of the subtree.
+      ///
+      NodePointer subtract_sorted(NodePointer node, const Key *keys, std::size_t count, std::size_t &dropped) {
+         if (node == nullptr || count == 0) { return node; }
+
+         auto middle = count / 2;
+         NodePointer left = nullptr, right = nullptr;
+         auto found = this->split_subtree(node, keys[middle], left, right);
+
+         if (found != nullptr)
+         {
+            this->discard_node(found);
+            ++dropped;
+         }
+
+         left = this->subtract_sorted(left, keys, middle, dropped);
+         right = this->subtract_sorted(right, keys + middle + 1, count - middle - 1, dropped);
+
+         return this->join_subtrees(left, right);
+      }
+
+      /// @brief Take the nodes of the other tree as a detached subtree, leaving the other tree empty.
+      ///
+      /// Nodes from an allocator which isn't equal to this tree's are copied into this tree's allocator first, so
+      /// if that fails both trees are left untouched.
+      ///
+      NodePointer take_subtree(AVLTreeBase &other) {
+         // the nodes keep whatever relaxed balance left them in
+         this->_deferred_rotations += other._deferred_rotations;
+         other._deferred_rotations = 0;
+
+         if (this->_allocator != other._allocator)
+         {
+            auto root = this->clone_subtree(other._root);
+
+            other.destroy();
+            return root;
+         }
+
+         NodePointer root = other._root;
+         other._root = nullptr;
+         other._size = 0;
+         other._rightmost = nullptr;
+
+         return root;
+      }
+
+      /// @brief Link a new node into the tree at the position found by locate.
+      ///
+      /// This is the second half of an insertion: the caller has already descended the tree and knows
+      /// the key of the node is not in it, so no further searching happens here. The exception is a tree
+      /// without parent links, which descends once more to record the path it rebalances along.
+      ///
+      /// @param parent The last node visited by locate, or null if the tree is empty.
+      /// @param branch The branch taken from the parent, -1 for left or 1 for right.
+      /// @param node The node to link into the tree.
+      ///
+      /// @returns The node which was linked into the tree.
+      ///
+      NodePointer attach_node(NodePointer parent, int branch, NodePointer node) {
+         if constexpr (!has_parent_links)
+         {
+            // without parents to walk back up, descend again to record the path, which is still cached
+            AncestorStack<NodePointer *> links;
+            auto link = &this->_root;
+            auto &key = node->key();
+
+            while (*link != nullptr)
+            {
+               links.push(link);
+               link = (this->compare_keys(key, (*link)->key()) < 0) ? &(*link)->_left : &(*link)->_right;
+            }
+
+            *link = node;
+            links.push(link);
+            this->retrace(links);
+         }
+         else
+         {
+            if (parent == nullptr) { this->_root = node; }
+            else if (branch < 0) { this->set_left_child(parent, node); }
+            else { this->set_right_child(parent, node); }
+
+            // a node linked right of the greatest node is the new greatest node
+            if (parent == nullptr || (branch > 0 && parent == this->_rightmost)) { this->_rightmost = node; }
+
+            this->self().update_node(node);
+         }
+
+         ++this->_size;
+
+         return node;
+      }
+
+      /// @brief Remove the node with the given key from a tree whose nodes do not link to their parents.
+      ///
+      /// The links followed on the way down are recorded, including those down to the successor of a node with
+      /// two children, which takes its place. See remove_node.
+      ///
+      NodePointer remove_unlinked_node(const Key &key) {
+         AncestorStack<NodePointer *> links;
+         auto link = &this->_root;
+         int branch;
+
+         while (*link != nullptr && (branch = this->compare_keys(key, (*link)->key())) != 0)
+         {
+            links.push(link);
+            link = (branch < 0) ? &(*link)->_left : &(*link)->_right;
+         }
+
+         if (*link == nullptr) { throw exception::NodeNotFound(); }
+
+         NodePointer node = *link;
+
+         if (node->_left == nullptr || node->_right == nullptr)
+         {
+            *link = (node->_left != nullptr) ? node->_left : node->_right;
+         }
+         else
+         {
+            links.push(link);
+
+            auto right_index = links.size();
+            auto successor_link = &node->_right;
+
+            while ((*successor_link)->_left != nullptr)
+            {
+               links.push(successor_link);
+               successor_link = &(*successor_link)->_left;
+            }
+
+            NodePointer successor = *successor_link;
+            *successor_link = successor->_right;
+
+            successor->_left = node->_left;
+            successor->_right = node->_right;
+            successor->_height = node->_height;
+            *link = successor;
+
+            // the link to the right subtree moved from the removed node to its successor
+            if (links.size() > right_index) { links[right_index] = &successor->_right; }
+         }
+
+         NodePointer update_node = links.empty() ? nullptr : *links.top();
+
+         node->_left = nullptr;
+         node->_right = nullptr;
+         this->deallocate_node(node);
+
+         --this->_size;
+         this->retrace(links);
+
+         return update_node;
+      }
+
+      /// @brief Remove a given node from the tree with the given value.
+      ///
+      /// Note that only the key of the value is used to verify the node to delete, not the whole value itself.
+      ///
+      /// @param value The value object to remove from the tree.
+      ///
+      /// @throw exception::EmptyTree Thrown when the tree is empty.
+      /// @throw exception::NodeNotFound Thrown when the key of the value is not found within the tree.
+      ///
+      NodePointer remove_node(const Value &value) {
+         if (this->is_empty()) { throw exception::EmptyTree(); }
+
+         if constexpr (has_parent_links) { return this->remove_linked_node(KeyOfValue()(value)); }
+         else { return this->remove_unlinked_node(KeyOfValue()(value)); }
+      }
+
+      /// @brief Remove the node with the given key from a tree whose nodes link to their parents.
+      ///
+      /// See remove_node.
+      ///
+      NodePointer remove_linked_node(const Key &key) {
+         auto result = this->locate(key);
+         NodePointer update_node = nullptr;
+
+         if (result.second != 0) { throw exception::NodeNotFound(); }
+
+         auto node = result.first;
+
+         if (node->is_leaf())
+         {
+            if (node->_parent != nullptr)
+            {
+               if (node->_parent->_left == node)
+                  node->_parent->_left = nullptr;
+               else if (node->_parent->_right == node)
+                  node->_parent->_right = nullptr;
+            }
+
+            if (node == this->_root)
+            {
+               this->_root = nullptr;
+            }
+            else
+            {
+               auto parent = node->_parent;
+               node->_parent = nullptr;
+
+               update_node = parent;
+            }
+         }
+         else if (node->_left == nullptr || node->_right == nullptr)
          {
-            if (node->_parent != nullptr)
+            NodePointer replacement_node;
+
+            if (node->_left == nullptr)
+               replacement_node = node->_right;
+            else
+               replacement_node = node->_left;
+
+            replacement_node->_parent = node->_parent;
+
+            if (node == this->_root)
             {
-               if (node->_parent->_left == node)
-                  node->_parent->_left.reset();
-               else if (node->_parent->_right == node)
-                  node->_parent->_right.reset();
+               this->_root = replacement_node;
+               update_node = this->_root;
+            }
+            else if (node->_parent->_left == node)
+            {
+               node->_parent->_left = replacement_node;
+               update_node = node->_parent;
+            }
+            else if (node->_parent->_right == node)
+            {
+               node->_parent->_right = replacement_node;
+               update_node = node->_parent;
+            }
+         }
+         else if (node->_left != nullptr && node->_right != nullptr)
+         {
+            auto leftmost = node->_right;
+
+            while (leftmost->_left != nullptr)
+               leftmost = leftmost->_left;
+
+            auto replaced_node = leftmost->_right;
+            auto leftmost_parent = leftmost->_parent;
+
+            if (leftmost_parent == node) {
+               node->_right = replaced_node;
+            }
+            else {
+               leftmost->_parent->_left = replaced_node;
+
+               if (replaced_node != nullptr)
+                  replaced_node->_parent = leftmost->_parent;
+            }
+
+            leftmost->copy_node_data(*node);
+
+            if (leftmost->_left != nullptr)
+               leftmost->_left->_parent = leftmost;
+
+            if (leftmost->_right != nullptr)
+               leftmost->_right->_parent = leftmost;
+
+            if (leftmost->_parent != nullptr)
+            {
+               if (node == leftmost->_parent->_left)
+                  leftmost->_parent->_left = leftmost;
+               else if (node == leftmost->_parent->_right)
+                  leftmost->_parent->_right = leftmost;
             }
 
-            if (node == this->_root)
-            {
-               this->_root.reset();
-            }
-            else
-            {
-               auto parent = node->_parent;
-               node->_parent.reset();
+            if (node == this->_root)
+               this->_root = leftmost;
+
+            // the subtree under the successor moved up whole, so the first height which changed is the one of
+            // its old parent, or of the successor itself when it was the right child of the removed node
+            if (leftmost_parent != node)
+               update_node = leftmost_parent;
+            else
+               update_node = leftmost;
+         }
+
+         // the greatest node is found again by the next append
+         if (node == this->_rightmost) { this->_rightmost = nullptr; }
+
+         node->_left = nullptr;
+         node->_right = nullptr;
+         node->_parent = nullptr;
+         this->deallocate_node(node);
+
+         --this->_size;
+
+         if (update_node != nullptr) { this->self().update_node(update_node); }
+
+         return update_node;
+      }
+
+   public:
+      /// @brief An iterator that performs an in-order traversal on the tree.
+      ///
+      /// Like every iterator of the tree, it declares the steps of its base again so that they return the
+      /// iterator itself, and postfix steps return a copy of the iterator from before the step.
+      ///
+      class inorder_iterator : public inorder_iterator_base<NodePointer>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = NodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         inorder_iterator(NodePointer node) : inorder_iterator_base<NodePointer>(node) {}
+
+         inorder_iterator &operator++() { inorder_iterator_base<NodePointer>::operator++(); return *this; }
+         inorder_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+         inorder_iterator &operator--() { inorder_iterator_base<NodePointer>::operator--(); return *this; }
+         inorder_iterator operator--(int) { auto tmp = *this; --(*this); return tmp; }
+         inorder_iterator &operator+=(difference_type offset) { inorder_iterator_base<NodePointer>::operator+=(offset); return *this; }
+         
+         reference operator*() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node;
+         }
+         pointer operator->() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return &this->node;
+         }
+      };
+
+      /// @brief An iterator that performs an in-order traversal on the tree, returning const nodes.
+      ///
+      class const_inorder_iterator : public inorder_iterator_base<ConstNodePointer>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = ConstNodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         const_inorder_iterator(ConstNodePointer node) : inorder_iterator_base<ConstNodePointer>(node) {}
+         /// @brief Convert a mutable iterator at the same position, so that the two can be compared.
+         ///
+         /// This is a template so that a node pointer, which converts to both kinds of iterator, still picks the
+         /// constructor above.
+         ///
+         template <typename Iterator, typename = std::enable_if_t<std::is_same<Iterator, inorder_iterator>::value>>
+         const_inorder_iterator(const Iterator &iter) : inorder_iterator_base<ConstNodePointer>(iter) {}
+
+         const_inorder_iterator &operator++() { inorder_iterator_base<ConstNodePointer>::operator++(); return *this; }
+         const_inorder_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+         const_inorder_iterator &operator--() { inorder_iterator_base<ConstNodePointer>::operator--(); return *this; }
+         const_inorder_iterator operator--(int) { auto tmp = *this; --(*this); return tmp; }
+         const_inorder_iterator &operator+=(difference_type offset) { inorder_iterator_base<ConstNodePointer>::operator+=(offset); return *this; }
+
+         reference operator*() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node;
+         }
+         pointer operator->() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return &this->node;
+         }
+      };
+
+      /// @brief An iterator that performs a pre-order traversal on the tree.
+      ///
+      class preorder_iterator : public preorder_iterator_base<NodePointer>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = NodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         preorder_iterator(NodePointer node) : preorder_iterator_base<NodePointer>(node) {}
+
+         preorder_iterator &operator++() { preorder_iterator_base<NodePointer>::operator++(); return *this; }
+         preorder_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+         
+         reference operator*() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node;
+         }
+         pointer operator->() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return &this->node;
+         }
+      };
+
+      /// @brief An iterator that performs a pre-order traversal on the tree, returning const nodes.
+      ///
+      class const_preorder_iterator : public preorder_iterator_base<ConstNodePointer>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = ConstNodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         const_preorder_iterator(ConstNodePointer node) : preorder_iterator_base<ConstNodePointer>(node) {}
+
+         const_preorder_iterator &operator++() { preorder_iterator_base<ConstNodePointer>::operator++(); return *this; }
+         const_preorder_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+
+         reference operator*() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node;
+         }
+         pointer operator->() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return &this->node;
+         }
+      };
+
+      /// @brief An iterator that performs a post-order traversal on the tree.
+      ///
+      class postorder_iterator : public postorder_iterator_base<NodePointer>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = NodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         postorder_iterator(NodePointer node) : postorder_iterator_base<NodePointer>(node) {}
+
+         postorder_iterator &operator++() { postorder_iterator_base<NodePointer>::operator++(); return *this; }
+         postorder_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+         
+         reference operator*() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node;
+         }
+         pointer operator->() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return &this->node;
+         }
+      };
+
+      /// @brief An iterator that performs a post-order traversal on the tree, returning const nodes.
+      ///
+      class const_postorder_iterator : public postorder_iterator_base<ConstNodePointer>
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = ConstNodePointer;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         const_postorder_iterator(ConstNodePointer node) : postorder_iterator_base<ConstNodePointer>(node) {}
+
+         const_postorder_iterator &operator++() { postorder_iterator_base<ConstNodePointer>::operator++(); return *this; }
+         const_postorder_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+
+         reference operator*() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node;
+         }
+         pointer operator->() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return &this->node;
+         }
+      };
+
+      /// @brief An iterator that yields value objects instead of nodes.
+      ///
+      /// Stepping backward and jumping are only available on top of the in-order iterators.
+      ///
+      /// @tparam iterator_base The base iterator to use as an iterator for this iterator. Options
+      /// are inorder_iterator, preorder_iterator and postorder_iterator.
+      ///
+      template <typename iterator_base>
+      class value_iterator : public iterator_base
+      {
+         static_assert(std::is_same<iterator_base, inorder_iterator>::value ||
+                       std::is_same<iterator_base, preorder_iterator>::value ||
+                       std::is_same<iterator_base, postorder_iterator>::value,
+                       "Value iterator base must be an inorder_iterator, a preorder_iterator or a postorder_iterator.");
+
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = Value;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         value_iterator(NodePointer node) : iterator_base(node) {}
+
+         value_iterator &operator++() { iterator_base::operator++(); return *this; }
+         value_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+         value_iterator &operator--() { iterator_base::operator--(); return *this; }
+         value_iterator operator--(int) { auto tmp = *this; --(*this); return tmp; }
+         value_iterator &operator+=(difference_type offset) { iterator_base::operator+=(offset); return *this; }
+
+         reference operator*() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node->value();
+         }
+
+         const reference operator*() const {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node->value();
+         }
 
-               update_node = parent;
-            }
+         pointer operator->() {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return &this->node->value();
          }
-         else if (node->_left == nullptr || node->_right == nullptr)
-         {
-            SharedNode replacement_node;
 
-            if (node->_left == nullptr)
-               replacement_node = node->_right;
-            else
-               replacement_node = node->_left;
+         const pointer operator->() const {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
 
-            replacement_node->_parent = node->_parent;
+            return &this->node->value();
+         }
+      };
 
-            if (node == this->_root)
-            {
-               this->_root = replacement_node;
-               update_node = this->_root;
-            }
-            else if (node->_parent->_left == node)
-            {
-               node->_parent->_left = replacement_node;
-               update_node = node->_parent;
-            }
-            else if (node->_parent->_right == node)
-            {
-               node->_parent->_right = replacement_node;
-               update_node = node->_parent;
-            }
+      /// @brief An iterator that yields const value objects instead of nodes.
+      ///
+      /// @tparam iterator_base The base iterator to use as an iterator for this iterator. Options
+      /// are inorder_iterator, preorder_iterator and postorder_iterator.
+      ///
+      template <typename iterator_base>
+      class const_value_iterator : public iterator_base
+      {
+         static_assert(std::is_same<iterator_base, const_inorder_iterator>::value ||
+                       std::is_same<iterator_base, const_preorder_iterator>::value ||
+                       std::is_same<iterator_base, const_postorder_iterator>::value,
+                       "Value iterator base must be a const_inorder_iterator, a const_preorder_iterator or a const_postorder_iterator.");
+
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = const Value;
+         using pointer = value_type *;
+         using reference = value_type &;
+
+         const_value_iterator(ConstNodePointer node) : iterator_base(node) {}
+
+         const_value_iterator &operator++() { iterator_base::operator++(); return *this; }
+         const_value_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+         const_value_iterator &operator--() { iterator_base::operator--(); return *this; }
+         const_value_iterator operator--(int) { auto tmp = *this; --(*this); return tmp; }
+         const_value_iterator &operator+=(difference_type offset) { iterator_base::operator+=(offset); return *this; }
+
+         reference operator*() const {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return this->node->value();
          }
-         else if (node->_left != nullptr && node->_right != nullptr)
+
+         pointer operator->() const {
+            if (this->node == nullptr) { throw exception::NullPointer(); }
+
+            return &this->node->value();
+         }
+      };
+
+      /// @brief A pair of iterators delimiting part of a traversal, which range-based for loops can walk.
+      ///
+      /// @tparam Iterator The iterator of the traversal.
+      ///
+      template <typename Iterator>
+      struct range_view {
+         Iterator first;
+         Iterator last;
+
+         Iterator begin() const { return this->first; }
+         Iterator end() const { return this->last; }
+         bool empty() const { return this->first == this->last; }
+      };
+
+      using iterator = value_iterator<inorder_iterator>;
+      using const_iterator = const_value_iterator<const_inorder_iterator>;
+
+      AVLTreeBase() : _root(nullptr), _size(0), _rightmost(nullptr), _balance_limit(1), _deferred_rotations(0), _compare() {}
+      explicit AVLTreeBase(const Allocator &allocator)
+         : _root(nullptr), _size(0), _allocator(allocator), _rightmost(nullptr), _balance_limit(1), _deferred_rotations(0), _compare() {}
+      /// @brief Construct an empty tree which orders its keys with the given comparator.
+      ///
+      explicit AVLTreeBase(const KeyCompare &compare, const Allocator &allocator=Allocator())
+         : _root(nullptr), _size(0), _allocator(allocator), _rightmost(nullptr), _balance_limit(1), _deferred_rotations(0), _compare(compare) {}
+      /// @brief Construct a tree from the given values.
+      ///
+      /// If the values are already sorted by strictly increasing keys, the tree is built in linear time
+      /// with assign_sorted. Otherwise each value is inserted in turn.
+      ///
+      AVLTreeBase(const std::vector<Value> &nodes, const Allocator &allocator=Allocator())
+         : _root(nullptr), _size(0), _allocator(allocator), _rightmost(nullptr), _balance_limit(1), _deferred_rotations(0), _compare()
+      {
+         if (this->is_sorted_unique(nodes.begin(), nodes.end()))
          {
-            auto leftmost = node->_right;
+            this->assign_sorted(nodes.begin(), nodes.end());
+            return;
+         }
+         
+         try {
+            for (auto &node : nodes)
+               this->self().add_node(node);
+         }
+         catch (...) {
+            // the destructor doesn't run when a constructor throws
+            this->destroy();
+            throw;
+         }
+      }
+      AVLTreeBase(std::vector<Value> &&nodes, const Allocator &allocator=Allocator())
+         : _root(nullptr), _size(0), _allocator(allocator), _rightmost(nullptr), _balance_limit(1), _deferred_rotations(0), _compare()
+      {
+         if (this->is_sorted_unique(nodes.begin(), nodes.end()))
+         {
+            this->assign_sorted(std::make_move_iterator(nodes.begin()), std::make_move_iterator(nodes.end()));
+            return;
+         }
+         
+         try {
+            for (auto &node : nodes)
+               this->self().add_node(std::move(node));
+         }
+         catch (...) {
+            // the destructor doesn't run when a constructor throws
+            this->destroy();
+            throw;
+         }
+      }
+      AVLTreeBase(const AVLTreeBase &other)
+         : _root(nullptr),
+           _size(0),
+           _allocator(std::allocator_traits<NodeAllocator>::select_on_container_copy_construction(other._allocator)),
+           _rightmost(nullptr),
+           _balance_limit(other._balance_limit),
+           _deferred_rotations(other._deferred_rotations),
+           _compare(other._compare)
+      {
+         this->copy(other);
+      }
+      /// @brief Take the nodes of the other tree, leaving it empty.
+      ///
+      /// The allocator is copied rather than moved so the other tree remains usable.
+      ///
+      AVLTreeBase(AVLTreeBase &&other) noexcept
+         : _root(std::move(other._root)), _size(other._size), _allocator(other._allocator), _rightmost(std::move(other._rightmost)),
+           _balance_limit(other._balance_limit), _deferred_rotations(other._deferred_rotations), _compare(other._compare)
+      {
+         other._root = nullptr;
+         other._size = 0;
+         other._rightmost = nullptr;
+         other._deferred_rotations = 0;
+      }
+      virtual ~AVLTreeBase() {
+         this->destroy();
+      }
 
-            while (leftmost->_left != nullptr)
-               leftmost = leftmost->_left;
+      AVLTreeBase &operator=(const AVLTreeBase &other) {
+         if (this != &other)
+         {
+            this->copy(other);
+            this->_balance_limit = other._balance_limit;
+            this->_deferred_rotations = other._deferred_rotations;
+            this->_compare = other._compare;
+         }
 
-            auto replaced_node = leftmost->_right;
-            auto leftmost_parent = leftmost->_parent;
+         return *this;
+      }
+      /// @brief Destroy this tree and take the nodes of the other tree.
+      ///
+      /// This is constant time when the allocator propagates on move assignment or the allocators are equal.
+      /// Otherwise the nodes can't change hands, and they are copied into this tree's allocator instead.
+      ///
+      AVLTreeBase &operator=(AVLTreeBase &&other)
+         noexcept(std::allocator_traits<NodeAllocator>::propagate_on_container_move_assignment::value ||
+                  std::allocator_traits<NodeAllocator>::is_always_equal::value)
+      {
+         using Traits = std::allocator_traits<NodeAllocator>;
+         
+         if (this == &other) { return *this; }
 
-            if (leftmost_parent == node) {
-               node->_right = replaced_node;
-            }
-            else {
-               leftmost->_parent->_left = replaced_node;
+         if (!Traits::propagate_on_container_move_assignment::value && this->_allocator != other._allocator)
+         {
+            this->copy(other);
+            this->_balance_limit = other._balance_limit;
+            this->_deferred_rotations = other._deferred_rotations;
+            this->_compare = other._compare;
+            other.destroy();
+            return *this;
+         }
 
-               if (replaced_node != nullptr)
-                  replaced_node->_parent = leftmost->_parent;
-            }
+         this->destroy();
 
-            leftmost->copy_node_data(*node);
+         if constexpr (Traits::propagate_on_container_move_assignment::value)
+            this->_allocator = other._allocator;
+
+         this->_root = std::move(other._root);
+         this->_size = other._size;
+         this->_rightmost = std::move(other._rightmost);
+         this->_balance_limit = other._balance_limit;
+         this->_deferred_rotations = other._deferred_rotations;
+         this->_compare = other._compare;
+         other._root = nullptr;
+         other._size = 0;
+         other._rightmost = nullptr;
+         other._deferred_rotations = 0;
+
+         return *this;
+      }
 
-            if (leftmost->_left != nullptr)
-               leftmost->_left->_parent = leftmost;
+      /// @brief Swap the nodes of this tree with the nodes of the other tree in constant time.
+      ///
+      void swap(AVLTreeBase &other) noexcept {
+         using std::swap;
 
-            if (leftmost->_right != nullptr)
-               leftmost->_right->_parent = leftmost;
+         if constexpr (std::allocator_traits<NodeAllocator>::propagate_on_container_swap::value)
+            swap(this->_allocator, other._allocator);
 
-            if (leftmost->_parent != nullptr)
-            {
-               if (node == leftmost->_parent->_left)
-                  leftmost->_parent->_left = leftmost;
-               else if (node == leftmost->_parent->_right)
-                  leftmost->_parent->_right = leftmost;
-            }
+         swap(this->_root, other._root);
+         swap(this->_size, other._size);
+         swap(this->_rightmost, other._rightmost);
+         swap(this->_balance_limit, other._balance_limit);
+         swap(this->_deferred_rotations, other._deferred_rotations);
+         swap(this->_compare, other._compare);
+      }
 
-            if (node == this->_root)
-               this->_root = leftmost;
+      /// @brief Return an iterator at the beginning of an in-order traversal.
+      ///
+      inorder_iterator begin_inorder() { return inorder_iterator(this->_root); }
+      /// @brief Return an iterator at the end of an in-order traversal.
+      ///
+      inorder_iterator end_inorder() { return inorder_iterator(nullptr); }
+      /// @brief Return a const iterator at the beginning of an in-order traversal.
+      ///
+      const_inorder_iterator cbegin_inorder() const { return const_inorder_iterator(this->_root); }
+      /// @brief Return a const iterator at the end of an in-order traversal.
+      ///
+      const_inorder_iterator cend_inorder() const { return const_inorder_iterator(nullptr); }
+      /// @brief Return an iterator at the last node of an in-order traversal, for walking the tree backward.
+      ///
+      /// Decrementing the iterator visits the nodes in reverse order, and yields end_inorder past the first node.
+      ///
+      inorder_iterator last_inorder() {
+         inorder_iterator iter(nullptr);
+         iter.seek_last(this->_root);
 
-            if (replaced_node != nullptr)
-               update_node = replaced_node;
-            else if (leftmost_parent != node)
-               update_node = leftmost_parent;
-            else
-               update_node = leftmost;
-         }
+         return iter;
+      }
+      /// @brief Return a const iterator at the last node of an in-order traversal. See last_inorder.
+      ///
+      const_inorder_iterator clast_inorder() const {
+         const_inorder_iterator iter(nullptr);
+         iter.seek_last(this->_root);
 
-         node->_left.reset();
-         node->_right.reset();
-         node->_parent.reset();
+         return iter;
+      }
 
-         --this->_size;
+      /// @brief Return an in-order iterator at the first node whose key is not less than the given key.
+      ///
+      /// This takes a single O(log n) descent, from which the iterator carries on in order.
+      ///
+      /// @param key The key to search for.
+      /// @returns The iterator at the node, or end_inorder if every key is less than the given key.
+      ///
+      inorder_iterator lower_bound(const Key &key) { return this->template lower_bound<Key>(key); }
+      /// @brief Return a const in-order iterator at the first node whose key is not less than the given key.
+      ///
+      /// See lower_bound.
+      ///
+      const_inorder_iterator lower_bound(const Key &key) const { return this->template lower_bound<Key>(key); }
+      /// @brief Return an in-order iterator at the first node whose key is greater than the given key.
+      ///
+      /// @param key The key to search for.
+      /// @returns The iterator at the node, or end_inorder if no key is greater than the given key.
+      ///
+      inorder_iterator upper_bound(const Key &key) { return this->template upper_bound<Key>(key); }
+      /// @brief Return a const in-order iterator at the first node whose key is greater than the given key.
+      ///
+      /// See upper_bound.
+      ///
+      const_inorder_iterator upper_bound(const Key &key) const { return this->template upper_bound<Key>(key); }
+      /// @brief Return an in-order iterator at the first node whose key is not less than the given key, which may be
+      /// of any type the comparator is transparent for.
+      ///
+      /// This searches a tree of strings with a std::string_view or a C string, say, without building a key to
+      /// search with. See lower_bound(const Key &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      inorder_iterator lower_bound(const K &key) {
+         inorder_iterator iter(nullptr);
+         iter.seek(this->_root, key, false, this->_compare);
+
+         return iter;
+      }
+      /// @brief Return a const in-order iterator at the first node whose key is not less than the given key. See
+      /// lower_bound(const K &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      const_inorder_iterator lower_bound(const K &key) const {
+         const_inorder_iterator iter(nullptr);
+         iter.seek(this->_root, key, false, this->_compare);
+
+         return iter;
+      }
+      /// @brief Return an in-order iterator at the first node whose key is greater than the given key, which may be
+      /// of any type the comparator is transparent for. See lower_bound(const K &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      inorder_iterator upper_bound(const K &key) {
+         inorder_iterator iter(nullptr);
+         iter.seek(this->_root, key, true, this->_compare);
+
+         return iter;
+      }
+      /// @brief Return a const in-order iterator at the first node whose key is greater than the given key. See
+      /// upper_bound(const K &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      const_inorder_iterator upper_bound(const K &key) const {
+         const_inorder_iterator iter(nullptr);
+         iter.seek(this->_root, key, true, this->_compare);
+
+         return iter;
+      }
+      /// @brief Return the range of nodes with the given key, which holds one node at most.
+      ///
+      /// @param key The key to search for.
+      /// @returns The pair of lower_bound and upper_bound of the key, found with a single descent.
+      ///
+      std::pair<inorder_iterator, inorder_iterator> equal_range(const Key &key) { return this->template equal_range<Key>(key); }
+      /// @brief Return the const range of nodes with the given key. See equal_range.
+      ///
+      std::pair<const_inorder_iterator, const_inorder_iterator> equal_range(const Key &key) const { return this->template equal_range<Key>(key); }
+      /// @brief Return the range of nodes with the given key, which may be of any type the comparator is transparent
+      /// for. See equal_range(const Key &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      std::pair<inorder_iterator, inorder_iterator> equal_range(const K &key) {
+         auto first = this->lower_bound(key);
+         auto last = first;
+
+         if (last != this->end_inorder() && this->compare_keys(key, (*last)->key()) == 0) { ++last; }
+
+         return std::make_pair(first, last);
+      }
+      /// @brief Return the const range of nodes with the given key. See equal_range(const K &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      std::pair<const_inorder_iterator, const_inorder_iterator> equal_range(const K &key) const {
+         auto first = this->lower_bound(key);
+         auto last = first;
+
+         if (last != this->cend_inorder() && this->compare_keys(key, (*last)->key()) == 0) { ++last; }
+
+         return std::make_pair(first, last);
+      }
+      /// @brief Return the nodes whose keys are within the half-open range [low, high), in order.
+      ///
+      /// Both ends are found with an O(log n) descent, so iterating the range visits only the nodes inside it
+      /// and compares no keys.
+      ///
+      /// @param low The inclusive lower bound of the range.
+      /// @param high The exclusive upper bound of the range.
+      /// @returns The view of the range, which is empty if the high bound isn't greater than the low one.
+      ///
+      range_view<inorder_iterator> range(const Key &low, const Key &high) {
+         auto first = this->lower_bound(low);
+
+         if (!this->key_less(low, high)) { return range_view<inorder_iterator>{first, first}; }
+
+         return range_view<inorder_iterator>{first, this->lower_bound(high)};
+      }
+      /// @brief Return the const nodes whose keys are within the half-open range [low, high). See range.
+      ///
+      range_view<const_inorder_iterator> range(const Key &low, const Key &high) const {
+         auto first = this->lower_bound(low);
+
+         if (!this->key_less(low, high)) { return range_view<const_inorder_iterator>{first, first}; }
+
+         return range_view<const_inorder_iterator>{first, this->lower_bound(high)};
+      }
+
+      /// @brief Return an iterator at the beginning of a pre-order traversal.
+      ///
+      preorder_iterator begin_preorder() { return preorder_iterator(this->_root); }
+      /// @brief Return an iterator at the end of a pre-order traversal.
+      ///
+      preorder_iterator end_preorder() { return preorder_iterator(nullptr); }
+      /// @brief Return a const iterator at the beginning of a pre-order traversal.
+      ///
+      const_preorder_iterator cbegin_preorder() const { return const_preorder_iterator(this->_root); }
+      /// @brief Return a const iterator at the end of a pre-order traversal.
+      ///
+      const_preorder_iterator cend_preorder() const { return const_preorder_iterator(nullptr); }
+
+      /// @brief Return an iterator at the beginning of a post-order traversal.
+      ///
+      postorder_iterator begin_postorder() { return postorder_iterator(this->_root); }
+      /// @brief Return an iterator at the end of a post-order traversal.
+      ///
+      postorder_iterator end_postorder() { return postorder_iterator(nullptr); }
+      /// @brief Return a const iterator at the beginning of a post-order traversal.
+      ///
+      const_postorder_iterator cbegin_postorder() const { return const_postorder_iterator(this->_root); }
+      /// @brief Return a const iterator at the end of a post-order traversal.
+      ///
+      const_postorder_iterator cend_postorder() const { return const_postorder_iterator(nullptr); }
+
+      /// @brief Returns a value iterator at the beginning of an in-order traversal.
+      ///
+      value_iterator<inorder_iterator> begin_values_inorder() { return value_iterator<inorder_iterator>(this->_root); }
+      /// @brief Returns a value iterator at the end of an in-order traversal.
+      ///
+      value_iterator<inorder_iterator> end_values_inorder() { return value_iterator<inorder_iterator>(nullptr); }
+      /// @brief Returns a const value iterator at the beginning of an in-order traversal.
+      ///
+      const_value_iterator<const_inorder_iterator> cbegin_values_inorder() { return const_value_iterator<const_inorder_iterator>(this->_root); }
+      /// @brief Returns a const value iterator at the end of an in-order traversal.
+      ///
+      const_value_iterator<const_inorder_iterator> cend_values_inorder() { return const_value_iterator<const_inorder_iterator>(nullptr); }
 
-         if (update_node != nullptr) { this->update_node(update_node); }
+      /// @brief Returns a value iterator at the beginning of a pre-order traversal.
+      ///
+      value_iterator<preorder_iterator> begin_values_preorder() { return value_iterator<preorder_iterator>(this->_root); }
+      /// @brief Returns a value iterator at the end of a pre-order traversal.
+      ///
+      value_iterator<preorder_iterator> end_values_preorder() { return value_iterator<preorder_iterator>(nullptr); }
+      /// @brief Returns a const value iterator at the beginning of a pre-order traversal.
+      ///
+      const_value_iterator<const_preorder_iterator> cbegin_values_preorder() { return const_value_iterator<const_preorder_iterator>(this->_root); }
+      /// @brief Returns a const value iterator at the end of a pre-order traversal.
+      ///
+      const_value_iterator<const_preorder_iterator> cend_values_preorder() { return const_value_iterator<const_preorder_iterator>(nullptr); }
 
-         return update_node;
-      }
+      /// @brief Returns a value iterator at the beginning of a post-order traversal.
+      ///
+      value_iterator<postorder_iterator> begin_values_postorder() { return value_iterator<postorder_iterator>(this->_root); }
+      /// @brief Returns a value iterator at the end of a post-order traversal.
+      ///
+      value_iterator<postorder_iterator> end_values_postorder() { return value_iterator<postorder_iterator>(nullptr); }
+      /// @brief Returns a const value iterator at the beginning of a post-order traversal.
+      ///
+      const_value_iterator<const_postorder_iterator> cbegin_values_postorder() { return const_value_iterator<const_postorder_iterator>(this->_root); }
+      /// @brief Returns a const value iterator at the end of a post-order traversal.
+      ///
+      const_value_iterator<const_postorder_iterator> cend_values_postorder() { return const_value_iterator<const_postorder_iterator>(nullptr); }
 
-   public:
-      /// @brief An iterator that performs an in-order traversal on the tree.
+      /// @brief Returns a default iterator to the beginning of the tree.
       ///
-      class inorder_iterator : public inorder_iterator_base<SharedNode>
-      {
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = SharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
+      /// The default iterator is an in-order value iterator, which visits the values sorted by key.
+      ///
+      iterator begin() { return iterator(this->_root); }
+      /// @brief Returns a default iterator to the end of the tree.
+      ///
+      /// The default iterator is an in-order value iterator, which visits the values sorted by key.
+      ///
+      iterator end() { return iterator(nullptr); }
 
-         inorder_iterator(SharedNode node) : inorder_iterator_base<SharedNode>(node) {}
-         
-         reference operator*() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+      /// @brief Returns a default const iterator to the beginning of the tree.
+      ///
+      /// The default iterator is an in-order value iterator, which visits the values sorted by key.
+      ///
+      const_iterator cbegin() const { return const_iterator(this->_root); }
+      /// @brief Returns a default const iterator to the end of the tree.
+      ///
+      /// The default iterator is an in-order value iterator, which visits the values sorted by key.
+      ///
+      const_iterator cend() const { return const_iterator(nullptr); }
 
-            return this->node;
-         }
-         pointer operator->() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+      /// @brief Determine if the tree is empty.
+      /// @returns True if the tree is empty, false otherwise.
+      ///
+      inline bool is_empty() const { return this->_root == nullptr; }
+      /// @brief Get the root node of this tree.
+      ///
+      inline NodePointer root() { return this->_root; }
+      /// @brief Get the const root node of this tree.
+      ///
+      inline ConstNodePointer root() const { return this->_root; }
+      /// @brief Determine if the given key exists in the tree.
+      /// @param key The key value to search for.
+      /// @returns True if the key was found, false otherwise.
+      ///
+      bool contains(const Key &key) const { return this->template contains<Key>(key); }
+      /// @brief Determine if the given key, which may be of any type the comparator is transparent for, exists in
+      /// the tree. See contains(const Key &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      bool contains(const K &key) const {
+         auto result = this->locate(key);
 
-            return &this->node;
-         }
-      };
+         return result.first != nullptr && result.second == 0;
+      }
+      /// @brief Locate the given key in the tree, returning const nodes.
+      ///
+      /// This is the point lookup used throughout the tree. Unlike search, it does not record the path
+      /// it takes, so it never allocates and only copies out the node it stops on.
+      ///
+      /// @param key The key value to search for.
+      /// @returns A pair of the last node visited and the branch taken from it: 0 means the node matched the key,
+      /// -1 means the key belongs to its left and 1 means the key belongs to its right. The node is null when
+      /// the tree is empty.
+      ///
+      std::pair<ConstNodePointer, int> locate(const Key &key) const { return this->template locate<Key>(key); }
+      /// @brief Locate the given key in the tree.
+      ///
+      /// See locate(const Key &key) const.
+      ///
+      std::pair<NodePointer, int> locate(const Key &key) { return this->template locate<Key>(key); }
+      /// @brief Locate the given key, which may be of any type the comparator is transparent for, in the tree,
+      /// returning const nodes. See locate(const Key &key) const.
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      std::pair<ConstNodePointer, int> locate(const K &key) const {
+         int branch = 0;
+         auto &node = this->locate_link(key, branch);
 
-      /// @brief An iterator that performs an in-order traversal on the tree, returning const nodes.
+         return std::make_pair(ConstNodePointer(node), branch);
+      }
+      /// @brief Locate the given key, which may be of any type the comparator is transparent for, in the tree.
+      /// See locate(const Key &key) const.
       ///
-      class const_inorder_iterator : public inorder_iterator_base<ConstSharedNode>
-      {
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = ConstSharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
+      template <typename K, typename = enable_if_lookup<K>>
+      std::pair<NodePointer, int> locate(const K &key) {
+         int branch = 0;
+         auto &node = this->locate_link(key, branch);
 
-         const_inorder_iterator(ConstSharedNode node) : inorder_iterator_base<ConstSharedNode>(node) {}
+         return std::make_pair(node, branch);
+      }
+      /// @brief Locate where the given key would be inserted into the tree.
+      ///
+      /// This is locate, except a key past the greatest key of a tree whose nodes link to their parents is
+      /// placed right of the cached greatest node without descending the tree, so inserting keys in increasing
+      /// order costs one comparison per key and the rebalancing along the right spine.
+      ///
+      /// @param key The key to locate.
+      /// @returns The same pair as locate.
+      ///
+      std::pair<NodePointer, int> locate_insert(const Key &key) {
+         if constexpr (has_parent_links)
+         {
+            if (this->_root != nullptr)
+            {
+               if (this->_rightmost == nullptr)
+               {
+                  this->_rightmost = this->_root;
 
-         reference operator*() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+                  while (this->_rightmost->_right != nullptr)
+                     this->_rightmost = this->_rightmost->_right;
+               }
 
-            return this->node;
-         }
-         pointer operator->() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+               this->_stats.count_comparisons(1);
 
-            return &this->node;
+               if (this->compare_keys(key, this->_rightmost->key()) > 0) { return std::make_pair(this->_rightmost, 1); }
+            }
          }
-      };
 
-      /// @brief An iterator that performs a pre-order traversal on the tree.
+         return this->locate(key);
+      }
+      /// @brief Search the tree for the given key, returning const nodes.
       ///
-      class preorder_iterator : public preorder_iterator_base<SharedNode>
-      {
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = SharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
-
-         preorder_iterator(SharedNode node) : preorder_iterator_base<SharedNode>(node) {}
-         
-         reference operator*() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+      /// This function does a basic binary traversal on the tree for the given key, with the ability
+      /// to return the path taken in order to find that key-- or to not find that key. It will immediately
+      /// terminate when it finds the given key. If you don't need the path, use locate instead.
+      ///
+      /// @param key The key value to search for.
+      /// @returns A SearchPath of pairs: the node that was traversed, and the number representing the path
+      /// which was taken. 1 means right, -1 means left, 0 means it matched the key.
+      ///
+      SearchPath<ConstNodePointer> search(const Key &key) const {
+         auto result = SearchPath<ConstNodePointer>();
+         auto node = &this->_root;
 
-            return this->node;
-         }
-         pointer operator->() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+         while (*node != nullptr)
+         {
+            auto branch = this->compare_keys(key, (*node)->key());
+            result.push_back(*node, branch);
 
-            return &this->node;
+            if (branch == 0) { break; }
+            else if (branch < 0) { node = &(*node)->_left; }
+            else { node = &(*node)->_right; }
          }
-      };
 
-      /// @brief An iterator that performs a pre-order traversal on the tree, returning const nodes.
+         return result;
+      }
+      /// @brief Search the tree for the given key.
       ///
-      class const_preorder_iterator : public preorder_iterator_base<ConstSharedNode>
-      {
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = ConstSharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
-
-         const_preorder_iterator(ConstSharedNode node) : preorder_iterator_base<ConstSharedNode>(node) {}
-
-         reference operator*() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+      /// This function does a basic binary traversal on the tree for the given key, with the ability
+      /// to return the path taken in order to find that key-- or to not find that key. It will immediately
+      /// terminate when it finds the given key. If you don't need the path, use locate instead.
+      ///
+      /// @param key The key value to search for.
+      /// @returns A SearchPath of pairs: the node that was traversed, and the number representing the path
+      /// which was taken. 1 means right, -1 means left, 0 means it matched the key.
+      ///
+      SearchPath<NodePointer> search(const Key &key) {
+         auto result = SearchPath<NodePointer>();
+         auto node = &this->_root;
 
-            return this->node;
-         }
-         pointer operator->() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+         while (*node != nullptr)
+         {
+            auto branch = this->compare_keys(key, (*node)->key());
+            result.push_back(*node, branch);
 
-            return &this->node;
+            if (branch == 0) { break; }
+            else if (branch < 0) { node = &(*node)->_left; }
+            else { node = &(*node)->_right; }
          }
-      };
 
-      /// @brief An iterator that performs a post-order traversal on the tree.
+         return result;
+      }
+      /// @brief Attempt to find the node corresponding to the given key in this tree.
       ///
-      class postorder_iterator : public postorder_iterator_base<SharedNode>
-      {
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = SharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
-
-         postorder_iterator(SharedNode node) : postorder_iterator_base<SharedNode>(node) {}
-         
-         reference operator*() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+      /// @param key The key to search for.
+      /// @returns The node with the given key, or std::nullopt if no node was found.
+      ///
+      std::optional<NodePointer> find(const Key &key) { return this->template find<Key>(key); }
+      /// @brief Attempt to find the const node corresponding to the given key in this tree.
+      ///
+      /// @param key The key to search for.
+      /// @returns The node with the given key, or std::nullopt if no node was found.
+      ///
+      std::optional<ConstNodePointer> find(const Key &key) const { return this->template find<Key>(key); }
+      /// @brief Attempt to get the node with the given key in the tree, throwing an exception if it fails.
+      /// @param key The key to search for.
+      /// @returns The node corresponding to the given key.
+      /// @throws exception::KeyNotFound Thrown if the key is not found in the tree.
+      ///
+      NodePointer get(const Key &key) { return this->template get<Key>(key); }
+      /// @brief Attempt to get the const node with the given key in the tree, throwing an exception if it fails.
+      /// @param key The key to search for.
+      /// @returns The node corresponding to the given key.
+      /// @throws exception::KeyNotFound Thrown if the key is not found in the tree.
+      ///
+      ConstNodePointer get(const Key &key) const { return this->template get<Key>(key); }
+      /// @brief Attempt to find the node with the given key, which may be of any type the comparator is transparent
+      /// for. See find(const Key &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      std::optional<NodePointer> find(const K &key) {
+         auto result = this->locate(key);
 
-            return this->node;
-         }
-         pointer operator->() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+         if (result.first != nullptr && result.second == 0) { return result.first; }
+         else { return std::nullopt; }
+      }
+      /// @brief Attempt to find the const node with the given key, which may be of any type the comparator is
+      /// transparent for. See find(const Key &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      std::optional<ConstNodePointer> find(const K &key) const {
+         auto result = this->locate(key);
 
-            return &this->node;
-         }
-      };
+         if (result.first != nullptr && result.second == 0) { return result.first; }
+         else { return std::nullopt; }
+      }
+      /// @brief Get the node with the given key, which may be of any type the comparator is transparent for. See
+      /// get(const Key &key).
+      ///
+      template <typename K, typename = enable_if_lookup<K>>
+      NodePointer get(const K &key) {
+         auto result = this->locate(key);
 
-      /// @brief An iterator that performs a post-order traversal on the tree, returning const nodes.
+         if (result.first == nullptr || result.second != 0) { throw exception::KeyNotFound(); }
+         return result.first;
+      }
+      /// @brief Get the const node with the given key, which may be of any type the comparator is transparent for.
+      /// See get(const Key &key).
       ///
-      class const_postorder_iterator : public postorder_iterator_base<ConstSharedNode>
-      {
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = ConstSharedNode;
-         using pointer = value_type *;
-         using reference = value_type &;
+      template <typename K, typename = enable_if_lookup<K>>
+      ConstNodePointer get(const K &key) const {
+         auto result = this->locate(key);
 
-         const_postorder_iterator(ConstSharedNode node) : postorder_iterator_base<ConstSharedNode>(node) {}
+         if (result.first == nullptr || result.second != 0) { throw exception::KeyNotFound(); }
+         return result.first;
+      }
+      /// @brief Count the keys in the tree which are less than the given key.
+      ///
+      /// This requires an augmentation policy which counts nodes, such as SubtreeSize, and takes logarithmic time.
+      ///
+      /// @param key The key to rank. It does not need to be in the tree.
+      /// @returns The number of keys less than the given key, which is the in-order position of the key if it
+      /// is in the tree.
+      ///
+      std::size_t rank(const Key &key) const {
+         ConstNodePointer node = this->_root;
+         std::size_t result = 0;
 
-         reference operator*() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+         while (node != nullptr)
+         {
+            auto branch = this->compare_keys(key, node->key());
 
-            return this->node;
-         }
-         pointer operator->() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+            if (branch < 0) { node = node->_left; }
+            else
+            {
+               result += subtree_size(node->_left);
+               if (branch == 0) { break; }
 
-            return &this->node;
+               ++result;
+               node = node->_right;
+            }
          }
-      };
 
-      /// @brief An iterator that yields value objects instead of nodes.
+         return result;
+      }
+      /// @brief Get the const node at the given in-order position, which holds the k-th smallest key.
       ///
-      /// @tparam iterator_base The base iterator to use as an iterator for this iterator. Options
-      /// are inorder_iterator, preorder_iterator and postorder_iterator.
+      /// This requires an augmentation policy which counts nodes, such as SubtreeSize, and takes logarithmic time.
       ///
-      template <typename iterator_base>
-      class value_iterator : public iterator_base
-      {
-         static_assert(std::is_same<iterator_base, inorder_iterator>::value ||
-                       std::is_same<iterator_base, preorder_iterator>::value ||
-                       std::is_same<iterator_base, postorder_iterator>::value,
-                       "Value iterator base must be an inorder_iterator, a preorder_iterator or a postorder_iterator.");
+      /// @param index The zero-based position of the node.
+      /// @returns The node at the given position.
+      /// @throws exception::IndexOutOfRange Thrown when the index is not less than the size of the tree.
+      ///
+      ConstNodePointer select(std::size_t index) const {
+         if (index >= this->_size) { throw exception::IndexOutOfRange(); }
 
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = Value;
-         using pointer = value_type *;
-         using reference = value_type &;
+         return select_node(ConstNodePointer(this->_root), index);
+      }
+      /// @brief Get the node at the given in-order position, which holds the k-th smallest key.
+      ///
+      /// See select(std::size_t index) const.
+      ///
+      NodePointer select(std::size_t index) {
+         if (index >= this->_size) { throw exception::IndexOutOfRange(); }
 
-         value_iterator(SharedNode node) : iterator_base(node) {}
+         return select_node(this->_root, index);
+      }
+      /// @brief Count the keys in the tree within the half-open range [low, high).
+      ///
+      /// This requires an augmentation policy which counts nodes, such as SubtreeSize, and takes logarithmic time.
+      ///
+      /// @param low The inclusive lower bound of the range.
+      /// @param high The exclusive upper bound of the range.
+      /// @returns The number of keys in the range, or 0 if the range is empty.
+      ///
+      std::size_t count_range(const Key &low, const Key &high) const {
+         if (!this->key_less(low, high)) { return 0; }
 
-         reference operator*() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+         return this->rank(high) - this->rank(low);
+      }
+      /// @brief Combine the aggregates of every node with a key within the half-open range [low, high).
+      ///
+      /// The nodes are combined in key order, so the augmentation policy does not need to be commutative. Only the
+      /// two paths bounding the range are walked, which takes logarithmic time. With SubtreeSum, for example,
+      /// this is a range-sum query.
+      ///
+      /// @param low The inclusive lower bound of the range.
+      /// @param high The exclusive upper bound of the range.
+      /// @returns The aggregate of the range, or the identity of the augmentation policy if the range is empty.
+      ///
+      AggregateType aggregate_range(const Key &low, const Key &high) const {
+         ConstNodePointer split = this->_root;
 
-            return this->node->value();
+         while (split != nullptr)
+         {
+            if (this->compare_keys(low, split->key()) > 0) { split = split->_right; }
+            else if (!this->key_less(split->key(), high)) { split = split->_left; }
+            else { break; }
          }
 
-         const reference operator*() const {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
-
-            return this->node->value();
-         }
+         if (split == nullptr) { return Augment::identity(); }
 
-         pointer operator->() {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+         auto left = Augment::identity(), right = Augment::identity();
 
-            return &this->node->value();
+         for (ConstNodePointer node = split->_left; node != nullptr;)
+         {
+            if (this->compare_keys(low, node->key()) > 0) { node = node->_right; }
+            else
+            {
+               left = merge_aggregates(Augment::combine(Augment::identity(), Augment::lift(node->_value), aggregate_of(node->_right)),
+                                       left);
+               node = node->_left;
+            }
          }
 
-         const pointer operator->() const {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
-
-            return &this->node->value();
+         for (ConstNodePointer node = split->_right; node != nullptr;)
+         {
+            if (!this->key_less(node->key(), high)) { node = node->_left; }
+            else
+            {
+               right = merge_aggregates(right,
+                                        Augment::combine(aggregate_of(node->_left), Augment::lift(node->_value), Augment::identity()));
+               node = node->_right;
+            }
          }
-      };
 
-      /// @brief An iterator that yields const value objects instead of nodes.
+         return Augment::combine(left, Augment::lift(split->_value), right);
+      }
+      /// @brief Insert the given value into the tree.
       ///
-      /// @tparam iterator_base The base iterator to use as an iterator for this iterator. Options
-      /// are inorder_iterator, preorder_iterator and postorder_iterator.
+      /// See AVLTreeBase::add_node.
       ///
-      template <typename iterator_base>
-      class const_value_iterator : public iterator_base
-      {
-         static_assert(std::is_same<iterator_base, const_inorder_iterator>::value ||
-                       std::is_same<iterator_base, const_preorder_iterator>::value ||
-                       std::is_same<iterator_base, const_postorder_iterator>::value,
-                       "Value iterator base must be a const_inorder_iterator, a const_preorder_iterator or a const_postorder_iterator.");
-
-      public:
-         using iterator_category = std::forward_iterator_tag;
-         using difference_type = std::ptrdiff_t;
-         using value_type = const Value;
-         using pointer = value_type *;
-         using reference = value_type &;
+      NodePointer insert(const Value &value) {
+         return this->self().add_node(value);
+      }
+      /// @brief Insert the given value into the tree, moving it into the new node.
+      ///
+      /// See AVLTreeBase::add_node.
+      ///
+      NodePointer insert(Value &&value) {
+         return this->self().add_node(std::move(value));
+      }
+      /// @brief Insert the given value near the given hint, like std::map::insert with a hint.
+      ///
+      /// If the value belongs directly before or after the node of the hint, it is linked there without
+      /// searching the tree. An end iterator hints at the end of the tree: a value past the greatest key is
+      /// appended without searching, which makes building a tree from increasing keys cheap. Otherwise the tree
+      /// is searched as usual. See attach_hinted.
+      ///
+      /// @param hint An iterator of this tree close to where the value belongs, or the end iterator.
+      /// @param value The value to insert if its key isn't in the tree.
+      /// @returns The node with the key of the value, which was not replaced if the key already existed.
+      ///
+      NodePointer insert(const inorder_iterator &hint, const Value &value) {
+         return this->attach_hinted(hint.node, this->self().allocate_node(value));
+      }
+      /// @brief Insert the given value near the given hint, moving it into the new node.
+      ///
+      /// See insert(const inorder_iterator &, const Value &).
+      ///
+      NodePointer insert(const inorder_iterator &hint, Value &&value) {
+         return this->attach_hinted(hint.node, this->self().allocate_node(std::move(value)));
+      }
+      /// @brief Insert the given value near the given const hint.
+      ///
+      /// See insert(const inorder_iterator &, const Value &).
+      ///
+      NodePointer insert(const const_inorder_iterator &hint, const Value &value) {
+         return this->attach_hinted(mutable_node(hint.node), this->self().allocate_node(value));
+      }
+      /// @brief Insert the given value near the given const hint, moving it into the new node.
+      ///
+      /// See insert(const inorder_iterator &, const Value &).
+      ///
+      NodePointer insert(const const_inorder_iterator &hint, Value &&value) {
+         return this->attach_hinted(mutable_node(hint.node), this->self().allocate_node(std::move(value)));
+      }
+      /// @brief Insert a value constructed in place from the given arguments.
+      ///
+      /// The node is constructed before the tree is searched, since its key comes from the value. If
+      /// the key already exists, the new node is released and nothing is thrown.
+      ///
+      /// @param args The arguments to pass to the constructor of the value.
+      /// @returns A pair of the node with the key of the value and whether the value was inserted.
+      ///
+      template <typename... Args>
+      std::pair<NodePointer, bool> emplace(Args&&... args) {
+         return this->attach_unique(this->construct_node(std::forward<Args>(args)...));
+      }
+      /// @brief Insert a value constructed in place from the given arguments, near the given hint.
+      ///
+      /// If the value belongs directly before or after the hint, no search of the tree is done.
+      /// See emplace.
+      ///
+      /// @param hint A node of this tree close to where the value belongs, or null.
+      /// @param args The arguments to pass to the constructor of the value.
+      /// @returns The node with the key of the value.
+      ///
+      template <typename... Args>
+      NodePointer emplace_hint(NodePointer hint, Args&&... args) {
+         return this->attach_hinted(hint, this->construct_node(std::forward<Args>(args)...));
+      }
+      /// @brief Find the node with the key of the given value, inserting the value if the key isn't found.
+      ///
+      /// Unlike insert, this does not throw when the key already exists, and the tree is only descended once
+      /// whether or not the key is found.
+      ///
+      /// @param value The value to insert if its key isn't in the tree.
+      /// @returns A pair of the node with the value's key and whether the value was inserted.
+      ///
+      std::pair<NodePointer, bool> find_or_insert(const Value &value) {
+         auto result = this->locate_insert(KeyOfValue()(value));
 
-         const_value_iterator(ConstSharedNode node) : iterator_base(node) {}
+         if (result.first != nullptr && result.second == 0) { return std::make_pair(result.first, false); }
 
-         reference operator*() const {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+         return std::make_pair(this->attach_node(result.first, result.second, this->self().allocate_node(value)), true);
+      }
+      /// @brief Remove a node with the given key from the tree.
+      ///
+      /// See AVLTreeBase::remove_node.
+      ///
+      /// @param key The key to remove from the tree.
+      /// @throws exception::KeyNotFound Thrown if the key isn't found in the tree.
+      ///
+      void remove(const Key &key) {
+         if (this->_root == nullptr) { return; }
+         
+         auto result = this->locate(key);
+         if (result.second != 0) { throw exception::KeyNotFound(); }
+         
+         this->self().remove_node(result.first->value());
+      }
+      /// @brief Convert this tree into a vector.
+      ///
+      /// Performs an in-order traversal on the tree, so the values come out sorted by key.
+      ///
+      /// @returns A vector of values in the tree.
+      std::vector<Value> to_vec() const {
+         return std::vector<Value>(this->cbegin(), this->cend());
+      }
+      /// @brief Replace the contents of this tree with a range of values sorted by strictly increasing keys.
+      ///
+      /// The tree is built bottom-up in linear time: no searching, no allocation besides the nodes themselves
+      /// and no rotations, since the result is perfectly balanced. Input iterators are first collected into a vector.
+      ///
+      /// @param first The beginning of the range of values.
+      /// @param last The end of the range of values.
+      ///
+      /// @throws exception::NotSorted Thrown when the range isn't sorted by strictly increasing keys. The tree
+      /// is left untouched.
+      ///
+      template <typename InputIt>
+      void assign_sorted(InputIt first, InputIt last) {
+         using Category = typename std::iterator_traits<InputIt>::iterator_category;
 
-            return this->node->value();
+         if constexpr (!std::is_base_of<std::forward_iterator_tag, Category>::value)
+         {
+            std::vector<Value> values(first, last);
+            this->assign_sorted(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
          }
+         else
+         {
+            if (!this->is_sorted_unique(first, last)) { throw exception::NotSorted(); }
 
-         pointer operator->() const {
-            if (this->node == nullptr) { throw exception::NullPointer(); }
+            auto count = static_cast<std::size_t>(std::distance(first, last));
+            auto cursor = first;
 
-            return &this->node->value();
+            this->destroy();
+            this->_root = this->build_sorted(cursor, count);
+            this->_size = count;
          }
-      };
+      }
+      /// @brief Replace the contents of this tree with a range of sorted values, building subtrees in parallel.
+      ///
+      /// This is assign_sorted split across up to the given number of threads, each building its own disjoint
+      /// subtree. See worker_threads for the trees which are always built on the calling thread.
+      ///
+      /// @param first The beginning of the range of values.
+      /// @param last The end of the range of values.
+      /// @param threads The maximum number of threads to build the tree with.
+      ///
+      /// @throws exception::NotSorted Thrown when the range isn't sorted by strictly increasing keys. The tree
+      /// is left untouched.
+      ///
+      template <typename RandomIt>
+      void assign_sorted(RandomIt first, RandomIt last, std::size_t threads) {
+         if (worker_threads(threads) <= 1)
+         {
+            this->assign_sorted(first, last);
+            return;
+         }
+         
+         if (!this->is_sorted_unique(first, last)) { throw exception::NotSorted(); }
 
-      using iterator = value_iterator<postorder_iterator>;
-      using const_iterator = const_value_iterator<const_postorder_iterator>;
+         auto count = static_cast<std::size_t>(std::distance(first, last));
 
-      AVLTreeBase() : _size(0) {}
-      AVLTreeBase(std::vector<Value> &nodes) : _size(0) {
-         for (auto node : nodes)
-            this->add_node(node);
-      }
-      AVLTreeBase(const AVLTreeBase &other) {
-         this->copy(other);
-      }
-      virtual ~AVLTreeBase() {
          this->destroy();
+         this->_root = this->build_sorted_parallel(first, count, threads);
+         this->_size = count;
       }
-
-      /// @brief Return an iterator at the beginning of an in-order traversal.
+      /// @brief Replace the contents of this tree with the given range of values in any order.
       ///
-      inorder_iterator begin_inorder() { return inorder_iterator(this->_root); }
-      /// @brief Return an iterator at the end of an in-order traversal.
+      /// The values are collected and sorted by key, then the tree is built with assign_sorted, which costs
+      /// O(n log n) for the sort but avoids searching and rebalancing the tree for every value.
       ///
-      inorder_iterator end_inorder() { return inorder_iterator(nullptr); }
-      /// @brief Return a const iterator at the beginning of an in-order traversal.
+      /// @param first The beginning of the range of values.
+      /// @param last The end of the range of values.
       ///
-      const_inorder_iterator cbegin_inorder() const { return const_inorder_iterator(this->_root); }
-      /// @brief Return a const iterator at the end of an in-order traversal.
+      /// @throws exception::KeyExists Thrown when two values of the range have the same key. The tree is left untouched.
       ///
-      const_inorder_iterator cend_inorder() const { return const_inorder_iterator(nullptr); }
+      template <typename InputIt>
+      void assign(InputIt first, InputIt last) {
+         std::vector<Value> values(first, last);
+         // Values such as map pairs have const keys and can't be sorted in place, so sort references to them.
+         std::vector<std::reference_wrapper<Value>> order(values.begin(), values.end());
 
-      /// @brief Return an iterator at the beginning of a pre-order traversal.
+         std::stable_sort(order.begin(), order.end(), [this](const Value &a, const Value &b) {
+            return this->key_less(KeyOfValue()(a), KeyOfValue()(b));
+         });
+
+         if (!this->is_sorted_unique(order.begin(), order.end())) { throw exception::KeyExists(); }
+
+         this->assign_sorted(order.begin(), order.end());
+      }
+      /// @brief Insert a batch of values into this tree in a single pass, in O(m log(n/m + 1)) for m values.
       ///
-      preorder_iterator begin_preorder() { return preorder_iterator(this->_root); }
-      /// @brief Return an iterator at the end of a pre-order traversal.
+      /// The batch is sorted and built into a balanced subtree, which is then merged into the tree with
+      /// set_union. Each affected ancestor is rebalanced once for the batch rather than once per value, and the
+      /// upper levels of the tree are not descended again for every value. Values whose key is already in the tree
+      /// are skipped, as are the later values of the batch which repeat a key. No hook of Derived is called, see
+      /// join_subtrees.
       ///
-      preorder_iterator end_preorder() { return preorder_iterator(nullptr); }
-      /// @brief Return a const iterator at the beginning of a pre-order traversal.
+      /// @param first The beginning of the range of values.
+      /// @param last The end of the range of values.
       ///
-      const_preorder_iterator cbegin_preorder() const { return const_preorder_iterator(this->_root); }
-      /// @brief Return a const iterator at the end of a pre-order traversal.
+      /// @returns The number of values inserted.
       ///
-      const_preorder_iterator cend_preorder() const { return const_preorder_iterator(nullptr); }
+      template <typename InputIt>
+      std::size_t insert_batch(InputIt first, InputIt last) {
+         std::vector<Value> values(first, last);
+         std::vector<std::reference_wrapper<Value>> order(values.begin(), values.end());
+         auto less = [this](const Value &a, const Value &b) { return this->key_less(KeyOfValue()(a), KeyOfValue()(b)); };
 
-      /// @brief Return an iterator at the beginning of a post-order traversal.
+         std::stable_sort(order.begin(), order.end(), less);
+         order.erase(std::unique(order.begin(), order.end(), [&less](const Value &a, const Value &b) { return !less(a, b); }),
+                     order.end());
+
+         auto cursor = order.begin();
+         auto batch = this->build_sorted(cursor, order.size());
+         auto size = this->_size + order.size();
+         std::size_t dropped = 0;
+         auto root = this->union_subtrees(this->_root, batch, 1, dropped, nullptr);
+
+         this->set_root(root, size - dropped);
+
+         return order.size() - dropped;
+      }
+      /// @brief Insert a batch of values into this tree in a single pass, replacing the values whose key is already
+      /// in the tree.
       ///
-      postorder_iterator begin_postorder() { return postorder_iterator(this->_root); }
-      /// @brief Return an iterator at the end of a post-order traversal.
+      /// This is insert_batch with the batch taking precedence: the batch is merged into the tree as the first
+      /// subtree of the union, so its nodes are kept on equal keys and the nodes they replace are released. Of the
+      /// values of the batch which repeat a key, the last one is kept.
       ///
-      postorder_iterator end_postorder() { return postorder_iterator(nullptr); }
-      /// @brief Return a const iterator at the beginning of a post-order traversal.
+      /// @param first The beginning of the range of values.
+      /// @param last The end of the range of values.
       ///
-      const_postorder_iterator cbegin_postorder() const { return const_postorder_iterator(this->_root); }
-      /// @brief Return a const iterator at the end of a post-order traversal.
+      /// @returns The number of values whose key was not in the tree.
       ///
-      const_postorder_iterator cend_postorder() const { return const_postorder_iterator(nullptr); }
+      template <typename InputIt>
+      std::size_t insert_or_assign_batch(InputIt first, InputIt last) {
+         std::vector<Value> values(first, last);
+         std::vector<std::reference_wrapper<Value>> order(values.begin(), values.end());
+         auto less = [this](const Value &a, const Value &b) { return this->key_less(KeyOfValue()(a), KeyOfValue()(b)); };
 
-      /// @brief Returns a value iterator at the beginning of an in-order traversal.
+         std::stable_sort(order.begin(), order.end(), less);
+
+         // keep the last value of every run of equal keys
+         std::size_t kept = 0;
+
+         for (std::size_t i=0; i<order.size(); ++i)
+         {
+            if (kept > 0 && !less(order[kept-1], order[i])) { order[kept-1] = order[i]; }
+            else { order[kept++] = order[i]; }
+         }
+
+         order.erase(order.begin() + kept, order.end());
+
+         auto cursor = order.begin();
+         auto batch = this->build_sorted(cursor, order.size());
+         auto size = this->_size + order.size();
+         std::size_t dropped = 0;
+         auto root = this->union_subtrees(batch, this->_root, 1, dropped, nullptr);
+
+         this->set_root(root, size - dropped);
+
+         return order.size() - dropped;
+      }
+      /// @brief Remove a batch of keys from this tree in a single pass, in O(m log(n/m + 1)) for m keys.
       ///
-      value_iterator<inorder_iterator> begin_values_inorder() { return value_iterator<inorder_iterator>(this->_root); }
-      /// @brief Returns a value iterator at the end of an in-order traversal.
+      /// The batch is sorted, and the tree is split around its keys and joined back without them, see
+      /// insert_batch. Keys which aren't in the tree are skipped.
       ///
-      value_iterator<inorder_iterator> end_values_inorder() { return value_iterator<inorder_iterator>(nullptr); }
-      /// @brief Returns a const value iterator at the beginning of an in-order traversal.
+      /// @param first The beginning of the range of keys.
+      /// @param last The end of the range of keys.
       ///
-      const_value_iterator<const_inorder_iterator> cbegin_values_inorder() { return const_value_iterator<const_inorder_iterator>(this->_root); }
-      /// @brief Returns a const value iterator at the end of an in-order traversal.
+      /// @returns The number of values removed.
       ///
-      const_value_iterator<const_inorder_iterator> cend_values_inorder() { return const_value_iterator<const_inorder_iterator>(nullptr); }
+      template <typename InputIt>
+      std::size_t erase_batch(InputIt first, InputIt last) {
+         std::vector<Key> keys(first, last);
+         auto less = [this](const Key &a, const Key &b) { return this->key_less(a, b); };
 
-      /// @brief Returns a value iterator at the beginning of a pre-order traversal.
-      ///
-      value_iterator<preorder_iterator> begin_values_preorder() { return value_iterator<preorder_iterator>(this->_root); }
-      /// @brief Returns a value iterator at the end of a pre-order traversal.
+         std::sort(keys.begin(), keys.end(), less);
+         keys.erase(std::unique(keys.begin(), keys.end(), [&less](const Key &a, const Key &b) { return !less(a, b); }),
+                    keys.end());
+
+         std::size_t dropped = 0;
+         auto root = this->subtract_sorted(this->_root, keys.data(), keys.size(), dropped);
+
+         this->set_root(root, this->_size - dropped);
+
+         return dropped;
+      }
+      /// @brief Return the number of elements in this tree.
       ///
-      value_iterator<preorder_iterator> end_values_preorder() { return value_iterator<preorder_iterator>(nullptr); }
-      /// @brief Returns a const value iterator at the beginning of a pre-order traversal.
+      inline std::size_t size() const {
+         return this->_size;
+      }
+      /// @brief Take a snapshot of the shape, memory footprint and counters of this tree.
       ///
-      const_value_iterator<const_preorder_iterator> cbegin_values_preorder() { return const_value_iterator<const_preorder_iterator>(this->_root); }
-      /// @brief Returns a const value iterator at the end of a pre-order traversal.
+      /// This walks every node to build the depth histogram, so it takes O(n) time. The counters are only
+      /// kept by a counting stats policy, see CountingStats.
       ///
-      const_value_iterator<const_preorder_iterator> cend_values_preorder() { return const_value_iterator<const_preorder_iterator>(nullptr); }
+      TreeStats stats() const {
+         TreeStats result;
 
-      /// @brief Returns a value iterator at the beginning of a post-order traversal.
+         result.counters = this->_stats.counters();
+         result.size = this->_size;
+         result.node_bytes = sizeof(Node);
+         result.memory_bytes = sizeof(Node) * this->_size;
+         count_depths(this->_root, 0, result.depth_histogram);
+         result.height = result.depth_histogram.size();
+
+         // the sparsest AVL trees of every height are Fibonacci trees, the first too big has height bound + 1
+         std::size_t shorter = 0, nodes = 1;
+
+         while (nodes <= this->_size)
+         {
+            auto taller = nodes + shorter + 1;
+            shorter = nodes;
+            nodes = taller;
+            ++result.height_bound;
+         }
+
+         return result;
+      }
+      /// @brief Reset the counters of the stats policy of this tree.
       ///
-      value_iterator<postorder_iterator> begin_values_postorder() { return value_iterator<postorder_iterator>(this->_root); }
-      /// @brief Returns a value iterator at the end of a post-order traversal.
+      void reset_stats() { this->_stats.reset(); }
+      /// @brief Switch relaxed balance on or off.
       ///
-      value_iterator<postorder_iterator> end_values_postorder() { return value_iterator<postorder_iterator>(nullptr); }
-      /// @brief Returns a const value iterator at the beginning of a post-order traversal.
+      /// Under relaxed balance, insertions and removals only rotate a node once the heights of its children differ
+      /// by three, rather than two. Heights are still kept exact, so every lookup stays within a guaranteed
+      /// bound: a tree of n nodes whose children differ in height by at most two is at most about
+      /// 1.81 log2(n) tall, against 1.44 log2(n) for strict AVL balance. Every rotation this skips is
+      /// counted, and rebalance_pending restores strict balance once the burst of writes is over.
       ///
-      const_value_iterator<const_postorder_iterator> cbegin_values_postorder() { return const_value_iterator<const_postorder_iterator>(this->_root); }
-      /// @brief Returns a const value iterator at the end of a post-order traversal.
+      /// Switching relaxed balance off doesn't restore strict balance by itself. Bulk operations such as
+      /// split and join rebalance the nodes they relink strictly.
       ///
-      const_value_iterator<const_postorder_iterator> cend_values_postorder() { return const_value_iterator<const_postorder_iterator>(nullptr); }
-
-      /// @brief Returns a default iterator to the beginning of the tree.
+      /// @param relaxed Whether to relax the balance of the tree.
       ///
-      /// The default iterator is a post-order value iterator.
+      void set_relaxed_balance(bool relaxed) { this->_balance_limit = relaxed ? 2 : 1; }
+      /// @brief Determine whether the tree is under relaxed balance. See set_relaxed_balance.
       ///
-      iterator begin() { return iterator(this->_root); }
-      /// @brief Returns a default iterator to the end of the tree.
+      bool is_relaxed_balance() const { return this->_balance_limit > 1; }
+      /// @brief Get the number of insertions and removals which left a node out of strict balance since strict
+      /// balance was last restored, or zero if the tree is strictly balanced.
       ///
-      /// The default iterator is a post-order value iterator.
+      std::size_t deferred_rotations() const { return this->_deferred_rotations; }
+      /// @brief Restore strict AVL balance to a tree relaxed balance has left nodes out of balance in.
       ///
-      iterator end() { return iterator(nullptr); }
+      /// Every subtree is joined back together bottom-up with join_subtrees, which relinks each node once, so this
+      /// takes O(n) time. It returns at once when no rotation was deferred, which makes it cheap to call whenever
+      /// writes are quiet. See set_relaxed_balance.
+      ///
+      /// @returns The number of insertions and removals which had deferred a rotation.
+      ///
+      std::size_t rebalance_pending() {
+         auto deferred = this->_deferred_rotations;
 
-      /// @brief Returns a default const iterator to the beginning of the tree.
+         if (deferred == 0) { return 0; }
+
+         // the same nodes stay in the tree, so the greatest one is still known
+         auto rightmost = this->_rightmost;
+         auto root = this->restore_balance(this->_root);
+
+         this->set_root(root, this->_size);
+         this->_rightmost = rightmost;
+         this->_deferred_rotations = 0;
+
+         return deferred;
+      }
+      /// @brief Return a copy of the comparator which orders the keys of this tree.
       ///
-      /// The default iterator is a post-order value iterator.
+      KeyCompare key_comp() const { return this->_compare; }
+      /// @brief Return a copy of the allocator of this tree.
       ///
-      const_iterator cbegin() const { return const_iterator(this->_root); }
-      /// @brief Returns a default const iterator to the end of the tree.
+      Allocator get_allocator() const { return Allocator(this->_allocator); }
+      /// @brief Destroy this tree.
       ///
-      /// The default iterator is a post-order value iterator.
+      /// When the tree owns its nodes and allocates them from a pool nothing else allocates from, the
+      /// whole pool is released at once instead of returning the nodes one by one.
       ///
-      const_iterator cend() const { return const_iterator(nullptr); }
+      void destroy() {
+         if (this->_root == nullptr) { return; }
 
-      /// @brief Determine if the tree is empty.
-      /// @returns True if the tree is empty, false otherwise.
+         if constexpr (std::is_pointer<NodePointer>::value && is_pool_allocator<NodeAllocator>::value)
+         {
+            if (this->_allocator.pool().use_count() == 1)
+            {
+               if constexpr (!std::is_trivially_destructible<Node>::value)
+               {
+                  auto iter = this->begin_postorder();
+
+                  while (iter != this->end_postorder())
+                  {
+                     auto node = *iter;
+                     ++iter;
+                     std::allocator_traits<NodeAllocator>::destroy(this->_allocator, node);
+                  }
+               }
+
+               this->_allocator.pool()->release();
+               this->_stats.count_deallocations(this->_size);
+               this->_root = nullptr;
+               this->_size = 0;
+               this->_rightmost = nullptr;
+               this->_deferred_rotations = 0;
+               return;
+            }
+         }
+
+         this->destroy_subtree(this->_root);
+         this->_root = nullptr;
+         this->_size = 0;
+         this->_rightmost = nullptr;
+         this->_deferred_rotations = 0;
+      }
+      /// @brief Copy the given tree into this tree.
       ///
-      inline bool is_empty() const { return this->_root == nullptr; }
-      /// @brief Get the root node of this tree.
+      /// This will destroy the current tree if it exists. The copy has the same shape as the other tree, so
+      /// it is made in linear time with a single allocation per node and no rebalancing. If copying
+      /// fails, this tree is left untouched.
+      ///
+      /// @param other The other tree to copy.
+      ///
+      void copy(const AVLTreeBase &other) { this->copy(other, 1); }
+      /// @brief Copy the given tree into this tree, cloning subtrees in parallel.
+      ///
+      /// This is copy split across up to the given number of threads, each cloning its own disjoint subtree.
+      /// See worker_threads for the trees which are always copied on the calling thread.
+      ///
+      /// @param other The other tree to copy.
+      /// @param threads The maximum number of threads to copy the tree with.
+      ///
+      void copy(const AVLTreeBase &other, std::size_t threads) {
+         auto root = (worker_threads(threads) <= 1)
+            ? this->clone_subtree(other._root)
+            : this->clone_subtree_parallel(other._root, threads);
+
+         // the clone may share a pool with the old nodes, which destroy would release along with it
+         this->destroy_subtree(this->_root);
+         this->_root = root;
+         this->_size = other._size;
+         this->_rightmost = nullptr;
+         this->_deferred_rotations = other._deferred_rotations;
+      }
+
+      /// @brief Move every value of the given tree to the end of this tree, in O(log n).
       ///
-      inline SharedNode root() { return this->_root; }
-      /// @brief Get the const root node of this tree.
+      /// Every key of the other tree must be greater than every key of this tree. The nodes are relinked rather
+      /// than copied, unless the allocators of the trees differ. The other tree is left empty.
       ///
-      inline ConstSharedNode root() const { return this->_root; }
-      /// @brief Determine if the given key exists in the tree.
-      /// @param key The key value to search for.
-      /// @returns True if the key was found, false otherwise.
+      /// @param greater The tree whose values all come after the values of this tree.
       ///
-      bool contains(const Key &key) const {
-         if (this->_root == nullptr) { return false; }
-         
-         auto traversal = this->search(key);
-         auto last_node = *traversal.rbegin();
+      /// @throws exception::NotSorted Thrown if a key of the other tree isn't greater than every key of this tree.
+      /// Both trees are left untouched.
+      ///
+      void join(AVLTreeBase &greater) {
+         if (&greater == this || greater._root == nullptr) { return; }
+
+         if (this->_root != nullptr && !this->key_less(this->last_key(), greater.first_key())) { throw exception::NotSorted(); }
+
+         auto size = this->_size + greater._size;
+         auto right = this->take_subtree(greater);
 
-         return last_node.second == 0;
+         this->set_root(this->join_subtrees(this->_root, right), size);
       }
-      /// @brief Search the tree for the given key, returning const nodes.
+      /// @brief Move the given value and then every value of the given tree to the end of this tree, in O(log n).
       ///
-      /// This function does a basic binary traversal on the tree for the given key, with the ability
-      /// to return the path taken in order to find that key-- or to not find that key. It will immediately
-      /// terminate when it finds the given key.
+      /// See join(AVLTreeBase &).
       ///
-      /// @param key The key value to search for.
-      /// @returns A vector of pairs: the node that was traversed, and the number representing the path
-      /// which was taken. 1 means right, -1 means left, 0 means it matched the key.
+      /// @param value The value to insert between the two trees.
+      /// @param greater The tree whose values all come after the given value.
       ///
-      std::vector<std::pair<ConstSharedNode, int>> search(const Key &key) const {
-         auto result = std::vector<std::pair<ConstSharedNode, int>>();
-         if (this->_root == nullptr) { return result; }
-         
-         ConstSharedNode node = this->_root;
-         auto branch = node->compare(key);
-         
-         while (branch != 0 && node != nullptr)
-         {
-            result.push_back(std::make_pair(node, branch));
+      /// @throws exception::NotSorted Thrown if the key of the value isn't greater than every key of this tree and
+      /// less than every key of the other tree. Both trees are left untouched.
+      ///
+      void join(const Value &value, AVLTreeBase &greater) {
+         if (&greater == this) { throw exception::NotSorted(); }
 
-            if (branch < 0)
-               node = node->left();
-            else
-               node = node->right();
+         const Key &key = KeyOfValue()(value);
+
+         if (this->_root != nullptr && !this->key_less(this->last_key(), key)) { throw exception::NotSorted(); }
+         if (greater._root != nullptr && !this->key_less(key, greater.first_key())) { throw exception::NotSorted(); }
+
+         auto node = this->construct_node(value);
+         auto size = this->_size + greater._size + 1;
+         NodePointer right = nullptr;
 
-            if (node != nullptr)
-               branch = node->compare(key);
+         try { right = this->take_subtree(greater); }
+         catch (...) {
+            this->deallocate_node(node);
+            throw;
          }
-            
-         if (node != nullptr) { result.push_back(std::make_pair(node, branch)); }
 
-         return result;
+         this->set_root(this->join_subtrees(this->_root, node, right), size);
       }
-      /// @brief Search the tree for the given key.
+      /// @brief Move every value whose key is not less than the given key into the given tree, in O(log n).
       ///
-      /// This function does a basic binary traversal on the tree for the given key, with the ability
-      /// to return the path taken in order to find that key-- or to not find that key. It will immediately
-      /// terminate when it finds the given key.
+      /// The previous values of the other tree are destroyed, even if copying the values into its allocator fails.
+      /// Counting the values moved costs O(log n) when the augmentation policy counts nodes, such as SubtreeSize,
+      /// and O(m) in the m values moved otherwise.
       ///
-      /// @param key The key value to search for.
-      /// @returns A vector of pairs: the node that was traversed, and the number representing the path
-      /// which was taken. 1 means right, -1 means left, 0 means it matched the key.
+      /// @param key The key to split at.
+      /// @param greater The tree which receives the values not less than the key.
       ///
-      std::vector<std::pair<SharedNode, int>> search(const Key &key) {
-         auto result = std::vector<std::pair<SharedNode, int>>();
-         if (this->_root == nullptr) { return result; }
-         
-         auto node = this->_root;
-         auto branch = node->compare(key);
-         
-         while (branch != 0 && node != nullptr)
-         {
-            result.push_back(std::make_pair(node, branch));
+      void split(const Key &key, AVLTreeBase &greater) {
+         if (&greater == this) { return; }
 
-            if (branch < 0)
-               node = node->_left;
-            else
-               node = node->_right;
+         NodePointer left = nullptr, right = nullptr;
+         this->split_around(this->_root, key, false, left, right);
+
+         auto greater_size = count_nodes(right);
+         auto moved = right;
+
+         // destroyed first, since destroying a tree may release the whole pool the copies would be made from
+         greater.destroy();
+
+         if (this->_allocator != greater._allocator)
+         {
+            try { moved = greater.clone_subtree(right); }
+            catch (...) {
+               this->set_root(this->join_subtrees(left, right), this->_size);
+               throw;
+            }
 
-            if (node != nullptr)
-               branch = node->compare(key);
+            this->destroy_subtree(right);
          }
-            
-         if (node != nullptr) { result.push_back(std::make_pair(node, branch)); }
 
-         return result;
+         greater.set_root(moved, greater_size);
+         this->set_root(left, this->_size - greater_size);
       }
-      /// @brief Attempt to find the node corresponding to the given key in this tree.
+      /// @brief Remove every value whose key is within the half-open range [low, high), in O(log n) plus the time
+      /// it takes to free the values.
       ///
-      /// @param key The key to search for.
-      /// @returns The node with the given key, or std::nullopt if no node was found.
+      /// The tree is split at both ends of the range and what is left is joined back, so only the nodes along the
+      /// two cuts are rebalanced, however many values are removed. The nodes of the range are then freed in bulk.
+      /// To free them off the calling thread instead, see extract_range.
       ///
-      std::optional<SharedNode> find(const Key &key) {
-         if (this->_root == nullptr) { return std::nullopt; }
-         
-         auto traversal = this->search(key);
-         auto last_node = *traversal.rbegin();
-
-         if (last_node.second == 0) { return last_node.first; }
-         else { return std::nullopt; }
-      }
-      /// @brief Attempt to find the const node corresponding to the given key in this tree.
+      /// @param low The inclusive lower bound of the range.
+      /// @param high The exclusive upper bound of the range.
       ///
-      /// @param key The key to search for.
-      /// @returns The node with the given key, or std::nullopt if no node was found.
+      /// @returns The number of values removed, which is 0 if the high bound isn't greater than the low one.
       ///
-      std::optional<ConstSharedNode> find(const Key &key) const {
-         if (this->_root == nullptr) { return std::nullopt; }
-         
-         auto traversal = this->search(key);
-         auto last_node = *traversal.rbegin();
+      std::size_t erase_range(const Key &low, const Key &high) {
+         if (this->_root == nullptr || !this->key_less(low, high)) { return 0; }
 
-         if (last_node.second == 0) { return last_node.first; }
-         else { return std::nullopt; }
-      }
-      /// @brief Attempt to get the node with the given key in the tree, throwing an exception if it fails.
-      /// @param key The key to search for.
-      /// @returns The node corresponding to the given key.
-      /// @throws exception::KeyNotFound Thrown if the key is not found in the tree.
-      ///
-      SharedNode get(const Key &key) {
-         auto result = this->find(key);
+         NodePointer left = nullptr, rest = nullptr, removed = nullptr, right = nullptr;
+         this->split_around(this->_root, low, false, left, rest);
+         this->split_around(rest, high, false, removed, right);
 
-         if (result == std::nullopt) { throw exception::KeyNotFound(); }
-         return *result;
+         return this->keep_subtree(this->join_subtrees(left, right), removed);
       }
-      /// @brief Attempt to get the const node with the given key in the tree, throwing an exception if it fails.
-      /// @param key The key to search for.
-      /// @returns The node corresponding to the given key.
-      /// @throws exception::KeyNotFound Thrown if the key is not found in the tree.
+      /// @brief Remove every value whose key is less than the given key, in O(log n) plus the time it takes to free
+      /// the values. See erase_range.
       ///
-      ConstSharedNode get(const Key &key) const {
-         auto result = this->find(key);
-
-         if (result == std::nullopt) { throw exception::KeyNotFound(); }
-         return *result;
-      }
-      /// @brief Insert the given value into the tree.
+      /// @param key The key to keep the values from.
       ///
-      /// See AVLTreeBase::add_node.
+      /// @returns The number of values removed.
       ///
-      SharedNode insert(const Value &value) {
-         return this->add_node(value);
+      std::size_t erase_below(const Key &key) {
+         if (this->_root == nullptr) { return 0; }
+
+         NodePointer removed = nullptr, kept = nullptr;
+         this->split_around(this->_root, key, false, removed, kept);
+
+         return this->keep_subtree(kept, removed);
       }
-      /// @brief Remove a node with the given key from the tree.
+      /// @brief Remove every value whose key is greater than the given key, in O(log n) plus the time it takes to
+      /// free the values. See erase_range.
       ///
-      /// See AVLTreeBase::remove_node.
+      /// @param key The key to keep the values up to.
       ///
-      /// @param key The key to remove from the tree.
-      /// @throws exception::KeyNotFound Thrown if the key isn't found in the tree.
+      /// @returns The number of values removed.
       ///
-      void remove(const Key &key) {
-         if (this->_root == nullptr) { return; }
-         
-         auto traversal = this->search(key);
-         auto last_node = *traversal.rbegin();
-         if (last_node.second != 0) { throw exception::KeyNotFound(); }
-         
-         this->remove_node(last_node.first->value());
+      std::size_t erase_above(const Key &key) {
+         if (this->_root == nullptr) { return 0; }
+
+         NodePointer kept = nullptr, removed = nullptr;
+         this->split_around(this->_root, key, true, kept, removed);
+
+         return this->keep_subtree(kept, removed);
       }
-      /// @brief Convert this tree into a vector.
-      ///
-      /// Performs a post-order traversal on the tree and gets const values from the nodes.
+      /// @brief Move every value whose key is within the half-open range [low, high) into the given tree, in
+      /// O(log n).
       ///
-      /// @returns A vector of values in the tree.
-      std::vector<Value> to_vec() const {
-         return std::vector<Value>(this->cbegin(), this->cend());
-      }
-      /// @brief Return the number of elements in this tree.
+      /// This is erase_range, except that the values are handed over rather than freed. The previous values of the
+      /// other tree are destroyed, even if copying the values into its allocator fails. Destroying the other tree
+      /// on another thread then frees the values off the calling thread, as long as the allocator is safe to use
+      /// from several threads at once. Counting the values moved costs O(log n) when the augmentation policy
+      /// counts nodes, such as SubtreeSize, and O(m) in the m values moved otherwise.
       ///
-      inline std::size_t size() const {
-         return this->_size;
-      }
-      /// @brief Destroy this tree.
+      /// @param low The inclusive lower bound of the range.
+      /// @param high The exclusive upper bound of the range.
+      /// @param removed The tree which receives the values of the range.
       ///
-      void destroy() {
-         if (this->_root == nullptr) { return; }
-         std::vector<SharedNode> visiting = { this->_root };
+      void extract_range(const Key &low, const Key &high, AVLTreeBase &removed) {
+         if (&removed == this) { return; }
+
+         NodePointer left = nullptr, rest = nullptr, middle = nullptr, right = nullptr;
 
-         while (visiting.size() > 0)
+         if (this->key_less(low, high))
          {
-            auto node = visiting.front();
-            visiting.erase(visiting.begin());
-            
-            if (node->_left != nullptr) { visiting.push_back(node->_left); }
-            if (node->_right != nullptr) { visiting.push_back(node->_right); }
+            this->split_around(this->_root, low, false, left, rest);
+            this->split_around(rest, high, false, middle, right);
+         }
+         else { left = this->_root; }
+
+         auto moved_size = count_nodes(middle);
+         auto moved = middle;
+
+         left = this->join_subtrees(left, right);
+         removed.destroy();
 
-            node->_parent.reset();
-            node->_left.reset();
-            node->_right.reset();
+         if (this->_allocator != removed._allocator)
+         {
+            try { moved = removed.clone_subtree(middle); }
+            catch (...) {
+               std::size_t dropped = 0;
+
+               this->set_root(this->union_subtrees(left, middle, 1, dropped, nullptr), this->_size);
+               throw;
+            }
+
+            this->destroy_subtree(middle);
          }
 
-         this->_root.reset();
+         removed.set_root(moved, moved_size);
+         this->set_root(left, this->_size - moved_size);
       }
-      /// @brief Copy the given tree into this tree.
+      /// @brief Move every value of the given tree whose key isn't in this tree into this tree.
       ///
-      /// This will destroy the current tree if it exists.
+      /// This is set_union, except that the values whose key is already in this tree stay in the other tree.
       ///
-      /// @param other The other tree to copy.
+      /// @param other The tree to move values from.
       ///
-      void copy(const AVLTreeBase &other) {
-         if (this->_root != nullptr)
-            this->destroy();
-         
-         if (other._root == nullptr) { return; }
+      void merge(AVLTreeBase &other) {
+         if (&other == this || other._root == nullptr) { return; }
 
-         std::vector<ConstSharedNode> visiting = { other._root };
-         std::vector<SharedNode> added = { this->copy_node(other._root) };
-         std::size_t parent_index = 0;
+         std::vector<NodePointer> duplicates;
+         duplicates.reserve(std::min(this->_size, other._size));
 
-         this->_root = added.front();
+         auto equal_allocators = this->_allocator == other._allocator;
+         auto size = this->_size + other._size;
+         auto root = this->take_subtree(other);
+         std::size_t dropped = 0;
 
-         while (visiting.size() > 0)
+         root = this->union_subtrees(this->_root, root, 1, dropped, &duplicates);
+         this->set_root(root, size - duplicates.size());
+
+         auto rest = this->link_sorted_nodes(duplicates.data(), duplicates.size());
+
+         if (equal_allocators) { other.set_root(rest, duplicates.size()); }
+         else
          {
-            auto node = visiting.front();
-            visiting.erase(visiting.begin());
-            
-            if (node == nullptr) { continue; }
+            // the duplicates were copied into this tree's allocator, so they go back as copies
+            try { other.set_root(other.clone_subtree(rest), duplicates.size()); }
+            catch (...) {
+               this->destroy_subtree(rest);
+               throw;
+            }
+
+            this->destroy_subtree(rest);
+         }
+      }
+      /// @brief Move every value of the given tree into this tree, in O(m log(n/m + 1)) for m <= n values.
+      ///
+      /// Values whose key is already in this tree are destroyed, so this tree keeps its own. The trees are split and
+      /// joined around each other rather than searched value by value, see union_subtrees. The other tree is left
+      /// empty.
+      ///
+      /// @param other The tree to take the values of.
+      ///
+      void set_union(AVLTreeBase &other) { this->set_union(other, 1); }
+      /// @brief Move every value of the given tree into this tree, merging disjoint subtrees in parallel.
+      ///
+      /// This is set_union split across up to the given number of threads. See worker_threads for the trees which
+      /// always merge on the calling thread.
+      ///
+      /// @param other The tree to take the values of.
+      /// @param threads The maximum number of threads to merge the trees with.
+      ///
+      void set_union(AVLTreeBase &other, std::size_t threads) {
+         if (&other == this || other._root == nullptr) { return; }
 
-            auto new_node = added.front();
-            added.erase(added.begin());
+         auto size = this->_size + other._size;
+         auto root = this->take_subtree(other);
+         std::size_t dropped = 0;
 
-            if (node->is_leaf()) { continue; }
+         root = this->union_subtrees(this->_root, root, worker_threads(threads), dropped, nullptr);
+         this->set_root(root, size - dropped);
+      }
+      /// @brief Keep only the values of this tree whose key is in the given tree, in O(m log(n/m + 1)).
+      ///
+      /// Every other value of both trees is destroyed, and the other tree is left empty. See set_union.
+      ///
+      /// @param other The tree whose keys to keep.
+      ///
+      void set_intersection(AVLTreeBase &other) { this->set_intersection(other, 1); }
+      /// @brief Keep only the values of this tree whose key is in the given tree, in parallel.
+      ///
+      /// See set_union(AVLTreeBase &, std::size_t).
+      ///
+      /// @param other The tree whose keys to keep.
+      /// @param threads The maximum number of threads to intersect the trees with.
+      ///
+      void set_intersection(AVLTreeBase &other, std::size_t threads) {
+         if (&other == this) { return; }
 
-            if (node->_left != nullptr) {
-               auto left = this->copy_node(node->_left);
-               this->set_left_child(new_node, left);
-               added.push_back(left);
-               visiting.push_back(node->_left);
-            }
-            
-            if (node->_right != nullptr) {
-               auto right = this->copy_node(node->_right);
-               this->set_right_child(new_node, right);
-               added.push_back(right);
-               visiting.push_back(node->_right);
-            }
+         auto root = this->take_subtree(other);
+         std::size_t dropped = 0;
+
+         root = this->intersect_subtrees(this->_root, root, worker_threads(threads), dropped);
+         this->set_root(root, this->_size - dropped);
+      }
+      /// @brief Remove the keys of the given tree from this tree, in O(m log(n/m + 1)).
+      ///
+      /// The values of the other tree are destroyed, and it is left empty. See set_union.
+      ///
+      /// @param other The tree whose keys to remove.
+      ///
+      void set_difference(AVLTreeBase &other) { this->set_difference(other, 1); }
+      /// @brief Remove the keys of the given tree from this tree, in parallel.
+      ///
+      /// See set_union(AVLTreeBase &, std::size_t).
+      ///
+      /// @param other The tree whose keys to remove.
+      /// @param threads The maximum number of threads to subtract the trees with.
+      ///
+      void set_difference(AVLTreeBase &other, std::size_t threads) {
+         if (&other == this)
+         {
+            this->destroy();
+            return;
          }
+
+         auto root = this->take_subtree(other);
+         std::size_t dropped = 0;
+
+         root = this->subtract_subtrees(this->_root, root, worker_threads(threads), dropped);
+         this->set_root(root, this->_size - dropped);
       }
    };
 
@@ -1452,21 +5115,36 @@ namespace exception {
    /// @tparam Key The class of the key of this tree.
    /// @tparam KeyCompare The comparison functor for the given key type. Defaults to std::less<Key>.
    /// See AVLTreeBase for Compare functor requirements.
+   /// @tparam NodeStorage The node storage policy. Defaults to RawNodeStorage, see AVLTreeBase.
+   /// @tparam Allocator The allocator of the tree's nodes. Defaults to std::allocator<Key>, see AVLTreeBase.
+   /// @tparam Augment The augmentation policy of the tree's nodes. Defaults to NoAugment, see AVLTreeBase.
+   /// @tparam Stats The stats policy of the tree. Defaults to NoStats, see AVLTreeBase.
    ///
-   template <typename Key, typename KeyCompare=std::less<Key>>
-   class AVLTree : public AVLTreeBase<Key, Key, KeyIsValue<Key>, KeyCompare>
+   template <typename Key, typename KeyCompare=std::less<Key>, typename NodeStorage=RawNodeStorage,
+             typename Allocator=std::allocator<Key>, typename Augment=NoAugment, typename Stats=NoStats>
+   class AVLTree : public AVLTreeBase<Key, Key, KeyIsValue<Key>, KeyCompare, NodeStorage, Allocator, Augment, void, Stats>
    {
    public:
-      using TreeBase = AVLTreeBase<Key, Key, KeyIsValue<Key>, KeyCompare>;
+      using TreeBase = AVLTreeBase<Key, Key, KeyIsValue<Key>, KeyCompare, NodeStorage, Allocator, Augment, void, Stats>;
       using iterator = typename TreeBase::const_iterator;
 
       AVLTree() : TreeBase() {}
-      AVLTree(std::vector<Key> &nodes) : TreeBase(nodes) {}
+      explicit AVLTree(const Allocator &allocator) : TreeBase(allocator) {}
+      explicit AVLTree(const KeyCompare &compare, const Allocator &allocator=Allocator()) : TreeBase(compare, allocator) {}
+      AVLTree(const std::vector<Key> &nodes, const Allocator &allocator=Allocator()) : TreeBase(nodes, allocator) {}
+      AVLTree(std::vector<Key> &&nodes, const Allocator &allocator=Allocator()) : TreeBase(std::move(nodes), allocator) {}
       AVLTree(const AVLTree &other) : TreeBase(other) {}
+      AVLTree(AVLTree &&other) noexcept : TreeBase(std::move(other)) {}
+
+      AVLTree &operator=(const AVLTree &other) { TreeBase::operator=(other); return *this; }
+      AVLTree &operator=(AVLTree &&other) noexcept(noexcept(std::declval<TreeBase &>() = std::declval<TreeBase &&>())) {
+         TreeBase::operator=(std::move(other));
+         return *this;
+      }
 
       /// @brief Return an iterator of values at the beginning of this tree.
       ///
-      /// This performs a post-order traversal on the tree. See AVLTreeBase::const_iterator.
+      /// This visits the values in order, sorted by key. See AVLTreeBase::const_iterator.
       ///
       iterator begin() const { return iterator(this->root()); }
       /// @brief Return an iterator of values at the end of this tree.
@@ -1474,7 +5152,7 @@ namespace exception {
       iterator end() const { return iterator(nullptr); }
       /// @brief Return a const iterator of values at the beginning of this tree.
       ///
-      /// This performs a post-order traversal on the tree. See AVLTreeBase::const_iterator.
+      /// This visits the values in order, sorted by key. See AVLTreeBase::const_iterator.
       ///
       iterator cbegin() const { return this->begin(); }
       /// @brief Return an iterator of values at the end of this tree.
@@ -1501,16 +5179,36 @@ namespace exception {
    /// @tparam Value The type of the value for the mapping.
    /// @tparam KeyCompare The key comparison functor for sorting the nodes. See AVLTreeBase for Comparison
    /// requirements.
+   /// @tparam NodeStorage The node storage policy. Defaults to RawNodeStorage, see AVLTreeBase.
+   /// @tparam Allocator The allocator of the map's nodes. Defaults to std::allocator of the key-value pair,
+   /// see AVLTreeBase.
+   /// @tparam Augment The augmentation policy of the map's nodes. Defaults to NoAugment, see AVLTreeBase.
+   /// @tparam Stats The stats policy of the map. Defaults to NoStats, see AVLTreeBase.
    ///
-   template <typename Key, typename Value, typename KeyCompare=std::less<Key>>
-   class AVLMap : public AVLTreeBase<Key, std::pair<const Key, Value>, KeyOfPair<Key, Value>, KeyCompare>
+   template <typename Key, typename Value, typename KeyCompare=std::less<Key>, typename NodeStorage=RawNodeStorage,
+             typename Allocator=std::allocator<std::pair<const Key, Value>>, typename Augment=NoAugment,
+             typename Stats=NoStats>
+   class AVLMap : public AVLTreeBase<Key, std::pair<const Key, Value>, KeyOfPair<Key, Value>, KeyCompare, NodeStorage, Allocator,
+                                     Augment, void, Stats>
    {
    public:
-      using TreeBase = AVLTreeBase<Key, std::pair<const Key, Value>, KeyOfPair<Key, Value>, KeyCompare>;
+      using TreeBase = AVLTreeBase<Key, std::pair<const Key, Value>, KeyOfPair<Key, Value>, KeyCompare, NodeStorage, Allocator,
+                                   Augment, void, Stats>;
       
       AVLMap() : TreeBase() {}
-      AVLMap(std::vector<std::pair<const Key, Value>> &nodes) : TreeBase(nodes) {}
+      explicit AVLMap(const Allocator &allocator) : TreeBase(allocator) {}
+      explicit AVLMap(const KeyCompare &compare, const Allocator &allocator=Allocator()) : TreeBase(compare, allocator) {}
+      AVLMap(const std::vector<std::pair<const Key, Value>> &nodes, const Allocator &allocator=Allocator()) : TreeBase(nodes, allocator) {}
+      AVLMap(std::vector<std::pair<const Key, Value>> &&nodes, const Allocator &allocator=Allocator())
+         : TreeBase(std::move(nodes), allocator) {}
       AVLMap(const AVLMap &other) : TreeBase(other) {}
+      AVLMap(AVLMap &&other) noexcept : TreeBase(std::move(other)) {}
+
+      AVLMap &operator=(const AVLMap &other) { TreeBase::operator=(other); return *this; }
+      AVLMap &operator=(AVLMap &&other) noexcept(noexcept(std::declval<TreeBase &>() = std::declval<TreeBase &&>())) {
+         TreeBase::operator=(std::move(other));
+         return *this;
+      }
 
       /// @brief Access the given mapping value with the given key.
       ///
@@ -1521,13 +5219,7 @@ namespace exception {
       /// @returns The value associated with the given key.
       ///
       Value &operator[](const Key &key) {
-         try {
-            return this->get(key);
-         }
-         catch (exception::KeyNotFound &) {
-            auto node = this->add_node(std::make_pair(key, Value()));
-            return node->value().second;
-         }
+         return this->try_emplace(key).first->value().second;
       }
       /// @brief Access the given const mapping value with the given key.
       /// @param key The key value to search for.
@@ -1546,15 +5238,97 @@ namespace exception {
       bool has_key(const Key &key) const {
          return this->contains(key);
       }
+      /// @brief Check if the given key, which may be of any type the comparator is transparent for, exists in the
+      /// tree. See has_key(const Key &key).
+      ///
+      template <typename K, typename = typename TreeBase::template enable_if_lookup<K>>
+      bool has_key(const K &key) const {
+         return this->contains(key);
+      }
 
       /// @brief Insert a given key-value pair into the tree.
       /// @param key The key to associate with the new node.
       /// @param value The value to give the new node.
       ///
-      void insert(const Key &key, const Value &value) {
-         TreeBase::insert(std::make_pair(key, value));
+      template <typename K, typename M, typename = std::enable_if_t<std::is_constructible<Key, K&&>::value>>
+      void insert(K &&key, M &&value) {
+         auto result = this->locate_insert(key);
+
+         if (result.first != nullptr && result.second == 0) { throw exception::KeyExists(); }
+
+         auto node = this->construct_node(std::piecewise_construct,
+                                          std::forward_as_tuple(std::forward<K>(key)),
+                                          std::forward_as_tuple(std::forward<M>(value)));
+         
+         this->attach_node(result.first, result.second, node);
+      }
+      using TreeBase::insert;
+
+      /// @brief Insert a value constructed from the given arguments if the key doesn't exist in the map.
+      ///
+      /// The map is descended once. If the key is found, nothing is constructed and the existing node is
+      /// returned; otherwise the new node is linked in where the descent ended. Nothing is thrown on either path.
+      ///
+      /// @param key The key to search for.
+      /// @param args The arguments to construct the value with if the key isn't found.
+      /// @returns A pair of the node with the given key and whether a new node was inserted.
+      ///
+      template <typename... Args>
+      std::pair<typename TreeBase::NodePointer, bool> try_emplace(const Key &key, Args&&... args) {
+         return this->try_emplace_key(key, std::forward<Args>(args)...);
       }
 
+      /// @brief Insert a value constructed from the given arguments if the key doesn't exist in the map.
+      ///
+      /// The key is moved into the new node if one is inserted. See try_emplace(const Key &key, Args&&... args).
+      ///
+      template <typename... Args>
+      std::pair<typename TreeBase::NodePointer, bool> try_emplace(Key &&key, Args&&... args) {
+         return this->try_emplace_key(std::move(key), std::forward<Args>(args)...);
+      }
+
+      /// @brief Assign the given value to the key, inserting the key if it doesn't exist in the map.
+      ///
+      /// Like try_emplace, the map is only descended once.
+      ///
+      /// @param key The key to assign to.
+      /// @param value The value to assign.
+      /// @returns A pair of the node with the given key and whether a new node was inserted.
+      ///
+      template <typename M>
+      std::pair<typename TreeBase::NodePointer, bool> insert_or_assign(const Key &key, M &&value) {
+         auto result = this->try_emplace(key, std::forward<M>(value));
+
+         if (!result.second) { result.first->value().second = std::forward<M>(value); }
+
+         return result;
+      }
+
+      /// @brief Assign the given value to the key, moving the key into the map if it doesn't exist.
+      ///
+      /// See insert_or_assign(const Key &key, M &&value).
+      ///
+      template <typename M>
+      std::pair<typename TreeBase::NodePointer, bool> insert_or_assign(Key &&key, M &&value) {
+         auto result = this->try_emplace(std::move(key), std::forward<M>(value));
+
+         if (!result.second) { result.first->value().second = std::forward<M>(value); }
+
+         return result;
+      }
+
+      /// @brief Find the node with the given key, inserting a default-constructed value if it doesn't exist.
+      ///
+      /// See try_emplace.
+      ///
+      /// @param key The key to search for.
+      /// @returns A pair of the node with the given key and whether a new node was inserted.
+      ///
+      std::pair<typename TreeBase::NodePointer, bool> find_or_insert(const Key &key) {
+         return this->try_emplace(key);
+      }
+      using TreeBase::find_or_insert;
+
       /// @brief Get the value associated with the given key.
       /// @param key The key to get.
       /// @returns The value associated with the given key.
@@ -1572,8 +5346,182 @@ namespace exception {
       const Value &get(const Key &key) const {
          return TreeBase::get(key)->value().second;
       }
+
+      /// @brief Get the value associated with the given key, which may be of any type the comparator is transparent
+      /// for. See get(const Key &key).
+      ///
+      template <typename K, typename = typename TreeBase::template enable_if_lookup<K>>
+      Value &get(const K &key) {
+         return TreeBase::get(key)->value().second;
+      }
+
+      /// @brief Get the const value associated with the given key, which may be of any type the comparator is
+      /// transparent for. See get(const Key &key).
+      ///
+      template <typename K, typename = typename TreeBase::template enable_if_lookup<K>>
+      const Value &get(const K &key) const {
+         return TreeBase::get(key)->value().second;
+      }
+
+   protected:
+      template <typename K, typename... Args>
+      std::pair<typename TreeBase::NodePointer, bool> try_emplace_key(K &&key, Args&&... args) {
+         auto result = this->locate_insert(key);
+
+         if (result.first != nullptr && result.second == 0) { return std::make_pair(result.first, false); }
+
+         auto node = this->construct_node(std::piecewise_construct,
+                                          std::forward_as_tuple(std::forward<K>(key)),
+                                          std::forward_as_tuple(std::forward<Args>(args)...));
+         
+         return std::make_pair(this->attach_node(result.first, result.second, node), true);
+      }
+   };
+
+   /// @brief A functor which orders intervals by their start, then by their end.
+   ///
+   /// @tparam Bound The type of the ends of the intervals.
+   /// @tparam Compare The comparison functor of the bounds.
+   ///
+   template <typename Bound, typename Compare>
+   struct IntervalLess {
+      bool operator() (const std::pair<Bound, Bound> &a, const std::pair<Bound, Bound> &b) const {
+         if (Compare()(a.first, b.first)) { return true; }
+         if (Compare()(b.first, a.first)) { return false; }
+
+         return Compare()(a.second, b.second);
+      }
+   };
+
+   /// @brief A functor which extracts the end of an interval.
+   ///
+   /// @tparam Bound The type of the ends of the intervals.
+   ///
+   template <typename Bound>
+   struct IntervalHigh {
+      const Bound &operator() (const std::pair<Bound, Bound> &interval) const { return interval.second; }
+   };
+
+   /// @brief An interval tree based on an AVL tree.
+   ///
+   /// Intervals are half-open pairs [low, high) ordered by their start, and every node keeps the greatest end
+   /// in its subtree (see IntervalMax). A query only descends into subtrees which can hold a match, so finding
+   /// the k intervals which overlap a range takes O(log n + k) time. Like AVLTree, each interval is stored once.
+   ///
+   /// @tparam Bound The type of the ends of the intervals.
+   /// @tparam Compare The comparison functor of the bounds. Defaults to std::less<Bound>.
+   /// @tparam NodeStorage The node storage policy. Defaults to RawNodeStorage, see AVLTreeBase.
+   /// @tparam Allocator The allocator of the tree's nodes. Defaults to std::allocator of the interval, see AVLTreeBase.
+   ///
+   template <typename Bound, typename Compare=std::less<Bound>, typename NodeStorage=RawNodeStorage,
+             typename Allocator=std::allocator<std::pair<Bound, Bound>>>
+   class IntervalTree : public AVLTreeBase<std::pair<Bound, Bound>, std::pair<Bound, Bound>, KeyIsValue<std::pair<Bound, Bound>>,
+                                           IntervalLess<Bound, Compare>, NodeStorage, Allocator,
+                                           IntervalMax<Bound, IntervalHigh<Bound>, Compare>>
+   {
+   public:
+      using Interval = std::pair<Bound, Bound>;
+      using TreeBase = AVLTreeBase<Interval, Interval, KeyIsValue<Interval>, IntervalLess<Bound, Compare>, NodeStorage, Allocator,
+                                   IntervalMax<Bound, IntervalHigh<Bound>, Compare>>;
+      using NodePointer = typename TreeBase::NodePointer;
+      using ConstNodePointer = typename TreeBase::ConstNodePointer;
+
+      IntervalTree() : TreeBase() {}
+      explicit IntervalTree(const Allocator &allocator) : TreeBase(allocator) {}
+      IntervalTree(const std::vector<Interval> &intervals, const Allocator &allocator=Allocator()) : TreeBase(intervals, allocator) {}
+      IntervalTree(std::vector<Interval> &&intervals, const Allocator &allocator=Allocator())
+         : TreeBase(std::move(intervals), allocator) {}
+      IntervalTree(const IntervalTree &other) : TreeBase(other) {}
+      IntervalTree(IntervalTree &&other) noexcept : TreeBase(std::move(other)) {}
+
+      IntervalTree &operator=(const IntervalTree &other) { TreeBase::operator=(other); return *this; }
+      IntervalTree &operator=(IntervalTree &&other) noexcept(noexcept(std::declval<TreeBase &>() = std::declval<TreeBase &&>())) {
+         TreeBase::operator=(std::move(other));
+         return *this;
+      }
+
+      using TreeBase::insert;
+      using TreeBase::remove;
+
+      /// @brief Insert the interval [low, high) into the tree.
+      ///
+      /// See AVLTreeBase::add_node.
+      ///
+      NodePointer insert(const Bound &low, const Bound &high) {
+         return TreeBase::insert(Interval(low, high));
+      }
+      /// @brief Remove the interval [low, high) from the tree.
+      ///
+      /// @throws exception::KeyNotFound Thrown if the interval isn't found in the tree.
+      ///
+      void remove(const Bound &low, const Bound &high) {
+         TreeBase::remove(Interval(low, high));
+      }
+
+      /// @brief Call the given function on every interval which overlaps the range [low, high).
+      ///
+      /// The intervals are visited in order.
+      ///
+      /// @param low The inclusive start of the range.
+      /// @param high The exclusive end of the range.
+      /// @param visitor The function to call with each overlapping interval.
+      ///
+      template <typename Visitor>
+      void visit_overlapping(const Bound &low, const Bound &high, Visitor &&visitor) const {
+         visit_intervals(this->root(), low, high, false, visitor);
+      }
+      /// @brief Get every interval which overlaps the range [low, high), in order.
+      ///
+      /// See visit_overlapping.
+      ///
+      std::vector<Interval> overlapping(const Bound &low, const Bound &high) const {
+         std::vector<Interval> result;
+
+         this->visit_overlapping(low, high, [&result](const Interval &interval) { result.push_back(interval); });
+
+         return result;
+      }
+      /// @brief Call the given function on every interval which contains the given point, in order.
+      ///
+      /// @param point The point to look for.
+      /// @param visitor The function to call with each interval containing the point.
+      ///
+      template <typename Visitor>
+      void visit_containing(const Bound &point, Visitor &&visitor) const {
+         visit_intervals(this->root(), point, point, true, visitor);
+      }
+      /// @brief Get every interval which contains the given point, in order.
+      ///
+      /// See visit_containing.
+      ///
+      std::vector<Interval> containing(const Bound &point) const {
+         std::vector<Interval> result;
+
+         this->visit_containing(point, [&result](const Interval &interval) { result.push_back(interval); });
+
+         return result;
+      }
+
+   protected:
+      /// @brief Visit every interval of the subtree which ends after start and begins before end.
+      ///
+      /// When inclusive is set, intervals which begin exactly at end are visited too.
+      ///
+      template <typename Visitor>
+      static void visit_intervals(const ConstNodePointer &node, const Bound &start, const Bound &end, bool inclusive, Visitor &visitor) {
+         if (node == nullptr || !Compare()(start, *node->aggregate())) { return; }
+
+         visit_intervals(node->left(), start, end, inclusive, visitor);
+
+         auto &interval = node->value();
+         bool begins_before = inclusive ? !Compare()(end, interval.first) : Compare()(interval.first, end);
+
+         if (!begins_before) { return; }
+         if (Compare()(start, interval.second)) { visitor(interval); }
+
+         visit_intervals(node->right(), start, end, inclusive, visitor);
+      }
    };
 }
 
 #endif
-
@@ -0,0 +1,385 @@
+#ifndef __AVLTREE_BLOCKED_HPP
+#define __AVLTREE_BLOCKED_HPP
+
+#include "../avltree.hpp"
+
+namespace avltree
+{
+   /// @brief A sorted run of up to Capacity keys, which is the value of every node of a BlockedAVLTree.
+   ///
+   /// @tparam Key The type of the keys.
+   /// @tparam Capacity The number of keys the block has room for.
+   ///
+   template <typename Key, std::size_t Capacity>
+   struct KeyBlock {
+      std::array<Key, Capacity> keys;
+      std::size_t count = 0;
+      /// @brief A copy of the first key, which searching the tree compares against.
+      ///
+      /// It comes last so that it shares a cache line with the links of the node, which follow the value.
+      ///
+      Key first;
+
+      inline const Key *begin() const { return this->keys.data(); }
+      inline const Key *end() const { return this->keys.data() + this->count; }
+   };
+
+   /// @brief A functor which treats the first key of a block as its key.
+   ///
+   /// The first key of a block may change while the block is in the tree, as long as it stays between the keys
+   /// of the blocks around it, which keeps the blocks sorted. See BlockedAVLTree.
+   ///
+   template <typename Key, std::size_t Capacity>
+   struct KeyOfBlock {
+      const Key &operator() (const KeyBlock<Key, Capacity> &block) const { return block.first; }
+   };
+
+   /// @brief A set of small keys stored in sorted blocks, which an AVL tree of blocks indexes.
+   ///
+   /// A tree node holding a single small key spends most of its cache line on links, its height and allocator
+   /// overhead. Here every node holds a block of up to BlockSize keys instead, so the tree is BlockSize times
+   /// smaller and balances over blocks with the rebalancing code of AVLTreeBase, while the keys themselves sit
+   /// side by side: scanning them in order reads whole cache lines, and a block of 32-bit keys takes
+   /// little more memory than the keys themselves.
+   ///
+   /// A key belongs to the last block whose first key is not greater than it. A full block is split in halves,
+   /// and a block which shrinks to a quarter is merged with the block after or before it when both fit in half a
+   /// block.
+   ///
+   /// Blocks of arithmetic keys are searched by counting the keys less than the key searched for, which has no
+   /// branch to mispredict and which compilers vectorize. Other keys are searched by bisection.
+   ///
+   /// @tparam Key The type of the keys, which must be default constructible and copy assignable.
+   /// @tparam KeyCompare The key comparison functor. See AVLTreeBase.
+   /// @tparam BlockSize The number of keys a block holds at most.
+   /// @tparam Allocator The allocator of the tree, rebound to its nodes. See AVLTreeBase.
+   ///
+   template <typename Key, typename KeyCompare=std::less<Key>, std::size_t BlockSize=32, typename Allocator=std::allocator<Key>>
+   class BlockedAVLTree : protected AVLTreeBase<Key, KeyBlock<Key, BlockSize>, KeyOfBlock<Key, BlockSize>, KeyCompare, RawNodeStorage,
+                                                typename std::allocator_traits<Allocator>::template rebind_alloc<KeyBlock<Key, BlockSize>>>
+   {
+   public:
+      using BlockType = KeyBlock<Key, BlockSize>;
+      using BlockAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<BlockType>;
+      using TreeBase = AVLTreeBase<Key, BlockType, KeyOfBlock<Key, BlockSize>, KeyCompare, RawNodeStorage, BlockAllocator>;
+      using KeyType = Key;
+      using ValueType = Key;
+      using KeyCompareType = KeyCompare;
+      using NodePointer = typename TreeBase::NodePointer;
+
+      static_assert(std::is_default_constructible<Key>::value && std::is_copy_assignable<Key>::value,
+                    "the keys of a blocked tree must be default constructible and copy assignable");
+      static_assert(BlockSize >= 4, "a block must hold at least four keys");
+
+      /// @brief The number of keys a block holds at most.
+      ///
+      static constexpr std::size_t block_size = BlockSize;
+
+      /// @brief Whether blocks are searched by counting the keys less than the key, rather than by bisection.
+      ///
+      static constexpr bool linear_search = std::is_arithmetic<Key>::value;
+
+      /// @brief An iterator over the keys of a blocked tree, in order.
+      ///
+      class const_iterator
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = Key;
+         using pointer = const value_type *;
+         using reference = const value_type &;
+
+         const_iterator(typename TreeBase::const_inorder_iterator block, std::size_t index) : block(block), index(index) {}
+
+         reference operator*() const { return (*this->block)->value().keys[this->index]; }
+         pointer operator->() const { return &**this; }
+
+         const_iterator &operator++() {
+            if (++this->index == (*this->block)->value().count)
+            {
+               ++this->block;
+               this->index = 0;
+            }
+
+            return *this;
+         }
+         const_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+
+         friend bool operator== (const const_iterator &a, const const_iterator &b) { return a.block == b.block && a.index == b.index; }
+         friend bool operator!= (const const_iterator &a, const const_iterator &b) { return !(a == b); }
+
+      private:
+         // dereferencing the inorder iterators of the tree isn't const
+         mutable typename TreeBase::const_inorder_iterator block;
+         std::size_t index;
+      };
+      using iterator = const_iterator;
+
+      BlockedAVLTree() : TreeBase(), _key_count(0) {}
+      explicit BlockedAVLTree(const Allocator &allocator) : TreeBase(BlockAllocator(allocator)), _key_count(0) {}
+      explicit BlockedAVLTree(const KeyCompare &compare, const Allocator &allocator=Allocator())
+         : TreeBase(compare, BlockAllocator(allocator)), _key_count(0) {}
+      BlockedAVLTree(const BlockedAVLTree &other) : TreeBase(other), _key_count(other._key_count) {}
+      BlockedAVLTree(BlockedAVLTree &&other) noexcept : TreeBase(std::move(other)), _key_count(other._key_count) {
+         other._key_count = 0;
+      }
+
+      BlockedAVLTree &operator=(const BlockedAVLTree &other) {
+         TreeBase::operator=(other);
+         this->_key_count = other._key_count;
+
+         return *this;
+      }
+      BlockedAVLTree &operator=(BlockedAVLTree &&other) {
+         TreeBase::operator=(std::move(other));
+         this->_key_count = other._key_count;
+         other._key_count = 0;
+
+         return *this;
+      }
+
+      using TreeBase::key_comp;
+
+      /// @brief Get the number of keys in the tree.
+      ///
+      inline std::size_t size() const { return this->_key_count; }
+      /// @brief Check whether the tree holds no keys.
+      ///
+      inline bool is_empty() const { return this->_key_count == 0; }
+      /// @brief Get the number of blocks the keys are stored in, which is the number of nodes of the tree.
+      ///
+      inline std::size_t block_count() const { return TreeBase::size(); }
+      /// @brief Get the bytes of every block of the tree, not counting allocator overhead.
+      ///
+      inline std::size_t memory_bytes() const { return this->block_count() * sizeof(typename TreeBase::Node); }
+
+      /// @brief Check whether the given key is in the tree.
+      ///
+      bool contains(const Key &key) const {
+         auto node = this->block_of(key);
+
+         if (node == nullptr) { return false; }
+
+         auto &block = node->value();
+         auto position = this->position_in(block, key);
+
+         return position < block.count && !this->key_less(key, block.keys[position]);
+      }
+
+      /// @brief Insert the given key into the tree.
+      ///
+      /// The key is put in place within its block. Only splitting a full block inserts a node into the tree.
+      ///
+      /// @param key The key to insert.
+      /// @throws exception::KeyExists Thrown when the key already exists in the tree.
+      ///
+      void insert(const Key &key) {
+         if (this->_root == nullptr)
+         {
+            BlockType block;
+            block.keys[0] = block.first = key;
+            block.count = 1;
+
+            TreeBase::insert(std::move(block));
+            ++this->_key_count;
+            return;
+         }
+
+         auto node = this->block_of(key);
+
+         // a key before every block goes to the first block, whose first key it becomes
+         if (node == nullptr) { node = *this->begin_inorder(); }
+
+         auto *block = &node->value();
+         auto position = this->position_in(*block, key);
+
+         if (position < block->count && !this->key_less(key, block->keys[position])) { throw exception::KeyExists(); }
+
+         if (block->count == BlockSize)
+         {
+            constexpr std::size_t half = BlockSize / 2;
+            BlockType upper;
+
+            std::copy(block->keys.begin() + half, block->keys.end(), upper.keys.begin());
+            upper.count = BlockSize - half;
+            upper.first = upper.keys[0];
+
+            // the upper half keeps its first key, so a key past it goes in before the block joins the tree
+            if (position > half)
+            {
+               this->insert_at(upper, position - half, key);
+               TreeBase::insert(std::move(upper));
+               block->count = half;
+               ++this->_key_count;
+               return;
+            }
+
+            TreeBase::insert(std::move(upper));
+            block->count = half;
+         }
+
+         this->insert_at(*block, position, key);
+         ++this->_key_count;
+      }
+
+      /// @brief Remove the given key from the tree.
+      ///
+      /// @param key The key to remove.
+      /// @throws exception::KeyNotFound Thrown if the key isn't found in the tree.
+      ///
+      void remove(const Key &key) {
+         auto node = this->block_of(key);
+
+         if (node == nullptr) { throw exception::KeyNotFound(); }
+
+         auto &block = node->value();
+         auto position = this->position_in(block, key);
+
+         if (position == block.count || this->key_less(key, block.keys[position])) { throw exception::KeyNotFound(); }
+
+         --this->_key_count;
+
+         if (block.count == 1)
+         {
+            TreeBase::remove(key);
+            return;
+         }
+
+         std::copy(block.keys.begin() + position + 1, block.keys.begin() + block.count, block.keys.begin() + position);
+         --block.count;
+         block.first = block.keys[0];
+
+         if (block.count <= BlockSize / 4) { this->merge_neighbours(block); }
+      }
+
+      /// @brief Remove every key of the tree.
+      ///
+      void clear() {
+         this->destroy();
+         this->_key_count = 0;
+      }
+
+      /// @brief Return an iterator at the first key of the tree.
+      ///
+      const_iterator begin() const { return const_iterator(this->cbegin_inorder(), 0); }
+      /// @brief Return an iterator past the last key of the tree.
+      ///
+      const_iterator end() const { return const_iterator(this->cend_inorder(), 0); }
+      const_iterator cbegin() const { return this->begin(); }
+      const_iterator cend() const { return this->end(); }
+
+      /// @brief Return an iterator at the first key which is not less than the given key, or end if there is none.
+      ///
+      const_iterator lower_bound(const Key &key) const {
+         auto next = TreeBase::upper_bound(key);
+         auto block = next;
+
+         if (next == this->cend_inorder()) { block = this->clast_inorder(); }
+         else { --block; }
+
+         // a key before every block, whose lower bound is the first key of the tree
+         if (block == this->cend_inorder()) { return const_iterator(next, 0); }
+
+         auto position = this->position_in((*block)->value(), key);
+
+         if (position < (*block)->value().count) { return const_iterator(block, position); }
+         return const_iterator(next, 0);
+      }
+
+      /// @brief Copy the keys of the tree into a vector, in order.
+      ///
+      std::vector<Key> to_vec() const {
+         std::vector<Key> result;
+         result.reserve(this->size());
+
+         for (auto iter = this->cbegin_inorder(); iter != this->cend_inorder(); ++iter)
+            result.insert(result.end(), (*iter)->value().begin(), (*iter)->value().end());
+
+         return result;
+      }
+
+   protected:
+      /// @brief Find the block the given key belongs to, which is the last block whose first key is not greater
+      /// than it, or null if the key is before every block.
+      ///
+      NodePointer block_of(const Key &key) const {
+         NodePointer node = this->_root, floor = nullptr;
+
+         while (node != nullptr)
+         {
+            if (this->key_less(key, node->key())) { node = node->left(); }
+            else
+            {
+               floor = node;
+               node = node->right();
+            }
+         }
+
+         return floor;
+      }
+
+      /// @brief Get the position of the first key of the block which is not less than the given key.
+      ///
+      std::size_t position_in(const BlockType &block, const Key &key) const {
+         if constexpr (linear_search)
+         {
+            std::size_t position = 0;
+
+            for (std::size_t i=0; i<block.count; ++i)
+               position += static_cast<std::size_t>(this->key_less(block.keys[i], key));
+
+            return position;
+         }
+         else
+         {
+            auto less = [this](const Key &a, const Key &b) { return this->key_less(a, b); };
+
+            return std::lower_bound(block.begin(), block.end(), key, less) - block.begin();
+         }
+      }
+
+      /// @brief Insert the given key at the given position of a block which isn't full.
+      ///
+      static void insert_at(BlockType &block, std::size_t position, const Key &key) {
+         std::copy_backward(block.keys.begin() + position, block.keys.begin() + block.count, block.keys.begin() + block.count + 1);
+         block.keys[position] = key;
+         block.first = block.keys[0];
+         ++block.count;
+      }
+
+      /// @brief Merge the given block with the block after it or, failing that, the block before it, if both fit
+      /// in half a block.
+      ///
+      void merge_neighbours(BlockType &block) {
+         auto iter = TreeBase::lower_bound(block.keys[0]);
+         auto next = iter, previous = iter;
+
+         if (++next != this->end_inorder() && this->merge_into(block, (*next)->value())) { return; }
+         if (--previous != this->end_inorder()) { this->merge_into((*previous)->value(), block); }
+      }
+
+      /// @brief Move the keys of a block into the block before it and remove the emptied block, if the keys
+      /// of both fit in half a block.
+      ///
+      /// @returns Whether the blocks were merged.
+      ///
+      bool merge_into(BlockType &into, const BlockType &from) {
+         if (into.count + from.count > BlockSize / 2) { return false; }
+
+         auto first = from.first;
+
+         std::copy(from.begin(), from.end(), into.keys.begin() + into.count);
+         into.count += from.count;
+         TreeBase::remove(first);
+
+         return true;
+      }
+
+      /// @brief The number of keys in the tree, over every block.
+      ///
+      std::size_t _key_count;
+   };
+}
+
+#endif
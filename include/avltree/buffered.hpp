@@ -0,0 +1,337 @@
+#ifndef __AVLTREE_BUFFERED_HPP
+#define __AVLTREE_BUFFERED_HPP
+
+#include "../avltree.hpp"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+
+namespace avltree
+{
+   /// @brief An AVL map whose writes land in a small buffer, which is merged into the main map in sorted batches.
+   ///
+   /// Assignments and erasures are recorded in a buffer of at most a few thousand keys, which stays in the cache,
+   /// without looking at the main map at all: an erasure is a tombstone which hides whatever the main map holds
+   /// for its key. When the buffer fills up, it is frozen and a background thread merges it into the main map:
+   /// the tombstones with erase_batch and the assignments with insert_or_assign_batch, so each ancestor is
+   /// rebalanced once per batch rather than once per write. Writes then go to a fresh buffer meanwhile. A buffer
+   /// which fills up before the previous merge is done waits for it, which bounds the memory the buffers take.
+   ///
+   /// Lookups consult the buffer, the frozen buffer and the main map, in that order, so each key reads as its
+   /// last write. Values are returned by copy, since a merge may release the node holding them as soon as the
+   /// lookup is done. The map is safe to use from several threads at once.
+   ///
+   /// A merge which fails to allocate terminates the program, since no thread is left to report it to.
+   ///
+   /// @tparam Key The type of the key for the mapping.
+   /// @tparam Value The type of the value for the mapping.
+   /// @tparam KeyCompare The key comparison functor for sorting the nodes. See AVLTreeBase.
+   /// @tparam Allocator The allocator of the nodes of the main map, which the merging thread allocates from too.
+   ///
+   template <typename Key, typename Value, typename KeyCompare=std::less<Key>,
+             typename Allocator=std::allocator<std::pair<const Key, Value>>>
+   class BufferedAVLMap
+   {
+   public:
+      using KeyType = Key;
+      using MappedType = Value;
+      using ValueType = std::pair<const Key, Value>;
+      using MapType = AVLMap<Key, Value, KeyCompare, RawNodeStorage, Allocator>;
+      /// @brief The map of the buffered writes, where an empty value is a tombstone.
+      ///
+      using BufferType = AVLMap<Key, std::optional<Value>, KeyCompare>;
+
+      /// @brief The number of writes the buffer takes before it is merged, unless told otherwise.
+      ///
+      static constexpr std::size_t default_buffer_capacity = 1 << 12;
+
+      /// @brief Create an empty map.
+      ///
+      /// @param buffer_capacity The number of keys the buffer takes before it is merged into the main map.
+      /// @throws exception::IndexOutOfRange Thrown if the capacity is 0.
+      ///
+      explicit BufferedAVLMap(std::size_t buffer_capacity=default_buffer_capacity) : _buffer_capacity(buffer_capacity) {
+         if (buffer_capacity == 0) { throw exception::IndexOutOfRange(); }
+      }
+      BufferedAVLMap(const BufferedAVLMap &other) = delete;
+      /// @brief Wait for the merge in progress, if any, and destroy the map.
+      ///
+      ~BufferedAVLMap() {
+         if (this->_merger.joinable()) { this->_merger.join(); }
+      }
+
+      BufferedAVLMap &operator=(const BufferedAVLMap &other) = delete;
+
+      /// @brief Check whether the given key is in the map.
+      ///
+      bool contains(const Key &key) const { return this->find(key).has_value(); }
+      /// @brief Attempt to find the value associated with the given key.
+      ///
+      /// @param key The key to search for.
+      /// @returns A copy of the value associated with the key, or std::nullopt if the key was not found.
+      ///
+      std::optional<Value> find(const Key &key) const {
+         std::shared_ptr<const BufferType> frozen;
+
+         {
+            std::lock_guard<std::mutex> lock(this->_buffer_lock);
+            auto entry = this->_buffer.find(key);
+
+            if (entry.has_value()) { return (*entry)->value().second; }
+
+            frozen = this->_frozen;
+         }
+
+         // the frozen buffer is never written to, and the merge only reads it
+         if (frozen != nullptr)
+         {
+            auto entry = frozen->find(key);
+
+            if (entry.has_value()) { return (*entry)->value().second; }
+         }
+
+         std::shared_lock<std::shared_mutex> lock(this->_map_lock);
+         auto node = this->_map.find(key);
+
+         if (!node.has_value()) { return std::nullopt; }
+         return (*node)->value().second;
+      }
+      /// @brief Get the value associated with the given key.
+      ///
+      /// @param key The key to get.
+      /// @returns A copy of the value associated with the given key.
+      /// @throws exception::KeyNotFound Thrown if the given key isn't found.
+      ///
+      Value get(const Key &key) const {
+         auto value = this->find(key);
+
+         if (!value.has_value()) { throw exception::KeyNotFound(); }
+         return *value;
+      }
+
+      /// @brief Assign the given value to the key, inserting the key if it doesn't exist in the map.
+      ///
+      /// Unlike AVLMap::insert_or_assign, this doesn't tell whether the key was inserted, since finding out would
+      /// take a lookup in the main map.
+      ///
+      /// @param key The key to assign to.
+      /// @param value The value to assign.
+      ///
+      void insert_or_assign(const Key &key, const Value &value) { this->write(key, std::optional<Value>(value)); }
+      /// @brief Erase the key from the map, if it is in the map.
+      ///
+      /// Unlike AVLMap::remove, this doesn't check for the key, so it throws nothing when the key isn't there. The
+      /// tombstone it leaves hides the key until the buffer is merged.
+      ///
+      /// @param key The key to erase.
+      ///
+      void erase(const Key &key) { this->write(key, std::nullopt); }
+
+      /// @brief Merge every buffered write into the main map, and wait for the merge to finish.
+      ///
+      void flush() {
+         std::lock_guard<std::mutex> lock(this->_buffer_lock);
+
+         if (!this->_buffer.is_empty()) { this->start_merge(); }
+         this->finish_merge();
+      }
+
+      /// @brief Get the number of keys in the map.
+      ///
+      /// Writes are buffered without looking at the main map, so this looks up every buffered key there. It takes
+      /// O(b log n) time for b buffered writes, during which writers wait.
+      ///
+      std::size_t size() const {
+         std::lock_guard<std::mutex> lock(this->_buffer_lock);
+         std::shared_lock<std::shared_mutex> map_lock(this->_map_lock);
+         auto size = this->_map.size();
+         // a key written to the buffer existed before if the frozen buffer or, failing that, the main map has it
+         auto existed = [this](const Key &key) {
+            if (this->_frozen != nullptr)
+            {
+               auto entry = this->_frozen->find(key);
+
+               if (entry.has_value()) { return (*entry)->value().second.has_value(); }
+            }
+
+            return this->_map.contains(key);
+         };
+
+         if (this->_frozen != nullptr)
+            for (auto iter = this->_frozen->cbegin_inorder(); iter != this->_frozen->cend_inorder(); ++iter)
+               size += count_change((*iter)->value().second.has_value(), this->_map.contains((*iter)->key()));
+
+         for (auto iter = this->_buffer.cbegin_inorder(); iter != this->_buffer.cend_inorder(); ++iter)
+            size += count_change((*iter)->value().second.has_value(), existed((*iter)->key()));
+
+         return size;
+      }
+      /// @brief Check whether the map holds no keys. See size.
+      ///
+      inline bool is_empty() const { return this->size() == 0; }
+      /// @brief Get the number of writes buffered and not yet merged into the main map, including a frozen buffer
+      /// being merged.
+      ///
+      std::size_t buffered() const {
+         std::lock_guard<std::mutex> lock(this->_buffer_lock);
+
+         return this->_buffer.size() + ((this->_frozen != nullptr) ? this->_frozen->size() : 0);
+      }
+
+      /// @brief Visit every key-value pair of the map, in order.
+      ///
+      /// The buffers and the main map are walked side by side, and each key is visited with its last write, so
+      /// this takes O(n + b) time. Writers wait for the whole visit, and the visitor must not use this map.
+      ///
+      /// @param visitor The functor to call with each key-value pair.
+      ///
+      template <typename Visitor>
+      void visit(Visitor &&visitor) const {
+         std::lock_guard<std::mutex> lock(this->_buffer_lock);
+         std::shared_lock<std::shared_mutex> map_lock(this->_map_lock);
+         auto compare = this->_map.key_comp();
+         auto less = [&compare](const Key &a, const Key &b) { return KeyOrder<KeyCompare>::less(compare, a, b); };
+         BufferType empty;
+         const BufferType &frozen = (this->_frozen != nullptr) ? *this->_frozen : empty;
+         auto buffered = this->_buffer.cbegin_inorder(), frozen_iter = frozen.cbegin_inorder();
+         auto node = this->_map.cbegin_inorder();
+
+         while (buffered != this->_buffer.cend_inorder() || frozen_iter != frozen.cend_inorder() ||
+                node != this->_map.cend_inorder())
+         {
+            // find the least key of the three, and which of them hold it
+            const Key *least = nullptr;
+
+            if (buffered != this->_buffer.cend_inorder()) { least = &(*buffered)->key(); }
+            if (frozen_iter != frozen.cend_inorder() && (least == nullptr || less((*frozen_iter)->key(), *least)))
+               least = &(*frozen_iter)->key();
+            if (node != this->_map.cend_inorder() && (least == nullptr || less((*node)->key(), *least)))
+               least = &(*node)->key();
+
+            auto key = *least;
+            auto at = [&less, &key](auto &iter, auto end) { return iter != end && !less(key, (*iter)->key()); };
+            auto in_buffer = at(buffered, this->_buffer.cend_inorder());
+            auto in_frozen = at(frozen_iter, frozen.cend_inorder());
+            auto in_map = at(node, this->_map.cend_inorder());
+
+            // the newest write wins
+            if (in_buffer)
+            {
+               auto &entry = (*buffered)->value();
+               if (entry.second.has_value()) { visitor(ValueType(entry.first, *entry.second)); }
+            }
+            else if (in_frozen)
+            {
+               auto &entry = (*frozen_iter)->value();
+               if (entry.second.has_value()) { visitor(ValueType(entry.first, *entry.second)); }
+            }
+            else { visitor((*node)->value()); }
+
+            if (in_buffer) { ++buffered; }
+            if (in_frozen) { ++frozen_iter; }
+            if (in_map) { ++node; }
+         }
+      }
+      /// @brief Copy every key-value pair of the map into a vector, in order. See visit.
+      ///
+      std::vector<ValueType> to_vec() const {
+         std::vector<ValueType> result;
+
+         this->visit([&result](const ValueType &value) { result.push_back(value); });
+
+         return result;
+      }
+
+   protected:
+      /// @brief Get how a buffered write changes the number of keys, given whether its key existed before it.
+      ///
+      static std::size_t count_change(bool assigns, bool existed) {
+         if (assigns && !existed) { return 1; }
+         if (!assigns && existed) { return static_cast<std::size_t>(-1); }
+
+         return 0;
+      }
+
+      /// @brief Record the given write in the buffer, and start merging the buffer if it is full.
+      ///
+      void write(const Key &key, std::optional<Value> entry) {
+         std::lock_guard<std::mutex> lock(this->_buffer_lock);
+
+         this->_buffer.insert_or_assign(key, std::move(entry));
+
+         if (this->_buffer.size() >= this->_buffer_capacity) { this->start_merge(); }
+      }
+
+      /// @brief Freeze the buffer and start merging it into the main map on a background thread. The buffer must
+      /// be locked.
+      ///
+      /// The previous merge is waited for first. The merging thread doesn't take the buffer lock, so waiting for
+      /// it with the lock held can't deadlock.
+      ///
+      void start_merge() {
+         this->finish_merge();
+
+         auto frozen = std::make_shared<const BufferType>(std::move(this->_buffer));
+         this->_frozen = frozen;
+         this->_merger = std::thread([this, frozen]() noexcept { this->merge(*frozen); });
+      }
+
+      /// @brief Wait for the merge in progress, if any, and drop the frozen buffer. The buffer must be locked.
+      ///
+      void finish_merge() {
+         if (this->_merger.joinable()) { this->_merger.join(); }
+
+         this->_frozen.reset();
+      }
+
+      /// @brief Merge the writes of the given buffer into the main map.
+      ///
+      /// The batches are gathered before the main map is locked, so readers of the main map only wait for the
+      /// batch operations themselves.
+      ///
+      void merge(const BufferType &buffer) {
+         std::vector<Key> tombstones;
+         std::vector<ValueType> values;
+
+         for (auto iter = buffer.cbegin_inorder(); iter != buffer.cend_inorder(); ++iter)
+         {
+            auto &entry = (*iter)->value();
+
+            if (entry.second.has_value()) { values.emplace_back(entry.first, *entry.second); }
+            else { tombstones.push_back(entry.first); }
+         }
+
+         std::unique_lock<std::shared_mutex> lock(this->_map_lock);
+
+         this->_map.erase_batch(tombstones.begin(), tombstones.end());
+         this->_map.insert_or_assign_batch(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+      }
+
+      /// @brief The main map, which holds every write merged so far.
+      ///
+      MapType _map;
+      /// @brief The lock of the main map, which merges take whole.
+      ///
+      mutable std::shared_mutex _map_lock;
+      /// @brief The writes made since the buffer was last frozen.
+      ///
+      BufferType _buffer;
+      /// @brief The buffer being merged into the main map, or null if no merge is in progress.
+      ///
+      std::shared_ptr<const BufferType> _frozen;
+      /// @brief The lock of the buffer, the frozen buffer and the merging thread.
+      ///
+      mutable std::mutex _buffer_lock;
+      /// @brief The thread merging the frozen buffer, if any.
+      ///
+      std::thread _merger;
+      /// @brief The number of keys the buffer takes before it is merged.
+      ///
+      std::size_t _buffer_capacity;
+   };
+}
+
+#endif
@@ -0,0 +1,354 @@
+#ifndef __AVLTREE_CONCURRENT_HPP
+#define __AVLTREE_CONCURRENT_HPP
+
+#include "../avltree.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace avltree
+{
+   /// @brief Epoch-based reclamation for structures whose readers take no locks.
+   ///
+   /// Readers pin the current epoch for as long as they hold on to anything they found. Writers retire what they
+   /// unlinked into the epoch it was unlinked in, and free it once no reader which could have seen it is left.
+   /// Readers are counted per epoch parity on separate cache lines, picked by thread, so readers on different
+   /// cores don't contend over a single counter.
+   ///
+   /// Only one writer may advance the epoch at a time. See ConcurrentAVLMap.
+   ///
+   class EpochDomain
+   {
+   public:
+      /// @brief The number of reader counters per epoch parity.
+      ///
+      static constexpr std::size_t stripes = 16;
+
+      /// @brief A pinned epoch, which keeps everything retired during or after it from being freed.
+      ///
+      class Guard
+      {
+      public:
+         Guard(const EpochDomain &domain) : counter(nullptr) {
+            auto stripe = EpochDomain::stripe();
+
+            for (;;)
+            {
+               auto epoch = domain._epoch.load();
+               this->counter = &domain._readers[epoch & 1][stripe].count;
+               this->counter->fetch_add(1);
+
+               // a writer may have advanced the epoch before it could see this reader, so check it still holds
+               if (domain._epoch.load() == epoch) { break; }
+
+               this->counter->fetch_sub(1);
+            }
+         }
+         Guard(const Guard &other) = delete;
+         ~Guard() { this->counter->fetch_sub(1, std::memory_order_release); }
+
+         Guard &operator=(const Guard &other) = delete;
+
+      private:
+         std::atomic<std::size_t> *counter;
+      };
+
+      EpochDomain() : _epoch(0) {}
+      EpochDomain(const EpochDomain &other) = delete;
+
+      EpochDomain &operator=(const EpochDomain &other) = delete;
+
+      /// @brief Pin the current epoch until the returned guard is destroyed.
+      ///
+      Guard pin() const { return Guard(*this); }
+
+      /// @brief Get the current epoch.
+      ///
+      inline std::uint64_t epoch() const { return this->_epoch.load(); }
+
+      /// @brief Advance the epoch, if no reader pinned the epoch before the current one is left.
+      ///
+      /// When this succeeds, nothing retired in the epoch before the current one can be reached by any reader, and
+      /// it may be freed. Must only be called by one writer at a time.
+      ///
+      /// @returns Whether the epoch was advanced.
+      ///
+      bool try_advance() {
+         auto epoch = this->_epoch.load();
+
+         // the epoch before the current one has the same parity as the next one
+         for (auto &readers : this->_readers[(epoch + 1) & 1])
+            if (readers.count.load() != 0)
+               return false;
+
+         this->_epoch.store(epoch + 1);
+         return true;
+      }
+
+   protected:
+      struct alignas(64) Readers {
+         std::atomic<std::size_t> count{0};
+      };
+
+      /// @brief Get the reader counter the calling thread uses.
+      ///
+      static std::size_t stripe() {
+         static thread_local const std::size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id()) % stripes;
+
+         return stripe;
+      }
+
+      std::atomic<std::uint64_t> _epoch;
+      mutable Readers _readers[2][stripes];
+   };
+
+   /// @brief An AVL map which any number of threads can read without locks while writers modify it.
+   ///
+   /// Writers never modify a node readers can reach. An insertion or removal copies the nodes on its path and
+   /// rebalances the copies, with the same rotation code as AVLTreeBase, then publishes the new root atomically.
+   /// A reader descends from whichever root it loaded and always sees a complete, balanced version of the map.
+   /// The nodes a write replaced are freed through an EpochDomain once no reader is left which could still be
+   /// looking at them.
+   ///
+   /// Writers are serialized by a mutex readers never touch. Each write only copies O(log n) nodes and publishes
+   /// them with a single store, so the write lock is held briefly, but writes from several threads still take turns.
+   ///
+   /// Values are returned by copy, since a node may be freed as soon as the reader which found it lets go.
+   ///
+   /// @tparam Key The type of the key for the mapping.
+   /// @tparam Value The type of the value for the mapping.
+   /// @tparam KeyCompare The key comparison functor for sorting the nodes. See AVLTreeBase.
+   /// @tparam Allocator The allocator of the map's nodes, only ever used by writers. See AVLTreeBase.
+   ///
+   template <typename Key, typename Value, typename KeyCompare=std::less<Key>,
+             typename Allocator=std::allocator<std::pair<const Key, Value>>>
+   class ConcurrentAVLMap : protected AVLTreeBase<Key, std::pair<const Key, Value>, KeyOfPair<Key, Value>, KeyCompare,
+                                                  CompactNodeStorage, Allocator>
+   {
+   public:
+      using TreeBase = AVLTreeBase<Key, std::pair<const Key, Value>, KeyOfPair<Key, Value>, KeyCompare, CompactNodeStorage,
+                                   Allocator>;
+      using KeyType = Key;
+      using MappedType = Value;
+      using ValueType = typename TreeBase::ValueType;
+      using NodePointer = typename TreeBase::NodePointer;
+      using ConstNodePointer = typename TreeBase::ConstNodePointer;
+      using TreeBase::key_comp;
+
+      ConcurrentAVLMap() : TreeBase(), _published(nullptr), _published_size(0) {}
+      explicit ConcurrentAVLMap(const Allocator &allocator) : TreeBase(allocator), _published(nullptr), _published_size(0) {}
+      ConcurrentAVLMap(const ConcurrentAVLMap &other) = delete;
+      /// @brief Destroy the map. No thread may be using it anymore.
+      ///
+      ~ConcurrentAVLMap() {
+         for (auto &retired : this->_retired)
+            this->release(retired);
+      }
+
+      ConcurrentAVLMap &operator=(const ConcurrentAVLMap &other) = delete;
+
+      /// @brief Check whether the given key is in the map.
+      ///
+      /// This takes no locks.
+      ///
+      bool contains(const Key &key) const {
+         auto guard = this->_epochs.pin();
+
+         return this->locate_published(key) != nullptr;
+      }
+      /// @brief Attempt to find the value associated with the given key.
+      ///
+      /// This takes no locks.
+      ///
+      /// @param key The key to search for.
+      /// @returns A copy of the value associated with the key, or std::nullopt if the key was not found.
+      ///
+      std::optional<Value> find(const Key &key) const {
+         auto guard = this->_epochs.pin();
+         auto node = this->locate_published(key);
+
+         if (node == nullptr) { return std::nullopt; }
+         return node->value().second;
+      }
+      /// @brief Get the value associated with the given key.
+      ///
+      /// This takes no locks.
+      ///
+      /// @param key The key to get.
+      /// @returns A copy of the value associated with the given key.
+      /// @throws exception::KeyNotFound Thrown if the given key isn't found.
+      ///
+      Value get(const Key &key) const {
+         auto value = this->find(key);
+
+         if (!value.has_value()) { throw exception::KeyNotFound(); }
+         return *value;
+      }
+      /// @brief Visit every key-value pair of a single version of the map, in order.
+      ///
+      /// This takes no locks. Writes made while visiting are not seen, and nodes are kept alive until the visit
+      /// ends, so keep the visitor short.
+      ///
+      /// @param visitor The functor to call with each key-value pair.
+      ///
+      template <typename Visitor>
+      void visit(Visitor &&visitor) const {
+         auto guard = this->_epochs.pin();
+         ConstNodePointer root = this->_published.load(std::memory_order_acquire);
+
+         for (auto iter = typename TreeBase::const_inorder_iterator(root); iter != typename TreeBase::const_inorder_iterator(nullptr); ++iter)
+            visitor((*iter)->value());
+      }
+      /// @brief Copy a single version of the map into a vector, in order.
+      ///
+      /// See visit.
+      ///
+      std::vector<ValueType> to_vec() const {
+         std::vector<ValueType> result;
+
+         this->visit([&result](const ValueType &value) { result.push_back(value); });
+
+         return result;
+      }
+      /// @brief Get the number of keys in the map as of the latest write.
+      ///
+      inline std::size_t size() const { return this->_published_size.load(std::memory_order_acquire); }
+      /// @brief Check whether the map held no keys as of the latest write.
+      ///
+      inline bool is_empty() const { return this->size() == 0; }
+
+      /// @brief Insert a given key-value pair into the map.
+      ///
+      /// @param key The key to associate with the value.
+      /// @param value The value to insert.
+      /// @throws exception::KeyExists Thrown when the key already exists in the map.
+      ///
+      void insert(const Key &key, const Value &value) {
+         std::lock_guard<std::mutex> lock(this->_writer);
+
+         if (this->contains_unpublished(key)) { throw exception::KeyExists(); }
+
+         this->insert_unpublished(key, value);
+         this->publish();
+      }
+      /// @brief Assign the given value to the key, inserting the key if it doesn't exist in the map.
+      ///
+      /// @param key The key to assign to.
+      /// @param value The value to assign.
+      /// @returns Whether the key was inserted.
+      ///
+      bool insert_or_assign(const Key &key, const Value &value) {
+         std::lock_guard<std::mutex> lock(this->_writer);
+         auto inserted = !this->contains_unpublished(key);
+
+         if (inserted) { this->insert_unpublished(key, value); }
+         else
+         {
+            typename TreeBase::template AncestorStack<NodePointer *> links;
+            auto retire = this->retirer();
+
+            (*this->copy_path(key, links, retire))->value().second = value;
+         }
+
+         this->publish();
+
+         return inserted;
+      }
+      /// @brief Remove the key from the map.
+      ///
+      /// @param key The key to remove.
+      /// @throws exception::KeyNotFound Thrown if the key isn't found in the map.
+      ///
+      void remove(const Key &key) {
+         std::lock_guard<std::mutex> lock(this->_writer);
+
+         if (!this->contains_unpublished(key)) { throw exception::KeyNotFound(); }
+
+         auto retire = this->retirer();
+         this->remove_copied(key, retire);
+         this->publish();
+      }
+
+   protected:
+      /// @brief Find the node with the given key in the published version of the map.
+      ///
+      /// The caller must have pinned the epoch.
+      ///
+      ConstNodePointer locate_published(const Key &key) const {
+         ConstNodePointer node = this->_published.load(std::memory_order_acquire);
+
+         while (node != nullptr)
+         {
+            auto branch = this->compare_keys(key, node->key());
+
+            if (branch == 0) { return node; }
+
+            node = (branch < 0) ? node->left() : node->right();
+         }
+
+         return nullptr;
+      }
+      /// @brief Check whether the given key is in the writer's version of the map. The writer lock must be held.
+      ///
+      bool contains_unpublished(const Key &key) const {
+         auto result = TreeBase::locate(key);
+
+         return result.first != nullptr && result.second == 0;
+      }
+      /// @brief Insert a key which isn't in the map into the writer's version of it. The writer lock must be held.
+      ///
+      void insert_unpublished(const Key &key, const Value &value) {
+         auto node = this->construct_node(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(value));
+         auto retire = this->retirer();
+
+         this->attach_copied(node, retire);
+      }
+      /// @brief Get the functor which retires nodes into the current epoch. The writer lock must be held.
+      ///
+      auto retirer() {
+         auto &retired = this->_retired[this->_epochs.epoch() & 1];
+
+         return [&retired](NodePointer node) { retired.push_back(node); };
+      }
+      /// @brief Publish the writer's version of the map, then free whatever no reader can reach anymore.
+      ///
+      /// The writer lock must be held.
+      ///
+      void publish() {
+         this->_published.store(this->_root, std::memory_order_release);
+         this->_published_size.store(this->_size, std::memory_order_release);
+
+         // the epoch before the current one shares its parity with the next one, whose retired nodes are empty
+         auto &reclaimable = this->_retired[(this->_epochs.epoch() + 1) & 1];
+
+         if (this->_epochs.try_advance()) { this->release(reclaimable); }
+      }
+      /// @brief Free the given retired nodes. Retired nodes are unlinked, so only the nodes themselves go.
+      ///
+      void release(std::vector<NodePointer> &retired) {
+         for (auto node : retired)
+            this->deallocate_node(node);
+
+         retired.clear();
+      }
+
+      /// @brief The root readers descend from.
+      ///
+      std::atomic<ConstNodePointer> _published;
+      /// @brief The size of the published version of the map.
+      ///
+      std::atomic<std::size_t> _published_size;
+      /// @brief The lock which serializes writers.
+      ///
+      std::mutex _writer;
+      /// @brief The epochs readers pin.
+      ///
+      EpochDomain _epochs;
+      /// @brief The nodes retired by writers, by the parity of the epoch they were retired in.
+      ///
+      std::vector<NodePointer> _retired[2];
+   };
+}
+
+#endif
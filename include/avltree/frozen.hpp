@@ -0,0 +1,457 @@
+#ifndef __AVLTREE_FROZEN_HPP
+#define __AVLTREE_FROZEN_HPP
+
+#include "../avltree.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace avltree
+{
+   /// @brief The index arithmetic of a complete binary tree laid out in Eytzinger order.
+   ///
+   /// Indexes count from 1, the children of the k-th value being the 2k-th and the (2k+1)-th values, and 0 stands
+   /// for no value. See FrozenTree.
+   ///
+   struct EytzingerLayout {
+      /// @brief Get the index of the first value to visit in order, which is the leftmost one.
+      ///
+      static std::size_t first_index(std::size_t size) {
+         if (size == 0) { return 0; }
+
+         std::size_t index = 1;
+
+         while (index * 2 <= size)
+            index *= 2;
+
+         return index;
+      }
+      /// @brief Get the index of the value following the given index in order, or 0 past the last value.
+      ///
+      static std::size_t next_index(std::size_t index, std::size_t size) {
+         if (index * 2 + 1 <= size)
+         {
+            index = index * 2 + 1;
+
+            while (index * 2 <= size)
+               index *= 2;
+
+            return index;
+         }
+
+         // climb past every ancestor whose right subtree was just finished
+         while (index & 1)
+            index >>= 1;
+
+         return index >> 1;
+      }
+
+      /// @brief Turn the index a descent ended past the bottom on into the index of its lower bound.
+      ///
+      /// The final index went right past the answer and then left at every level below it, so the answer is
+      /// found by stripping the trailing right turns and the last left turn.
+      ///
+      static std::size_t lower_bound_of(std::size_t index) {
+         while (index & 1)
+            index >>= 1;
+
+         return index >> 1;
+      }
+   };
+
+   /// @brief An immutable snapshot of a tree, laid out contiguously in Eytzinger order.
+   ///
+   /// The values are stored in a single array in the order of a breadth-first walk of a complete binary tree:
+   /// the children of the k-th value (counting from 1) are the 2k-th and the (2k+1)-th values. The first levels
+   /// of every search share the same few cache lines, each step of a search is a comparison and an index
+   /// computation with no branch to mispredict, and the descendants of a value four levels down are contiguous,
+   /// so they are prefetched while the levels in between are compared. An AVL tree built from separately
+   /// allocated nodes has none of these properties.
+   ///
+   /// The snapshot keeps the lookup and in-order iteration interface of the tree it was frozen from. Use thaw
+   /// to get a mutable tree back.
+   ///
+   /// @tparam Tree The tree class the snapshot was frozen from, such as AVLTree or AVLMap.
+   ///
+   template <typename Tree>
+   class FrozenTree : protected EytzingerLayout
+   {
+   public:
+      using TreeType = Tree;
+      using KeyType = typename Tree::KeyType;
+      using ValueType = typename Tree::ValueType;
+      using KeyOfValue = typename Tree::KeyOfValueType;
+      using KeyCompare = typename Tree::KeyCompareType;
+
+      /// @brief An iterator over the values of a frozen tree, in order.
+      ///
+      class const_iterator
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = ValueType;
+         using pointer = const value_type *;
+         using reference = const value_type &;
+
+         const_iterator(const FrozenTree *tree, std::size_t index) : tree(tree), index(index) {}
+
+         reference operator*() const {
+            if (this->index == 0) { throw exception::NullPointer(); }
+
+            return this->tree->at(this->index);
+         }
+         pointer operator->() const { return &**this; }
+
+         const_iterator &operator++() {
+            if (this->index == 0) { throw exception::NullPointer(); }
+
+            this->index = this->tree->next_index(this->index);
+
+            return *this;
+         }
+         const_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+
+         friend bool operator== (const const_iterator &a, const const_iterator &b) { return a.index == b.index; }
+         friend bool operator!= (const const_iterator &a, const const_iterator &b) { return a.index != b.index; }
+
+      private:
+         const FrozenTree *tree;
+         std::size_t index;
+      };
+      using iterator = const_iterator;
+
+      FrozenTree() {}
+      /// @brief Freeze the given tree, copying its values.
+      ///
+      /// This takes linear time.
+      ///
+      explicit FrozenTree(const Tree &tree) : _compare(tree.key_comp()) {
+         std::vector<const ValueType *> order(tree.size(), nullptr);
+         std::size_t index = this->first_index(tree.size());
+
+         for (auto iter = tree.cbegin_inorder(); iter != tree.cend_inorder(); ++iter)
+         {
+            order[index-1] = &(*iter)->value();
+            index = next_index(index, tree.size());
+         }
+
+         this->_values.reserve(order.size());
+
+         for (auto value : order)
+            this->_values.push_back(*value);
+      }
+
+      /// @brief Get a mutable tree holding the values of this snapshot.
+      ///
+      /// This takes linear time, see AVLTreeBase::assign_sorted.
+      ///
+      Tree thaw() const {
+         Tree tree = this->make_tree();
+         tree.assign_sorted(this->begin(), this->end());
+
+         return tree;
+      }
+
+      /// @brief Get the number of values in this snapshot.
+      ///
+      inline std::size_t size() const { return this->_values.size(); }
+      /// @brief Check whether this snapshot holds no values.
+      ///
+      inline bool is_empty() const { return this->_values.empty(); }
+
+      /// @brief Check whether the given key is in this snapshot.
+      ///
+      bool contains(const KeyType &key) const { return this->find_index(key) != 0; }
+      /// @brief Attempt to find the value with the given key in this snapshot.
+      ///
+      /// @param key The key to search for.
+      /// @returns The value with the given key, or std::nullopt if no value was found.
+      ///
+      std::optional<const ValueType *> find(const KeyType &key) const {
+         auto index = this->find_index(key);
+
+         if (index == 0) { return std::nullopt; }
+         return &this->at(index);
+      }
+      /// @brief Get the value with the given key in this snapshot, throwing an exception if it isn't there.
+      ///
+      /// @param key The key to search for.
+      /// @returns The value with the given key.
+      /// @throws exception::KeyNotFound Thrown if the key is not found in the snapshot.
+      ///
+      const ValueType &get(const KeyType &key) const {
+         auto index = this->find_index(key);
+
+         if (index == 0) { throw exception::KeyNotFound(); }
+         return this->at(index);
+      }
+      /// @brief Look up every key of the given range, writing a pointer to the value found for each to the output.
+      ///
+      /// The searches run in batches of batch_width keys which descend the snapshot together, one level at a time,
+      /// so the cache misses of the searches in a batch overlap instead of waiting on one another. The value each
+      /// search reads next is prefetched while the other searches of the batch take their step. When built with
+      /// AVX2, batches of 32-bit integer keys ordered by std::less are compared eight at a time.
+      ///
+      /// @param first The start of the range of keys.
+      /// @param last The end of the range of keys.
+      /// @param out The output to write a pointer to each value to, or null for the keys which were not found.
+      /// @returns The output iterator past the last pointer written.
+      ///
+      template <typename ForwardIt, typename OutputIt>
+      OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const {
+         this->search_many(first, last, [this, &out](const KeyType &key, std::size_t index) {
+            *out = (this->matches(index, key)) ? &this->at(index) : nullptr;
+            ++out;
+         });
+
+         return out;
+      }
+      /// @brief Check whether each key of the given range is in this snapshot. See find_many.
+      ///
+      /// @param first The start of the range of keys.
+      /// @param last The end of the range of keys.
+      /// @returns A bitmap with the bit of every key which was found set, in the order of the keys.
+      ///
+      template <typename ForwardIt>
+      std::vector<bool> contains_many(ForwardIt first, ForwardIt last) const {
+         std::vector<bool> result;
+
+         this->search_many(first, last, [this, &result](const KeyType &key, std::size_t index) {
+            result.push_back(this->matches(index, key));
+         });
+
+         return result;
+      }
+      /// @brief Get an iterator to the first value whose key is not less than the given key.
+      ///
+      const_iterator lower_bound(const KeyType &key) const { return const_iterator(this, this->lower_bound_index(key)); }
+
+      const_iterator begin() const { return const_iterator(this, this->first_index(this->size())); }
+      const_iterator end() const { return const_iterator(this, 0); }
+      const_iterator cbegin() const { return this->begin(); }
+      const_iterator cend() const { return this->end(); }
+
+      /// @brief Get the values of this snapshot in Eytzinger order.
+      ///
+      inline const std::vector<ValueType> &values() const { return this->_values; }
+
+      /// @brief The number of searches a batch lookup runs together. See find_many.
+      ///
+      static constexpr std::size_t batch_width = 16;
+
+   protected:
+      /// @brief The number of values whose descendants four levels down are prefetched.
+      ///
+      static constexpr std::size_t prefetch_levels = 4;
+
+#if defined(__AVX2__)
+      /// @brief Whether batches of keys are compared with vector instructions.
+      ///
+      /// This is the case when the values are 32-bit integer keys ordered by std::less, so the values a level of
+      /// searches is on can be gathered straight out of the array and compared eight at a time.
+      ///
+      static constexpr bool vector_lookups = std::is_integral<KeyType>::value && sizeof(KeyType) == 4 &&
+         std::is_same<KeyType, ValueType>::value && std::is_same<KeyCompare, std::less<KeyType>>::value;
+#else
+      static constexpr bool vector_lookups = false;
+#endif
+
+      /// @brief Make an empty tree ordered by the comparator of the snapshot, if the tree can be given one.
+      ///
+      Tree make_tree() const {
+         if constexpr (std::is_constructible<Tree, const KeyCompare &>::value) { return Tree(this->_compare); }
+         else { return Tree(); }
+      }
+
+      /// @brief Determine whether the first key is ordered before the second by the comparator of the tree.
+      ///
+      inline bool less(const KeyType &a, const KeyType &b) const { return KeyOrder<KeyCompare>::less(this->_compare, a, b); }
+
+      /// @brief Get the value at the given index, counting from 1.
+      ///
+      inline const ValueType &at(std::size_t index) const { return this->_values[index-1]; }
+
+      using EytzingerLayout::next_index;
+      std::size_t next_index(std::size_t index) const { return next_index(index, this->size()); }
+
+      /// @brief Get the index of the first value whose key is not less than the given key, or 0 if there is none.
+      ///
+      /// The descent compares one value per level and turns the result into the next index arithmetically,
+      /// until it falls past the bottom of the snapshot. See lower_bound_of.
+      ///
+      std::size_t lower_bound_index(const KeyType &key) const {
+         const auto size = this->size();
+         const auto data = this->_values.data();
+         std::size_t index = 1;
+
+         while (index <= size)
+         {
+            auto prefetch_index = index << prefetch_levels;
+
+            // the block of descendants may straddle two cache lines, so touch both of its ends
+            if (prefetch_index <= size)
+            {
+               prefetch(data + prefetch_index - 1);
+               prefetch(data + prefetch_index + (std::size_t(1) << prefetch_levels) - 2);
+            }
+
+            index = index * 2 + static_cast<std::size_t>(this->less(KeyOfValue()(data[index-1]), key));
+         }
+
+         return lower_bound_of(index);
+      }
+      /// @brief Get the index of the value with the given key, or 0 if there is none.
+      ///
+      std::size_t find_index(const KeyType &key) const {
+         auto index = this->lower_bound_index(key);
+
+         if (!this->matches(index, key)) { return 0; }
+         return index;
+      }
+
+      /// @brief Check whether the value at the given lower bound index has the given key.
+      ///
+      bool matches(std::size_t index, const KeyType &key) const {
+         return index != 0 && !this->less(key, KeyOfValue()(this->at(index)));
+      }
+      /// @brief Get the number of levels of the snapshot, which is how many steps the deepest search takes.
+      ///
+      std::size_t levels() const {
+         std::size_t levels = 0;
+
+         for (auto size = this->size(); size != 0; size >>= 1)
+            ++levels;
+
+         return levels;
+      }
+
+      /// @brief Find the lower bound of every key of the given range, calling the visitor with each key and its index.
+      ///
+      /// See find_many.
+      ///
+      template <typename ForwardIt, typename Visitor>
+      void search_many(ForwardIt first, ForwardIt last, Visitor &&visitor) const {
+         const auto size = this->size();
+         const auto data = this->_values.data();
+         const auto levels = this->levels();
+         std::array<ForwardIt, batch_width> keys;
+         std::array<std::size_t, batch_width> indexes;
+
+         while (first != last)
+         {
+            std::size_t count = 0;
+
+            for (; first != last && count < batch_width; ++first, ++count)
+            {
+               keys[count] = first;
+               indexes[count] = 1;
+            }
+
+            if (vector_lookups && count == batch_width && size < (std::size_t(1) << 30))
+               this->descend_vector(keys, indexes, levels);
+            else
+            {
+               for (std::size_t level=0; level<levels; ++level)
+               {
+                  for (std::size_t lane=0; lane<count; ++lane)
+                  {
+                     auto index = indexes[lane];
+
+                     // searches down a shorter branch reach the bottom a level early
+                     if (index > size) { continue; }
+
+                     index = index * 2 + static_cast<std::size_t>(this->less(KeyOfValue()(data[index-1]), *keys[lane]));
+                     indexes[lane] = index;
+
+                     if (index <= size) { prefetch(data + index - 1); }
+                  }
+               }
+            }
+
+            for (std::size_t lane=0; lane<count; ++lane)
+               visitor(*keys[lane], lower_bound_of(indexes[lane]));
+         }
+      }
+      /// @brief Descend a full batch of searches with vector instructions. See vector_lookups.
+      ///
+      /// Unsigned keys are biased so that they order correctly under signed comparisons. Every level gathers the
+      /// values the searches are on, with the searches that reached the bottom masked off.
+      ///
+      template <typename ForwardIt>
+      void descend_vector(const std::array<ForwardIt, batch_width> &keys, std::array<std::size_t, batch_width> &indexes,
+                          std::size_t levels) const {
+#if defined(__AVX2__)
+         if constexpr (vector_lookups)
+         {
+            constexpr std::size_t lanes = 8, vectors = batch_width / lanes;
+            alignas(32) std::int32_t lane_keys[batch_width], lane_indexes[batch_width];
+
+            for (std::size_t lane=0; lane<batch_width; ++lane)
+               lane_keys[lane] = static_cast<std::int32_t>(*keys[lane]);
+
+            const auto data = reinterpret_cast<const int *>(this->_values.data());
+            const auto bias = _mm256_set1_epi32((std::is_signed<KeyType>::value) ? 0 : std::numeric_limits<std::int32_t>::min());
+            const auto one = _mm256_set1_epi32(1);
+            const auto past_end = _mm256_set1_epi32(static_cast<std::int32_t>(this->size()) + 1);
+            __m256i key_vectors[vectors], index_vectors[vectors];
+
+            for (std::size_t vector=0; vector<vectors; ++vector)
+            {
+               auto loaded = _mm256_load_si256(reinterpret_cast<const __m256i *>(lane_keys + vector * lanes));
+               key_vectors[vector] = _mm256_xor_si256(loaded, bias);
+               index_vectors[vector] = one;
+            }
+
+            for (std::size_t level=0; level<levels; ++level)
+            {
+               for (std::size_t vector=0; vector<vectors; ++vector)
+               {
+                  auto index = index_vectors[vector];
+                  auto active = _mm256_cmpgt_epi32(past_end, index);
+                  auto values = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), data, _mm256_sub_epi32(index, one), active, 4);
+                  auto less = _mm256_cmpgt_epi32(key_vectors[vector], _mm256_xor_si256(values, bias));
+
+                  // less is all ones where the value is less than the key, so subtracting it turns right
+                  auto next = _mm256_sub_epi32(_mm256_add_epi32(index, index), less);
+                  index_vectors[vector] = _mm256_blendv_epi8(index, next, active);
+
+                  // there is no vector prefetch, so start loading the next level of each search one lane at a time
+                  _mm256_store_si256(reinterpret_cast<__m256i *>(lane_indexes + vector * lanes), index_vectors[vector]);
+
+                  for (std::size_t lane=vector * lanes; lane<(vector + 1) * lanes; ++lane)
+                     prefetch(data + lane_indexes[lane] - 1);
+               }
+            }
+
+            for (std::size_t vector=0; vector<vectors; ++vector)
+               _mm256_store_si256(reinterpret_cast<__m256i *>(lane_indexes + vector * lanes), index_vectors[vector]);
+
+            for (std::size_t lane=0; lane<batch_width; ++lane)
+               indexes[lane] = static_cast<std::size_t>(lane_indexes[lane]);
+         }
+#else
+         (void)keys;
+         (void)indexes;
+         (void)levels;
+#endif
+      }
+
+      /// @brief The values of the snapshot, in Eytzinger order.
+      ///
+      std::vector<ValueType> _values;
+      /// @brief The comparator of the tree the snapshot was frozen from.
+      ///
+      KeyCompare _compare;
+   };
+
+   /// @brief Freeze the given tree into an immutable snapshot. See FrozenTree.
+   ///
+   template <typename Tree>
+   FrozenTree<Tree> freeze(const Tree &tree) {
+      return FrozenTree<Tree>(tree);
+   }
+}
+
+#endif
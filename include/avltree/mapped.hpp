@@ -0,0 +1,562 @@
+#ifndef __AVLTREE_MAPPED_HPP
+#define __AVLTREE_MAPPED_HPP
+
+#include "../avltree.hpp"
+#include "frozen.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace avltree
+{
+   /// @brief How a key or mapped value is stored in a serialized tree. See MappedTree.
+   ///
+   /// A codec turns a value into a fixed-size, trivially copyable slot kept in the record of its node, plus any
+   /// bytes of variable length, which go to the heap at the end of the file. Reading the value back gives a view
+   /// of it straight out of the mapped file, without copying it anywhere.
+   ///
+   /// A codec provides the Slot and View types, and the functions:
+   ///
+   /// - `Slot encode(const T &value, std::vector<char> &heap)`, which may append to the heap;
+   /// - `View view(const Slot &slot, const char *heap)` and `View view_of(const T &value)`;
+   /// - `T decode(const Slot &slot, const char *heap)`;
+   /// - `bool valid(const Slot &slot, std::size_t heap_size)`, checked for every slot when the file is opened.
+   ///
+   /// This one covers trivially copyable types, whose slot is the value itself. Specialize it for other types,
+   /// see Codec<std::string>.
+   ///
+   template <typename T, typename = void>
+   struct Codec;
+
+   template <typename T>
+   struct Codec<T, std::enable_if_t<std::is_trivially_copyable<T>::value>> {
+      using Slot = T;
+      using View = const T &;
+
+      static Slot encode(const T &value, std::vector<char> &) { return value; }
+      static View view(const Slot &slot, const char *) { return slot; }
+      static View view_of(const T &value) { return value; }
+      static T decode(const Slot &slot, const char *) { return slot; }
+      static bool valid(const Slot &, std::size_t) { return true; }
+   };
+
+   /// @brief The codec of strings, whose characters go to the heap and are viewed through std::string_view.
+   ///
+   template <>
+   struct Codec<std::string> {
+      struct Slot {
+         std::uint64_t offset;
+         std::uint64_t length;
+      };
+      using View = std::string_view;
+
+      static Slot encode(const std::string &value, std::vector<char> &heap) {
+         Slot slot{heap.size(), value.size()};
+         heap.insert(heap.end(), value.begin(), value.end());
+
+         return slot;
+      }
+      static View view(const Slot &slot, const char *heap) { return View(heap + slot.offset, slot.length); }
+      static View view_of(const std::string &value) { return View(value); }
+      static std::string decode(const Slot &slot, const char *heap) { return std::string(view(slot, heap)); }
+      static bool valid(const Slot &slot, std::size_t heap_size) {
+         return slot.offset <= heap_size && slot.length <= heap_size - slot.offset;
+      }
+   };
+
+   /// @brief The mapped type of a set, which has none.
+   ///
+   struct NoMapped {};
+
+   /// @brief Get the mapped type of the values of a tree: the second type of a map's pairs, or NoMapped.
+   ///
+   template <typename Value>
+   struct mapped_type_of { using type = NoMapped; };
+   template <typename Key, typename Mapped>
+   struct mapped_type_of<std::pair<const Key, Mapped>> { using type = Mapped; };
+
+   /// @brief A read-only file, mapped into memory where the platform can, otherwise read into it.
+   ///
+   class MappedFile
+   {
+   public:
+      /// @brief Map the file at the given path.
+      ///
+      /// @throws exception::FileError Thrown if the file can't be opened or mapped.
+      ///
+      explicit MappedFile(const std::string &path) : _data(nullptr), _size(0) {
+#if defined(__unix__) || defined(__APPLE__)
+         auto descriptor = ::open(path.c_str(), O_RDONLY);
+         struct stat status;
+
+         if (descriptor < 0) { throw exception::FileError(path); }
+         if (::fstat(descriptor, &status) != 0)
+         {
+            ::close(descriptor);
+            throw exception::FileError(path);
+         }
+
+         this->_size = static_cast<std::size_t>(status.st_size);
+
+         if (this->_size != 0)
+         {
+            auto data = ::mmap(nullptr, this->_size, PROT_READ, MAP_SHARED, descriptor, 0);
+
+            if (data == MAP_FAILED)
+            {
+               ::close(descriptor);
+               throw exception::FileError(path);
+            }
+
+            this->_data = static_cast<const char *>(data);
+         }
+
+         // the mapping outlives the descriptor
+         ::close(descriptor);
+#else
+         std::ifstream file(path, std::ios::binary);
+
+         if (!file) { throw exception::FileError(path); }
+
+         this->_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+         this->_data = this->_buffer.data();
+         this->_size = this->_buffer.size();
+#endif
+      }
+      MappedFile(const MappedFile &other) = delete;
+      ~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+         if (this->_data != nullptr) { ::munmap(const_cast<char *>(this->_data), this->_size); }
+#endif
+      }
+
+      MappedFile &operator=(const MappedFile &other) = delete;
+
+      inline const char *data() const { return this->_data; }
+      inline std::size_t size() const { return this->_size; }
+
+   private:
+      const char *_data;
+      std::size_t _size;
+#if !defined(__unix__) && !defined(__APPLE__)
+      std::vector<char> _buffer;
+#endif
+   };
+
+   /// @brief A read-only view of a tree serialized to a pointer-free file, served straight out of the mapping.
+   ///
+   /// The file holds a header, then a fixed-size record per node in Eytzinger order (see FrozenTree), then a
+   /// heap for the bytes of variable length, such as the characters of strings. Records refer to the heap by
+   /// offset, so the file can be mapped anywhere and searched as it is: opening it checks the header and the
+   /// slots of the codecs, but decodes nothing. Keys and mapped values are handed out as the views of their
+   /// codecs, which point into the mapping and stay valid for as long as the view of the tree.
+   ///
+   /// The format is versioned, and written in the byte order of the machine writing it; files of another byte
+   /// order, version or record layout are rejected with exception::InvalidFormat. Keys are trusted to be in
+   /// order, since the writer wrote them from a tree.
+   ///
+   /// Trees can be written with write or serialize, and loaded back into a mutable tree in O(n) with thaw.
+   ///
+   /// @tparam Tree The tree class which was serialized, such as AVLTree or AVLMap.
+   /// @tparam KeyCodec The codec of the keys. See Codec.
+   /// @tparam MappedCodec The codec of the mapped values of a map. See Codec.
+   ///
+   template <typename Tree, typename KeyCodec=Codec<typename Tree::KeyType>,
+             typename MappedCodec=Codec<typename mapped_type_of<typename Tree::ValueType>::type>>
+   class MappedTree : protected EytzingerLayout
+   {
+   public:
+      using TreeType = Tree;
+      using KeyType = typename Tree::KeyType;
+      using ValueType = typename Tree::ValueType;
+      using MappedType = typename mapped_type_of<ValueType>::type;
+      using KeyOfValue = typename Tree::KeyOfValueType;
+      using KeyCompare = typename Tree::KeyCompareType;
+      using KeyView = typename KeyCodec::View;
+      using MappedView = typename MappedCodec::View;
+
+      /// @brief Whether the tree is a map, whose records hold a mapped value next to the key.
+      ///
+      static constexpr bool is_map = !std::is_same<MappedType, NoMapped>::value;
+
+      /// @brief The version of the format written, and the only one read.
+      ///
+      static constexpr std::uint32_t version = 1;
+
+      /// @brief A node of the serialized tree: the views of its key and, for maps, its mapped value.
+      ///
+      class Entry
+      {
+      public:
+         Entry(const MappedTree *tree, std::size_t index) : tree(tree), index(index) {}
+
+         KeyView key() const { return KeyCodec::view(this->tree->at(this->index).key, this->tree->_heap); }
+         MappedView mapped() const {
+            static_assert(is_map, "only the entries of maps have a mapped value");
+
+            return MappedCodec::view(this->tree->at(this->index).mapped, this->tree->_heap);
+         }
+         /// @brief Decode the value of the node.
+         ///
+         ValueType value() const { return this->tree->decode(this->index); }
+
+      private:
+         const MappedTree *tree;
+         std::size_t index;
+      };
+
+      /// @brief An iterator over the entries of the serialized tree, in order.
+      ///
+      class const_iterator
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using difference_type = std::ptrdiff_t;
+         using value_type = Entry;
+         using pointer = void;
+         using reference = Entry;
+
+         const_iterator(const MappedTree *tree, std::size_t index) : tree(tree), index(index) {}
+
+         Entry operator*() const {
+            if (this->index == 0) { throw exception::NullPointer(); }
+
+            return Entry(this->tree, this->index);
+         }
+
+         const_iterator &operator++() {
+            if (this->index == 0) { throw exception::NullPointer(); }
+
+            this->index = next_index(this->index, this->tree->size());
+
+            return *this;
+         }
+         const_iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; }
+
+         friend bool operator== (const const_iterator &a, const const_iterator &b) { return a.index == b.index; }
+         friend bool operator!= (const const_iterator &a, const const_iterator &b) { return a.index != b.index; }
+
+      private:
+         const MappedTree *tree;
+         std::size_t index;
+      };
+      using iterator = const_iterator;
+
+      /// @brief Map the serialized tree at the given path.
+      ///
+      /// @throws exception::FileError Thrown if the file can't be opened or mapped.
+      /// @throws exception::InvalidFormat Thrown if the file isn't a tree of this type in this format.
+      ///
+      static MappedTree open(const std::string &path) {
+         auto file = std::make_shared<const MappedFile>(path);
+         MappedTree tree(file->data(), file->size());
+
+         tree._file = std::move(file);
+
+         return tree;
+      }
+
+      /// @brief View a serialized tree in memory the caller keeps alive, such as a mapping of its own.
+      ///
+      /// The data must be aligned to at least alignof(std::max_align_t).
+      ///
+      /// @throws exception::InvalidFormat Thrown if the data isn't a tree of this type in this format.
+      ///
+      MappedTree(const void *data, std::size_t size) : _records(nullptr), _heap(nullptr), _size(0) {
+         auto bytes = static_cast<const char *>(data);
+         Header header;
+
+         if (size < sizeof(Header) || reinterpret_cast<std::uintptr_t>(data) % alignof(Record) != 0)
+            throw exception::InvalidFormat();
+
+         std::memcpy(&header, bytes, sizeof(Header));
+
+         if (!header.matches() || header.count > (size - header.records_offset) / sizeof(Record) ||
+             header.heap_offset < header.records_offset + header.count * sizeof(Record) ||
+             header.heap_offset > size || header.heap_size > size - header.heap_offset)
+            throw exception::InvalidFormat();
+
+         this->_records = reinterpret_cast<const Record *>(bytes + header.records_offset);
+         this->_heap = bytes + header.heap_offset;
+         this->_size = static_cast<std::size_t>(header.count);
+
+         for (std::size_t index=1; index<=this->_size; ++index)
+            if (!this->valid(index, static_cast<std::size_t>(header.heap_size)))
+               throw exception::InvalidFormat();
+      }
+
+      /// @brief Write the given tree in the format of this view to the given stream.
+      ///
+      /// @throws exception::FileError Thrown if writing fails, naming the path given, if any.
+      ///
+      static void write(const Tree &tree, std::ostream &out, const std::string &path="stream") {
+         auto count = tree.size();
+         std::vector<Record> records(count);
+         std::vector<char> heap;
+         std::size_t index = first_index(count);
+
+         for (auto iter = tree.cbegin_inorder(); iter != tree.cend_inorder(); ++iter)
+         {
+            auto &value = (*iter)->value();
+            auto &record = records[index-1];
+
+            record.key = KeyCodec::encode(KeyOfValue()(value), heap);
+            if constexpr (is_map) { record.mapped = MappedCodec::encode(value.second, heap); }
+
+            index = next_index(index, count);
+         }
+
+         Header header = Header::expected();
+         header.count = count;
+         header.heap_offset = header.records_offset + count * sizeof(Record);
+         header.heap_size = heap.size();
+
+         out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+         out.write(reinterpret_cast<const char *>(records.data()), static_cast<std::streamsize>(count * sizeof(Record)));
+         out.write(heap.data(), static_cast<std::streamsize>(heap.size()));
+
+         if (!out) { throw exception::FileError(path); }
+      }
+      /// @brief Write the given tree in the format of this view to the file at the given path.
+      ///
+      /// @throws exception::FileError Thrown if the file can't be written.
+      ///
+      static void write(const Tree &tree, const std::string &path) {
+         std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+         if (!out) { throw exception::FileError(path); }
+
+         write(tree, out, path);
+         out.close();
+
+         if (!out) { throw exception::FileError(path); }
+      }
+
+      /// @brief Decode every value into a mutable tree, in linear time. See AVLTreeBase::assign_sorted.
+      ///
+      Tree thaw() const {
+         std::vector<ValueType> values;
+         Tree tree;
+
+         values.reserve(this->_size);
+
+         for (auto index = first_index(this->_size); index != 0; index = next_index(index, this->_size))
+            values.push_back(this->decode(index));
+
+         tree.assign_sorted(values.begin(), values.end());
+
+         return tree;
+      }
+
+      /// @brief Get the number of values in the serialized tree.
+      ///
+      inline std::size_t size() const { return this->_size; }
+      /// @brief Check whether the serialized tree holds no values.
+      ///
+      inline bool is_empty() const { return this->_size == 0; }
+
+      /// @brief Check whether the given key is in the serialized tree.
+      ///
+      bool contains(const KeyType &key) const { return this->find_index(key) != 0; }
+      /// @brief Attempt to find the entry with the given key.
+      ///
+      /// @param key The key to search for.
+      /// @returns The entry with the given key, or std::nullopt if no entry was found.
+      ///
+      std::optional<Entry> find(const KeyType &key) const {
+         auto index = this->find_index(key);
+
+         if (index == 0) { return std::nullopt; }
+         return Entry(this, index);
+      }
+      /// @brief Get the view of the value mapped to the given key, throwing an exception if it isn't there.
+      ///
+      /// @throws exception::KeyNotFound Thrown if the key is not found.
+      ///
+      MappedView get(const KeyType &key) const {
+         auto entry = this->find(key);
+
+         if (!entry.has_value()) { throw exception::KeyNotFound(); }
+         return entry->mapped();
+      }
+      /// @brief Get an iterator to the first entry whose key is not less than the given key.
+      ///
+      const_iterator lower_bound(const KeyType &key) const { return const_iterator(this, this->lower_bound_index(key)); }
+      /// @brief Get the entries whose keys fall in the half-open range [low, high), in order.
+      ///
+      typename Tree::template range_view<const_iterator> range(const KeyType &low, const KeyType &high) const {
+         if (!less(KeyCodec::view_of(low), KeyCodec::view_of(high))) { return {this->end(), this->end()}; }
+
+         return {this->lower_bound(low), this->lower_bound(high)};
+      }
+
+      const_iterator begin() const { return const_iterator(this, first_index(this->_size)); }
+      const_iterator end() const { return const_iterator(this, 0); }
+      const_iterator cbegin() const { return this->begin(); }
+      const_iterator cend() const { return this->end(); }
+
+   protected:
+      struct SetRecord {
+         typename KeyCodec::Slot key;
+      };
+      struct MapRecord {
+         typename KeyCodec::Slot key;
+         typename MappedCodec::Slot mapped;
+      };
+      using Record = std::conditional_t<is_map, MapRecord, SetRecord>;
+
+      static_assert(std::is_trivially_copyable<Record>::value, "codec slots must be trivially copyable");
+      static_assert(alignof(Record) <= alignof(std::max_align_t), "codec slots must not be over-aligned");
+
+      /// @brief The header at the start of a serialized tree.
+      ///
+      struct Header {
+         char magic[8];
+         std::uint32_t version;
+         /// @brief A known value in the byte order of the writer.
+         ///
+         std::uint32_t byte_order;
+         std::uint64_t count;
+         std::uint32_t key_slot_size;
+         std::uint32_t mapped_slot_size;
+         std::uint64_t record_size;
+         /// @brief The offset of the records from the start of the file.
+         ///
+         std::uint64_t records_offset;
+         /// @brief The offset of the heap from the start of the file.
+         ///
+         std::uint64_t heap_offset;
+         std::uint64_t heap_size;
+
+         /// @brief Get the header every file of this type starts with, without its counts.
+         ///
+         static Header expected() {
+            Header header;
+
+            std::memset(&header, 0, sizeof(Header));
+            std::memcpy(header.magic, "AVLTREE", 8);
+            header.version = MappedTree::version;
+            header.byte_order = 0x01020304;
+            header.key_slot_size = sizeof(typename KeyCodec::Slot);
+            header.mapped_slot_size = is_map ? sizeof(typename MappedCodec::Slot) : 0;
+            header.record_size = sizeof(Record);
+            header.records_offset = sizeof(Header);
+
+            return header;
+         }
+
+         /// @brief Check whether this header describes a file of this type in this format.
+         ///
+         bool matches() const {
+            auto header = expected();
+
+            return std::memcmp(this->magic, header.magic, 8) == 0 && this->version == header.version &&
+               this->byte_order == header.byte_order && this->key_slot_size == header.key_slot_size &&
+               this->mapped_slot_size == header.mapped_slot_size && this->record_size == header.record_size &&
+               this->records_offset == header.records_offset;
+         }
+      };
+
+      static_assert(sizeof(Header) % alignof(std::max_align_t) == 0, "records must start aligned");
+
+      /// @brief Get the record at the given index, counting from 1.
+      ///
+      inline const Record &at(std::size_t index) const { return this->_records[index-1]; }
+
+      /// @brief Compare the views of two keys with the comparison functor of the tree.
+      ///
+      /// Views which the functor can't compare, such as std::string_view under std::less<std::string>, are
+      /// compared with std::less<>, which orders them the same way as the keys they view.
+      ///
+      static bool less(const KeyView &a, const KeyView &b) {
+         if constexpr (std::is_invocable<KeyCompare, const KeyView &, const KeyView &>::value)
+            return KeyOrder<KeyCompare>::less(KeyCompare(), a, b);
+         else
+         {
+            static_assert(std::is_same<KeyCompare, std::less<KeyType>>::value,
+                          "the key comparison must compare the views of the key codec");
+
+            return std::less<>()(a, b);
+         }
+      }
+
+      /// @brief Get the index of the first record whose key is not less than the given key, or 0 if there is none.
+      ///
+      /// See FrozenTree::lower_bound_index.
+      ///
+      std::size_t lower_bound_index(const KeyType &key) const {
+         const auto size = this->_size;
+         const KeyView target = KeyCodec::view_of(key);
+         std::size_t index = 1;
+
+         while (index <= size)
+         {
+            auto prefetch_index = index << 4;
+
+            if (prefetch_index <= size) { prefetch(this->_records + prefetch_index - 1); }
+
+            index = index * 2 + static_cast<std::size_t>(less(KeyCodec::view(this->at(index).key, this->_heap), target));
+         }
+
+         return lower_bound_of(index);
+      }
+      /// @brief Get the index of the record with the given key, or 0 if there is none.
+      ///
+      std::size_t find_index(const KeyType &key) const {
+         auto index = this->lower_bound_index(key);
+
+         if (index == 0 || less(KeyCodec::view_of(key), KeyCodec::view(this->at(index).key, this->_heap))) { return 0; }
+         return index;
+      }
+
+      /// @brief Check whether the slots of the record at the given index stay within the heap.
+      ///
+      bool valid(std::size_t index, std::size_t heap_size) const {
+         auto &record = this->at(index);
+
+         if constexpr (is_map) { return KeyCodec::valid(record.key, heap_size) && MappedCodec::valid(record.mapped, heap_size); }
+         else { return KeyCodec::valid(record.key, heap_size); }
+      }
+      /// @brief Decode the value of the record at the given index.
+      ///
+      ValueType decode(std::size_t index) const {
+         auto &record = this->at(index);
+
+         if constexpr (is_map) { return ValueType(KeyCodec::decode(record.key, this->_heap), MappedCodec::decode(record.mapped, this->_heap)); }
+         else { return KeyCodec::decode(record.key, this->_heap); }
+      }
+
+      /// @brief The mapping this view owns, or null if the caller keeps the data alive.
+      ///
+      std::shared_ptr<const MappedFile> _file;
+      /// @brief The records, in Eytzinger order.
+      ///
+      const Record *_records;
+      /// @brief The start of the heap.
+      ///
+      const char *_heap;
+      /// @brief The number of records.
+      ///
+      std::size_t _size;
+   };
+
+   /// @brief Write the given tree to the file at the given path, in the format of MappedTree.
+   ///
+   /// @throws exception::FileError Thrown if the file can't be written.
+   ///
+   template <typename Tree>
+   void serialize(const Tree &tree, const std::string &path) {
+      MappedTree<Tree>::write(tree, path);
+   }
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef __AVLTREE_PERSISTENT_HPP
+#define __AVLTREE_PERSISTENT_HPP
+
+#include "../avltree.hpp"
+
+namespace avltree
+{
+   /// @brief The base of the persistent trees, whose versions share every node they have in common.
+   ///
+   /// Copying a persistent tree takes constant time: the copy shares the root of the original. An insertion or
+   /// removal then copies the O(log n) nodes on its path, rebalances the copies with the same rotation code as
+   /// AVLTreeBase and leaves the nodes it replaced to the other versions which still refer to them. Nodes only
+   /// one version owns are changed in place, so a tree which was never copied allocates no more than a regular
+   /// tree. Nodes are reference-counted without parent links, see PersistentNodeStorage.
+   ///
+   /// Since nodes every version can reach are never modified, a snapshot can be read from another thread while
+   /// the tree it was taken from keeps changing. Values are only ever handed out as const.
+   ///
+   /// @tparam Key The key type of the tree.
+   /// @tparam Value The value type of the tree.
+   /// @tparam KeyOfValue The functor which extracts the key from the value. See AVLTreeBase.
+   /// @tparam KeyCompare The key comparison functor for sorting the nodes. See AVLTreeBase.
+   /// @tparam Allocator The allocator of the nodes. See AVLTreeBase.
+   ///
+   template <typename Key, typename Value, typename KeyOfValue, typename KeyCompare, typename Allocator>
+   class PersistentTreeBase : protected AVLTreeBase<Key, Value, KeyOfValue, KeyCompare, PersistentNodeStorage, Allocator>
+   {
+   public:
+      using TreeBase = AVLTreeBase<Key, Value, KeyOfValue, KeyCompare, PersistentNodeStorage, Allocator>;
+      using KeyType = Key;
+      using ValueType = Value;
+      using KeyOfValueType = KeyOfValue;
+      using KeyCompareType = KeyCompare;
+      using NodePointer = typename TreeBase::NodePointer;
+      using ConstNodePointer = typename TreeBase::ConstNodePointer;
+      using iterator = typename TreeBase::template const_value_iterator<typename TreeBase::const_inorder_iterator>;
+      using const_iterator = iterator;
+      using TreeBase::has_parent_links;
+      using TreeBase::key_comp;
+
+      PersistentTreeBase() : TreeBase() {}
+      explicit PersistentTreeBase(const Allocator &allocator) : TreeBase(allocator) {}
+      /// @brief Share the nodes of the other tree, in constant time.
+      ///
+      PersistentTreeBase(const PersistentTreeBase &other) : TreeBase(other.get_allocator()) {
+         this->_root = other._root;
+         this->_size = other._size;
+      }
+      PersistentTreeBase(PersistentTreeBase &&other) noexcept : TreeBase(std::move(other)) {}
+
+      /// @brief Let go of the nodes of this tree and share the nodes of the other tree, in constant time.
+      ///
+      PersistentTreeBase &operator=(const PersistentTreeBase &other) {
+         if constexpr (std::allocator_traits<typename TreeBase::NodeAllocator>::propagate_on_container_copy_assignment::value)
+            this->_allocator = other._allocator;
+
+         this->_root = other._root;
+         this->_size = other._size;
+
+         return *this;
+      }
+      PersistentTreeBase &operator=(PersistentTreeBase &&other) noexcept {
+         this->_root = std::move(other._root);
+         this->_size = other._size;
+         other._root = nullptr;
+         other._size = 0;
+
+         return *this;
+      }
+
+      /// @brief Check whether the given key is in the tree.
+      ///
+      bool contains(const Key &key) const { return TreeBase::contains(key); }
+      /// @brief Attempt to find the node with the given key.
+      ///
+      /// The node stays valid for as long as it is held, whatever happens to the tree afterwards.
+      ///
+      /// @param key The key to search for.
+      /// @returns The node with the key, or std::nullopt if the key was not found.
+      ///
+      std::optional<ConstNodePointer> find(const Key &key) const { return TreeBase::find(key); }
+      /// @brief Get the value with the given key.
+      ///
+      /// @param key The key to get.
+      /// @returns The value with the given key.
+      /// @throws exception::KeyNotFound Thrown if the given key isn't found.
+      ///
+      const Value &get(const Key &key) const { return TreeBase::get(key)->value(); }
+
+      /// @brief Get the number of values in the tree.
+      ///
+      inline std::size_t size() const { return this->_size; }
+      /// @brief Determine if the tree is empty.
+      ///
+      inline bool is_empty() const { return this->_root == nullptr; }
+      /// @brief Get the const root node of this tree.
+      ///
+      inline ConstNodePointer root() const { return this->_root; }
+
+      /// @brief Return an iterator over the values of the tree, in order.
+      ///
+      iterator begin() const { return iterator(this->root()); }
+      /// @brief Return an iterator at the end of the values of the tree.
+      ///
+      iterator end() const { return iterator(nullptr); }
+      iterator cbegin() const { return this->begin(); }
+      iterator cend() const { return this->end(); }
+      /// @brief Copy the values of the tree into a vector, in order.
+      ///
+      std::vector<Value> to_vec() const { return std::vector<Value>(this->begin(), this->end()); }
+
+      /// @brief Insert the given value into the tree.
+      ///
+      /// @param value The value to insert.
+      /// @throws exception::KeyExists Thrown when the key of the value already exists in the tree.
+      ///
+      void insert(const Value &value) {
+         if (TreeBase::contains(KeyOfValue()(value))) { throw exception::KeyExists(); }
+
+         KeepReplaced keep;
+         this->attach_copied(this->construct_node(value), keep);
+      }
+      /// @brief Remove the value with the given key from the tree.
+      ///
+      /// @param key The key to remove.
+      /// @throws exception::KeyNotFound Thrown if the key isn't found in the tree.
+      ///
+      void remove(const Key &key) {
+         if (!TreeBase::contains(key)) { throw exception::KeyNotFound(); }
+
+         KeepReplaced keep;
+         this->remove_copied(key, keep);
+      }
+      /// @brief Let go of every value of the tree. Other versions of the tree keep theirs.
+      ///
+      void clear() {
+         this->_root = nullptr;
+         this->_size = 0;
+      }
+
+   protected:
+      /// @brief The functor path copying retires replaced nodes to, which does nothing.
+      ///
+      /// Replaced nodes belong to the other versions which still refer to them, and are freed along with the
+      /// last of them. See AVLTreeBase::copy_at.
+      ///
+      struct KeepReplaced {
+         void operator() (const NodePointer &) const {}
+      };
+   };
+
+   /// @brief A persistent AVL tree of keys. See PersistentTreeBase.
+   ///
+   /// @tparam Key The type of the keys.
+   /// @tparam KeyCompare The key comparison functor for sorting the nodes. See AVLTreeBase.
+   /// @tparam Allocator The allocator of the tree's nodes. See AVLTreeBase.
+   ///
+   template <typename Key, typename KeyCompare=std::less<Key>, typename Allocator=std::allocator<Key>>
+   class PersistentAVLTree : public PersistentTreeBase<Key, Key, KeyIsValue<Key>, KeyCompare, Allocator>
+   {
+   public:
+      using PersistentBase = PersistentTreeBase<Key, Key, KeyIsValue<Key>, KeyCompare, Allocator>;
+
+      PersistentAVLTree() : PersistentBase() {}
+      explicit PersistentAVLTree(const Allocator &allocator) : PersistentBase(allocator) {}
+
+      /// @brief Take an immutable version of this tree, in constant time.
+      ///
+      /// The snapshot shares the nodes of this tree, and changes made to this tree afterwards are not seen by it.
+      /// Copying the tree directly makes a version which can be changed in turn.
+      ///
+      std::shared_ptr<const PersistentAVLTree> snapshot() const { return std::make_shared<const PersistentAVLTree>(*this); }
+   };
+
+   /// @brief A persistent mapping of keys to values. See PersistentTreeBase.
+   ///
+   /// @tparam Key The type of the key for the mapping.
+   /// @tparam Value The type of the value for the mapping.
+   /// @tparam KeyCompare The key comparison functor for sorting the nodes. See AVLTreeBase.
+   /// @tparam Allocator The allocator of the map's nodes. See AVLTreeBase.
+   ///
+   template <typename Key, typename Value, typename KeyCompare=std::less<Key>,
+             typename Allocator=std::allocator<std::pair<const Key, Value>>>
+   class PersistentAVLMap : public PersistentTreeBase<Key, std::pair<const Key, Value>, KeyOfPair<Key, Value>, KeyCompare, Allocator>
+   {
+   public:
+      using PersistentBase = PersistentTreeBase<Key, std::pair<const Key, Value>, KeyOfPair<Key, Value>, KeyCompare, Allocator>;
+      using TreeBase = typename PersistentBase::TreeBase;
+      using NodePointer = typename PersistentBase::NodePointer;
+
+      PersistentAVLMap() : PersistentBase() {}
+      explicit PersistentAVLMap(const Allocator &allocator) : PersistentBase(allocator) {}
+
+      /// @brief Take an immutable version of this map, in constant time.
+      ///
+      /// See PersistentAVLTree::snapshot.
+      ///
+      std::shared_ptr<const PersistentAVLMap> snapshot() const { return std::make_shared<const PersistentAVLMap>(*this); }
+
+      /// @brief Get the value associated with the given key.
+      ///
+      /// @param key The key to get.
+      /// @returns The value associated with the given key.
+      /// @throws exception::KeyNotFound Thrown if the given key isn't found.
+      ///
+      const Value &get(const Key &key) const { return PersistentBase::get(key).second; }
+
+      /// @brief Insert a given key-value pair into the map.
+      ///
+      /// @param key The key to associate with the value.
+      /// @param value The value to insert.
+      /// @throws exception::KeyExists Thrown when the key already exists in the map.
+      ///
+      void insert(const Key &key, const Value &value) { PersistentBase::insert(std::make_pair(key, value)); }
+      using PersistentBase::insert;
+
+      /// @brief Assign the given value to the key, inserting the key if it doesn't exist in the map.
+      ///
+      /// Only this version of the map sees the new value.
+      ///
+      /// @param key The key to assign to.
+      /// @param value The value to assign.
+      /// @returns Whether the key was inserted.
+      ///
+      bool insert_or_assign(const Key &key, const Value &value) {
+         if (!this->contains(key))
+         {
+            this->insert(key, value);
+            return true;
+         }
+
+         typename TreeBase::template AncestorStack<NodePointer *> links;
+         typename PersistentBase::KeepReplaced keep;
+         (*this->copy_path(key, links, keep))->value().second = value;
+
+         return false;
+      }
+   };
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef __AVLTREE_SHARDED_HPP
+#define __AVLTREE_SHARDED_HPP
+
+#include "../avltree.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+namespace avltree
+{
+   /// @brief An AVL map split by key ranges into independent shards, so writers on different shards don't wait.
+   ///
+   /// Each shard is an AVLMap holding a contiguous range of keys behind its own reader-writer lock. Operations
+   /// on keys in different shards never touch the same lock or the same nodes, so writes spread across cores.
+   /// Since the shards are ordered by range, iterating them one after another visits every key in order.
+   ///
+   /// When a shard grows past its capacity, it is split at its median key into two shards. The shard directory
+   /// is read under a lock striped across cache lines by thread, which splitting takes whole, so looking up the
+   /// shard of a key costs no shared cache line either.
+   ///
+   /// Values are returned by copy, since another thread may change them as soon as the shard is unlocked.
+   ///
+   /// @tparam Key The type of the key for the mapping.
+   /// @tparam Value The type of the value for the mapping.
+   /// @tparam KeyCompare The key comparison functor for sorting the nodes. See AVLTreeBase.
+   /// @tparam Allocator The allocator of the shards' nodes. It must be safe to use from several threads at once.
+   ///
+   template <typename Key, typename Value, typename KeyCompare=std::less<Key>,
+             typename Allocator=std::allocator<std::pair<const Key, Value>>>
+   class ShardedAVLMap
+   {
+   public:
+      using KeyType = Key;
+      using MappedType = Value;
+      using ValueType = std::pair<const Key, Value>;
+      using ShardType = AVLMap<Key, Value, KeyCompare, RawNodeStorage, Allocator, SubtreeSize>;
+
+      /// @brief The number of keys a shard holds before it is split, unless told otherwise.
+      ///
+      static constexpr std::size_t default_shard_capacity = 1 << 16;
+      /// @brief The number of stripes of the directory lock.
+      ///
+      static constexpr std::size_t stripes = 16;
+
+      /// @brief Create a map with a single shard, which splits as it grows.
+      ///
+      /// @param shard_capacity The number of keys a shard holds before it is split.
+      /// @throws exception::IndexOutOfRange Thrown if the capacity is less than 2, since a shard that small can't be split.
+      ///
+      explicit ShardedAVLMap(std::size_t shard_capacity=default_shard_capacity) : ShardedAVLMap(std::vector<Key>(), shard_capacity) {}
+      /// @brief Create a map whose shards start out split at the given keys.
+      ///
+      /// Partitioning the key space up front lets writes spread across shards before any shard has grown enough
+      /// to split.
+      ///
+      /// @param bounds The first key of every shard but the first, sorted by strictly increasing keys.
+      /// @param shard_capacity The number of keys a shard holds before it is split.
+      /// @throws exception::NotSorted Thrown if the bounds are not sorted by strictly increasing keys.
+      /// @throws exception::IndexOutOfRange Thrown if the capacity is less than 2.
+      ///
+      ShardedAVLMap(std::vector<Key> bounds, std::size_t shard_capacity=default_shard_capacity)
+         : _bounds(std::move(bounds)), _shard_capacity(shard_capacity)
+      {
+         if (shard_capacity < 2) { throw exception::IndexOutOfRange(); }
+
+         for (std::size_t i=1; i<this->_bounds.size(); ++i)
+            if (!KeyOrder<KeyCompare>::less(KeyCompare(), this->_bounds[i-1], this->_bounds[i]))
+               throw exception::NotSorted();
+
+         for (std::size_t i=0; i<=this->_bounds.size(); ++i)
+            this->_shards.push_back(std::make_unique<Shard>());
+      }
+      ShardedAVLMap(const ShardedAVLMap &other) = delete;
+
+      ShardedAVLMap &operator=(const ShardedAVLMap &other) = delete;
+
+      /// @brief Check whether the given key is in the map.
+      ///
+      bool contains(const Key &key) const {
+         return this->read_shard(key, [&key](const ShardType &shard) { return shard.has_key(key); });
+      }
+      /// @brief Attempt to find the value associated with the given key.
+      ///
+      /// @param key The key to search for.
+      /// @returns A copy of the value associated with the key, or std::nullopt if the key was not found.
+      ///
+      std::optional<Value> find(const Key &key) const {
+         return this->read_shard(key, [&key](const ShardType &shard) -> std::optional<Value> {
+            auto node = shard.find(key);
+
+            if (!node.has_value()) { return std::nullopt; }
+            return (*node)->value().second;
+         });
+      }
+      /// @brief Get the value associated with the given key.
+      ///
+      /// @param key The key to get.
+      /// @returns A copy of the value associated with the given key.
+      /// @throws exception::KeyNotFound Thrown if the given key isn't found.
+      ///
+      Value get(const Key &key) const {
+         auto value = this->find(key);
+
+         if (!value.has_value()) { throw exception::KeyNotFound(); }
+         return *value;
+      }
+
+      /// @brief Insert a given key-value pair into the map.
+      ///
+      /// @param key The key to associate with the value.
+      /// @param value The value to insert.
+      /// @throws exception::KeyExists Thrown when the key already exists in the map.
+      ///
+      void insert(const Key &key, const Value &value) {
+         this->write_shard(key, [&](ShardType &shard) { shard.insert(key, value); });
+      }
+      /// @brief Assign the given value to the key, inserting the key if it doesn't exist in the map.
+      ///
+      /// @param key The key to assign to.
+      /// @param value The value to assign.
+      /// @returns Whether the key was inserted.
+      ///
+      bool insert_or_assign(const Key &key, const Value &value) {
+         return this->write_shard(key, [&](ShardType &shard) { return shard.insert_or_assign(key, value).second; });
+      }
+      /// @brief Remove the key from the map.
+      ///
+      /// Shards are not merged back as they shrink.
+      ///
+      /// @param key The key to remove.
+      /// @throws exception::KeyNotFound Thrown if the key isn't found in the map.
+      ///
+      void remove(const Key &key) {
+         this->write_shard(key, [&key](ShardType &shard) {
+            if (!shard.has_key(key)) { throw exception::KeyNotFound(); }
+
+            shard.remove(key);
+         });
+      }
+
+      /// @brief Get the number of keys in the map.
+      ///
+      /// This sums the sizes of the shards without locking them, so it is only exact while nothing writes.
+      ///
+      std::size_t size() const {
+         std::shared_lock<std::shared_mutex> directory(this->directory_stripe());
+         std::size_t size = 0;
+
+         for (auto &shard : this->_shards)
+            size += shard->size.load(std::memory_order_relaxed);
+
+         return size;
+      }
+      /// @brief Check whether the map holds no keys. See size.
+      ///
+      inline bool is_empty() const { return this->size() == 0; }
+      /// @brief Get the number of shards the map is split into.
+      ///
+      std::size_t shard_count() const {
+         std::shared_lock<std::shared_mutex> directory(this->directory_stripe());
+
+         return this->_shards.size();
+      }
+
+      /// @brief Visit every key-value pair of the map, in order.
+      ///
+      /// Shards are visited one at a time under their read lock, so writes to shards which were not visited yet
+      /// are seen, and nothing that happens while visiting can stop the visit. Keep the visitor short: writers
+      /// of the shard being visited are waiting on it, and it must not use this map.
+      ///
+      /// @param visitor The functor to call with each key-value pair.
+      ///
+      template <typename Visitor>
+      void visit(Visitor &&visitor) const {
+         std::shared_lock<std::shared_mutex> directory(this->directory_stripe());
+
+         for (auto &shard : this->_shards)
+         {
+            std::shared_lock<std::shared_mutex> lock(shard->lock);
+
+            for (auto iter = shard->map.cbegin_inorder(); iter != shard->map.cend_inorder(); ++iter)
+               visitor((*iter)->value());
+         }
+      }
+      /// @brief Copy every key-value pair of the map into a vector, in order. See visit.
+      ///
+      std::vector<ValueType> to_vec() const {
+         std::vector<ValueType> result;
+
+         this->visit([&result](const ValueType &value) { result.push_back(value); });
+
+         return result;
+      }
+
+   protected:
+      /// @brief A shard of the map: the map of its range of keys and its lock, on cache lines of its own.
+      ///
+      struct alignas(64) Shard {
+         mutable std::shared_mutex lock;
+         ShardType map;
+         /// @brief The size of the map, which size reads without locking the shard.
+         ///
+         std::atomic<std::size_t> size{0};
+      };
+
+      /// @brief A stripe of the directory lock, on a cache line of its own.
+      ///
+      struct alignas(64) DirectoryStripe {
+         mutable std::shared_mutex lock;
+      };
+
+      /// @brief Get the stripe of the directory lock the calling thread takes.
+      ///
+      std::shared_mutex &directory_stripe() const {
+         static thread_local const std::size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id()) % stripes;
+
+         return this->_directory[stripe].lock;
+      }
+
+      /// @brief Get the index of the shard holding the given key. The directory must be locked.
+      ///
+      std::size_t shard_of(const Key &key) const {
+         auto less = [](const Key &a, const Key &b) { return KeyOrder<KeyCompare>::less(KeyCompare(), a, b); };
+
+         return std::upper_bound(this->_bounds.begin(), this->_bounds.end(), key, less) - this->_bounds.begin();
+      }
+
+      /// @brief Call the given function with the shard of the given key, under its read lock.
+      ///
+      template <typename Function>
+      auto read_shard(const Key &key, Function &&function) const {
+         std::shared_lock<std::shared_mutex> directory(this->directory_stripe());
+         auto &shard = *this->_shards[this->shard_of(key)];
+         std::shared_lock<std::shared_mutex> lock(shard.lock);
+
+         return function(shard.map);
+      }
+
+      /// @brief Call the given function with the shard of the given key under its write lock, then split the shard
+      /// if it outgrew its capacity.
+      ///
+      template <typename Function>
+      decltype(auto) write_shard(const Key &key, Function &&function) {
+         // declared before the locks, so the shard is split once they are released
+         struct SplitIfFull {
+            ShardedAVLMap &map;
+            const Key &key;
+            bool full;
+
+            ~SplitIfFull() { if (this->full) { this->map.split_shard_of(this->key); } }
+         } split{*this, key, false};
+
+         std::shared_lock<std::shared_mutex> directory(this->directory_stripe());
+         auto &shard = *this->_shards[this->shard_of(key)];
+         std::unique_lock<std::shared_mutex> lock(shard.lock);
+
+         // the size is updated on the way out, even if the function throws after changing the shard
+         struct SizeUpdate {
+            Shard &shard;
+            SplitIfFull &split;
+            std::size_t capacity;
+
+            ~SizeUpdate() {
+               auto size = this->shard.map.size();
+
+               this->shard.size.store(size, std::memory_order_relaxed);
+               this->split.full = size > this->capacity;
+            }
+         } update{shard, split, this->_shard_capacity};
+
+         return function(shard.map);
+      }
+
+      /// @brief Split the shard of the given key at its median key, if it is still over capacity.
+      ///
+      /// This takes every stripe of the directory lock, so no other operation runs while the shard is split.
+      /// The shards count the nodes of their subtrees, so finding the median and splitting the shard at it only
+      /// relinks O(log n) nodes and the directory is held briefly.
+      ///
+      void split_shard_of(const Key &key) noexcept {
+         // splitting only keeps the shards small, so running out of memory for it leaves the shard as it is
+         try { this->split_shard_at(key); }
+         catch (const std::bad_alloc &) {}
+      }
+
+      /// @brief Split the shard of the given key. See split_shard_of.
+      ///
+      void split_shard_at(const Key &key) {
+         std::vector<std::unique_lock<std::shared_mutex>> directory;
+
+         for (auto &stripe : this->_directory)
+            directory.emplace_back(stripe.lock);
+
+         auto index = this->shard_of(key);
+         auto &shard = *this->_shards[index];
+
+         if (shard.map.size() <= this->_shard_capacity) { return; }
+
+         auto upper = std::make_unique<Shard>();
+         Key middle = shard.map.select(shard.map.size() / 2)->key();
+
+         // make room first, so nothing can fail once the shard is split
+         this->_bounds.reserve(this->_bounds.size() + 1);
+         this->_shards.reserve(this->_shards.size() + 1);
+
+         shard.map.split(middle, upper->map);
+         upper->size.store(upper->map.size(), std::memory_order_relaxed);
+         shard.size.store(shard.map.size(), std::memory_order_relaxed);
+
+         this->_bounds.insert(this->_bounds.begin() + index, std::move(middle));
+         this->_shards.insert(this->_shards.begin() + index + 1, std::move(upper));
+      }
+
+      /// @brief The first key of every shard but the first.
+      ///
+      std::vector<Key> _bounds;
+      /// @brief The shards, in the order of their ranges.
+      ///
+      std::vector<std::unique_ptr<Shard>> _shards;
+      /// @brief The number of keys a shard holds before it is split.
+      ///
+      std::size_t _shard_capacity;
+      /// @brief The lock of the shard directory, which is the bounds and the shards.
+      ///
+      mutable DirectoryStripe _directory[stripes];
+   };
+}
+
+#endif
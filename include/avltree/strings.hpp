@@ -0,0 +1,136 @@
+#ifndef __AVLTREE_STRINGS_HPP
+#define __AVLTREE_STRINGS_HPP
+
+#include "../avltree.hpp"
+
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace avltree
+{
+   /// @brief A string key which carries its first eight bytes inline, as a big-endian integer.
+   ///
+   /// Comparing two std::string keys longer than their small-string buffer follows a heap pointer, so searching
+   /// a tree of them misses the cache twice on every level: once on the node and once on its characters. The
+   /// prefix lives in the node next to the string, and comparing two prefixes as integers orders them as their
+   /// bytes would, so most comparisons finish on the node. The characters are only read when the prefixes
+   /// match and both strings are longer than the prefix.
+   ///
+   /// Keys are ordered as std::string orders them, byte by byte.
+   ///
+   class PrefixedString
+   {
+   public:
+      /// @brief The number of bytes the prefix covers.
+      ///
+      static constexpr std::size_t prefix_size = sizeof(std::uint64_t);
+
+      PrefixedString() : _prefix(0) {}
+      PrefixedString(std::string string) : _prefix(prefix_of(string)), _string(std::move(string)) {}
+      PrefixedString(const char *string) : PrefixedString(std::string(string)) {}
+      explicit PrefixedString(std::string_view string) : PrefixedString(std::string(string)) {}
+
+      /// @brief Get the first bytes of the given string as a big-endian integer, padded with zero bytes.
+      ///
+      static std::uint64_t prefix_of(std::string_view string) {
+         unsigned char bytes[prefix_size] = {};
+         std::uint64_t prefix = 0;
+
+         std::memcpy(bytes, string.data(), std::min(string.size(), prefix_size));
+
+         for (std::size_t i=0; i<prefix_size; ++i)
+            prefix = (prefix << 8) | bytes[i];
+
+         return prefix;
+      }
+
+      /// @brief Get the inline prefix of the key. See prefix_of.
+      ///
+      inline std::uint64_t prefix() const { return this->_prefix; }
+      /// @brief Get the string of the key.
+      ///
+      inline const std::string &str() const { return this->_string; }
+      inline std::size_t size() const { return this->_string.size(); }
+      inline operator std::string_view() const { return this->_string; }
+
+      /// @brief Do a three-way comparison of this key and the given key.
+      ///
+      /// @returns A negative number if this key is ordered before the other, 0 if they are equal and a positive
+      /// number otherwise.
+      ///
+      int compare(const PrefixedString &other) const { return compare(this->_prefix, this->_string, other._prefix, other._string); }
+      /// @brief Do a three-way comparison of this key and the given string, whose prefix is worked out on the spot.
+      ///
+      int compare(std::string_view other) const { return compare(this->_prefix, this->_string, prefix_of(other), other); }
+
+      /// @brief Do a three-way comparison of two strings with the given prefixes.
+      ///
+      static int compare(std::uint64_t prefix, std::string_view string, std::uint64_t other_prefix, std::string_view other) {
+         if (prefix != other_prefix) { return (prefix < other_prefix) ? -1 : 1; }
+
+         // when either string fits in the prefix, the matching prefixes hold all of its bytes, so it's
+         // ordered by length alone
+         if (string.size() <= prefix_size || other.size() <= prefix_size)
+            return (string.size() < other.size()) ? -1 : (string.size() > other.size()) ? 1 : 0;
+
+         auto order = string.substr(prefix_size).compare(other.substr(prefix_size));
+
+         return (order < 0) ? -1 : (order > 0) ? 1 : 0;
+      }
+
+      friend bool operator== (const PrefixedString &a, const PrefixedString &b) {
+         return a._prefix == b._prefix && a._string == b._string;
+      }
+      friend bool operator!= (const PrefixedString &a, const PrefixedString &b) { return !(a == b); }
+      friend bool operator< (const PrefixedString &a, const PrefixedString &b) { return a.compare(b) < 0; }
+
+      friend std::ostream &operator<< (std::ostream &stream, const PrefixedString &key) { return stream << key._string; }
+
+   protected:
+      /// @brief The first bytes of the string, as a big-endian integer. See prefix_of.
+      ///
+      std::uint64_t _prefix;
+      /// @brief The string of the key.
+      ///
+      std::string _string;
+   };
+
+   /// @brief A three-way comparator of PrefixedString keys, which is transparent for anything convertible to a
+   /// std::string_view.
+   ///
+   /// Searching with a std::string, a std::string_view or a C string needs no key to be built: the prefix of the
+   /// searched string is worked out on each comparison, from characters which are already in the cache.
+   ///
+   struct PrefixCompare {
+      using is_transparent = void;
+
+      template <typename S>
+      using enable_if_string = std::enable_if_t<std::is_convertible<const S &, std::string_view>::value &&
+                                                !std::is_same<S, PrefixedString>::value>;
+
+      int operator() (const PrefixedString &a, const PrefixedString &b) const { return a.compare(b); }
+
+      template <typename S, typename = enable_if_string<S>>
+      int operator() (const PrefixedString &a, const S &b) const { return a.compare(std::string_view(b)); }
+
+      template <typename S, typename = enable_if_string<S>>
+      int operator() (const S &a, const PrefixedString &b) const { return -b.compare(std::string_view(a)); }
+   };
+
+   /// @brief An AVL map keyed by strings which compares them by their inline prefixes first. See PrefixedString.
+   ///
+   template <typename Value, typename NodeStorage=RawNodeStorage,
+             typename Allocator=std::allocator<std::pair<const PrefixedString, Value>>, typename Augment=NoAugment,
+             typename Stats=NoStats>
+   using StringMap = AVLMap<PrefixedString, Value, PrefixCompare, NodeStorage, Allocator, Augment, Stats>;
+
+   /// @brief An AVL tree of strings which compares them by their inline prefixes first. See PrefixedString.
+   ///
+   template <typename NodeStorage=RawNodeStorage, typename Allocator=std::allocator<PrefixedString>,
+             typename Augment=NoAugment, typename Stats=NoStats>
+   using StringTree = AVLTree<PrefixedString, PrefixCompare, NodeStorage, Allocator, Augment, Stats>;
+}
+
+#endif
@@ -1,10 +1,53 @@
 #include <framework.hpp>
 #include <avltree.hpp>
+#include <avltree/blocked.hpp>
+#include <avltree/buffered.hpp>
+#include <avltree/concurrent.hpp>
+#include <avltree/frozen.hpp>
+#include <avltree/mapped.hpp>
+#include <avltree/persistent.hpp>
+#include <avltree/sharded.hpp>
+#include <avltree/strings.hpp>
 
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 
 using namespace avltree;
 
+template <bool CheckParents, typename NodeType, typename Compare>
+int check_subtree(NodeType node, NodeType parent, const Compare &compare, std::size_t &count, int limit) {
+   if (node == nullptr) { return 0; }
+   if constexpr (CheckParents) { if (node->parent() != parent) { return -1; } }
+
+   auto left = check_subtree<CheckParents>(node->left(), node, compare, count, limit);
+   auto right = check_subtree<CheckParents>(node->right(), node, compare, count, limit);
+
+   if (left < 0 || right < 0) { return -1; }
+   if (node->left() != nullptr && KeyOrder<Compare>::compare(compare, node->key(), node->left()->key()) <= 0) { return -1; }
+   if (node->right() != nullptr && KeyOrder<Compare>::compare(compare, node->key(), node->right()->key()) >= 0) { return -1; }
+   if (node->height() != std::max(left, right) + 1 || right - left > limit || left - right > limit) { return -1; }
+
+   ++count;
+   
+   return node->height();
+}
+
+/// Verify the ordering, heights, balance, parent links and size of the given tree. The heights of the children
+/// of a node may differ by at most the given limit.
+template <typename Tree>
+bool is_valid_tree(const Tree &tree, int limit=1) {
+   std::size_t count = 0;
+
+   return check_subtree<Tree::has_parent_links>(tree.root(), decltype(tree.root())(nullptr), tree.key_comp(), count, limit) >= 0 &&
+          count == tree.size();
+}
+
 int test_avltree() {
    INIT();
 
@@ -56,17 +99,2001 @@ int test_avlmap() {
    COMPLETE();
 }
 
-int
-main
-(int argc, char *argv[])
+int test_node_storage() {
+   INIT();
+
+   std::vector<std::uint32_t> nodes = { 5, 7, 2, 4, 3, 8, 10, 1, 0, 6, 9 };
+   std::vector<std::uint32_t> inorder_expected = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+   
+   auto tree = AVLTree<std::uint32_t>(nodes);
+   AVLTree<std::uint32_t> copied;
+   copied = tree;
+   ASSERT_SUCCESS(tree.remove(5));
+   
+   std::vector<std::uint32_t> copied_result(copied.begin_values_inorder(), copied.end_values_inorder());
+   ASSERT(copied_result == inorder_expected);
+   ASSERT(!tree.contains(5) && copied.contains(5));
+
+   AVLTree<std::uint32_t, std::less<std::uint32_t>, SharedNodeStorage>::SharedNode handle;
+
+   {
+      auto shared_tree = AVLTree<std::uint32_t, std::less<std::uint32_t>, SharedNodeStorage>(nodes);
+      std::vector<std::uint32_t> shared_result(shared_tree.begin_values_inorder(), shared_tree.end_values_inorder());
+      ASSERT(shared_result == inorder_expected);
+
+      handle = shared_tree.get(8);
+      ASSERT_SUCCESS(shared_tree.remove(8));
+      ASSERT(!shared_tree.contains(8));
+   }
+
+   ASSERT(handle->value() == 8 && handle->is_leaf());
+
+   COMPLETE();
+}
+
+int test_lookup() {
+   INIT();
+
+   std::vector<std::uint32_t> nodes = { 5, 7, 2, 4, 3, 8, 10, 1, 0, 6, 9 };
+   auto tree = AVLTree<std::uint32_t>(nodes);
+
+   auto hit = tree.locate(6);
+   ASSERT(hit.first->value() == 6 && hit.second == 0);
+
+   auto miss = tree.locate(11);
+   ASSERT(miss.first->value() == 10 && miss.second == 1);
+   ASSERT(AVLTree<std::uint32_t>().locate(1).first == nullptr);
+
+   auto path = tree.search(6);
+   std::vector<std::uint32_t> path_nodes;
+   std::vector<int> path_branches;
+
+   for (auto &step : path)
+   {
+      path_nodes.push_back(step.first->value());
+      path_branches.push_back(step.second);
+   }
+
+   ASSERT(path_nodes == std::vector<std::uint32_t>({ 5, 8, 7, 6 }));
+   ASSERT(path_branches == std::vector<int>({ 1, -1, -1, 0 }));
+   ASSERT(tree.search(11).back().second == 1);
+   ASSERT(tree.search(11).size() == 3);
+
+   COMPLETE();
+}
+
+int test_node_pool() {
+   INIT();
+
+   using PooledMap = AVLMap<std::uint32_t, std::uint32_t, std::less<std::uint32_t>, RawNodeStorage,
+                            PoolAllocator<std::pair<const std::uint32_t, std::uint32_t>>>;
+   PooledMap map;
+   auto pool = map.get_allocator().pool();
+
+   for (std::uint32_t i=0; i<1000; ++i)
+      map.insert(i, i*2);
+
+   auto chunks = pool->chunks();
+   ASSERT(map.size() == 1000 && chunks > 0);
+   
+   for (std::uint32_t i=0; i<1000; i+=2)
+      map.remove(i);
+
+   for (std::uint32_t i=0; i<1000; i+=2)
+      map.insert(i, i*3);
+
+   ASSERT(map.size() == 1000);
+   ASSERT(pool->chunks() == chunks);
+   ASSERT(map.get(10) == 30 && map.get(11) == 22);
+
+   PooledMap copied(map);
+   ASSERT(copied.get_allocator().pool() != pool);
+   ASSERT(copied.get(998) == 2994);
+
+   pool.reset();
+   auto copied_pool = copied.get_allocator().pool();
+   copied_pool.reset();
+   ASSERT_SUCCESS(copied.destroy());
+   ASSERT(copied.is_empty() && copied.get_allocator().pool()->chunks() == 0);
+
+   using SharedPooledTree = AVLTree<std::string, std::less<std::string>, SharedNodeStorage, PoolAllocator<std::string>>;
+   SharedPooledTree tree;
+   tree.insert("abad1dea");
+   tree.insert("deadbeef");
+   ASSERT(tree.contains("abad1dea") && tree.size() == 2);
+   ASSERT(tree.get_allocator().pool()->chunks() > 0);
+
+   COMPLETE();
+}
+
+int test_map_upsert() {
+   INIT();
+
+   AVLMap<std::string, std::uint32_t> map;
+
+   auto inserted = map.try_emplace("abad1dea", 0xabad1dea);
+   ASSERT(inserted.second && inserted.first->value().second == 0xabad1dea);
+
+   auto existing = map.try_emplace("abad1dea", 0);
+   ASSERT(!existing.second && existing.first == inserted.first);
+   ASSERT(map["abad1dea"] == 0xabad1dea);
+
+   auto assigned = map.insert_or_assign("abad1dea", 0xdeadbeef);
+   ASSERT(!assigned.second && map.get("abad1dea") == 0xdeadbeef);
+   ASSERT(map.insert_or_assign("facebabe", 0xfacebabe).second);
+
+   auto defaulted = map.find_or_insert("defaced1");
+   ASSERT(defaulted.second && defaulted.first->value().second == 0);
+   ASSERT(!map.find_or_insert(std::make_pair(std::string("defaced1"), 1u)).second);
+   ASSERT(map.size() == 3);
+
+   COMPLETE();
+}
+
+struct CopyCounter {
+   static int copies;
+   std::uint32_t value;
+
+   CopyCounter() : value(0) {}
+   CopyCounter(std::uint32_t value) : value(value) {}
+   CopyCounter(const CopyCounter &other) : value(other.value) { ++copies; }
+   CopyCounter(CopyCounter &&other) : value(other.value) {}
+   CopyCounter &operator=(const CopyCounter &other) { this->value = other.value; ++copies; return *this; }
+   CopyCounter &operator=(CopyCounter &&other) { this->value = other.value; return *this; }
+};
+
+int CopyCounter::copies = 0;
+
+AVLMap<std::string, CopyCounter> make_map() {
+   AVLMap<std::string, CopyCounter> map;
+
+   map.insert(std::string("abad1dea"), CopyCounter(0xabad1dea));
+   map.try_emplace("deadbeef", 0xdeadbeef);
+   map.emplace(std::piecewise_construct, std::forward_as_tuple("facebabe"), std::forward_as_tuple(0xfacebabe));
+   map.insert(std::make_pair(std::string("defaced1"), CopyCounter(0xdefaced1)));
+   map["abad1dea"] = CopyCounter(0);
+
+   return map;
+}
+
+int test_move_semantics() {
+   INIT();
+
+   CopyCounter::copies = 0;
+   auto map = make_map();
+   ASSERT(map.size() == 4 && map.get("deadbeef").value == 0xdeadbeef);
+   ASSERT(map.get("facebabe").value == 0xfacebabe && map.get("abad1dea").value == 0);
+
+   auto moved = std::move(map);
+   ASSERT(moved.size() == 4 && map.size() == 0 && map.is_empty());
+
+   map = std::move(moved);
+   ASSERT(map.size() == 4 && moved.is_empty());
+   ASSERT(CopyCounter::copies == 0);
+   ASSERT(!map.emplace(std::piecewise_construct, std::forward_as_tuple("deadbeef"), std::forward_as_tuple(1)).second);
+
+   AVLTree<std::uint32_t> tree;
+   auto five = tree.emplace(5).first;
+   auto six = tree.emplace_hint(five, 6);
+   auto four = tree.emplace_hint(five, 4);
+   ASSERT(tree.emplace_hint(six, 7)->value() == 7);
+   ASSERT(tree.emplace_hint(four, 3)->value() == 3);
+   ASSERT(tree.emplace_hint(six, 1)->value() == 1);
+   ASSERT(tree.emplace_hint(five, 5) == five && tree.size() == 6);
+
+   std::vector<std::uint32_t> inorder_result(tree.begin_values_inorder(), tree.end_values_inorder());
+   ASSERT(inorder_result == std::vector<std::uint32_t>({ 1, 3, 4, 5, 6, 7 }));
+
+   AVLTree<std::uint32_t> swapped;
+   swapped.swap(tree);
+   ASSERT(swapped.size() == 6 && tree.size() == 0 && swapped.contains(7));
+
+   COMPLETE();
+}
+
+int test_bulk_build() {
+   INIT();
+
+   std::vector<std::uint32_t> sorted;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+      sorted.push_back(i*2);
+
+   AVLTree<std::uint32_t> tree;
+   tree.insert(1);
+   ASSERT_SUCCESS(tree.assign_sorted(sorted.begin(), sorted.end()));
+   ASSERT(tree.size() == 1000 && !tree.contains(1) && tree.contains(1998));
+   ASSERT(tree.root()->height() == 10);
+   ASSERT(is_valid_tree(tree));
+
+   std::vector<std::uint32_t> inorder_result(tree.begin_values_inorder(), tree.end_values_inorder());
+   ASSERT(inorder_result == sorted);
+
+   std::vector<std::uint32_t> unsorted = { 3, 1, 2 };
+   ASSERT_THROWS(tree.assign_sorted(unsorted.begin(), unsorted.end()), exception::NotSorted);
+   ASSERT(tree.size() == 1000);
+
+   std::vector<std::uint32_t> large;
+
+   for (std::uint32_t i=0; i<100000; ++i)
+      large.push_back(i);
+
+   AVLTree<std::uint32_t> parallel_tree;
+   ASSERT_SUCCESS(parallel_tree.assign_sorted(large.begin(), large.end(), 4));
+   ASSERT(parallel_tree.size() == 100000 && is_valid_tree(parallel_tree));
+   ASSERT(parallel_tree.contains(0) && parallel_tree.contains(99999) && !parallel_tree.contains(100000));
+
+   std::vector<std::pair<const std::string, std::uint32_t>> pairs = { { "deadbeef", 2 }, { "abad1dea", 1 }, { "facebabe", 3 } };
+   AVLMap<std::string, std::uint32_t> map;
+   ASSERT_SUCCESS(map.assign(pairs.begin(), pairs.end()));
+   ASSERT(map.size() == 3 && map.get("abad1dea") == 1 && map.get("facebabe") == 3);
+   ASSERT(is_valid_tree(map));
+
+   pairs.push_back({ "abad1dea", 4 });
+   ASSERT_THROWS(map.assign(pairs.begin(), pairs.end()), exception::KeyExists);
+
+   auto from_vector = AVLTree<std::uint32_t>(sorted);
+   ASSERT(from_vector.size() == 1000 && is_valid_tree(from_vector));
+
+   // the values inserted before a duplicate are freed when the constructor throws
+   std::vector<std::uint32_t> duplicated = { 3, 1, 2, 1 };
+   ASSERT_THROWS(AVLTree<std::uint32_t>(duplicated), exception::KeyExists);
+   ASSERT_THROWS(AVLTree<std::uint32_t>(std::move(duplicated)), exception::KeyExists);
+
+   COMPLETE();
+}
+
+int test_copy() {
+   INIT();
+
+   AVLTree<std::uint32_t> tree;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+      tree.insert((i * 7919) % 1000);
+
+   auto copied = tree;
+   ASSERT(copied.size() == tree.size() && is_valid_tree(copied));
+   ASSERT(copied.root() != tree.root());
+
+   std::vector<std::uint32_t> original_shape(tree.begin_values_preorder(), tree.end_values_preorder());
+   std::vector<std::uint32_t> copied_shape(copied.begin_values_preorder(), copied.end_values_preorder());
+   ASSERT(original_shape == copied_shape);
+
+   copied = copied;
+   ASSERT(copied.size() == 1000 && is_valid_tree(copied));
+
+   AVLTree<std::uint32_t> large;
+
+   for (std::uint32_t i=0; i<100000; ++i)
+      large.insert(i);
+
+   AVLTree<std::uint32_t> parallel_copy;
+   parallel_copy.insert(100000);
+   ASSERT_SUCCESS(parallel_copy.copy(large, 4));
+   ASSERT(parallel_copy.size() == 100000 && is_valid_tree(parallel_copy));
+   ASSERT(!parallel_copy.contains(100000) && parallel_copy.contains(99999));
+
+   parallel_copy.destroy();
+   ASSERT(parallel_copy.size() == 0 && parallel_copy.root() == nullptr);
+
+   // copying into a tree which already has nodes in its pool keeps the pool alive for the copy
+   using PooledTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, PoolAllocator<std::uint32_t>>;
+   PooledTree pooled, pooled_copy;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+   {
+      pooled.insert(i);
+      pooled_copy.insert(i + 1000);
+   }
+
+   pooled_copy = pooled;
+   ASSERT(pooled_copy.size() == 1000 && is_valid_tree(pooled_copy));
+   ASSERT(*pooled_copy.begin_values_inorder() == 0 && !pooled_copy.contains(1000));
+   ASSERT(pooled.size() == 1000 && is_valid_tree(pooled));
+
+   COMPLETE();
+}
+
+int test_order_statistics() {
+   INIT();
+
+   AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, std::allocator<std::uint32_t>, SubtreeSize> tree;
+   std::vector<std::uint32_t> keys;
+
+   for (std::uint32_t i=0; i<500; ++i)
+   {
+      tree.insert((i * 7919) % 1000);
+      keys.push_back((i * 7919) % 1000);
+   }
+
+   for (std::uint32_t i=0; i<500; i+=3)
+   {
+      tree.remove((i * 7919) % 1000);
+      keys.erase(std::find(keys.begin(), keys.end(), (i * 7919) % 1000));
+   }
+
+   std::sort(keys.begin(), keys.end());
+   ASSERT(tree.size() == keys.size() && is_valid_tree(tree));
+   ASSERT(tree.root()->aggregate() == keys.size());
+
+   bool selected = true, ranked = true;
+
+   for (std::size_t i=0; i<keys.size(); ++i)
+   {
+      selected = selected && tree.select(i)->key() == keys[i];
+      ranked = ranked && tree.rank(keys[i]) == i;
+   }
+
+   ASSERT(selected && ranked);
+   ASSERT_THROWS(tree.select(keys.size()), exception::IndexOutOfRange);
+   ASSERT(tree.rank(1000) == keys.size());
+
+   auto expected_count = std::lower_bound(keys.begin(), keys.end(), 750) - std::lower_bound(keys.begin(), keys.end(), 250);
+   ASSERT(tree.count_range(250, 750) == static_cast<std::size_t>(expected_count));
+   ASSERT(tree.count_range(750, 250) == 0);
+
+   auto iter = tree.begin_inorder();
+   iter += 100;
+   ASSERT((*iter)->key() == keys[100]);
+   iter += -57;
+   ASSERT((*iter)->key() == keys[43]);
+   iter += keys.size();
+   ASSERT(iter == tree.end_inorder());
+
+   auto copied = tree;
+   ASSERT(copied.select(200)->key() == keys[200]);
+
+   COMPLETE();
+}
+
+int test_removal_balance() {
+   INIT();
+
+   using PooledTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, PoolAllocator<std::uint32_t>>;
+
+   AVLTree<std::uint32_t> tree;
+   PooledTree pooled;
+   std::vector<bool> present(4096, false);
+   std::uint32_t state = 12345;
+   std::size_t size = 0;
+   bool valid = true;
+
+   // churning a small range of keys removes plenty of nodes with two children, whose successor's old parent
+   // is the first node to lose height
+   for (std::uint32_t i=0; i<20000; ++i)
+   {
+      state = state * 1103515245 + 12345;
+      auto key = (state >> 16) % 4096;
+
+      if (present[key])
+      {
+         tree.remove(key);
+         pooled.remove(key);
+         --size;
+      }
+      else
+      {
+         tree.insert(key);
+         pooled.insert(key);
+         ++size;
+      }
+
+      present[key] = !present[key];
+
+      if (i % 500 == 0) { valid = valid && is_valid_tree(tree) && is_valid_tree(pooled); }
+   }
+
+   ASSERT(valid && is_valid_tree(tree) && is_valid_tree(pooled));
+   ASSERT(tree.size() == size && pooled.size() == size);
+
+   COMPLETE();
+}
+
+struct MappedValue {
+   std::uint64_t operator() (const std::pair<const std::uint32_t, std::uint32_t> &pair) const { return pair.second; }
+};
+
+int test_augmentation() {
+   using SumOfValues = SubtreeSum<std::uint64_t, MappedValue>;
+   using SizeAndSum = Augments<SubtreeSize, SumOfValues>;
+
+   INIT();
+
+   AVLMap<std::uint32_t, std::uint32_t, std::less<std::uint32_t>, RawNodeStorage,
+          std::allocator<std::pair<const std::uint32_t, std::uint32_t>>, SizeAndSum> map;
+   std::vector<std::uint64_t> values(1000, 0);
+
+   for (std::uint32_t i=0; i<1000; ++i)
+   {
+      auto key = (i * 7919) % 1000;
+      map.insert(key, key * 3);
+      values[key] = key * 3;
+   }
+
+   for (std::uint32_t key=0; key<1000; key+=7)
+   {
+      map.remove(key);
+      values[key] = 0;
+   }
+
+   ASSERT(is_valid_tree(map));
+   ASSERT(SizeAndSum::get<SubtreeSize>(map.root()->aggregate()) == map.size());
+   ASSERT(map.rank(500) == 500 - 72);
+
+   bool summed = true;
+
+   for (std::uint32_t low=0; low<1000; low+=37)
+   {
+      for (std::uint32_t high=low; high<=1000; high+=91)
+      {
+         std::uint64_t expected = 0;
+
+         for (auto key=low; key<high; ++key)
+            expected += values[key];
+
+         summed = summed && SizeAndSum::get<SumOfValues>(map.aggregate_range(low, high)) == expected;
+      }
+   }
+
+   ASSERT(summed);
+   ASSERT(SizeAndSum::get<SumOfValues>(map.aggregate_range(600, 100)) == 0);
+
+   COMPLETE();
+}
+
+int test_interval_tree() {
+   INIT();
+
+   IntervalTree<std::int32_t> tree;
+   std::vector<std::pair<std::int32_t, std::int32_t>> intervals;
+
+   for (std::int32_t i=0; i<2000; ++i)
+   {
+      std::int32_t low = (i * 7919) % 10000;
+      std::int32_t high = low + 1 + (i * 104729) % 300;
+
+      tree.insert(low, high);
+      intervals.push_back(std::make_pair(low, high));
+   }
+
+   for (std::size_t i=0; i<intervals.size(); i+=5)
+      tree.remove(intervals[i].first, intervals[i].second);
+
+   for (std::size_t i=0; i<intervals.size(); i+=5)
+      intervals[i] = std::make_pair(0, 0);
+
+   intervals.erase(std::remove(intervals.begin(), intervals.end(), std::make_pair(0, 0)), intervals.end());
+   std::sort(intervals.begin(), intervals.end());
+   ASSERT(tree.size() == intervals.size() && is_valid_tree(tree));
+
+   bool overlapped = true, contained = true;
+
+   for (std::int32_t low=-100; low<10400; low+=173)
+   {
+      auto high = low + (low % 50) + 1;
+      std::vector<std::pair<std::int32_t, std::int32_t>> expected_overlaps, expected_contains;
+
+      for (auto &interval : intervals)
+      {
+         if (interval.first < high && low < interval.second) { expected_overlaps.push_back(interval); }
+         if (interval.first <= low && low < interval.second) { expected_contains.push_back(interval); }
+      }
+
+      overlapped = overlapped && tree.overlapping(low, high) == expected_overlaps;
+      contained = contained && tree.containing(low) == expected_contains;
+   }
+
+   ASSERT(overlapped && contained);
+   ASSERT(tree.overlapping(20000, 30000).empty());
+   ASSERT_THROWS(tree.remove(-5, 5), exception::KeyNotFound);
+
+   COMPLETE();
+}
+
+class RotationCountingTree : public AVLTreeBase<std::uint32_t, std::uint32_t, KeyIsValue<std::uint32_t>, std::less<std::uint32_t>,
+                                                 RawNodeStorage, std::allocator<std::uint32_t>, NoAugment, RotationCountingTree>
 {
+public:
+   using TreeBase = AVLTreeBase<std::uint32_t, std::uint32_t, KeyIsValue<std::uint32_t>, std::less<std::uint32_t>,
+                                RawNodeStorage, std::allocator<std::uint32_t>, NoAugment, RotationCountingTree>;
+
+   std::size_t rotations = 0;
+
+   void rotate_left(NodePointer node) { ++this->rotations; TreeBase::rotate_left(node); }
+   void rotate_right(NodePointer node) { ++this->rotations; TreeBase::rotate_right(node); }
+};
+
+int test_static_dispatch() {
    INIT();
 
-   LOG_INFO("Testing AVLTree.");
-   PROCESS_RESULT(test_avltree);
+   static_assert(!std::is_polymorphic<AVLTree<std::uint32_t>::Node>::value, "Nodes should not carry a vtable.");
 
-   LOG_INFO("Testing AVLMap.");
-   PROCESS_RESULT(test_avlmap);
+   RotationCountingTree tree;
+
+   for (std::uint32_t i=0; i<7; ++i)
+      tree.insert(i);
+
+   ASSERT(tree.rotations == 4);
+   ASSERT(is_valid_tree(tree) && tree.root()->key() == 3);
+
+   AVLMap<std::uint32_t, std::unique_ptr<std::string>> owners;
+   ASSERT_SUCCESS(owners.insert(1, std::make_unique<std::string>("abad1dea")));
+   ASSERT_SUCCESS(owners.try_emplace(2, std::make_unique<std::string>("deadbeef")));
+   ASSERT(*owners.get(1) == "abad1dea" && *owners.get(2) == "deadbeef");
+
+   COMPLETE();
+}
+
+int test_compact_nodes() {
+   using CompactTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage, std::allocator<std::uint32_t>, SubtreeSize>;
+   using LinkedTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, std::allocator<std::uint32_t>, SubtreeSize>;
+
+   INIT();
+
+   ASSERT(sizeof(CompactTree::Node) + sizeof(void *) == sizeof(LinkedTree::Node));
+   ASSERT(sizeof(AVLTree<std::uint32_t>::const_iterator) == sizeof(void *));
+
+   CompactTree compact;
+   LinkedTree linked;
+
+   for (std::uint32_t i=0; i<2000; ++i)
+   {
+      compact.insert((i * 7919) % 2000);
+      linked.insert((i * 7919) % 2000);
+   }
+
+   for (std::uint32_t i=0; i<2000; i+=3)
+   {
+      compact.remove((i * 7919) % 2000);
+      linked.remove((i * 7919) % 2000);
+   }
+
+   ASSERT(compact.size() == linked.size() && is_valid_tree(compact));
+   ASSERT(std::vector<std::uint32_t>(compact.begin_values_preorder(), compact.end_values_preorder())
+          == std::vector<std::uint32_t>(linked.begin_values_preorder(), linked.end_values_preorder()));
+   ASSERT(std::vector<std::uint32_t>(compact.begin_values_inorder(), compact.end_values_inorder())
+          == std::vector<std::uint32_t>(linked.begin_values_inorder(), linked.end_values_inorder()));
+   ASSERT(std::vector<std::uint32_t>(compact.begin_values_postorder(), compact.end_values_postorder())
+          == std::vector<std::uint32_t>(linked.begin_values_postorder(), linked.end_values_postorder()));
+
+   auto iter = compact.begin_inorder();
+   iter += 500;
+   ASSERT((*iter)->key() == linked.select(500)->key());
+   iter += -250;
+   ASSERT((*iter)->key() == linked.select(250)->key());
+   ASSERT(compact.rank(1000) == linked.rank(1000));
+
+   ASSERT(compact.emplace_hint(compact.root(), 5000) != nullptr);
+   ASSERT(compact.contains(5000) && is_valid_tree(compact));
+
+   auto copied = compact;
+   ASSERT(copied.size() == compact.size() && is_valid_tree(copied));
+
+   AVLMap<std::string, std::uint32_t, std::less<std::string>, CompactNodeStorage> map;
+   map["abad1dea"] = 0xabad1dea;
+   map["deadbeef"] = 0xdeadbeef;
+   map.remove("abad1dea");
+   ASSERT(map.size() == 1 && map["deadbeef"] == 0xdeadbeef && is_valid_tree(map));
+
+   COMPLETE();
+}
+
+int test_frozen_tree() {
+   INIT();
+
+   AVLTree<std::uint32_t> tree;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+      tree.insert(((i * 7919) % 1000) * 2);
+
+   auto frozen = freeze(tree);
+   ASSERT(frozen.size() == tree.size());
+
+   bool matched = true;
+
+   for (std::uint32_t key=0; key<2100; ++key)
+      matched = matched && frozen.contains(key) == tree.contains(key);
+
+   ASSERT(matched);
+   ASSERT(frozen.find(998).has_value() && *frozen.find(998).value() == 998);
+   ASSERT(!frozen.find(999).has_value());
+   ASSERT_THROWS(frozen.get(3), exception::KeyNotFound);
+   ASSERT(*frozen.lower_bound(999) == 1000 && frozen.lower_bound(5000) == frozen.end());
+
+   std::vector<std::uint32_t> inorder(tree.begin_values_inorder(), tree.end_values_inorder());
+   ASSERT(std::vector<std::uint32_t>(frozen.begin(), frozen.end()) == inorder);
+
+   auto thawed = frozen.thaw();
+   ASSERT(thawed.size() == tree.size() && is_valid_tree(thawed));
+   ASSERT(std::vector<std::uint32_t>(thawed.begin_values_inorder(), thawed.end_values_inorder()) == inorder);
+
+   AVLMap<std::string, std::uint32_t> map;
+   map["abad1dea"] = 0xabad1dea;
+   map["deadbeef"] = 0xdeadbeef;
+   map["facebabe"] = 0xfacebabe;
+
+   auto frozen_map = freeze(map);
+   ASSERT(frozen_map.get("deadbeef").second == 0xdeadbeef && !frozen_map.contains("defaced1"));
+   ASSERT(frozen_map.thaw()["facebabe"] == 0xfacebabe);
+
+   auto frozen_empty = freeze(AVLTree<std::uint32_t>());
+   ASSERT(frozen_empty.is_empty() && !frozen_empty.contains(0) && frozen_empty.begin() == frozen_empty.end());
+
+   COMPLETE();
+}
+
+int test_find_many() {
+   INIT();
+
+   AVLTree<std::uint32_t> tree;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+      tree.insert(((i * 7919) % 1000) * 2);
+
+   // keys with the top bit set only order correctly if unsigned comparisons are kept unsigned
+   tree.insert(0x80000001);
+   tree.insert(0xfffffff0);
+
+   auto frozen = freeze(tree);
+
+   // an odd batch size leaves a partial batch at the end, which takes the scalar path
+   std::vector<std::uint32_t> keys;
+
+   for (std::uint32_t key=0; key<2101; ++key)
+      keys.push_back((key * 613) % 2101);
+
+   keys.insert(keys.begin(), { 0x80000001, 0xfffffff0, 0x7fffffff, 0xffffffff });
+
+   std::vector<const std::uint32_t *> found;
+   frozen.find_many(keys.begin(), keys.end(), std::back_inserter(found));
+   auto bitmap = frozen.contains_many(keys.begin(), keys.end());
+
+   ASSERT(found.size() == keys.size() && bitmap.size() == keys.size());
+
+   bool matched = true;
+
+   for (std::size_t i=0; i<keys.size(); ++i)
+   {
+      auto expected = frozen.find(keys[i]);
+      matched = matched && bitmap[i] == tree.contains(keys[i]);
+      matched = matched && ((expected.has_value()) ? found[i] == expected.value() : found[i] == nullptr);
+   }
+
+   ASSERT(matched);
+
+   // signed keys take a different bias through the vector comparisons
+   AVLTree<std::int32_t> signed_tree;
+
+   for (std::int32_t i=-500; i<500; i+=3)
+      signed_tree.insert(i);
+
+   auto frozen_signed = freeze(signed_tree);
+   std::vector<std::int32_t> signed_keys;
+
+   for (std::int32_t i=-510; i<510; ++i)
+      signed_keys.push_back(i);
+
+   auto signed_bitmap = frozen_signed.contains_many(signed_keys.begin(), signed_keys.end());
+   matched = signed_bitmap.size() == signed_keys.size();
+
+   for (std::size_t i=0; i<signed_keys.size(); ++i)
+      matched = matched && signed_bitmap[i] == signed_tree.contains(signed_keys[i]);
+
+   ASSERT(matched);
+
+   AVLMap<std::string, std::uint32_t> map;
+   map["abad1dea"] = 0xabad1dea;
+   map["deadbeef"] = 0xdeadbeef;
+
+   auto frozen_map = freeze(map);
+   std::vector<std::string> names = { "deadbeef", "defaced1", "abad1dea" };
+   ASSERT(frozen_map.contains_many(names.begin(), names.end()) == std::vector<bool>({ true, false, true }));
+
+   auto frozen_empty = freeze(AVLTree<std::uint32_t>());
+   ASSERT(frozen_empty.contains_many(keys.begin(), keys.end()) == std::vector<bool>(keys.size(), false));
+   ASSERT(frozen.contains_many(keys.begin(), keys.begin()).empty());
+
+   COMPLETE();
+}
+
+/// A concurrent map whose writer's version of the tree can be checked by is_valid_tree.
+class InspectableConcurrentMap : public ConcurrentAVLMap<std::uint32_t, std::uint32_t>
+{
+public:
+   using TreeBase::has_parent_links;
+   using TreeBase::root;
+};
+
+int test_concurrent_map() {
+   INIT();
+
+   InspectableConcurrentMap map;
+   std::map<std::uint32_t, std::uint32_t> expected;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+   {
+      auto key = (i * 7919) % 1000;
+      map.insert(key, key + 1);
+      expected[key] = key + 1;
+   }
+
+   ASSERT(map.size() == 1000 && is_valid_tree(map));
+   ASSERT_THROWS(map.insert(5, 0), exception::KeyExists);
+   ASSERT(map.get(5) == 6 && !map.find(1000).has_value());
+   ASSERT_THROWS(map.get(1000), exception::KeyNotFound);
+
+   for (std::uint32_t i=0; i<1000; i+=3)
+   {
+      map.remove((i * 7919) % 1000);
+      expected.erase((i * 7919) % 1000);
+   }
+
+   ASSERT_THROWS(map.remove(0), exception::KeyNotFound);
+   ASSERT(!map.insert_or_assign(1, 100) && map.insert_or_assign(0, 200));
+   expected[1] = 100;
+   expected[0] = 200;
+
+   ASSERT(is_valid_tree(map) && map.size() == expected.size());
+   auto pairs = map.to_vec();
+   ASSERT(std::equal(pairs.begin(), pairs.end(), expected.begin(), expected.end()));
+
+   // readers look up keys which are never removed while a writer churns the keys around them
+   ConcurrentAVLMap<std::uint32_t, std::uint32_t> shared;
+
+   for (std::uint32_t key=0; key<2000; key+=2)
+      shared.insert(key, key);
+
+   std::atomic<bool> done(false);
+   std::atomic<std::size_t> misses(0);
+   std::vector<std::thread> readers;
+
+   for (std::size_t reader=0; reader<3; ++reader)
+   {
+      readers.emplace_back([&shared, &done, &misses]() {
+         while (!done.load())
+         {
+            for (std::uint32_t key=0; key<2000; key+=2)
+            {
+               auto value = shared.find(key);
+
+               if (!value.has_value() || *value != key) { ++misses; }
+            }
+
+            std::uint32_t last = 0;
+            bool first = true;
+
+            shared.visit([&](const std::pair<const std::uint32_t, std::uint32_t> &pair) {
+               if (!first && pair.first <= last) { ++misses; }
+
+               first = false;
+               last = pair.first;
+            });
+         }
+      });
+   }
+
+   for (std::size_t round=0; round<20; ++round)
+   {
+      for (std::uint32_t key=1; key<2000; key+=2)
+         shared.insert(key, key);
+
+      for (std::uint32_t key=1; key<2000; key+=2)
+         shared.remove(key);
+   }
+
+   done.store(true);
+
+   for (auto &reader : readers)
+      reader.join();
+
+   ASSERT(misses.load() == 0 && shared.size() == 1000);
+
+   COMPLETE();
+}
+
+/// Collect the addresses of every node of the given subtree.
+template <typename NodeType>
+void collect_nodes(const NodeType &node, std::set<const void *> &nodes) {
+   if (node == nullptr) { return; }
+
+   nodes.insert(&*node);
+   collect_nodes(node->left(), nodes);
+   collect_nodes(node->right(), nodes);
+}
+
+int test_persistent_tree() {
+   INIT();
+
+   PersistentAVLTree<std::uint32_t> tree;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+      tree.insert((i * 7919) % 1000);
+
+   ASSERT(tree.size() == 1000 && is_valid_tree(tree));
+   ASSERT_THROWS(tree.insert(5), exception::KeyExists);
+   ASSERT_THROWS(tree.remove(1000), exception::KeyNotFound);
+
+   auto snapshot = tree.snapshot();
+   auto before = tree.to_vec();
+
+   tree.insert(1000);
+   tree.remove(0);
+
+   // the snapshot keeps its version, and the new version only copied the paths the changes took
+   ASSERT(snapshot->to_vec() == before && is_valid_tree(*snapshot));
+   ASSERT(tree.size() == 1000 && tree.contains(1000) && !tree.contains(0) && is_valid_tree(tree));
+   ASSERT(snapshot->contains(0) && !snapshot->contains(1000));
+
+   std::set<const void *> old_nodes, new_nodes;
+   collect_nodes(snapshot->root(), old_nodes);
+   collect_nodes(tree.root(), new_nodes);
+
+   std::size_t copied = 0;
+
+   for (auto node : new_nodes)
+      copied += old_nodes.count(node) == 0;
+
+   ASSERT(copied > 0 && copied <= 4 * static_cast<std::size_t>(tree.root()->height()));
+
+   // a version nothing else shares is changed in place
+   PersistentAVLTree<std::uint32_t> solo;
+
+   for (std::uint32_t i=0; i<100; ++i)
+      solo.insert(i);
+
+   std::set<const void *> solo_before, solo_after;
+   collect_nodes(solo.root(), solo_before);
+   solo.remove(50);
+   collect_nodes(solo.root(), solo_after);
+
+   ASSERT(std::includes(solo_before.begin(), solo_before.end(), solo_after.begin(), solo_after.end()) && is_valid_tree(solo));
+
+   // a snapshot outlives the versions it was taken from
+   PersistentAVLTree<std::uint32_t> copy = *snapshot;
+   snapshot.reset();
+   copy.remove(500);
+
+   for (std::uint32_t i=0; i<1000; i+=2)
+      tree.remove((i * 7919) % 1000 + 1);
+
+   ASSERT(tree.size() == 500 && tree.contains(500) && is_valid_tree(tree));
+   ASSERT(copy.size() == 999 && !copy.contains(500) && copy.contains(1) && is_valid_tree(copy));
+
+   PersistentAVLMap<std::string, std::uint32_t> map;
+   map.insert("abad1dea", 0xabad1dea);
+   map.insert("deadbeef", 0xdeadbeef);
+
+   auto map_snapshot = map.snapshot();
+   ASSERT(!map.insert_or_assign("deadbeef", 0xdefaced1) && map.insert_or_assign("facebabe", 0xfacebabe));
+   ASSERT(map.get("deadbeef") == 0xdefaced1 && map_snapshot->get("deadbeef") == 0xdeadbeef);
+   ASSERT(!map_snapshot->contains("facebabe") && map.size() == 3 && map_snapshot->size() == 2);
+   ASSERT_THROWS(map_snapshot->get("facebabe"), exception::KeyNotFound);
+
+   COMPLETE();
+}
+
+int test_sharded_map() {
+   INIT();
+
+   ShardedAVLMap<std::uint32_t, std::uint32_t> map(64);
+   std::map<std::uint32_t, std::uint32_t> expected;
+
+   using Sharded = ShardedAVLMap<std::uint32_t, std::uint32_t>;
+   ASSERT_THROWS(Sharded(1), exception::IndexOutOfRange);
+   ASSERT_THROWS(Sharded(std::vector<std::uint32_t>({ 5, 5 })), exception::NotSorted);
+
+   for (std::uint32_t i=0; i<1000; ++i)
+   {
+      auto key = (i * 7919) % 1000;
+      map.insert(key, key + 1);
+      expected[key] = key + 1;
+   }
+
+   // every shard split once it went past 64 keys, so none is left holding more than that
+   ASSERT(map.size() == 1000 && map.shard_count() >= 1000 / 64);
+   ASSERT_THROWS(map.insert(5, 0), exception::KeyExists);
+   ASSERT(map.get(5) == 6 && !map.find(1000).has_value() && map.contains(999));
+   ASSERT_THROWS(map.get(1000), exception::KeyNotFound);
+
+   for (std::uint32_t i=0; i<1000; i+=3)
+   {
+      map.remove((i * 7919) % 1000);
+      expected.erase((i * 7919) % 1000);
+   }
+
+   ASSERT_THROWS(map.remove(0), exception::KeyNotFound);
+   ASSERT(!map.insert_or_assign(1, 100) && map.insert_or_assign(0, 200));
+   expected[1] = 100;
+   expected[0] = 200;
+
+   auto pairs = map.to_vec();
+   ASSERT(map.size() == expected.size() && std::equal(pairs.begin(), pairs.end(), expected.begin(), expected.end()));
+
+   // writers on every thread insert their own keys, splitting shards under each other
+   ShardedAVLMap<std::uint32_t, std::uint32_t> shared({ 1000, 2000, 3000 }, 128);
+   std::vector<std::thread> writers;
+
+   for (std::uint32_t writer=0; writer<4; ++writer)
+   {
+      writers.emplace_back([&shared, writer]() {
+         for (std::uint32_t i=0; i<1000; ++i)
+            shared.insert(i * 4 + writer, writer);
+      });
+   }
+
+   for (auto &writer : writers)
+      writer.join();
+
+   std::uint32_t next = 0;
+   bool ordered = true;
+
+   shared.visit([&](const std::pair<const std::uint32_t, std::uint32_t> &pair) {
+      ordered = ordered && pair.first == next && pair.second == next % 4;
+      ++next;
+   });
+
+   ASSERT(ordered && next == 4000 && shared.size() == 4000 && shared.shard_count() > 4);
+
+   COMPLETE();
+}
+
+template <typename Tree>
+std::vector<std::uint32_t> values_of(Tree tree) {
+   return std::vector<std::uint32_t>(tree.cbegin_values_inorder(), tree.cend_values_inorder());
+}
+
+template <typename Tree>
+Tree multiples_of(std::uint32_t step, std::uint32_t limit) {
+   Tree tree;
+
+   for (std::uint32_t i=0; i<limit; i+=step)
+      tree.insert(i);
+
+   return tree;
+}
+
+int test_set_operations() {
+   INIT();
+
+   using Tree = AVLTree<std::uint32_t>;
+
+   Tree lower = multiples_of<Tree>(1, 100), upper, empty;
+
+   for (std::uint32_t i=100; i<600; ++i)
+      upper.insert(i);
+
+   ASSERT_THROWS(upper.join(lower), exception::NotSorted);
+   ASSERT_THROWS(lower.join(100, lower), exception::NotSorted);
+   lower.join(upper);
+   ASSERT(lower.size() == 600 && upper.is_empty() && is_valid_tree(lower) && is_valid_tree(upper));
+   ASSERT(values_of(lower) == values_of(multiples_of<Tree>(1, 600)));
+
+   lower.join(1000, empty);
+   ASSERT(lower.size() == 601 && lower.contains(1000) && is_valid_tree(lower));
+
+   lower.split(300, upper);
+   ASSERT(lower.size() == 300 && upper.size() == 301 && is_valid_tree(lower) && is_valid_tree(upper));
+   ASSERT(values_of(lower) == values_of(multiples_of<Tree>(1, 300)) && upper.contains(300) && !lower.contains(300));
+
+   upper.split(5000, empty);
+   ASSERT(upper.size() == 301 && empty.is_empty() && is_valid_tree(upper));
+   upper.split(0, empty);
+   ASSERT(upper.is_empty() && empty.size() == 301 && is_valid_tree(empty));
+
+   std::set<std::uint32_t> evens, triples, expected;
+
+   for (std::uint32_t i=0; i<3000; i+=2) { evens.insert(i); }
+   for (std::uint32_t i=0; i<3000; i+=3) { triples.insert(i); }
+
+   auto a = multiples_of<Tree>(2, 3000), b = multiples_of<Tree>(3, 3000);
+   std::set_union(evens.begin(), evens.end(), triples.begin(), triples.end(), std::inserter(expected, expected.end()));
+   a.set_union(b);
+   ASSERT(a.size() == expected.size() && b.is_empty() && is_valid_tree(a));
+   ASSERT(values_of(a) == std::vector<std::uint32_t>(expected.begin(), expected.end()));
+
+   a = multiples_of<Tree>(2, 3000);
+   b = multiples_of<Tree>(3, 3000);
+   expected.clear();
+   std::set_intersection(evens.begin(), evens.end(), triples.begin(), triples.end(), std::inserter(expected, expected.end()));
+   a.set_intersection(b);
+   ASSERT(a.size() == expected.size() && b.is_empty() && is_valid_tree(a));
+   ASSERT(values_of(a) == std::vector<std::uint32_t>(expected.begin(), expected.end()));
+
+   a = multiples_of<Tree>(2, 3000);
+   b = multiples_of<Tree>(3, 3000);
+   expected.clear();
+   std::set_difference(evens.begin(), evens.end(), triples.begin(), triples.end(), std::inserter(expected, expected.end()));
+   a.set_difference(b);
+   ASSERT(a.size() == expected.size() && b.is_empty() && is_valid_tree(a));
+   ASSERT(values_of(a) == std::vector<std::uint32_t>(expected.begin(), expected.end()));
+
+   // merge leaves the values with keys already in the tree behind, like std::set::merge
+   a = multiples_of<Tree>(2, 3000);
+   b = multiples_of<Tree>(3, 3000);
+   auto duplicates = multiples_of<Tree>(6, 3000);
+   a.merge(b);
+   ASSERT(a.size() == 2000 && is_valid_tree(a) && is_valid_tree(b));
+   ASSERT(values_of(b) == values_of(duplicates));
+
+   // big enough to fork, the parallel operations must match the sequential ones
+   a = multiples_of<Tree>(2, 1 << 18);
+   b = multiples_of<Tree>(3, 1 << 18);
+   auto sequential = a, other = b;
+   a.set_union(b, 4);
+   sequential.set_union(other);
+   ASSERT(a.size() == sequential.size() && is_valid_tree(a) && values_of(a) == values_of(sequential));
+
+   b = multiples_of<Tree>(3, 1 << 18);
+   other = b;
+   a.set_difference(b, 4);
+   sequential.set_difference(other);
+   ASSERT(a.size() == (1 << 18) / 2 - (1 << 18) / 6 - 1 && is_valid_tree(a) && values_of(a) == values_of(sequential));
+
+   b = multiples_of<Tree>(5, 1 << 18);
+   other = b;
+   a.set_intersection(b, 4);
+   sequential.set_intersection(other);
+   ASSERT(a.size() == sequential.size() && is_valid_tree(a) && values_of(a) == values_of(sequential));
+
+   // relinked nodes without parents keep their subtree sizes up to date
+   using CompactTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage, std::allocator<std::uint32_t>, SubtreeSize>;
+
+   auto compact = multiples_of<CompactTree>(2, 3000), compact_other = multiples_of<CompactTree>(3, 3000);
+   compact.set_union(compact_other);
+   ASSERT(compact.size() == 2000 && is_valid_tree(compact) && compact.root()->aggregate() == 2000);
+
+   compact.split(1500, compact_other);
+   ASSERT(is_valid_tree(compact) && is_valid_tree(compact_other) && compact.contains(1498) && compact_other.contains(1500));
+   ASSERT(compact.root()->aggregate() == compact.size() && compact_other.root()->aggregate() == compact_other.size());
+
+   compact.join(compact_other);
+   ASSERT(compact.size() == 2000 && is_valid_tree(compact) && compact.root()->aggregate() == 2000);
+
+   // splitting into a pooled tree frees its old values without releasing the pool the split values move into
+   using PooledTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, PoolAllocator<std::uint32_t>>;
+
+   auto pooled = multiples_of<PooledTree>(1, 600), pooled_upper = multiples_of<PooledTree>(1, 10);
+   pooled.split(300, pooled_upper);
+   ASSERT(pooled.size() == 300 && pooled_upper.size() == 300 && is_valid_tree(pooled) && is_valid_tree(pooled_upper));
+   ASSERT(pooled_upper.contains(300) && pooled_upper.contains(599) && !pooled_upper.contains(0));
+
+   pooled.set_union(pooled_upper, 4);
+   ASSERT(pooled.size() == 600 && pooled_upper.is_empty() && is_valid_tree(pooled));
+   ASSERT(values_of(pooled) == values_of(multiples_of<PooledTree>(1, 600)));
+
+   COMPLETE();
+}
+
+template <typename Tree>
+int test_range_queries_of() {
+   INIT();
+
+   Tree tree = multiples_of<Tree>(10, 1000), empty;
+   const Tree &view = tree;
+
+   ASSERT((*tree.lower_bound(500))->key() == 500 && (*tree.lower_bound(501))->key() == 510);
+   ASSERT((*tree.upper_bound(500))->key() == 510 && (*view.upper_bound(499))->key() == 500);
+   ASSERT((*tree.lower_bound(0))->key() == 0 && tree.lower_bound(991) == tree.end_inorder());
+   ASSERT(view.upper_bound(990) == view.cend_inorder() && empty.lower_bound(0) == empty.end_inorder());
+   ASSERT(tree.lower_bound(991) == tree.cend_inorder() && tree.cend_inorder() != tree.lower_bound(990));
+
+   // a mutable iterator converts to a const one at the same position, ancestors included
+   typename Tree::const_inorder_iterator converted = tree.lower_bound(500);
+   ++converted;
+   ASSERT((*converted)->key() == 510 && converted == view.lower_bound(501));
+
+   auto found = tree.equal_range(500), missing = tree.equal_range(505);
+   ASSERT(std::distance(found.first, found.second) == 1 && (*found.first)->key() == 500);
+   ASSERT(missing.first == missing.second && (*missing.first)->key() == 510);
+
+   std::vector<std::uint32_t> keys;
+
+   for (auto node : tree.range(95, 200))
+      keys.push_back(node->key());
+
+   ASSERT(keys == std::vector<std::uint32_t>({ 100, 110, 120, 130, 140, 150, 160, 170, 180, 190 }));
+
+   auto constant = view.range(980, 5000);
+   ASSERT(std::distance(constant.begin(), constant.end()) == 2);
+   ASSERT(tree.range(500, 500).empty() && tree.range(600, 500).empty() && tree.range(501, 509).empty());
+
+   // the latest entries, walking back from the last node
+   keys.clear();
+
+   for (auto iter = view.clast_inorder(); iter != view.cend_inorder() && keys.size() < 3; --iter)
+      keys.push_back((*iter)->key());
+
+   ASSERT(keys == std::vector<std::uint32_t>({ 990, 980, 970 }));
+
+   std::size_t count = 0;
+
+   for (auto iter = tree.last_inorder(); iter != tree.end_inorder(); --iter)
+      ++count;
+
+   ASSERT(count == tree.size() && empty.last_inorder() == empty.end_inorder());
+
+   // decrementing from a searched position undoes incrementing from it
+   auto iter = tree.lower_bound(305);
+   ++iter;
+   ++iter;
+   --iter;
+   ASSERT((*iter)->key() == 320);
+   --iter;
+   ASSERT((*iter)->key() == 310);
+
+   auto first = tree.begin_inorder();
+   --first;
+   ASSERT(first == tree.end_inorder());
+
+   COMPLETE();
+}
+
+int test_range_queries() {
+   using CompactTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage>;
+
+   return test_range_queries_of<AVLTree<std::uint32_t>>() + test_range_queries_of<CompactTree>();
+}
+
+int test_iteration() {
+   INIT();
+
+   std::vector<std::uint32_t> nodes = { 5, 7, 2, 4, 3, 8, 10, 1, 0, 6, 9 };
+   std::vector<std::uint32_t> sorted = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+
+   auto tree = AVLTree<std::uint32_t>(nodes);
+   ASSERT(std::vector<std::uint32_t>(tree.begin(), tree.end()) == sorted && tree.to_vec() == sorted);
+
+   AVLMap<std::string, std::uint32_t> map;
+   map["charlie"] = 3;
+   map["alpha"] = 1;
+   map["bravo"] = 2;
+
+   auto pairs = map.to_vec();
+   ASSERT(pairs.size() == 3 && pairs[0].first == "alpha" && pairs[1].first == "bravo" && pairs[2].first == "charlie");
+
+   // postfix steps return the position from before the step, prefix steps the iterator itself
+   auto iter = tree.begin();
+   auto before = iter++;
+   ASSERT(*before == 0 && *iter == 1 && *++iter == 2 && *iter-- == 2 && *iter == 1 && *--iter == 0);
+
+   auto nodes_iter = tree.begin_preorder();
+   auto root = nodes_iter++;
+   ASSERT(*root == tree.root() && (*++nodes_iter)->key() == 1);
+
+   auto last = tree.clast_inorder();
+   ASSERT((*last--)->key() == 10 && (*last)->key() == 9);
+
+   using SharedTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, SharedNodeStorage>;
+   using PersistentTree = PersistentAVLTree<std::uint32_t>;
+
+   // walking a tree of reference-counted nodes leaves no counts behind, with or without parent links
+   auto shared = SharedTree(nodes);
+   auto root_count = shared.root().use_count();
+   auto middle = shared.begin_inorder();
+
+   for (int i=0; i<5; ++i)
+      ++middle;
+
+   ASSERT((*middle)->key() == 5 && std::vector<std::uint32_t>(shared.begin(), shared.end()) == sorted);
+   middle = shared.end_inorder();
+   ASSERT(shared.root().use_count() == root_count);
+
+   PersistentTree persistent;
+
+   for (auto value : nodes)
+      persistent.insert(value);
+
+   auto persistent_count = persistent.root().use_count();
+   ASSERT(persistent.to_vec() == sorted && persistent.root().use_count() == persistent_count);
+
+   COMPLETE();
+}
+
+int test_hinted_insert() {
+   INIT();
+
+   // increasing keys are appended past the greatest node, with or without a hint
+   AVLTree<std::uint32_t> tree, hinted;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+   {
+      tree.insert(i);
+      ASSERT(hinted.insert(hinted.end(), i)->key() == i);
+   }
+
+   ASSERT(is_valid_tree(tree) && is_valid_tree(hinted) && tree.to_vec() == hinted.to_vec());
+
+   // an existing key is returned rather than replaced or thrown
+   ASSERT(hinted.insert(hinted.end(), 500)->key() == 500 && hinted.size() == 1000);
+   ASSERT_THROWS(tree.insert(999), exception::KeyExists);
+
+   // the greatest node is found again after it is removed
+   tree.remove(999);
+   tree.remove(998);
+   tree.insert(998);
+   tree.insert(1500);
+   ASSERT(is_valid_tree(tree) && tree.size() == 1000 && (*tree.last_inorder())->key() == 1500);
+
+   // a copy over the tree forgets the greatest node it had
+   auto small = multiples_of<AVLTree<std::uint32_t>>(1, 10);
+   hinted = small;
+   hinted.insert(10);
+   ASSERT(is_valid_tree(hinted) && hinted.size() == 11 && (*hinted.last_inorder())->key() == 10);
+
+   // hints next to the key link it without searching, hints elsewhere fall back to a search
+   auto evens = multiples_of<AVLTree<std::uint32_t>>(2, 100);
+   evens.insert(evens.lower_bound(52), 51);
+   evens.insert(evens.begin(), 1);
+   evens.insert(evens.lower_bound(10), 77);
+   evens.insert(evens.end(), 3);
+   ASSERT(is_valid_tree(evens) && evens.size() == 54 && evens.contains(51) && evens.contains(1) && evens.contains(77) && evens.contains(3));
+
+   AVLMap<std::uint32_t, std::uint32_t> map;
+
+   for (std::uint32_t i=0; i<100; ++i)
+      map.insert(map.end(), std::make_pair(i, i * i));
+
+   map.insert(100, 10000);
+   ASSERT(is_valid_tree(map) && map.size() == 101 && map.get(100) == 10000 && map.get(9) == 81);
+
+   // trees without parent links take the same hints and stay valid
+   AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage> compact;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+      compact.insert(compact.end(), i);
+
+   ASSERT(is_valid_tree(compact) && compact.size() == 1000);
+
+   COMPLETE();
+}
+
+int test_stats() {
+   INIT();
+
+   using CountedTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, std::allocator<std::uint32_t>, NoAugment,
+                               CountingStats>;
+   using CountedCompactTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage, std::allocator<std::uint32_t>,
+                                      NoAugment, CountingStats>;
+
+   CountedTree tree;
+
+   // increasing keys only ever need single rotations, zigzagging keys need double ones
+   for (std::uint32_t i=0; i<1023; ++i)
+      tree.insert(i);
+
+   auto stats = tree.stats();
+   ASSERT(stats.counters.allocations == 1023 && stats.counters.single_rotations > 0 && stats.counters.double_rotations == 0);
+   ASSERT(stats.counters.updates == 1023 && stats.counters.update_path_nodes >= stats.counters.updates);
+
+   // a perfect tree of 1023 nodes has ten full levels
+   ASSERT(stats.size == 1023 && stats.height == 10 && stats.height <= stats.height_bound);
+   ASSERT(stats.depth_histogram.size() == 10 && stats.depth_histogram[0] == 1 && stats.depth_histogram[9] == 512);
+   ASSERT(stats.node_bytes == sizeof(CountedTree::Node) && stats.memory_bytes == 1023 * sizeof(CountedTree::Node));
+   ASSERT(stats.average_depth() > 7.0 && stats.average_depth() < 9.0);
+
+   tree.reset_stats();
+   ASSERT(tree.contains(500) && !tree.contains(5000));
+
+   // each lookup compares once per level it descends, at most the height of the tree
+   auto lookups = tree.stats().counters;
+   ASSERT(lookups.comparisons > 2 && lookups.comparisons <= 20 && lookups.allocations == 0);
+
+   tree.insert(2000);
+   tree.insert(1500);
+   ASSERT(tree.stats().counters.double_rotations == 1);
+
+   auto size = tree.size();
+   tree.destroy();
+   ASSERT(tree.stats().counters.deallocations == size && tree.stats().height == 0 && tree.stats().height_bound == 0);
+
+   // counting trees keep their bulk operations on one thread, so no allocation goes uncounted
+   std::vector<std::uint32_t> sorted;
+
+   for (std::uint32_t i=0; i<200000; ++i)
+      sorted.push_back(i);
+
+   CountedTree built, copied, merged;
+   built.assign_sorted(sorted.begin(), sorted.end(), 4);
+   copied.copy(built, 4);
+   merged.assign_sorted(sorted.begin() + 100000, sorted.end());
+   copied.set_union(merged, 4);
+   ASSERT(built.stats().counters.allocations == 200000 && copied.stats().counters.allocations == 200000);
+   ASSERT(copied.size() == 200000 && copied.stats().counters.deallocations == 100000 && merged.size() == 0);
+
+   CountedCompactTree compact;
+
+   for (std::uint32_t i=0; i<100; ++i)
+      compact.insert((i * 37) % 100);
+
+   auto compact_stats = compact.stats();
+   ASSERT(compact_stats.counters.single_rotations + compact_stats.counters.double_rotations > 0);
+   ASSERT(compact_stats.counters.allocations == 100 && compact_stats.height <= compact_stats.height_bound);
+
+   // without a counting policy the shape is still reported, and the counters stay zero
+   auto plain = multiples_of<AVLTree<std::uint32_t>>(1, 100).stats();
+   ASSERT(plain.size == 100 && plain.counters.comparisons == 0 && plain.counters.allocations == 0);
+   ASSERT(plain.height <= plain.height_bound && plain.height_bound == 9);
+
+   COMPLETE();
+}
+
+int test_mapped_tree() {
+   INIT();
+
+   using Map = AVLMap<std::uint32_t, std::uint64_t>;
+   using StringMap = AVLMap<std::string, std::string>;
+
+   Map map;
+
+   for (std::uint32_t i=0; i<1000; ++i)
+      map.insert(i * 3, std::uint64_t(i) << 32);
+
+   // the file is mapped and searched in place, then loaded back into a mutable map
+   const std::string path = "avltree_mapped_test.bin";
+   serialize(map, path);
+
+   {
+      auto view = MappedTree<Map>::open(path);
+      ASSERT(view.size() == 1000 && view.contains(300) && !view.contains(301) && view.get(300) == std::uint64_t(100) << 32);
+      ASSERT_THROWS(view.get(301), exception::KeyNotFound);
+
+      std::vector<std::uint32_t> keys;
+
+      for (auto entry : view.range(10, 22))
+         keys.push_back(entry.key());
+
+      ASSERT(keys == std::vector<std::uint32_t>({ 12, 15, 18, 21 }) && (*view.lower_bound(2996)).key() == 2997);
+      ASSERT(view.lower_bound(2998) == view.end() && view.range(22, 10).empty());
+
+      auto thawed = view.thaw();
+      ASSERT(is_valid_tree(thawed) && thawed.to_vec() == map.to_vec());
+   }
+
+   std::remove(path.c_str());
+   ASSERT_THROWS(MappedTree<Map>::open(path), exception::FileError);
+
+   // strings go to the heap and are viewed where they lie
+   StringMap strings;
+   strings["bravo"] = "two";
+   strings["alpha"] = "one";
+   strings["charlie"] = std::string(100, 'c');
+
+   std::ostringstream out;
+   MappedTree<StringMap>::write(strings, out);
+   auto bytes = out.str();
+
+   MappedTree<StringMap> string_view(bytes.data(), bytes.size());
+   ASSERT(string_view.get("alpha") == "one" && string_view.get("charlie").size() == 100 && !string_view.contains("delta"));
+   ASSERT((*string_view.begin()).key() == "alpha" && string_view.thaw().to_vec() == strings.to_vec());
+
+   // files of another type, or cut short, are rejected
+   using Set = AVLTree<std::uint32_t>;
+   ASSERT_THROWS(MappedTree<Set>(bytes.data(), bytes.size()), exception::InvalidFormat);
+   ASSERT_THROWS(MappedTree<StringMap>(bytes.data(), bytes.size() - 1), exception::InvalidFormat);
+
+   Set empty;
+   std::ostringstream empty_out;
+   MappedTree<Set>::write(empty, empty_out);
+   auto empty_bytes = empty_out.str();
+   MappedTree<Set> empty_view(empty_bytes.data(), empty_bytes.size());
+   ASSERT(empty_view.is_empty() && empty_view.begin() == empty_view.end() && !empty_view.contains(0));
+
+   COMPLETE();
+}
+
+/// Orders keys in the direction it was constructed with, so two trees of the same type can order differently.
+struct DirectedOrder {
+   int direction = 1;
+
+   bool operator() (int a, int b) const { return this->direction * a < this->direction * b; }
+};
+
+/// A transparent three-way comparator which counts how many times it is called.
+struct CountingThreeWay {
+   using is_transparent = void;
+
+   std::size_t *calls = nullptr;
+
+   template <typename A, typename B>
+   int operator() (const A &a, const B &b) const {
+      ++*this->calls;
+      return ThreeWayCompare()(a, b);
+   }
+};
+
+int test_key_comparison() {
+   INIT();
+
+   // a tree keeps the comparator it was given, through copies and swaps
+   AVLTree<int, DirectedOrder> descending(DirectedOrder{-1});
+
+   for (int i=0; i<100; ++i)
+      descending.insert((i * 37) % 100);
+
+   std::vector<int> expected;
+   for (int i=99; i>=0; --i)
+      expected.push_back(i);
+
+   ASSERT(is_valid_tree(descending));
+   ASSERT(std::vector<int>(descending.begin_values_inorder(), descending.end_values_inorder()) == expected);
+   ASSERT(descending.key_comp().direction == -1 && descending.contains(42) && !descending.contains(100));
+   ASSERT((*descending.lower_bound(150))->key() == 99 && (*descending.upper_bound(50))->key() == 49);
+
+   auto copy = descending;
+   AVLTree<int, DirectedOrder> ascending;
+   ascending.insert(1);
+   ascending.swap(copy);
+   ASSERT(ascending.key_comp().direction == -1 && copy.key_comp().direction == 1);
+   ASSERT(ascending.size() == 100 && is_valid_tree(ascending) && is_valid_tree(copy));
+
+   auto frozen = freeze(descending);
+   ASSERT(frozen.contains(42) && !frozen.contains(-1) && *frozen.begin() == 99);
+   ASSERT(frozen.thaw().key_comp().direction == -1 && is_valid_tree(frozen.thaw()));
+
+   // a three-way comparator orders two keys in a single call
+   std::size_t calls = 0;
+   AVLMap<std::string, int, CountingThreeWay> words(CountingThreeWay{&calls});
+
+   for (int i=0; i<1000; ++i)
+      words.insert("word" + std::to_string(i), i);
+
+   ASSERT(is_valid_tree(words));
+
+   auto stats = words.stats();
+   calls = 0;
+   ASSERT(words.get("word500") == 500);
+   ASSERT(calls <= stats.height);
+
+   // a transparent comparator searches with views and C strings, without building a key
+   calls = 0;
+   std::string_view view = "word250";
+   ASSERT(words.has_key(view) && words.get(view) == 250 && !words.has_key("word1000"));
+   ASSERT(words.find(view).has_value() && (*words.find(view))->value().second == 250);
+   ASSERT((*words.lower_bound("word99"))->key() == "word99" && (*words.upper_bound("word99"))->key() == "word990");
+   ASSERT(calls > 0);
+
+   AVLMap<std::string, int, std::less<>> names;
+   names.insert("alice", 1);
+   names.insert("bob", 2);
+   ASSERT(names.has_key(std::string_view("bob")) && names.get("alice") == 1 && !names.contains("carol"));
+
+   auto range = names.equal_range(std::string_view("bob"));
+   ASSERT(range.first != range.second && std::next(range.first) == range.second);
+
+   // keys still convert for lookups through a comparator which isn't transparent
+   AVLMap<std::string, int> plain;
+   plain.insert("alice", 1);
+   ASSERT(plain.has_key("alice") && plain.get("alice") == 1 && !plain.has_key("bob"));
+
+   COMPLETE();
+}
+
+int test_batch_operations() {
+   INIT();
+
+   using Tree = AVLTree<std::uint32_t>;
+
+   Tree tree = multiples_of<Tree>(2, 1000), empty;
+   std::vector<std::uint32_t> batch;
+
+   // every key below 1000 once, shuffled, a few twice, and nothing else
+   for (std::uint32_t i=0; i<1000; ++i)
+      batch.push_back((i * 997) % 1000);
+   batch.push_back(1);
+   batch.push_back(500);
+
+   ASSERT(tree.insert_batch(batch.begin(), batch.end()) == 500);
+   ASSERT(tree.size() == 1000 && is_valid_tree(tree) && values_of(tree) == values_of(multiples_of<Tree>(1, 1000)));
+   ASSERT(tree.insert_batch(batch.begin(), batch.end()) == 0 && tree.size() == 1000);
+
+   // a batch rebuilds the tree around its greatest node, which the next append has to find again
+   tree.insert(5000);
+   ASSERT(tree.size() == 1001 && is_valid_tree(tree) && (*tree.last_inorder())->key() == 5000);
+
+   std::vector<std::uint32_t> triples;
+   for (std::uint32_t i=0; i<1000; i+=3) { triples.push_back(999 - i); }
+   triples.push_back(3);
+   triples.push_back(7777);
+
+   std::set<std::uint32_t> expected;
+   for (std::uint32_t i=0; i<1000; ++i) { if (i % 3 != 0) { expected.insert(i); } }
+   expected.insert(5000);
+
+   ASSERT(tree.erase_batch(triples.begin(), triples.end()) == 334);
+   ASSERT(tree.size() == expected.size() && is_valid_tree(tree));
+   ASSERT(values_of(tree) == std::vector<std::uint32_t>(expected.begin(), expected.end()));
+
+   ASSERT(empty.insert_batch(triples.begin(), triples.end()) == 335 && is_valid_tree(empty));
+   ASSERT(empty.erase_batch(batch.begin(), batch.end()) == 334 && empty.size() == 1 && empty.contains(7777));
+   ASSERT(empty.erase_batch(triples.begin(), triples.end()) == 1 && empty.is_empty() && is_valid_tree(empty));
+   ASSERT(empty.erase_batch(triples.begin(), triples.end()) == 0);
+
+   // batches keep subtree sizes exact on nodes without parents, and free dropped values back into the pool
+   using CompactTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage, std::allocator<std::uint32_t>, SubtreeSize>;
+   using PooledTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, PoolAllocator<std::uint32_t>>;
+
+   auto compact = multiples_of<CompactTree>(2, 1000);
+   ASSERT(compact.insert_batch(batch.begin(), batch.end()) == 500 && is_valid_tree(compact));
+   ASSERT(compact.erase_batch(triples.begin(), triples.end()) == 334 && is_valid_tree(compact));
+   ASSERT(compact.root()->aggregate() == compact.size() && compact.size() == 666);
+
+   auto pooled = multiples_of<PooledTree>(2, 1000);
+   ASSERT(pooled.insert_batch(batch.begin(), batch.end()) == 500 && is_valid_tree(pooled));
+   ASSERT(pooled.erase_batch(triples.begin(), triples.end()) == 334 && is_valid_tree(pooled) && pooled.size() == 666);
+
+   // values whose key is in the tree are skipped, as are later values of the batch with the same key
+   AVLMap<std::string, int> map;
+   map.insert("b", 1);
+
+   std::vector<std::pair<const std::string, int>> values = { {"c", 2}, {"a", 3}, {"b", 4}, {"c", 5} };
+   ASSERT(map.insert_batch(values.begin(), values.end()) == 2);
+   ASSERT(map.size() == 3 && map.get("a") == 3 && map.get("b") == 1 && map.get("c") == 2 && is_valid_tree(map));
+
+   std::vector<std::string> keys = { "c", "z", "a" };
+   ASSERT(map.erase_batch(keys.begin(), keys.end()) == 2 && map.size() == 1 && map.has_key("b"));
+
+   COMPLETE();
+}
+
+int test_range_erase() {
+   INIT();
+
+   using Tree = AVLTree<std::uint32_t>;
+
+   auto tree = multiples_of<Tree>(1, 1000);
+
+   ASSERT(tree.erase_range(100, 200) == 100);
+   ASSERT(tree.size() == 900 && is_valid_tree(tree) && !tree.contains(100) && !tree.contains(199) && tree.contains(200));
+   ASSERT(tree.erase_range(150, 250) == 50 && tree.size() == 850 && is_valid_tree(tree));
+   ASSERT(tree.erase_range(300, 300) == 0 && tree.erase_range(400, 300) == 0 && tree.size() == 850);
+
+   ASSERT(tree.erase_below(50) == 50 && tree.size() == 800 && is_valid_tree(tree) && (*tree.begin_inorder())->key() == 50);
+   ASSERT(tree.erase_above(899) == 100 && tree.size() == 700 && is_valid_tree(tree) && (*tree.clast_inorder())->key() == 899);
+   ASSERT(tree.erase_below(0) == 0 && tree.erase_above(5000) == 0 && tree.size() == 700);
+
+   // erase_above cut the greatest node away, and the next append finds the new one
+   tree.insert(1000);
+   ASSERT(tree.size() == 701 && is_valid_tree(tree) && (*tree.clast_inorder())->key() == 1000);
+
+   std::vector<std::uint32_t> expected;
+   for (std::uint32_t i=50; i<100; ++i) { expected.push_back(i); }
+   for (std::uint32_t i=250; i<900; ++i) { expected.push_back(i); }
+   expected.push_back(1000);
+   ASSERT(values_of(tree) == expected);
+
+   // extracted values can be freed by whoever holds them, here on another thread
+   Tree extracted = multiples_of<Tree>(1, 10);
+   tree.extract_range(300, 600, extracted);
+   ASSERT(tree.size() == 401 && extracted.size() == 300 && is_valid_tree(tree) && is_valid_tree(extracted));
+   ASSERT(!tree.contains(300) && extracted.contains(300) && extracted.contains(599) && !extracted.contains(600));
+
+   std::thread([&extracted]() { extracted.destroy(); }).join();
+   ASSERT(extracted.is_empty());
+
+   tree.extract_range(700, 600, extracted);
+   ASSERT(tree.size() == 401 && extracted.is_empty());
+
+   ASSERT(tree.erase_below(5000) == 401 && tree.is_empty() && is_valid_tree(tree));
+   ASSERT(tree.erase_range(0, 10) == 0 && tree.erase_above(0) == 0);
+
+   // the cuts keep subtree sizes exact on nodes without parents
+   using CompactTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage, std::allocator<std::uint32_t>, SubtreeSize>;
+
+   auto compact = multiples_of<CompactTree>(1, 1000), compact_extracted = multiples_of<CompactTree>(1, 10);
+   ASSERT(compact.erase_range(100, 200) == 100 && compact.erase_below(50) == 50 && compact.erase_above(899) == 100);
+   compact.extract_range(300, 600, compact_extracted);
+   ASSERT(is_valid_tree(compact) && is_valid_tree(compact_extracted) && compact_extracted.size() == 300);
+   ASSERT(compact.root()->aggregate() == 450 && compact.size() == 450 && compact_extracted.root()->aggregate() == 300);
+
+   // extracting into a pooled tree frees its old values before copying the range into its pool
+   using PooledTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, PoolAllocator<std::uint32_t>>;
+
+   auto pooled = multiples_of<PooledTree>(1, 1000), pooled_extracted = multiples_of<PooledTree>(1, 10);
+   pooled.extract_range(300, 600, pooled_extracted);
+   ASSERT(pooled.size() == 700 && pooled_extracted.size() == 300 && is_valid_tree(pooled) && is_valid_tree(pooled_extracted));
+   ASSERT(pooled_extracted.contains(300) && !pooled_extracted.contains(0) && pooled.erase_below(500) == 300);
+
+   // expiring entries by timestamp
+   AVLMap<std::uint64_t, std::string, std::less<std::uint64_t>, RawNodeStorage, std::allocator<std::pair<const std::uint64_t, std::string>>,
+          SubtreeSize> entries;
+
+   for (std::uint64_t time=0; time<10000; time+=10)
+      entries.insert(time, std::to_string(time));
+
+   ASSERT(entries.erase_below(5005) == 501 && entries.size() == 499 && entries.get(5010) == "5010" && is_valid_tree(entries));
+
+   COMPLETE();
+}
+
+template <typename Tree>
+bool matches_set(const Tree &tree, const std::set<typename Tree::KeyType> &expected) {
+   std::vector<typename Tree::KeyType> keys(tree.begin(), tree.end());
+
+   return tree.size() == expected.size() && tree.to_vec() == keys && keys == std::vector<typename Tree::KeyType>(expected.begin(), expected.end());
+}
+
+int test_blocked_tree() {
+   INIT();
+
+   BlockedAVLTree<std::uint32_t, std::less<std::uint32_t>, 8> tree;
+   std::set<std::uint32_t> expected;
+
+   ASSERT(tree.is_empty() && tree.begin() == tree.end() && tree.lower_bound(5) == tree.end());
+   ASSERT_THROWS(tree.remove(5), exception::KeyNotFound);
+
+   // keys before, between and after the blocks split them and lower the first key of the first block
+   std::mt19937 random(7);
+   for (std::size_t i=0; i<2000; ++i)
+   {
+      std::uint32_t key = random() % 5000;
+
+      if (expected.insert(key).second) { tree.insert(key); }
+      else { ASSERT_THROWS(tree.insert(key), exception::KeyExists); }
+   }
+
+   ASSERT(matches_set(tree, expected) && tree.block_count() < tree.size() / 4 + 1);
+
+   for (std::uint32_t key=0; key<5001; ++key)
+   {
+      auto bound = expected.lower_bound(key);
+
+      ASSERT(tree.contains(key) == (expected.count(key) == 1));
+      ASSERT(bound == expected.end() ? tree.lower_bound(key) == tree.end() : *tree.lower_bound(key) == *bound);
+   }
+
+   // removing most keys merges the emptied blocks
+   for (std::uint32_t key=0; key<5000; ++key)
+   {
+      if (key % 7 == 0) { continue; }
+
+      if (expected.erase(key) == 1) { tree.remove(key); }
+      else { ASSERT_THROWS(tree.remove(key), exception::KeyNotFound); }
+   }
+
+   ASSERT(matches_set(tree, expected) && tree.block_count() <= tree.size() / 2 + 1);
+
+   auto copy = tree;
+   tree.clear();
+   ASSERT(tree.is_empty() && tree.block_count() == 0 && matches_set(copy, expected));
+
+   // keys which aren't arithmetic are searched by bisection, in the order of the comparator
+   BlockedAVLTree<std::pair<int, int>, std::greater<std::pair<int, int>>, 4> pairs;
+
+   for (int i=0; i<100; ++i)
+      pairs.insert(std::make_pair(i % 10, i));
+
+   ASSERT(pairs.size() == 100 && *pairs.begin() == std::make_pair(9, 99) && pairs.contains(std::make_pair(3, 43)));
+   ASSERT(*pairs.lower_bound(std::make_pair(5, 1000)) == std::make_pair(5, 95));
+
+   COMPLETE();
+}
+
+int test_string_keys() {
+   INIT();
+
+   // the prefix orders keys as their bytes do, including the bytes past the high bit and zero bytes
+   std::vector<std::string> samples = { "", "a", "ab", std::string("ab\0", 3), "abcdefgh", "abcdefghi", "abcdefgh\xff",
+                                        "abcdefgi", "\xff", "\x7f", "zzzzzzzzzzzzzzzz", std::string(20, 'a') };
+
+   for (auto &a : samples)
+      for (auto &b : samples)
+      {
+         auto order = a.compare(b);
+
+         ASSERT(PrefixedString(a).compare(PrefixedString(b)) == ((order < 0) ? -1 : (order > 0) ? 1 : 0));
+         ASSERT(PrefixCompare()(PrefixedString(a), std::string_view(b)) == -PrefixCompare()(b, PrefixedString(a)));
+      }
+
+   // keys sharing long prefixes fall back to their characters, short keys to their lengths
+   StringMap<std::uint32_t> map;
+   std::map<std::string, std::uint32_t> expected;
+   std::mt19937 random(11);
+
+   for (std::uint32_t i=0; i<3000; ++i)
+   {
+      std::string key(random() % 24, 'k');
+
+      for (auto &c : key)
+         c = "kx\xff"[random() % 3];
+
+      if (expected.emplace(key, i).second) { map.insert(key, i); }
+   }
+
+   ASSERT(map.size() == expected.size() && is_valid_tree(map));
+
+   auto iter = map.cbegin_inorder();
+   for (auto &entry : expected)
+   {
+      ASSERT((*iter)->key().str() == entry.first && (*iter)->value().second == entry.second);
+      ++iter;
+   }
+
+   // lookups with strings, string views and C strings build no key
+   for (auto &entry : expected)
+   {
+      ASSERT(map.get(entry.first) == entry.second && map.contains(std::string_view(entry.first)));
+      ASSERT(!map.contains(entry.first + "y"));
+   }
+
+   map.insert("kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk", 1);
+   ASSERT(map.has_key("kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk") && map.get("kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk") == 1);
+   ASSERT_THROWS(map.insert(std::string("kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk"), 2), exception::KeyExists);
+
+   StringTree<> tree;
+   tree.insert("pear");
+   tree.insert("apple");
+   tree.insert("apple pie");
+   ASSERT(tree.size() == 3 && (*tree.cbegin_inorder())->key() == "apple" && tree.contains("apple pie"));
+
+   COMPLETE();
+}
+
+int test_relaxed_balance() {
+   INIT();
+
+   using Tree = AVLTree<std::uint32_t>;
+
+   Tree tree;
+   tree.set_relaxed_balance(true);
+   ASSERT(tree.is_relaxed_balance() && tree.rebalance_pending() == 0);
+
+   // increasing keys rotate on every other insertion under strict balance
+   for (std::uint32_t i=0; i<4096; ++i)
+      tree.insert(i);
+
+   ASSERT(tree.size() == 4096 && is_valid_tree(tree, 2) && tree.deferred_rotations() > 0);
+   ASSERT(tree.root()->height() <= 22);
+
+   for (std::uint32_t i=0; i<4096; i+=3)
+      tree.remove(i);
+
+   ASSERT(tree.size() == 2730 && is_valid_tree(tree, 2) && tree.contains(4094) && !tree.contains(4095 - 4095 % 3));
+
+   // copies keep the relaxed shape along with its deferred rotations
+   Tree copy = tree, copied = multiples_of<Tree>(1, 10);
+   copied.copy(tree);
+   ASSERT(copy.is_relaxed_balance() && copy.deferred_rotations() == tree.deferred_rotations() && is_valid_tree(copy, 2));
+   ASSERT(copied.deferred_rotations() == tree.deferred_rotations() && is_valid_tree(copied, 2));
+
+   auto values = values_of(tree);
+   ASSERT(tree.rebalance_pending() > 0 && tree.deferred_rotations() == 0 && is_valid_tree(tree));
+   ASSERT(values_of(tree) == values && tree.root()->height() <= 12);
+
+   // the rebuilt tree links new nodes, so the next append looks for its greatest node again
+   tree.insert(5000);
+   ASSERT(tree.size() == 2731 && is_valid_tree(tree, 2) && (*tree.last_inorder())->key() == 5000);
+
+   tree.set_relaxed_balance(false);
+   for (std::uint32_t i=6000; i<7000; ++i)
+      tree.insert(i);
+
+   ASSERT(!tree.is_relaxed_balance() && is_valid_tree(tree, 2));
+   tree.rebalance_pending();
+   ASSERT(is_valid_tree(tree) && tree.size() == 3731);
+
+   tree.destroy();
+   ASSERT(tree.deferred_rotations() == 0 && tree.rebalance_pending() == 0);
+
+   // nodes without parents retrace the recorded path instead, and keep their subtree sizes through the rebuild
+   using CompactTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, CompactNodeStorage, std::allocator<std::uint32_t>, SubtreeSize>;
+
+   CompactTree compact;
+   compact.set_relaxed_balance(true);
+
+   for (std::uint32_t i=0; i<4096; ++i)
+      compact.insert(i);
+
+   for (std::uint32_t i=0; i<4096; i+=3)
+      compact.remove(i);
+
+   ASSERT(compact.size() == 2730 && is_valid_tree(compact, 2) && compact.deferred_rotations() > 0);
+   ASSERT(compact.rebalance_pending() > 0 && is_valid_tree(compact) && compact.root()->aggregate() == 2730);
+
+   // a pooled tree is rebuilt from its own nodes, so none of them leave the pool
+   using PooledTree = AVLTree<std::uint32_t, std::less<std::uint32_t>, RawNodeStorage, PoolAllocator<std::uint32_t>>;
+
+   PooledTree pooled;
+   pooled.set_relaxed_balance(true);
+
+   for (std::uint32_t i=0; i<4096; ++i)
+      pooled.insert(i);
+
+   auto chunks = pooled.get_allocator().pool()->chunks();
+   ASSERT(is_valid_tree(pooled, 2) && pooled.rebalance_pending() > 0 && is_valid_tree(pooled) && pooled.size() == 4096);
+   ASSERT(pooled.get_allocator().pool()->chunks() == chunks);
+
+   COMPLETE();
+}
+
+int test_buffered_map() {
+   INIT();
+
+   // the batch takes precedence over the tree, and the last of its repeated keys over the others
+   AVLMap<std::uint32_t, std::uint32_t> map;
+   map.insert(1, 10);
+   map.insert(3, 30);
+
+   std::vector<std::pair<const std::uint32_t, std::uint32_t>> batch = { { 3, 31 }, { 2, 20 }, { 3, 32 }, { 4, 40 } };
+   ASSERT(map.insert_or_assign_batch(batch.begin(), batch.end()) == 2 && map.size() == 4 && is_valid_tree(map));
+   ASSERT(map.get(1) == 10 && map.get(2) == 20 && map.get(3) == 32 && map.get(4) == 40);
+   ASSERT(map.insert_or_assign_batch(batch.end(), batch.end()) == 0 && map.size() == 4);
+
+   using Buffered = BufferedAVLMap<std::uint32_t, std::uint32_t>;
+   ASSERT_THROWS(Buffered(0), exception::IndexOutOfRange);
+
+   // a small buffer merges many times over, with writes landing while merges run
+   Buffered buffered(16);
+   std::map<std::uint32_t, std::uint32_t> expected;
+   std::mt19937 random(5);
+
+   for (std::uint32_t i=0; i<5000; ++i)
+   {
+      std::uint32_t key = random() % 1000;
+
+      if (random() % 4 == 0)
+      {
+         buffered.erase(key);
+         expected.erase(key);
+      }
+      else
+      {
+         buffered.insert_or_assign(key, i);
+         expected[key] = i;
+      }
+
+      if (i % 97 == 0)
+      {
+         ASSERT(buffered.contains(key) == (expected.count(key) == 1) && buffered.size() == expected.size());
+      }
+   }
+
+   std::vector<std::pair<const std::uint32_t, std::uint32_t>> expected_values(expected.begin(), expected.end());
+   ASSERT(buffered.size() == expected.size() && buffered.to_vec() == expected_values);
+
+   for (std::uint32_t key=0; key<1000; ++key)
+   {
+      auto entry = expected.find(key);
+
+      if (entry == expected.end()) { ASSERT_THROWS(buffered.get(key), exception::KeyNotFound); }
+      else { ASSERT(buffered.get(key) == entry->second); }
+   }
+
+   buffered.flush();
+   ASSERT(buffered.buffered() == 0 && buffered.size() == expected.size() && buffered.to_vec() == expected_values);
+
+   // readers see every key the writer has finished writing, whichever layer holds it
+   Buffered shared(64);
+   std::atomic<std::uint32_t> written(0);
+   std::atomic<bool> consistent(true);
+   std::thread writer([&]() {
+      for (std::uint32_t i=0; i<20000; ++i)
+      {
+         shared.insert_or_assign(i, i * 2);
+         written.store(i + 1, std::memory_order_release);
+      }
+   });
+   std::thread reader([&]() {
+      for (std::uint32_t i=0; i<20000; ++i)
+      {
+         auto limit = written.load(std::memory_order_acquire);
+         auto key = (limit == 0) ? 0 : i % limit;
+         auto value = shared.find(key);
+
+         if (limit != 0 && (!value.has_value() || *value != key * 2)) { consistent = false; }
+      }
+   });
+
+   writer.join();
+   reader.join();
+   ASSERT(consistent && shared.size() == 20000);
+
+   COMPLETE();
+}
+
+int
+main
+(int argc, char *argv[])
+{
+   INIT();
+
+   LOG_INFO("Testing AVLTree.");
+   PROCESS_RESULT(test_avltree);
+
+   LOG_INFO("Testing AVLMap.");
+   PROCESS_RESULT(test_avlmap);
+
+   LOG_INFO("Testing node storage policies.");
+   PROCESS_RESULT(test_node_storage);
+
+   LOG_INFO("Testing lookups.");
+   PROCESS_RESULT(test_lookup);
+
+   LOG_INFO("Testing node pools.");
+   PROCESS_RESULT(test_node_pool);
+
+   LOG_INFO("Testing map upserts.");
+   PROCESS_RESULT(test_map_upsert);
+
+   LOG_INFO("Testing move semantics.");
+   PROCESS_RESULT(test_move_semantics);
+
+   LOG_INFO("Testing bulk construction.");
+   PROCESS_RESULT(test_bulk_build);
+
+   LOG_INFO("Testing tree copies.");
+   PROCESS_RESULT(test_copy);
+
+   LOG_INFO("Testing order statistics.");
+   PROCESS_RESULT(test_order_statistics);
+
+   LOG_INFO("Testing balance after removals.");
+   PROCESS_RESULT(test_removal_balance);
+
+   LOG_INFO("Testing augmentation policies.");
+   PROCESS_RESULT(test_augmentation);
+
+   LOG_INFO("Testing IntervalTree.");
+   PROCESS_RESULT(test_interval_tree);
+
+   LOG_INFO("Testing static hook dispatch.");
+   PROCESS_RESULT(test_static_dispatch);
+
+   LOG_INFO("Testing compact nodes.");
+   PROCESS_RESULT(test_compact_nodes);
+
+   LOG_INFO("Testing frozen trees.");
+   PROCESS_RESULT(test_frozen_tree);
+
+   LOG_INFO("Testing batched lookups.");
+   PROCESS_RESULT(test_find_many);
+
+   LOG_INFO("Testing concurrent maps.");
+   PROCESS_RESULT(test_concurrent_map);
+
+   LOG_INFO("Testing persistent trees.");
+   PROCESS_RESULT(test_persistent_tree);
+
+   LOG_INFO("Testing sharded maps.");
+   PROCESS_RESULT(test_sharded_map);
+
+   LOG_INFO("Testing set operations.");
+   PROCESS_RESULT(test_set_operations);
+
+   LOG_INFO("Testing range queries.");
+   PROCESS_RESULT(test_range_queries);
+
+   LOG_INFO("Testing iteration.");
+   PROCESS_RESULT(test_iteration);
+
+   LOG_INFO("Testing hinted insertion.");
+   PROCESS_RESULT(test_hinted_insert);
+
+   LOG_INFO("Testing stats.");
+   PROCESS_RESULT(test_stats);
+
+   LOG_INFO("Testing mapped trees.");
+   PROCESS_RESULT(test_mapped_tree);
+
+   LOG_INFO("Testing key comparison.");
+   PROCESS_RESULT(test_key_comparison);
+
+   LOG_INFO("Testing batch operations.");
+   PROCESS_RESULT(test_batch_operations);
+
+   LOG_INFO("Testing range erase.");
+   PROCESS_RESULT(test_range_erase);
+
+   LOG_INFO("Testing blocked trees.");
+   PROCESS_RESULT(test_blocked_tree);
+
+   LOG_INFO("Testing string keys.");
+   PROCESS_RESULT(test_string_keys);
+
+   LOG_INFO("Testing relaxed balance.");
+   PROCESS_RESULT(test_relaxed_balance);
+
+   LOG_INFO("Testing buffered maps.");
+   PROCESS_RESULT(test_buffered_map);
       
    COMPLETE();
 }